@@ -1,5 +1,12 @@
 #define _LINUX_STRING_H_
 
+/*
+ * The decompressor runs with the U bit as the boot loader left it, so
+ * unaligned word accesses may trap or rotate.  Keep the shared
+ * decompressors on their bytewise paths.
+ */
+#undef CONFIG_HAVE_EFFICIENT_UNALIGNED_ACCESS
+
 #include <linux/compiler.h>	/* for inline */
 #include <linux/types.h>	/* for size_t */
 #include <linux/stddef.h>	/* for NULL */
@@ -44,6 +51,10 @@ extern void error(char *);
 #include "../../../../lib/decompress_unlzma.c"
 #endif
 
+#ifdef CONFIG_KERNEL_LZ4
+#include "../../../../lib/decompress_unlz4.c"
+#endif
+
 int do_decompress(u8 *input, int len, u8 *output, void (*error)(char *x))
 {
 	return decompress(input, len, NULL, NULL, output, NULL, error);
@@ -1,8 +1,23 @@
 #ifndef _ASM_ARM_UNALIGNED_H
 #define _ASM_ARM_UNALIGNED_H
 
+/*
+ * ARMv6 and later perform unaligned LDR/STR/LDRH/STRH in hardware once
+ * the U bit is set, which the kernel does for these CPUs at boot.  Let the
+ * compiler use them for the native byte order through packed structs.
+ * Plain casts (linux/unaligned/access_ok.h) are avoided since they may be
+ * combined into LDM/STM or LDRD/STRD, which still fault when unaligned.
+ */
+#if defined(CONFIG_HAVE_EFFICIENT_UNALIGNED_ACCESS) && !defined(__ARMEB__)
+#include <linux/unaligned/le_struct.h>
+#include <linux/unaligned/be_byteshift.h>
+#elif defined(CONFIG_HAVE_EFFICIENT_UNALIGNED_ACCESS)
+#include <linux/unaligned/le_byteshift.h>
+#include <linux/unaligned/be_struct.h>
+#else
 #include <linux/unaligned/le_byteshift.h>
 #include <linux/unaligned/be_byteshift.h>
+#endif
 #include <linux/unaligned/generic.h>
 
 /*
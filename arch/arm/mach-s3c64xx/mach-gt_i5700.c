@@ -825,6 +825,9 @@ static struct s3c_fimc_isp_info spica_fimc_isp_infos[] = {
 static struct s3c_platform_fimc spica_fimc_pdata = {
 	.isp_info	= spica_fimc_isp_infos,
 	.num_clients	= ARRAY_SIZE(spica_fimc_isp_infos),
+#ifndef SECOND_FB
+	.overlay_win	= 1,
+#endif
 };
 
 static u64 spica_fimc_dma_mask = DMA_BIT_MASK(32);
@@ -1761,6 +1764,7 @@ static struct platform_device spica_usb_rndis = {
 struct class *sec_class;
 EXPORT_SYMBOL(sec_class);
 
+#ifndef CONFIG_SPICA_DPRAM_SIM
 #define SPICA_DPRAM_START	0x5d000000
 #define SPICA_DPRAM_SIZE	SZ_16M
 
@@ -1792,6 +1796,7 @@ static struct platform_device spica_dpram_device = {
 		.platform_data = &spica_dpram_pdata,
 	},
 };
+#endif
 
 /*
  * Vibetonz
@@ -1985,7 +1990,9 @@ static struct platform_device *spica_devices[] __initdata = {
 	&s3c_device_timer[1],
 	&spica_wlan_device,
 	&spica_bt_device,
+#ifndef CONFIG_SPICA_DPRAM_SIM
 	&spica_dpram_device,
+#endif
 	&spica_vibetonz_device,
 	&spica_jack_device,
 	&spica_audio_device,
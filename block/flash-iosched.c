@@ -0,0 +1,515 @@
+/*
+ *  Flash i/o scheduler.
+ *
+ *  A read-over-write scheduler for flash media (eMMC, SD cards), where
+ *  seeks are free but a long stream of writes in front of a read makes
+ *  the read, and whoever is waiting on it, stall.
+ *
+ *  Based on the deadline scheduler, Copyright (C) 2002 Jens Axboe.
+ */
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/compiler.h>
+#include <linux/rbtree.h>
+#include <linux/ktime.h>
+
+/*
+ * See Documentation/block/flash-iosched.txt
+ */
+static const int write_expire = HZ;	/* max time a write waits behind reads */
+static const int writes_starved = 8;	/* max reads dispatched ahead of a write */
+static const int read_idle = 2;		/* ms to wait for a sequential reader */
+
+struct flash_latency {
+	unsigned long count;
+	u64 total_us;
+	unsigned long max_us;
+};
+
+struct flash_data {
+	struct request_queue *queue;
+
+	/*
+	 * requests are present on both sort_list (for front merges) and
+	 * fifo_list (for dispatch order)
+	 */
+	struct rb_root sort_list[2];
+	struct list_head fifo_list[2];
+
+	unsigned int starved;		/* reads dispatched ahead of writes */
+	unsigned int reads_in_driver;
+	sector_t last_read_end;		/* end of the last dispatched read */
+	int seq_reader;			/* the last read was sync and sequential */
+	unsigned long last_read_done;	/* jiffies */
+
+	struct timer_list idle_timer;
+	struct work_struct unplug_work;
+
+	/*
+	 * statistics, queue insertion to completion
+	 */
+	struct flash_latency latency[2];
+	unsigned long idles;
+
+	/*
+	 * settings that change how the i/o scheduler behaves
+	 */
+	int write_expire;
+	int writes_starved;
+	int read_idle;
+	int front_merges;
+};
+
+/* insertion time, in us, of a request */
+#define RQ_INSERT_TIME(rq)	((unsigned long) (rq)->elevator_private[0])
+
+static inline unsigned long flash_now_us(void)
+{
+	return (unsigned long) ktime_to_us(ktime_get());
+}
+
+static void flash_move_to_dispatch(struct flash_data *, struct request *);
+
+static inline struct rb_root *
+flash_rb_root(struct flash_data *fd, struct request *rq)
+{
+	return &fd->sort_list[rq_data_dir(rq)];
+}
+
+static void
+flash_add_rq_rb(struct flash_data *fd, struct request *rq)
+{
+	struct rb_root *root = flash_rb_root(fd, rq);
+	struct request *__alias;
+
+	/*
+	 * Requests for the same sector can't both be in the tree, move the
+	 * older one to the dispatch queue.
+	 */
+	while (unlikely(__alias = elv_rb_add(root, rq)))
+		flash_move_to_dispatch(fd, __alias);
+}
+
+/*
+ * add rq to rbtree and fifo
+ */
+static void
+flash_add_request(struct request_queue *q, struct request *rq)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	const int data_dir = rq_data_dir(rq);
+
+	flash_add_rq_rb(fd, rq);
+
+	rq->elevator_private[0] = (void *) flash_now_us();
+	rq_set_fifo_time(rq, jiffies + fd->write_expire);
+	list_add_tail(&rq->queuelist, &fd->fifo_list[data_dir]);
+
+	/* a read ends the wait for one */
+	if (data_dir == READ)
+		del_timer(&fd->idle_timer);
+}
+
+/*
+ * remove rq from rbtree and fifo.
+ */
+static void flash_remove_request(struct request_queue *q, struct request *rq)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+
+	rq_fifo_clear(rq);
+	elv_rb_del(flash_rb_root(fd, rq), rq);
+}
+
+static int
+flash_merge(struct request_queue *q, struct request **req, struct bio *bio)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	struct request *__rq;
+
+	/*
+	 * check for front merge
+	 */
+	if (fd->front_merges) {
+		sector_t sector = bio->bi_sector + bio_sectors(bio);
+
+		__rq = elv_rb_find(&fd->sort_list[bio_data_dir(bio)], sector);
+		if (__rq) {
+			BUG_ON(sector != blk_rq_pos(__rq));
+
+			if (elv_rq_merge_ok(__rq, bio)) {
+				*req = __rq;
+				return ELEVATOR_FRONT_MERGE;
+			}
+		}
+	}
+
+	return ELEVATOR_NO_MERGE;
+}
+
+static void flash_merged_request(struct request_queue *q,
+				 struct request *req, int type)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+
+	/*
+	 * if the merge was a front merge, we need to reposition request
+	 */
+	if (type == ELEVATOR_FRONT_MERGE) {
+		elv_rb_del(flash_rb_root(fd, req), req);
+		flash_add_rq_rb(fd, req);
+	}
+}
+
+static void
+flash_merged_requests(struct request_queue *q, struct request *req,
+		      struct request *next)
+{
+	/*
+	 * if next is older than rq, rq takes its place in the fifo
+	 */
+	if (!list_empty(&req->queuelist) && !list_empty(&next->queuelist)) {
+		if (time_before(rq_fifo_time(next), rq_fifo_time(req))) {
+			list_move(&req->queuelist, &next->queuelist);
+			rq_set_fifo_time(req, rq_fifo_time(next));
+			req->elevator_private[0] = next->elevator_private[0];
+		}
+	}
+
+	flash_remove_request(q, next);
+}
+
+/*
+ * move request from the fifo to the dispatch queue
+ */
+static void flash_move_to_dispatch(struct flash_data *fd, struct request *rq)
+{
+	if (rq_data_dir(rq) == READ) {
+		fd->seq_reader = rq_is_sync(rq) &&
+			blk_rq_pos(rq) == fd->last_read_end;
+		fd->last_read_end = rq_end_sector(rq);
+		fd->reads_in_driver++;
+	}
+
+	flash_remove_request(fd->queue, rq);
+	elv_dispatch_add_tail(fd->queue, rq);
+}
+
+/*
+ * returns 1 if the oldest write has waited longer than write_expire.
+ * Requires !list_empty(&fd->fifo_list[WRITE])
+ */
+static inline int flash_write_expired(struct flash_data *fd)
+{
+	struct request *rq = rq_entry_fifo(fd->fifo_list[WRITE].next);
+
+	return time_after(jiffies, rq_fifo_time(rq));
+}
+
+/*
+ * Should writes be held back for a moment, because a sequential reader
+ * is likely to issue its next read soon?  Arms the idle timer if so.
+ */
+static int flash_idle(struct flash_data *fd)
+{
+	unsigned long end;
+
+	if (!fd->read_idle || !fd->seq_reader)
+		return 0;
+
+	if (fd->reads_in_driver)
+		end = jiffies + fd->read_idle;
+	else
+		end = fd->last_read_done + fd->read_idle;
+	if (!time_before(jiffies, end))
+		return 0;
+
+	if (!timer_pending(&fd->idle_timer))
+		fd->idles++;
+	mod_timer(&fd->idle_timer, end);
+	return 1;
+}
+
+/*
+ * flash_dispatch_requests dispatches the oldest read, unless writes have
+ * been starved for long enough, then the oldest write.
+ */
+static int flash_dispatch_requests(struct request_queue *q, int force)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	const int reads = !list_empty(&fd->fifo_list[READ]);
+	const int writes = !list_empty(&fd->fifo_list[WRITE]);
+	struct request *rq;
+
+	if (reads) {
+		if (writes && (fd->starved >= fd->writes_starved ||
+			       flash_write_expired(fd)))
+			goto dispatch_writes;
+
+		if (writes)
+			fd->starved++;
+		rq = rq_entry_fifo(fd->fifo_list[READ].next);
+		goto dispatch_request;
+	}
+
+	if (!writes)
+		return 0;
+
+	if (!force && !flash_write_expired(fd) && flash_idle(fd))
+		return 0;
+
+dispatch_writes:
+	fd->starved = 0;
+	rq = rq_entry_fifo(fd->fifo_list[WRITE].next);
+
+dispatch_request:
+	flash_move_to_dispatch(fd, rq);
+
+	return 1;
+}
+
+static void flash_completed_request(struct request_queue *q,
+				    struct request *rq)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	struct flash_latency *lat = &fd->latency[rq_data_dir(rq)];
+	unsigned long us = flash_now_us() - RQ_INSERT_TIME(rq);
+
+	lat->count++;
+	lat->total_us += us;
+	if (us > lat->max_us)
+		lat->max_us = us;
+
+	if (rq_data_dir(rq) == READ) {
+		WARN_ON(!fd->reads_in_driver);
+		if (fd->reads_in_driver)
+			fd->reads_in_driver--;
+		fd->last_read_done = jiffies;
+	}
+}
+
+static void flash_kick_queue(struct work_struct *work)
+{
+	struct flash_data *fd =
+		container_of(work, struct flash_data, unplug_work);
+	struct request_queue *q = fd->queue;
+
+	spin_lock_irq(q->queue_lock);
+	__blk_run_queue(q);
+	spin_unlock_irq(q->queue_lock);
+}
+
+/*
+ * The idle period is over, run the queue to let the writes go unless a
+ * read came meanwhile.
+ */
+static void flash_idle_timer(unsigned long data)
+{
+	struct flash_data *fd = (struct flash_data *) data;
+
+	kblockd_schedule_work(fd->queue, &fd->unplug_work);
+}
+
+static void flash_exit_queue(struct elevator_queue *e)
+{
+	struct flash_data *fd = e->elevator_data;
+
+	del_timer_sync(&fd->idle_timer);
+	cancel_work_sync(&fd->unplug_work);
+
+	BUG_ON(!list_empty(&fd->fifo_list[READ]));
+	BUG_ON(!list_empty(&fd->fifo_list[WRITE]));
+
+	kfree(fd);
+}
+
+/*
+ * initialize elevator private data (flash_data).
+ */
+static void *flash_init_queue(struct request_queue *q)
+{
+	struct flash_data *fd;
+
+	fd = kmalloc_node(sizeof(*fd), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!fd)
+		return NULL;
+
+	fd->queue = q;
+	INIT_LIST_HEAD(&fd->fifo_list[READ]);
+	INIT_LIST_HEAD(&fd->fifo_list[WRITE]);
+	fd->sort_list[READ] = RB_ROOT;
+	fd->sort_list[WRITE] = RB_ROOT;
+	setup_timer(&fd->idle_timer, flash_idle_timer, (unsigned long) fd);
+	INIT_WORK(&fd->unplug_work, flash_kick_queue);
+	fd->write_expire = write_expire;
+	fd->writes_starved = writes_starved;
+	fd->read_idle = msecs_to_jiffies(read_idle);
+	fd->front_merges = 1;
+	return fd;
+}
+
+/*
+ * sysfs parts below
+ */
+
+static ssize_t
+flash_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+flash_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR, __CONV)				\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct flash_data *fd = e->elevator_data;			\
+	int __data = __VAR;						\
+	if (__CONV)							\
+		__data = jiffies_to_msecs(__data);			\
+	return flash_var_show(__data, (page));				\
+}
+SHOW_FUNCTION(flash_write_expire_show, fd->write_expire, 1);
+SHOW_FUNCTION(flash_writes_starved_show, fd->writes_starved, 0);
+SHOW_FUNCTION(flash_read_idle_show, fd->read_idle, 1);
+SHOW_FUNCTION(flash_front_merges_show, fd->front_merges, 0);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct flash_data *fd = e->elevator_data;			\
+	int __data;							\
+	int ret = flash_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	if (__CONV)							\
+		*(__PTR) = msecs_to_jiffies(__data);			\
+	else								\
+		*(__PTR) = __data;					\
+	return ret;							\
+}
+STORE_FUNCTION(flash_write_expire_store, &fd->write_expire, 0, INT_MAX, 1);
+STORE_FUNCTION(flash_writes_starved_store, &fd->writes_starved, 0, INT_MAX, 0);
+STORE_FUNCTION(flash_read_idle_store, &fd->read_idle, 0, 1000, 1);
+STORE_FUNCTION(flash_front_merges_store, &fd->front_merges, 0, 1, 0);
+#undef STORE_FUNCTION
+
+/*
+ * Latency statistics: "<requests> <average us> <maximum us>", writing
+ * anything resets them.
+ */
+static ssize_t flash_latency_show(struct flash_data *fd, int data_dir,
+				  char *page)
+{
+	struct request_queue *q = fd->queue;
+	struct flash_latency lat;
+
+	spin_lock_irq(q->queue_lock);
+	lat = fd->latency[data_dir];
+	spin_unlock_irq(q->queue_lock);
+
+	if (lat.count)
+		do_div(lat.total_us, lat.count);
+	return sprintf(page, "%lu %llu %lu\n", lat.count,
+		       (unsigned long long) lat.total_us, lat.max_us);
+}
+
+static ssize_t flash_latency_reset(struct flash_data *fd, int data_dir,
+				   size_t count)
+{
+	struct request_queue *q = fd->queue;
+
+	spin_lock_irq(q->queue_lock);
+	memset(&fd->latency[data_dir], 0, sizeof(fd->latency[data_dir]));
+	spin_unlock_irq(q->queue_lock);
+	return count;
+}
+
+#define LATENCY_FUNCTIONS(__NAME, __DIR)				\
+static ssize_t flash_##__NAME##_show(struct elevator_queue *e, char *page) \
+{									\
+	return flash_latency_show(e->elevator_data, __DIR, page);	\
+}									\
+static ssize_t flash_##__NAME##_store(struct elevator_queue *e,	\
+				      const char *page, size_t count)	\
+{									\
+	return flash_latency_reset(e->elevator_data, __DIR, count);	\
+}
+LATENCY_FUNCTIONS(read_latency, READ);
+LATENCY_FUNCTIONS(write_latency, WRITE);
+#undef LATENCY_FUNCTIONS
+
+static ssize_t flash_idles_show(struct elevator_queue *e, char *page)
+{
+	struct flash_data *fd = e->elevator_data;
+
+	return sprintf(page, "%lu\n", fd->idles);
+}
+
+#define FD_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, flash_##name##_show, \
+				      flash_##name##_store)
+
+static struct elv_fs_entry flash_attrs[] = {
+	FD_ATTR(write_expire),
+	FD_ATTR(writes_starved),
+	FD_ATTR(read_idle),
+	FD_ATTR(front_merges),
+	FD_ATTR(read_latency),
+	FD_ATTR(write_latency),
+	__ATTR(idles, S_IRUGO, flash_idles_show, NULL),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_flash = {
+	.ops = {
+		.elevator_merge_fn = 		flash_merge,
+		.elevator_merged_fn =		flash_merged_request,
+		.elevator_merge_req_fn =	flash_merged_requests,
+		.elevator_dispatch_fn =		flash_dispatch_requests,
+		.elevator_add_req_fn =		flash_add_request,
+		.elevator_completed_req_fn =	flash_completed_request,
+		.elevator_former_req_fn =	elv_rb_former_request,
+		.elevator_latter_req_fn =	elv_rb_latter_request,
+		.elevator_init_fn =		flash_init_queue,
+		.elevator_exit_fn =		flash_exit_queue,
+	},
+
+	.elevator_attrs = flash_attrs,
+	.elevator_name = "flash",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init flash_init(void)
+{
+	elv_register(&iosched_flash);
+
+	return 0;
+}
+
+static void __exit flash_exit(void)
+{
+	elv_unregister(&iosched_flash);
+}
+
+module_init(flash_init);
+module_exit(flash_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Flash IO scheduler");
@@ -24,6 +24,8 @@
 #include <linux/pm_runtime.h>
 #include <linux/list.h>
 #include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/s3c_fb.h>
 
 #include <linux/videodev2.h>
 #include <media/v4l2-device.h>
@@ -86,8 +88,15 @@ static int fimc_capture_state_cleanup(struct fimc_dev *fimc, bool suspend)
 
 	fimc->state &= ~(1 << ST_CAPT_RUN | 1 << ST_CAPT_SHUT |
 			 1 << ST_CAPT_STREAM | 1 << ST_CAPT_ISP_STREAM);
-	if (!suspend)
+	if (!suspend) {
 		fimc->state &= ~(1 << ST_CAPT_PEND | 1 << ST_CAPT_SUSPENDED);
+		/*
+		 * buffers released by the display or the JPEG encoder
+		 * are returned as errors
+		 */
+		cap->ovl_active = false;
+		cap->jpeg_active = false;
+	}
 
 	/* Release unused buffers */
 	while (!suspend && !list_empty(&cap->pending_buf_q)) {
@@ -164,6 +173,271 @@ int fimc_capture_config_update(struct fimc_ctx *ctx)
 	return ret;
 }
 
+static bool fimc_capture_queue_buffer(struct fimc_ctx *ctx,
+				      struct fimc_vid_buffer *buf);
+
+#ifdef CONFIG_VIDEO_SAMSUNG_S3C_FIMC_OVERLAY
+/*
+ * Zero-copy preview. When the capture output is linked to the display
+ * overlay entity, completed frames are flipped onto the s3c-fb window
+ * instead of being returned to userspace, and each buffer is queued back
+ * to the camera interface once the display has moved on to the next one.
+ * The capture format must then be a display format (RGB565 or RGB32).
+ */
+
+/* Called by s3c-fb, from its VSYNC interrupt */
+static void fimc_capture_overlay_done(void *priv)
+{
+	struct fimc_vid_buffer *buf = priv;
+	struct fimc_ctx *ctx = vb2_get_drv_priv(buf->vb.vb2_queue);
+	struct fimc_dev *fimc = ctx->fimc_dev;
+	unsigned long flags;
+
+	spin_lock_irqsave(&fimc->slock, flags);
+	if (fimc->vid_cap.ovl_active)
+		fimc_capture_queue_buffer(ctx, buf);
+	else
+		vb2_buffer_done(&buf->vb, VB2_BUF_STATE_ERROR);
+	spin_unlock_irqrestore(&fimc->slock, flags);
+}
+
+/**
+ * fimc_capture_overlay_frame - pass a captured frame to the display
+ *
+ * To be called from within the interrupt handler with fimc.slock
+ * spinlock held. Returns false if the buffer should be returned to
+ * userspace as usual.
+ */
+bool fimc_capture_overlay_frame(struct fimc_dev *fimc,
+				struct fimc_vid_buffer *buf)
+{
+	struct fimc_vid_cap *cap = &fimc->vid_cap;
+
+	if (!cap->ovl_active)
+		return false;
+
+	if (!cap->ovl_enabled) {
+		/* the window is enabled with the first frame */
+		if (cap->ovl_first == NULL) {
+			cap->ovl_first = buf;
+			schedule_work(&cap->ovl_work);
+			return true;
+		}
+	} else if (!s3c_fb_overlay_flip(cap->overlay->win, buf->paddr.y,
+					fimc_capture_overlay_done, buf)) {
+		return true;
+	}
+
+	/* the display has not taken the previous frame yet, drop this one */
+	fimc_capture_queue_buffer(cap->ctx, buf);
+	return true;
+}
+
+static void fimc_capture_overlay_work(struct work_struct *work)
+{
+	struct fimc_dev *fimc =
+		container_of(work, struct fimc_dev, vid_cap.ovl_work);
+	struct fimc_vid_cap *cap = &fimc->vid_cap;
+	struct fimc_frame *f = &cap->ctx->d_frame;
+	struct s3c_fb_overlay ovl = {
+		.win	= cap->overlay->win,
+		.flags	= S3CFB_OVERLAY_ENABLE,
+		.width	= f->f_width,
+		.height	= f->f_height,
+		.stride	= f->f_width * f->fmt->depth[0] / 8,
+		.x	= cap->overlay->pos.left,
+		.y	= cap->overlay->pos.top,
+		.alpha	= S3CFB_ALPHA_MAX,
+	};
+	struct fimc_vid_buffer *buf;
+	unsigned long flags;
+	int ret;
+
+	if (f->fmt->color == S3C_FIMC_RGB565)
+		ovl.format = S3CFB_FMT_RGB565;
+	else
+		ovl.format = S3CFB_FMT_XRGB8888;
+
+	spin_lock_irqsave(&fimc->slock, flags);
+	buf = cap->ovl_first;
+	spin_unlock_irqrestore(&fimc->slock, flags);
+
+	ret = s3c_fb_overlay_setup(&ovl, buf->paddr.y,
+				   fimc_capture_overlay_done, buf);
+
+	spin_lock_irqsave(&fimc->slock, flags);
+	cap->ovl_first = NULL;
+	if (ret) {
+		v4l2_err(cap->vfd, "Failed to enable display window %u: %d\n",
+			 ovl.win, ret);
+		/* fall back to returning the frames to userspace */
+		cap->ovl_active = false;
+		vb2_buffer_done(&buf->vb, VB2_BUF_STATE_DONE);
+	} else {
+		cap->ovl_enabled = true;
+	}
+	spin_unlock_irqrestore(&fimc->slock, flags);
+}
+
+static int fimc_capture_overlay_start(struct fimc_dev *fimc)
+{
+	struct fimc_vid_cap *cap = &fimc->vid_cap;
+	struct fimc_fmt *fmt = cap->ctx->d_frame.fmt;
+
+	if (cap->overlay == NULL)
+		return 0;
+
+	if (fmt->color != S3C_FIMC_RGB565 && fmt->color != S3C_FIMC_RGB888)
+		return -EINVAL;
+
+	/* one buffer shown, one waiting for VSYNC and one being captured */
+	if (cap->reqbufs_count < 3)
+		return -EINVAL;
+
+	cap->ovl_first = NULL;
+	cap->ovl_enabled = false;
+	cap->ovl_active = true;
+	return 0;
+}
+
+/* To be called once the capture has been stopped and ovl_active cleared */
+static void fimc_capture_overlay_stop(struct fimc_dev *fimc)
+{
+	struct fimc_vid_cap *cap = &fimc->vid_cap;
+
+	if (cap->overlay == NULL)
+		return;
+
+	cancel_work_sync(&cap->ovl_work);
+
+	/* returns all the buffers held by the display */
+	if (cap->ovl_enabled) {
+		s3c_fb_overlay_disable(cap->overlay->win);
+		cap->ovl_enabled = false;
+	}
+
+	if (cap->ovl_first) {
+		vb2_buffer_done(&cap->ovl_first->vb, VB2_BUF_STATE_ERROR);
+		cap->ovl_first = NULL;
+	}
+}
+#else
+static inline int fimc_capture_overlay_start(struct fimc_dev *fimc)
+{
+	return 0;
+}
+
+static inline void fimc_capture_overlay_stop(struct fimc_dev *fimc)
+{
+}
+#endif /* CONFIG_VIDEO_SAMSUNG_S3C_FIMC_OVERLAY */
+
+#ifdef CONFIG_VIDEO_SAMSUNG_S3C_FIMC_JPEG
+/*
+ * Direct path to the JPEG encoder. When the capture output is linked to
+ * the JPEG entity, completed frames are queued to the s3c-jpeg encoder
+ * context acting as the camera source, and each buffer is queued back
+ * to the camera interface once it has been encoded. Userspace dequeues
+ * the JPEG images from the encoder.
+ */
+static void fimc_capture_jpeg_done(struct s3c_jpeg_frame *frame)
+{
+	struct fimc_vid_buffer *buf =
+		container_of(frame, struct fimc_vid_buffer, jpeg);
+	struct fimc_ctx *ctx = vb2_get_drv_priv(buf->vb.vb2_queue);
+	struct fimc_dev *fimc = ctx->fimc_dev;
+	struct fimc_vid_cap *cap = &fimc->vid_cap;
+	unsigned long flags;
+
+	spin_lock_irqsave(&fimc->slock, flags);
+	if (cap->jpeg_active)
+		fimc_capture_queue_buffer(ctx, buf);
+	else
+		vb2_buffer_done(&buf->vb, VB2_BUF_STATE_ERROR);
+	if (--cap->jpeg_pending == 0)
+		wake_up(&fimc->irq_queue);
+	spin_unlock_irqrestore(&fimc->slock, flags);
+}
+
+/**
+ * fimc_capture_jpeg_frame - pass a captured frame to the JPEG encoder
+ *
+ * To be called from within the interrupt handler with fimc.slock
+ * spinlock held. Returns false if the buffer should be returned to
+ * userspace as usual.
+ */
+bool fimc_capture_jpeg_frame(struct fimc_dev *fimc,
+			     struct fimc_vid_buffer *buf)
+{
+	struct fimc_vid_cap *cap = &fimc->vid_cap;
+	struct fimc_frame *f = &cap->ctx->d_frame;
+	struct s3c_jpeg_frame *frame = &buf->jpeg;
+
+	if (!cap->jpeg_active)
+		return false;
+
+	frame->addr = buf->paddr.y;
+	frame->vaddr = vb2_plane_vaddr(&buf->vb, 0);
+	frame->fourcc = f->fmt->fourcc;
+	frame->width = f->f_width;
+	frame->height = f->f_height;
+	frame->timestamp = buf->vb.v4l2_buf.timestamp;
+	frame->sequence = buf->vb.v4l2_buf.sequence;
+	frame->done = fimc_capture_jpeg_done;
+
+	if (s3c_jpeg_encode_frame(frame)) {
+		/* no encoder context is taking frames, drop this one */
+		fimc_capture_queue_buffer(cap->ctx, buf);
+		return true;
+	}
+
+	cap->jpeg_pending++;
+	return true;
+}
+
+static int fimc_capture_jpeg_start(struct fimc_dev *fimc)
+{
+	struct fimc_vid_cap *cap = &fimc->vid_cap;
+	u32 fourcc = cap->ctx->d_frame.fmt->fourcc;
+
+	if (!cap->jpeg_linked)
+		return 0;
+
+	if (cap->ovl_active)
+		return -EBUSY;
+
+	if (fourcc != V4L2_PIX_FMT_YUYV && fourcc != V4L2_PIX_FMT_RGB565)
+		return -EINVAL;
+
+	/* one buffer encoded, one waiting for the encoder, one captured */
+	if (cap->reqbufs_count < 3)
+		return -EINVAL;
+
+	cap->jpeg_pending = 0;
+	cap->jpeg_active = true;
+	return 0;
+}
+
+/* To be called once the capture has been stopped and jpeg_active cleared */
+static void fimc_capture_jpeg_stop(struct fimc_dev *fimc)
+{
+	if (!fimc->vid_cap.jpeg_linked)
+		return;
+
+	s3c_jpeg_flush_frames();
+	wait_event(fimc->irq_queue, fimc->vid_cap.jpeg_pending == 0);
+}
+#else
+static inline int fimc_capture_jpeg_start(struct fimc_dev *fimc)
+{
+	return 0;
+}
+
+static inline void fimc_capture_jpeg_stop(struct fimc_dev *fimc)
+{
+}
+#endif /* CONFIG_VIDEO_SAMSUNG_S3C_FIMC_JPEG */
+
 static int start_streaming(struct vb2_queue *q, unsigned int count)
 {
 	struct fimc_ctx *ctx = q->drv_priv;
@@ -178,6 +452,14 @@ static int start_streaming(struct vb2_queue *q, unsigned int count)
 	if (ret)
 		goto error;
 
+	ret = fimc_capture_overlay_start(fimc);
+	if (ret)
+		goto error;
+
+	ret = fimc_capture_jpeg_start(fimc);
+	if (ret)
+		goto error;
+
 	set_bit(ST_CAPT_PEND, &fimc->state);
 
 	min_bufs = fimc->vid_cap.reqbufs_count > 1 ? 2 : 1;
@@ -200,11 +482,15 @@ static int stop_streaming(struct vb2_queue *q)
 {
 	struct fimc_ctx *ctx = q->drv_priv;
 	struct fimc_dev *fimc = ctx->fimc_dev;
+	int ret;
 
 	if (!fimc_capture_active(fimc))
 		return -EINVAL;
 
-	return fimc_stop_capture(fimc, false);
+	ret = fimc_stop_capture(fimc, false);
+	fimc_capture_overlay_stop(fimc);
+	fimc_capture_jpeg_stop(fimc);
+	return ret;
 }
 
 int fimc_capture_suspend(struct fimc_dev *fimc)
@@ -299,19 +585,18 @@ static int buffer_prepare(struct vb2_buffer *vb)
 	return 0;
 }
 
-static void buffer_queue(struct vb2_buffer *vb)
+/*
+ * Hand a buffer to the hardware, or put it on the pending queue. To be
+ * called with fimc.slock held. Returns true if the capture has been
+ * activated, in which case the sensor stream may need to be started.
+ */
+static bool fimc_capture_queue_buffer(struct fimc_ctx *ctx,
+				      struct fimc_vid_buffer *buf)
 {
-	struct fimc_vid_buffer *buf
-		= container_of(vb, struct fimc_vid_buffer, vb);
-	struct fimc_ctx *ctx = vb2_get_drv_priv(vb->vb2_queue);
 	struct fimc_dev *fimc = ctx->fimc_dev;
 	struct fimc_vid_cap *vid_cap = &fimc->vid_cap;
-	unsigned long flags;
 	int min_bufs;
 
-	spin_lock_irqsave(&fimc->slock, flags);
-	fimc_prepare_addr(ctx, &buf->vb, &ctx->d_frame, &buf->paddr);
-
 	if (!test_bit(ST_CAPT_SUSPENDED, &fimc->state) &&
 	    !test_bit(ST_CAPT_STREAM, &fimc->state) &&
 	    vid_cap->active_buf_cnt < FIMC_MAX_OUT_BUFS) {
@@ -336,13 +621,27 @@ static void buffer_queue(struct vb2_buffer *vb)
 	    vid_cap->active_buf_cnt >= min_bufs &&
 	    !test_and_set_bit(ST_CAPT_STREAM, &fimc->state)) {
 		fimc_activate_capture(ctx);
-		spin_unlock_irqrestore(&fimc->slock, flags);
-
-		if (!test_and_set_bit(ST_CAPT_ISP_STREAM, &fimc->state))
-			fimc_pipeline_s_stream(fimc, 1);
-		return;
+		return true;
 	}
+	return false;
+}
+
+static void buffer_queue(struct vb2_buffer *vb)
+{
+	struct fimc_vid_buffer *buf
+		= container_of(vb, struct fimc_vid_buffer, vb);
+	struct fimc_ctx *ctx = vb2_get_drv_priv(vb->vb2_queue);
+	struct fimc_dev *fimc = ctx->fimc_dev;
+	unsigned long flags;
+	bool activated;
+
+	spin_lock_irqsave(&fimc->slock, flags);
+	fimc_prepare_addr(ctx, &buf->vb, &ctx->d_frame, &buf->paddr);
+	activated = fimc_capture_queue_buffer(ctx, buf);
 	spin_unlock_irqrestore(&fimc->slock, flags);
+
+	if (activated && !test_and_set_bit(ST_CAPT_ISP_STREAM, &fimc->state))
+		fimc_pipeline_s_stream(fimc, 1);
 }
 
 static void fimc_lock(struct vb2_queue *vq)
@@ -1105,6 +1404,10 @@ static int fimc_link_setup(struct media_entity *entity,
 	if (WARN_ON(fimc == NULL))
 		return 0;
 
+	/* the output links are handled by the overlay entity */
+	if (local->flags & MEDIA_PAD_FL_SOURCE)
+		return 0;
+
 	dbg("%s --> %s, flags: 0x%x. input: 0x%x",
 	    local->entity->name, remote->entity->name, flags,
 	    fimc->vid_cap.input);
@@ -1451,6 +1754,9 @@ int fimc_register_capture_device(struct fimc_dev *fimc,
 
 	INIT_LIST_HEAD(&vid_cap->pending_buf_q);
 	INIT_LIST_HEAD(&vid_cap->active_buf_q);
+#ifdef CONFIG_VIDEO_SAMSUNG_S3C_FIMC_OVERLAY
+	INIT_WORK(&vid_cap->ovl_work, fimc_capture_overlay_work);
+#endif
 	spin_lock_init(&ctx->slock);
 	vid_cap->ctx = ctx;
 
@@ -25,9 +25,12 @@
 #include <media/v4l2-mem2mem.h>
 #include <media/v4l2-mediabus.h>
 #include <media/s3c_fimc.h>
+#include <media/s3c_jpeg.h>
 
 #include "regs-fimc.h"
 
+struct fimc_overlay;
+
 #define err(fmt, args...) \
 	printk(KERN_ERR "%s:%d: " fmt "\n", __func__, __LINE__, ##args)
 
@@ -249,6 +252,9 @@ struct fimc_vid_buffer {
 	struct list_head	list;
 	struct fimc_addr	paddr;
 	int			index;
+#ifdef CONFIG_VIDEO_SAMSUNG_S3C_FIMC_JPEG
+	struct s3c_jpeg_frame	jpeg;
+#endif
 };
 
 /**
@@ -318,6 +324,14 @@ struct fimc_m2m_device {
  * @refcnt: driver's private reference counter
  * @input: capture input type, grp_id of the attached subdev
  * @user_subdev_api: true if subdevs are not configured by the host driver
+ * @overlay: display window linked to the capture output, if any
+ * @ovl_work: work enabling the display window with the first frame
+ * @ovl_first: the first frame, waiting for @ovl_work
+ * @ovl_active: true if captured frames go to the display window
+ * @ovl_enabled: true if the display window has been enabled
+ * @jpeg_linked: true if the capture output is linked to the JPEG encoder
+ * @jpeg_active: true if captured frames go to the JPEG encoder
+ * @jpeg_pending: number of buffers held by the JPEG encoder
  */
 struct fimc_vid_cap {
 	struct fimc_ctx			*ctx;
@@ -338,6 +352,14 @@ struct fimc_vid_cap {
 	int				refcnt;
 	u32				input;
 	bool				user_subdev_api;
+	struct fimc_overlay		*overlay;
+	struct work_struct		ovl_work;
+	struct fimc_vid_buffer		*ovl_first;
+	bool				ovl_active;
+	bool				ovl_enabled;
+	bool				jpeg_linked;
+	bool				jpeg_active;
+	unsigned int			jpeg_pending;
 };
 
 /**
@@ -700,6 +722,26 @@ void fimc_sensor_notify(struct v4l2_subdev *sd, unsigned int notification,
 int fimc_capture_suspend(struct fimc_dev *fimc);
 int fimc_capture_resume(struct fimc_dev *fimc);
 int fimc_capture_config_update(struct fimc_ctx *ctx);
+#ifdef CONFIG_VIDEO_SAMSUNG_S3C_FIMC_OVERLAY
+bool fimc_capture_overlay_frame(struct fimc_dev *fimc,
+				struct fimc_vid_buffer *buf);
+#else
+static inline bool fimc_capture_overlay_frame(struct fimc_dev *fimc,
+					      struct fimc_vid_buffer *buf)
+{
+	return false;
+}
+#endif
+#ifdef CONFIG_VIDEO_SAMSUNG_S3C_FIMC_JPEG
+bool fimc_capture_jpeg_frame(struct fimc_dev *fimc,
+			     struct fimc_vid_buffer *buf);
+#else
+static inline bool fimc_capture_jpeg_frame(struct fimc_dev *fimc,
+					   struct fimc_vid_buffer *buf)
+{
+	return false;
+}
+#endif
 
 /* Locking: the caller holds fimc->slock */
 static inline void fimc_activate_capture(struct fimc_ctx *ctx)
@@ -313,10 +313,247 @@ static int fimc_md_register_platform_entities(struct fimc_md *fmd)
 	return ret;
 }
 
+#ifdef CONFIG_VIDEO_SAMSUNG_S3C_FIMC_OVERLAY
+/*
+ * Display overlay window entity. It has no hardware of its own to set up,
+ * the linked FIMC capture device programs the s3c-fb window when it starts
+ * streaming; only the window position is kept here.
+ */
+static inline struct fimc_overlay *sd_to_fimc_overlay(struct v4l2_subdev *sd)
+{
+	return container_of(sd, struct fimc_overlay, subdev);
+}
+
+static int fimc_overlay_get_crop(struct v4l2_subdev *sd,
+				 struct v4l2_subdev_fh *fh,
+				 struct v4l2_subdev_crop *crop)
+{
+	crop->rect = sd_to_fimc_overlay(sd)->pos;
+	return 0;
+}
+
+static int fimc_overlay_set_crop(struct v4l2_subdev *sd,
+				 struct v4l2_subdev_fh *fh,
+				 struct v4l2_subdev_crop *crop)
+{
+	struct fimc_overlay *ovl = sd_to_fimc_overlay(sd);
+
+	if (crop->which == V4L2_SUBDEV_FORMAT_TRY)
+		return 0;
+
+	/* the size follows the capture output format */
+	ovl->pos.left = max(crop->rect.left, 0);
+	ovl->pos.top = max(crop->rect.top, 0);
+	crop->rect = ovl->pos;
+	return 0;
+}
+
+static struct v4l2_subdev_pad_ops fimc_overlay_pad_ops = {
+	.get_crop	= fimc_overlay_get_crop,
+	.set_crop	= fimc_overlay_set_crop,
+};
+
+static struct v4l2_subdev_ops fimc_overlay_subdev_ops = {
+	.pad = &fimc_overlay_pad_ops,
+};
+
+static int fimc_overlay_link_setup(struct media_entity *entity,
+				   const struct media_pad *local,
+				   const struct media_pad *remote, u32 flags)
+{
+	struct fimc_overlay *ovl =
+		sd_to_fimc_overlay(media_entity_to_v4l2_subdev(entity));
+	struct v4l2_subdev *sd;
+	struct fimc_dev *fimc;
+
+	if (media_entity_type(remote->entity) != MEDIA_ENT_T_V4L2_SUBDEV)
+		return -EINVAL;
+
+	sd = media_entity_to_v4l2_subdev(remote->entity);
+	fimc = v4l2_get_subdevdata(sd);
+	if (WARN_ON(fimc == NULL))
+		return 0;
+
+	if (vb2_is_streaming(&fimc->vid_cap.vbq))
+		return -EBUSY;
+
+	if (!(flags & MEDIA_LNK_FL_ENABLED)) {
+		if (ovl->host == fimc) {
+			ovl->host = NULL;
+			fimc->vid_cap.overlay = NULL;
+		}
+		return 0;
+	}
+
+	if (ovl->host && ovl->host != fimc)
+		return -EBUSY;
+
+	ovl->host = fimc;
+	fimc->vid_cap.overlay = ovl;
+	return 0;
+}
+
+static const struct media_entity_operations fimc_overlay_media_ops = {
+	.link_setup = fimc_overlay_link_setup,
+};
+
+static int fimc_md_register_overlay_entity(struct fimc_md *fmd)
+{
+	struct s3c_platform_fimc *pdata = fmd->pdev->dev.platform_data;
+	struct fimc_overlay *ovl = &fmd->overlay;
+	struct v4l2_subdev *sd = &ovl->subdev;
+	int ret;
+
+	if (!pdata || !pdata->overlay_win)
+		return 0;
+
+	v4l2_subdev_init(sd, &fimc_overlay_subdev_ops);
+	sd->flags = V4L2_SUBDEV_FL_HAS_DEVNODE;
+	sd->grp_id = OVERLAY_GROUP_ID;
+	snprintf(sd->name, sizeof(sd->name), "s3c-fb.win%u",
+		 pdata->overlay_win);
+
+	ovl->win = pdata->overlay_win;
+	ovl->pad.flags = MEDIA_PAD_FL_SINK;
+	ret = media_entity_init(&sd->entity, 1, &ovl->pad, 0);
+	if (ret)
+		return ret;
+
+	sd->entity.ops = &fimc_overlay_media_ops;
+	ret = v4l2_device_register_subdev(&fmd->v4l2_dev, sd);
+	if (ret) {
+		media_entity_cleanup(&sd->entity);
+		return ret;
+	}
+
+	v4l2_info(&fmd->v4l2_dev, "Registered overlay subdevice %s\n",
+		  sd->name);
+	return 0;
+}
+
+static void fimc_md_unregister_overlay_entity(struct fimc_md *fmd)
+{
+	struct v4l2_subdev *sd = &fmd->overlay.subdev;
+
+	if (!fmd->overlay.win)
+		return;
+	v4l2_device_unregister_subdev(sd);
+	media_entity_cleanup(&sd->entity);
+	fmd->overlay.win = 0;
+}
+#else
+static inline int fimc_md_register_overlay_entity(struct fimc_md *fmd)
+{
+	return 0;
+}
+
+static inline void fimc_md_unregister_overlay_entity(struct fimc_md *fmd)
+{
+}
+#endif /* CONFIG_VIDEO_SAMSUNG_S3C_FIMC_OVERLAY */
+
+#ifdef CONFIG_VIDEO_SAMSUNG_S3C_FIMC_JPEG
+/*
+ * JPEG encoder entity. As for the overlay, only the link state is kept
+ * here; the capture device passes the frames to s3c-jpeg.
+ */
+static struct v4l2_subdev_ops fimc_jpeg_subdev_ops;
+
+static int fimc_jpeg_link_setup(struct media_entity *entity,
+				const struct media_pad *local,
+				const struct media_pad *remote, u32 flags)
+{
+	struct v4l2_subdev *jpeg_sd = media_entity_to_v4l2_subdev(entity);
+	struct fimc_jpeg_sink *js =
+		container_of(jpeg_sd, struct fimc_jpeg_sink, subdev);
+	struct v4l2_subdev *sd;
+	struct fimc_dev *fimc;
+
+	if (media_entity_type(remote->entity) != MEDIA_ENT_T_V4L2_SUBDEV)
+		return -EINVAL;
+
+	sd = media_entity_to_v4l2_subdev(remote->entity);
+	fimc = v4l2_get_subdevdata(sd);
+	if (WARN_ON(fimc == NULL))
+		return 0;
+
+	if (vb2_is_streaming(&fimc->vid_cap.vbq))
+		return -EBUSY;
+
+	if (!(flags & MEDIA_LNK_FL_ENABLED)) {
+		if (js->host == fimc) {
+			js->host = NULL;
+			fimc->vid_cap.jpeg_linked = false;
+		}
+		return 0;
+	}
+
+	if (js->host && js->host != fimc)
+		return -EBUSY;
+
+	js->host = fimc;
+	fimc->vid_cap.jpeg_linked = true;
+	return 0;
+}
+
+static const struct media_entity_operations fimc_jpeg_media_ops = {
+	.link_setup = fimc_jpeg_link_setup,
+};
+
+static int fimc_md_register_jpeg_entity(struct fimc_md *fmd)
+{
+	struct fimc_jpeg_sink *js = &fmd->jpeg;
+	struct v4l2_subdev *sd = &js->subdev;
+	int ret;
+
+	v4l2_subdev_init(sd, &fimc_jpeg_subdev_ops);
+	sd->grp_id = JPEG_GROUP_ID;
+	strlcpy(sd->name, "s3c-jpeg", sizeof(sd->name));
+
+	js->pad.flags = MEDIA_PAD_FL_SINK;
+	ret = media_entity_init(&sd->entity, 1, &js->pad, 0);
+	if (ret)
+		return ret;
+
+	sd->entity.ops = &fimc_jpeg_media_ops;
+	ret = v4l2_device_register_subdev(&fmd->v4l2_dev, sd);
+	if (ret) {
+		media_entity_cleanup(&sd->entity);
+		return ret;
+	}
+
+	js->registered = true;
+	return 0;
+}
+
+static void fimc_md_unregister_jpeg_entity(struct fimc_md *fmd)
+{
+	struct v4l2_subdev *sd = &fmd->jpeg.subdev;
+
+	if (!fmd->jpeg.registered)
+		return;
+	v4l2_device_unregister_subdev(sd);
+	media_entity_cleanup(&sd->entity);
+	fmd->jpeg.registered = false;
+}
+#else
+static inline int fimc_md_register_jpeg_entity(struct fimc_md *fmd)
+{
+	return 0;
+}
+
+static inline void fimc_md_unregister_jpeg_entity(struct fimc_md *fmd)
+{
+}
+#endif /* CONFIG_VIDEO_SAMSUNG_S3C_FIMC_JPEG */
+
 static void fimc_md_unregister_entities(struct fimc_md *fmd)
 {
 	int i;
 
+	fimc_md_unregister_jpeg_entity(fmd);
+	fimc_md_unregister_overlay_entity(fmd);
+
 	for (i = 0; i < FIMC_MAX_DEVS; i++) {
 		if (fmd->fimc[i] == NULL)
 			continue;
@@ -419,6 +656,28 @@ static int __fimc_md_create_fimc_links(struct fimc_md *fmd,
 	return 0;
 }
 
+/* Create disabled links from each FIMC's subdev to an output entity */
+static int fimc_md_create_output_links(struct fimc_md *fmd,
+				       struct media_entity *sink)
+{
+	struct media_entity *source;
+	int i, ret;
+
+	for (i = 0; i < FIMC_MAX_DEVS; i++) {
+		if (!fmd->fimc[i])
+			continue;
+		source = &fmd->fimc[i]->vid_cap.subdev->entity;
+		ret = media_entity_create_link(source, FIMC_SD_PAD_SOURCE,
+					      sink, 0, 0);
+		if (ret)
+			return ret;
+
+		v4l2_info(&fmd->v4l2_dev, "created link [%s] -> [%s]",
+			  source->name, sink->name);
+	}
+	return 0;
+}
+
 /**
  * fimc_md_create_links - create default links between registered entities
  *
@@ -479,7 +738,18 @@ static int fimc_md_create_links(struct fimc_md *fmd)
 		if (ret)
 			break;
 	}
+	if (ret)
+		return ret;
 
+	if (fmd->overlay.win) {
+		ret = fimc_md_create_output_links(fmd,
+						  &fmd->overlay.subdev.entity);
+		if (ret)
+			return ret;
+	}
+	if (fmd->jpeg.registered)
+		ret = fimc_md_create_output_links(fmd,
+						  &fmd->jpeg.subdev.entity);
 	return ret;
 }
 
@@ -595,6 +865,8 @@ static int fimc_md_link_notify(struct media_pad *source,
 		return 0;
 
 	sd = media_entity_to_v4l2_subdev(sink->entity);
+	if (sd->grp_id == OVERLAY_GROUP_ID || sd->grp_id == JPEG_GROUP_ID)
+		return 0;
 	fimc = v4l2_get_subdevdata(sd);
 
 	if (!(flags & MEDIA_LNK_FL_ENABLED)) {
@@ -715,6 +987,12 @@ static int __devinit fimc_md_probe(struct platform_device *pdev)
 		if (ret)
 			goto err3;
 	}
+	ret = fimc_md_register_overlay_entity(fmd);
+	if (ret)
+		goto err3;
+	ret = fimc_md_register_jpeg_entity(fmd);
+	if (ret)
+		goto err3;
 	ret = fimc_md_create_links(fmd);
 	if (ret)
 		goto err3;
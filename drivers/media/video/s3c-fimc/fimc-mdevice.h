@@ -22,6 +22,8 @@
 /* Group IDs of sensor and the writeback subdevs. */
 #define SENSOR_GROUP_ID		(1 << 8)
 #define WRITEBACK_GROUP_ID	(1 << 10)
+#define OVERLAY_GROUP_ID	(1 << 11)
+#define JPEG_GROUP_ID		(1 << 12)
 
 #define FIMC_MAX_SENSORS	8
 #define FIMC_MAX_CAMCLKS	1
@@ -48,12 +50,44 @@ struct fimc_sensor_info {
 	bool clk_on;
 };
 
+/**
+ * struct fimc_overlay - display window fed directly by a capture output
+ * @subdev: subdev representing the s3c-fb window in the media graph
+ * @pad: sink pad of @subdev
+ * @win: s3c-fb hardware window number
+ * @pos: position of the window on the screen, set through the pad crop
+ * @host: fimc device whose capture output is linked to the window
+ */
+struct fimc_overlay {
+	struct v4l2_subdev subdev;
+	struct media_pad pad;
+	unsigned int win;
+	struct v4l2_rect pos;
+	struct fimc_dev *host;
+};
+
+/**
+ * struct fimc_jpeg_sink - JPEG encoder fed directly by a capture output
+ * @subdev: subdev representing the s3c-jpeg encoder in the media graph
+ * @pad: sink pad of @subdev
+ * @host: fimc device whose capture output is linked to the encoder
+ * @registered: true if @subdev has been registered
+ */
+struct fimc_jpeg_sink {
+	struct v4l2_subdev subdev;
+	struct media_pad pad;
+	struct fimc_dev *host;
+	bool registered;
+};
+
 /**
  * struct fimc_md - fimc media device information
  * @sensor: array of registered sensor subdevs
  * @num_sensors: actual number of registered sensors
  * @camclk: external sensor clock information
  * @fimc: array of registered fimc devices
+ * @overlay: display overlay window entity
+ * @jpeg: JPEG encoder entity
  * @media_dev: top level media device
  * @v4l2_dev: top level v4l2_device holding up the subdevs
  * @pdev: platform device this media device is hooked up into
@@ -65,6 +99,8 @@ struct fimc_md {
 	int num_sensors;
 	struct fimc_camclk_info camclk[FIMC_MAX_CAMCLKS];
 	struct fimc_dev *fimc[FIMC_MAX_DEVS];
+	struct fimc_overlay overlay;
+	struct fimc_jpeg_sink jpeg;
 	struct media_device media_dev;
 	struct v4l2_device v4l2_dev;
 	struct platform_device *pdev;
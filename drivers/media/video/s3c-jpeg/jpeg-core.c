@@ -12,6 +12,8 @@
  */
 
 #include <linux/clk.h>
+#include <linux/completion.h>
+#include <linux/dma-mapping.h>
 #include <linux/err.h>
 #include <linux/gfp.h>
 #include <linux/interrupt.h>
@@ -20,9 +22,11 @@
 #include <linux/module.h>
 #include <linux/platform_device.h>
 #include <linux/pm_runtime.h>
+#include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/string.h>
+#include <linux/workqueue.h>
 #include <media/v4l2-mem2mem.h>
 #include <media/v4l2-ioctl.h>
 #include <media/videobuf2-core.h>
@@ -74,6 +78,15 @@ static struct s3c_jpeg_fmt formats_dec[] = {
 };
 #define NUM_FORMATS_DEC ARRAY_SIZE(formats_dec)
 
+#ifdef CONFIG_VIDEO_SAMSUNG_S3C_JPEG_SW
+static bool sw_encode;
+module_param(sw_encode, bool, 0444);
+MODULE_PARM_DESC(sw_encode, "Encode on the CPU instead of the codec IP block");
+#endif
+
+/* for the in-kernel encoder interface */
+static struct s3c_jpeg *s3c_jpeg_dev;
+
 static const unsigned char qtbl_luminance[4][64] = {
 	{/* level 1 - high quality */
 		 8,  6,  6,  8, 12, 14, 16, 17,
@@ -194,6 +207,17 @@ static const unsigned char hactblg0[162] = {
 	0xf9, 0xfa
 };
 
+#ifdef CONFIG_VIDEO_SAMSUNG_S3C_JPEG_SW
+static const struct s3c_jpeg_tables s3c_jpeg_sw_tables = {
+	.qtbl_lum	= qtbl_luminance,
+	.qtbl_chr	= qtbl_chrominance,
+	.dc_bits	= hdctbl0,
+	.dc_vals	= hdctblg0,
+	.ac_bits	= hactbl0,
+	.ac_vals	= hactblg0,
+};
+#endif
+
 static inline struct s3c_jpeg_ctx *ctrl_to_ctx(struct v4l2_ctrl *c)
 {
 	return container_of(c->handler, struct s3c_jpeg_ctx, ctrl_handler);
@@ -395,11 +419,18 @@ static void skip(struct s3c_jpeg_buffer *buf, long len)
 		get_byte(buf);
 }
 
+/*
+ * Read the image size from the SOF0 segment. If thumb_offset is not NULL,
+ * the location of the thumbnail embedded in an APP1 (EXIF) segment is
+ * returned in thumb_offset and thumb_size, or 0 if there is none.
+ */
 static bool s3c_jpeg_parse_hdr(struct s3c_jpeg_q_data *result,
-			       unsigned long buffer, unsigned long size)
+			       unsigned long buffer, unsigned long size,
+			       unsigned long *thumb_offset,
+			       unsigned long *thumb_size)
 {
-	int c, components, notfound;
-	unsigned int height, width, word;
+	int c, components = 0, notfound;
+	unsigned int height = 0, width = 0, word;
 	long length;
 	struct s3c_jpeg_buffer jpeg_buffer;
 
@@ -407,6 +438,11 @@ static bool s3c_jpeg_parse_hdr(struct s3c_jpeg_q_data *result,
 	jpeg_buffer.data = buffer;
 	jpeg_buffer.curr = 0;
 
+	if (thumb_offset) {
+		*thumb_offset = 0;
+		*thumb_size = 0;
+	}
+
 	notfound = 1;
 	while (notfound) {
 		c = get_byte(&jpeg_buffer);
@@ -441,6 +477,19 @@ static bool s3c_jpeg_parse_hdr(struct s3c_jpeg_q_data *result,
 			skip(&jpeg_buffer, components * 3);
 			break;
 
+		case APP1:
+			if (get_word_be(&jpeg_buffer, &word))
+				break;
+			length = (long)word - 2;
+			if (thumb_offset && length > 0 && !*thumb_size &&
+			    length <= jpeg_buffer.size - jpeg_buffer.curr &&
+			    s3c_jpeg_exif_find_thumb(
+					(const u8 *)buffer + jpeg_buffer.curr,
+					length, thumb_offset, thumb_size))
+				*thumb_offset += jpeg_buffer.curr;
+			skip(&jpeg_buffer, length);
+			break;
+
 		/* skip payload-less markers */
 		case RST ... RST + 7:
 		case SOI:
@@ -867,6 +916,22 @@ static int s3c_jpeg_s_ctrl(struct v4l2_ctrl *ctrl)
 	struct s3c_jpeg_ctx *ctx = ctrl_to_ctx(ctrl);
 	unsigned long flags;
 
+	switch (ctrl->id) {
+	case V4L2_CID_JPEG_S3C_DECODE_THUMBNAIL:
+		/* takes effect when the next source buffer is queued */
+		ctx->dec_thumb = ctrl->val;
+		return 0;
+	}
+
+	if (ctrl->id == V4L2_CID_JPEG_S3C_CAMERA_SOURCE) {
+		if (ctx->m2m_ctx &&
+		    (vb2_is_busy(v4l2_m2m_get_src_vq(ctx->m2m_ctx)) ||
+		     vb2_is_streaming(v4l2_m2m_get_dst_vq(ctx->m2m_ctx))))
+			return -EBUSY;
+		ctx->cam_src = ctrl->val;
+		return 0;
+	}
+
 	spin_lock_irqsave(&ctx->jpeg->slock, flags);
 
 	switch (ctrl->id) {
@@ -879,6 +944,15 @@ static int s3c_jpeg_s_ctrl(struct v4l2_ctrl *ctrl)
 	case V4L2_CID_JPEG_CHROMA_SUBSAMPLING:
 		ctx->subsampling = ctrl->val;
 		break;
+	case V4L2_CID_JPEG_ACTIVE_MARKER:
+		ctx->exif = ctrl->val & V4L2_JPEG_ACTIVE_MARKER_APP1;
+		break;
+	case V4L2_CID_JPEG_S3C_THUMBNAIL_WIDTH:
+		ctx->thumb_width = ctrl->val;
+		break;
+	case V4L2_CID_JPEG_S3C_THUMBNAIL_HEIGHT:
+		ctx->thumb_height = ctrl->val;
+		break;
 	}
 
 	spin_unlock_irqrestore(&ctx->jpeg->slock, flags);
@@ -890,12 +964,50 @@ static const struct v4l2_ctrl_ops s3c_jpeg_ctrl_ops = {
 	.s_ctrl			= s3c_jpeg_s_ctrl,
 };
 
+static const struct v4l2_ctrl_config s3c_jpeg_camera_source_ctrl = {
+	.ops	= &s3c_jpeg_ctrl_ops,
+	.id	= V4L2_CID_JPEG_S3C_CAMERA_SOURCE,
+	.name	= "Camera Source",
+	.type	= V4L2_CTRL_TYPE_BOOLEAN,
+	.max	= 1,
+	.step	= 1,
+};
+
+static const struct v4l2_ctrl_config s3c_jpeg_thumb_width_ctrl = {
+	.ops	= &s3c_jpeg_ctrl_ops,
+	.id	= V4L2_CID_JPEG_S3C_THUMBNAIL_WIDTH,
+	.name	= "Thumbnail Width",
+	.type	= V4L2_CTRL_TYPE_INTEGER,
+	.max	= S3C_JPEG_THUMB_MAX_WIDTH,
+	.step	= 16,
+	.def	= 160,
+};
+
+static const struct v4l2_ctrl_config s3c_jpeg_thumb_height_ctrl = {
+	.ops	= &s3c_jpeg_ctrl_ops,
+	.id	= V4L2_CID_JPEG_S3C_THUMBNAIL_HEIGHT,
+	.name	= "Thumbnail Height",
+	.type	= V4L2_CTRL_TYPE_INTEGER,
+	.max	= S3C_JPEG_THUMB_MAX_HEIGHT,
+	.step	= 8,
+	.def	= 120,
+};
+
+static const struct v4l2_ctrl_config s3c_jpeg_decode_thumb_ctrl = {
+	.ops	= &s3c_jpeg_ctrl_ops,
+	.id	= V4L2_CID_JPEG_S3C_DECODE_THUMBNAIL,
+	.name	= "Decode Thumbnail",
+	.type	= V4L2_CTRL_TYPE_BOOLEAN,
+	.max	= 1,
+	.step	= 1,
+};
+
 static int s3c_jpeg_controls_create(struct s3c_jpeg_ctx *ctx)
 {
 	unsigned int mask = ~0x27; /* 444, 422, 420, GRAY */
 	struct v4l2_ctrl *ctrl;
 
-	v4l2_ctrl_handler_init(&ctx->ctrl_handler, 3);
+	v4l2_ctrl_handler_init(&ctx->ctrl_handler, 7);
 
 	if (ctx->mode == S3C_JPEG_ENCODE) {
 		v4l2_ctrl_new_std(&ctx->ctrl_handler, &s3c_jpeg_ctrl_ops,
@@ -905,7 +1017,23 @@ static int s3c_jpeg_controls_create(struct s3c_jpeg_ctx *ctx)
 		v4l2_ctrl_new_std(&ctx->ctrl_handler, &s3c_jpeg_ctrl_ops,
 				  V4L2_CID_JPEG_RESTART_INTERVAL,
 				  0, 3, 0xffff, 0);
+
+		v4l2_ctrl_new_custom(&ctx->ctrl_handler,
+				     &s3c_jpeg_camera_source_ctrl, NULL);
+
+		v4l2_ctrl_new_std(&ctx->ctrl_handler, &s3c_jpeg_ctrl_ops,
+				  V4L2_CID_JPEG_ACTIVE_MARKER,
+				  0, V4L2_JPEG_ACTIVE_MARKER_APP1, 0, 0);
+		v4l2_ctrl_new_custom(&ctx->ctrl_handler,
+				     &s3c_jpeg_thumb_width_ctrl, NULL);
+		v4l2_ctrl_new_custom(&ctx->ctrl_handler,
+				     &s3c_jpeg_thumb_height_ctrl, NULL);
+		ctx->thumb_width = s3c_jpeg_thumb_width_ctrl.def;
+		ctx->thumb_height = s3c_jpeg_thumb_height_ctrl.def;
 		mask = ~0x06; /* 422, 420 */
+	} else {
+		v4l2_ctrl_new_custom(&ctx->ctrl_handler,
+				     &s3c_jpeg_decode_thumb_ctrl, NULL);
 	}
 
 	ctrl = v4l2_ctrl_new_std_menu(&ctx->ctrl_handler, &s3c_jpeg_ctrl_ops,
@@ -953,90 +1081,374 @@ static const struct v4l2_ioctl_ops s3c_jpeg_ioctl_ops = {
  * mem2mem callbacks
  */
 
-static void s3c_jpeg_device_run(void *priv)
+static void s3c_jpeg_job_init(struct s3c_jpeg_job *job,
+			      struct s3c_jpeg_ctx *ctx,
+			      struct vb2_buffer *dst_buf)
+{
+	job->dst_addr = vb2_dma_contig_plane_dma_addr(dst_buf, 0);
+	job->dst_vaddr = vb2_plane_vaddr(dst_buf, 0);
+	job->dst_size = vb2_plane_size(dst_buf, 0);
+	job->quality = ctx->compr_quality;
+	job->subsampling = ctx->subsampling;
+	job->restart_interval = ctx->restart_interval;
+	job->exif = ctx->exif;
+	job->thumb_width = ctx->thumb_width;
+	job->thumb_height = ctx->thumb_height;
+}
+
+/* Locking: the caller holds jpeg->slock */
+static void s3c_jpeg_hw_start_enc(struct s3c_jpeg *jpeg,
+				  const struct s3c_jpeg_job *job)
+{
+	/*
+	 * JPEG IP allows storing two Huffman tables for each component
+	 * We fill table 0 for each component
+	 */
+	jpeg_set_hdctbl(jpeg->regs);
+	jpeg_set_hdctblg(jpeg->regs);
+	jpeg_set_hactbl(jpeg->regs);
+	jpeg_set_hactblg(jpeg->regs);
+
+	jpeg_proc_mode(jpeg->regs, S3C_JPEG_ENCODE);
+	if (job->fourcc == V4L2_PIX_FMT_RGB565)
+		jpeg_input_raw_mode(jpeg->regs, S3C_JPEG_RAW_IN_565);
+	else
+		jpeg_input_raw_mode(jpeg->regs, S3C_JPEG_RAW_IN_422);
+	jpeg_subsampling_mode(jpeg->regs, job->subsampling);
+	jpeg_dri(jpeg->regs, job->restart_interval);
+	jpeg_x(jpeg->regs, job->width);
+	jpeg_y(jpeg->regs, job->height);
+	jpeg_imgadr(jpeg->regs, job->src_addr);
+	jpeg_jpgadr(jpeg->regs, job->dst_addr);
+
+	/* JPEG RGB to YCbCr conversion matrix */
+	jpeg_coef(jpeg->regs, 1, 1, S3C_JPEG_COEF11);
+	jpeg_coef(jpeg->regs, 1, 2, S3C_JPEG_COEF12);
+	jpeg_coef(jpeg->regs, 1, 3, S3C_JPEG_COEF13);
+	jpeg_coef(jpeg->regs, 2, 1, S3C_JPEG_COEF21);
+	jpeg_coef(jpeg->regs, 2, 2, S3C_JPEG_COEF22);
+	jpeg_coef(jpeg->regs, 2, 3, S3C_JPEG_COEF23);
+	jpeg_coef(jpeg->regs, 3, 1, S3C_JPEG_COEF31);
+	jpeg_coef(jpeg->regs, 3, 2, S3C_JPEG_COEF32);
+	jpeg_coef(jpeg->regs, 3, 3, S3C_JPEG_COEF33);
+
+	/*
+	 * JPEG IP allows storing 4 quantization tables
+	 * We fill table 0 for luma and table 1 for chroma
+	 */
+	jpeg_set_qtbl_lum(jpeg->regs, job->quality);
+	jpeg_set_qtbl_chr(jpeg->regs, job->quality);
+	/* use table 0 for Y */
+	jpeg_qtbl(jpeg->regs, 1, 0);
+	/* use table 1 for Cb and Cr*/
+	jpeg_qtbl(jpeg->regs, 2, 1);
+	jpeg_qtbl(jpeg->regs, 3, 1);
+
+	/* Y, Cb, Cr use Huffman table 0 */
+	jpeg_htbl_ac(jpeg->regs, 1);
+	jpeg_htbl_dc(jpeg->regs, 1);
+	jpeg_htbl_ac(jpeg->regs, 2);
+	jpeg_htbl_dc(jpeg->regs, 2);
+	jpeg_htbl_ac(jpeg->regs, 3);
+	jpeg_htbl_dc(jpeg->regs, 3);
+
+	jpeg_start_enc(jpeg->regs);
+}
+
+/*
+ * Jobs encoded on the CPU, and the ones made of several encoding runs,
+ * are completed by jpeg->work. Locking: the caller holds jpeg->slock.
+ */
+static void s3c_jpeg_start_enc(struct s3c_jpeg *jpeg,
+			       const struct s3c_jpeg_job *job)
+{
+	bool sw = false;
+
+#ifdef CONFIG_VIDEO_SAMSUNG_S3C_JPEG_SW
+	sw = jpeg->sw != NULL;
+#endif
+	if (sw || job->exif) {
+		jpeg->work_job = *job;
+		jpeg->hw_sync = true;
+		queue_work(jpeg->wq, &jpeg->work);
+		return;
+	}
+
+	s3c_jpeg_hw_start_enc(jpeg, job);
+}
+
+/* Locking: the caller holds jpeg->slock */
+static void s3c_jpeg_m2m_start(struct s3c_jpeg_ctx *ctx)
 {
-	struct s3c_jpeg_ctx *ctx = priv;
 	struct s3c_jpeg *jpeg = ctx->jpeg;
 	struct vb2_buffer *src_buf, *dst_buf;
 	unsigned long src_addr, dst_addr;
-	int ret;
+	struct s3c_jpeg_job job;
 
 	src_buf = v4l2_m2m_next_src_buf(ctx->m2m_ctx);
 	dst_buf = v4l2_m2m_next_dst_buf(ctx->m2m_ctx);
-	src_addr = vb2_dma_contig_plane_dma_addr(src_buf, 0);
+
+	if (ctx->mode == S3C_JPEG_ENCODE) {
+		s3c_jpeg_job_init(&job, ctx, dst_buf);
+		job.fourcc = ctx->out_q.fmt->fourcc;
+		job.width = ctx->out_q.w;
+		job.height = ctx->out_q.h;
+		job.src_addr = vb2_dma_contig_plane_dma_addr(src_buf, 0);
+		job.src_vaddr = vb2_plane_vaddr(src_buf, 0);
+		s3c_jpeg_start_enc(jpeg, &job);
+		return;
+	}
+
+	src_addr = vb2_dma_contig_plane_dma_addr(src_buf, 0) + ctx->src_offset;
 	dst_addr = vb2_dma_contig_plane_dma_addr(dst_buf, 0);
 
+	jpeg_set_hdctbl(jpeg->regs);
+	jpeg_set_hdctblg(jpeg->regs);
+	jpeg_set_hactbl(jpeg->regs);
+	jpeg_set_hactblg(jpeg->regs);
+
+	jpeg_proc_mode(jpeg->regs, S3C_JPEG_DECODE);
+	jpeg_rst_int_enable(jpeg->regs, true);
+	jpeg_jpgadr(jpeg->regs, src_addr);
+	jpeg_imgadr(jpeg->regs, dst_addr);
+
+	jpeg_start_dec(jpeg->regs);
+}
+
+/*
+ * Start encoding the next camera frame, if there is one and a destination
+ * buffer to encode it to. Locking: the caller holds jpeg->slock.
+ */
+static void s3c_jpeg_cam_try_run(struct s3c_jpeg *jpeg)
+{
+	struct s3c_jpeg_ctx *ctx = jpeg->cam_ctx;
+	struct s3c_jpeg_frame *frame;
+	struct vb2_buffer *dst_buf;
+	struct s3c_jpeg_job job;
+
+	if (jpeg->busy || !ctx || list_empty(&jpeg->cam_q) ||
+	    !v4l2_m2m_num_dst_bufs_ready(ctx->m2m_ctx))
+		return;
+
+	frame = list_first_entry(&jpeg->cam_q, struct s3c_jpeg_frame, list);
+	list_del(&frame->list);
+	dst_buf = v4l2_m2m_dst_buf_remove(ctx->m2m_ctx);
+
+	jpeg->busy = true;
+	jpeg->cam_frame = frame;
+	jpeg->cam_dst = dst_buf;
+
+	s3c_jpeg_job_init(&job, ctx, dst_buf);
+	job.fourcc = frame->fourcc;
+	job.width = frame->width;
+	job.height = frame->height;
+	job.src_addr = frame->addr;
+	job.src_vaddr = frame->vaddr;
+	s3c_jpeg_start_enc(jpeg, &job);
+}
+
+/*
+ * Complete the current job and start the next one. Camera frames take
+ * precedence over the mem2mem jobs, so that a burst keeps up with the
+ * sensor.
+ */
+static void s3c_jpeg_job_done(struct s3c_jpeg *jpeg, bool ok,
+			      unsigned long payload_size)
+{
+	enum vb2_buffer_state state = VB2_BUF_STATE_DONE;
+	struct s3c_jpeg_ctx *curr_ctx = NULL;
+	struct s3c_jpeg_frame *frame;
+	struct vb2_buffer *src_buf, *dst_buf;
+	unsigned long flags;
+
+	if (!ok) {
+		state = VB2_BUF_STATE_ERROR;
+		payload_size = 0;
+	}
+
+	spin_lock_irqsave(&jpeg->slock, flags);
+
+	frame = jpeg->cam_frame;
+	if (frame) {
+		dst_buf = jpeg->cam_dst;
+		jpeg->cam_frame = NULL;
+		jpeg->cam_dst = NULL;
+
+		dst_buf->v4l2_buf.timestamp = frame->timestamp;
+		dst_buf->v4l2_buf.sequence = frame->sequence;
+		vb2_set_plane_payload(dst_buf, 0, payload_size);
+		v4l2_m2m_buf_done(dst_buf, state);
+		wake_up(&jpeg->cam_wait);
+	} else {
+		curr_ctx = v4l2_m2m_get_curr_priv(jpeg->m2m_dev);
+
+		pm_runtime_put(jpeg->dev);
+
+		src_buf = v4l2_m2m_src_buf_remove(curr_ctx->m2m_ctx);
+		dst_buf = v4l2_m2m_dst_buf_remove(curr_ctx->m2m_ctx);
+
+		v4l2_m2m_buf_done(src_buf, state);
+		if (curr_ctx->mode == S3C_JPEG_ENCODE)
+			vb2_set_plane_payload(dst_buf, 0, payload_size);
+		v4l2_m2m_buf_done(dst_buf, state);
+	}
+	jpeg->busy = false;
+
+	s3c_jpeg_cam_try_run(jpeg);
+	if (!jpeg->busy && jpeg->m2m_pending) {
+		jpeg->busy = true;
+		s3c_jpeg_m2m_start(jpeg->m2m_pending);
+		jpeg->m2m_pending = NULL;
+	}
+
+	spin_unlock_irqrestore(&jpeg->slock, flags);
+
+	if (frame)
+		frame->done(frame);
+	if (curr_ctx)
+		v4l2_m2m_job_finish(jpeg->m2m_dev, curr_ctx->m2m_ctx);
+}
+
+/* Encode one image from jpeg->work, returns its size or an error code */
+static int s3c_jpeg_encode_sync(struct s3c_jpeg *jpeg,
+				const struct s3c_jpeg_job *job)
+{
+	unsigned long flags;
+	long ret;
+
+#ifdef CONFIG_VIDEO_SAMSUNG_S3C_JPEG_SW
+	if (jpeg->sw)
+		return s3c_jpeg_sw_encode(jpeg->sw, job);
+#endif
+	INIT_COMPLETION(jpeg->hw_done);
+
+	spin_lock_irqsave(&jpeg->slock, flags);
+	s3c_jpeg_hw_start_enc(jpeg, job);
+	spin_unlock_irqrestore(&jpeg->slock, flags);
+
+	ret = wait_for_completion_timeout(&jpeg->hw_done,
+				msecs_to_jiffies(S3C_JPEG_TIMEOUT_MS));
+	if (!ret) {
+		v4l2_err(&jpeg->v4l2_dev, "encoding timed out\n");
+		jpeg_reset(jpeg->regs);
+		return -ETIMEDOUT;
+	}
+
+	return jpeg->hw_result;
+}
+
+/*
+ * Encode the thumbnail, then the main image after room for the APP1
+ * segment, which is written last. Returns the size of the whole image.
+ */
+static int s3c_jpeg_encode_exif(struct s3c_jpeg *jpeg,
+				const struct s3c_jpeg_job *job)
+{
+	struct s3c_jpeg_job thumb_job, main_job;
+	unsigned int thumb_size = 0;
+	void *thumb = NULL;
+	int len, ret;
+
+	if (job->thumb_width < S3C_JPEG_MIN_WIDTH ||
+	    job->thumb_height < S3C_JPEG_MIN_HEIGHT ||
+	    job->thumb_width > job->width || job->thumb_height > job->height)
+		goto encode_main;
+
+	/* allocated on first use, most contexts never ask for APP1 */
+	if (!jpeg->thumb_vaddr)
+		jpeg->thumb_vaddr = dma_alloc_coherent(jpeg->dev,
+						S3C_JPEG_THUMB_BUF_SIZE,
+						&jpeg->thumb_addr, GFP_KERNEL);
+
+	if (jpeg->thumb_vaddr) {
+		s3c_jpeg_scale_thumb(job, jpeg->thumb_vaddr);
+
+		thumb_job = *job;
+		thumb_job.fourcc = V4L2_PIX_FMT_YUYV;
+		thumb_job.width = job->thumb_width;
+		thumb_job.height = job->thumb_height;
+		thumb_job.src_addr = jpeg->thumb_addr;
+		thumb_job.src_vaddr = jpeg->thumb_vaddr;
+		thumb_job.dst_addr = jpeg->thumb_addr +
+				     S3C_JPEG_THUMB_RAW_SIZE;
+		thumb_job.dst_vaddr = jpeg->thumb_vaddr +
+				      S3C_JPEG_THUMB_RAW_SIZE;
+		thumb_job.dst_size = S3C_JPEG_THUMB_JPEG_SIZE;
+		thumb_job.restart_interval = 0;
+
+		ret = s3c_jpeg_encode_sync(jpeg, &thumb_job);
+		if (ret > 0 && s3c_jpeg_exif_len(ret) > 0) {
+			thumb = thumb_job.dst_vaddr;
+			thumb_size = ret;
+		}
+		/* otherwise the image goes without a thumbnail */
+	}
+
+encode_main:
+	len = s3c_jpeg_exif_len(thumb_size);
+	if (len + 2 > job->dst_size)
+		return -ENOSPC;
+
+	/* the APP1 segment ends over the SOI marker of the main image */
+	main_job = *job;
+	main_job.dst_addr += len - 2;
+	main_job.dst_vaddr += len - 2;
+	main_job.dst_size -= len - 2;
+
+	ret = s3c_jpeg_encode_sync(jpeg, &main_job);
+	if (ret < 0)
+		return ret;
+
+	s3c_jpeg_exif_build(job->dst_vaddr, len, job, thumb, thumb_size);
+	return len - 2 + ret;
+}
+
+static void s3c_jpeg_work(struct work_struct *work)
+{
+	struct s3c_jpeg *jpeg = container_of(work, struct s3c_jpeg, work);
+	unsigned long flags;
+	int ret;
+
+	if (jpeg->work_job.exif)
+		ret = s3c_jpeg_encode_exif(jpeg, &jpeg->work_job);
+	else
+		ret = s3c_jpeg_encode_sync(jpeg, &jpeg->work_job);
+
+	spin_lock_irqsave(&jpeg->slock, flags);
+	jpeg->hw_sync = false;
+	spin_unlock_irqrestore(&jpeg->slock, flags);
+
+	s3c_jpeg_job_done(jpeg, ret >= 0, max(ret, 0));
+}
+
+static void s3c_jpeg_device_run(void *priv)
+{
+	struct s3c_jpeg_ctx *ctx = priv;
+	struct s3c_jpeg *jpeg = ctx->jpeg;
+	unsigned long flags;
+	int ret;
+
 	ret = pm_runtime_get_sync(jpeg->dev);
 	if (ret < 0) {
 		v4l2_err(&jpeg->v4l2_dev,
 				"pm_runtime_get_sync failed (%d)\n", ret);
-		v4l2_m2m_buf_done(src_buf, VB2_BUF_STATE_ERROR);
-		v4l2_m2m_buf_done(dst_buf, VB2_BUF_STATE_ERROR);
+		v4l2_m2m_buf_done(v4l2_m2m_src_buf_remove(ctx->m2m_ctx),
+				  VB2_BUF_STATE_ERROR);
+		v4l2_m2m_buf_done(v4l2_m2m_dst_buf_remove(ctx->m2m_ctx),
+				  VB2_BUF_STATE_ERROR);
 		v4l2_m2m_job_finish(jpeg->m2m_dev, ctx->m2m_ctx);
 		return;
 	}
 
-	/*
-	 * JPEG IP allows storing two Huffman tables for each component
-	 * We fill table 0 for each component
-	 */
-	jpeg_set_hdctbl(jpeg->regs);
-	jpeg_set_hdctblg(jpeg->regs);
-	jpeg_set_hactbl(jpeg->regs);
-	jpeg_set_hactblg(jpeg->regs);
-
-	jpeg_proc_mode(jpeg->regs, ctx->mode);
-	if (ctx->mode == S3C_JPEG_ENCODE) {
-		if (ctx->out_q.fmt->fourcc == V4L2_PIX_FMT_RGB565)
-			jpeg_input_raw_mode(jpeg->regs, S3C_JPEG_RAW_IN_565);
-		else
-			jpeg_input_raw_mode(jpeg->regs, S3C_JPEG_RAW_IN_422);
-		jpeg_subsampling_mode(jpeg->regs, ctx->subsampling);
-		jpeg_dri(jpeg->regs, ctx->restart_interval);
-		jpeg_x(jpeg->regs, ctx->out_q.w);
-		jpeg_y(jpeg->regs, ctx->out_q.h);
-		jpeg_imgadr(jpeg->regs, src_addr);
-		jpeg_jpgadr(jpeg->regs, dst_addr);
-
-		/* JPEG RGB to YCbCr conversion matrix */
-		jpeg_coef(jpeg->regs, 1, 1, S3C_JPEG_COEF11);
-		jpeg_coef(jpeg->regs, 1, 2, S3C_JPEG_COEF12);
-		jpeg_coef(jpeg->regs, 1, 3, S3C_JPEG_COEF13);
-		jpeg_coef(jpeg->regs, 2, 1, S3C_JPEG_COEF21);
-		jpeg_coef(jpeg->regs, 2, 2, S3C_JPEG_COEF22);
-		jpeg_coef(jpeg->regs, 2, 3, S3C_JPEG_COEF23);
-		jpeg_coef(jpeg->regs, 3, 1, S3C_JPEG_COEF31);
-		jpeg_coef(jpeg->regs, 3, 2, S3C_JPEG_COEF32);
-		jpeg_coef(jpeg->regs, 3, 3, S3C_JPEG_COEF33);
-
-		/*
-		 * JPEG IP allows storing 4 quantization tables
-		 * We fill table 0 for luma and table 1 for chroma
-		 */
-		jpeg_set_qtbl_lum(jpeg->regs, ctx->compr_quality);
-		jpeg_set_qtbl_chr(jpeg->regs, ctx->compr_quality);
-		/* use table 0 for Y */
-		jpeg_qtbl(jpeg->regs, 1, 0);
-		/* use table 1 for Cb and Cr*/
-		jpeg_qtbl(jpeg->regs, 2, 1);
-		jpeg_qtbl(jpeg->regs, 3, 1);
-
-		/* Y, Cb, Cr use Huffman table 0 */
-		jpeg_htbl_ac(jpeg->regs, 1);
-		jpeg_htbl_dc(jpeg->regs, 1);
-		jpeg_htbl_ac(jpeg->regs, 2);
-		jpeg_htbl_dc(jpeg->regs, 2);
-		jpeg_htbl_ac(jpeg->regs, 3);
-		jpeg_htbl_dc(jpeg->regs, 3);
-
-		jpeg_start_enc(jpeg->regs);
-	} else { /* S3C_JPEG_DECODE */
-		jpeg_rst_int_enable(jpeg->regs, true);
-		jpeg_jpgadr(jpeg->regs, src_addr);
-		jpeg_imgadr(jpeg->regs, dst_addr);
-
-		jpeg_start_dec(jpeg->regs);
+	spin_lock_irqsave(&jpeg->slock, flags);
+	if (jpeg->busy) {
+		/* a camera frame is being encoded, run when it is done */
+		jpeg->m2m_pending = ctx;
+	} else {
+		jpeg->busy = true;
+		s3c_jpeg_m2m_start(ctx);
 	}
+	spin_unlock_irqrestore(&jpeg->slock, flags);
 }
 
 static int s3c_jpeg_job_ready(void *priv)
@@ -1117,16 +1529,28 @@ static void s3c_jpeg_buf_queue(struct vb2_buffer *vb)
 
 	if (ctx->mode == S3C_JPEG_DECODE &&
 	    vb->vb2_queue->type == V4L2_BUF_TYPE_VIDEO_OUTPUT) {
-		struct s3c_jpeg_q_data tmp, *q_data;
-		ctx->hdr_parsed = s3c_jpeg_parse_hdr(&tmp,
-		     (unsigned long)vb2_plane_vaddr(vb, 0),
+		struct s3c_jpeg_q_data tmp, thumb, *q_data;
+		unsigned long vaddr, offset, size = 0;
+
+		vaddr = (unsigned long)vb2_plane_vaddr(vb, 0);
+		ctx->hdr_parsed = s3c_jpeg_parse_hdr(&tmp, vaddr,
 		     min((unsigned long)ctx->out_q.size,
-			 vb2_get_plane_payload(vb, 0)));
+			 vb2_get_plane_payload(vb, 0)),
+		     ctx->dec_thumb ? &offset : NULL, &size);
 		if (!ctx->hdr_parsed) {
 			vb2_buffer_done(vb, VB2_BUF_STATE_ERROR);
 			return;
 		}
 
+		/* decode the embedded thumbnail instead, if asked to */
+		ctx->src_offset = 0;
+		if (ctx->dec_thumb && size &&
+		    s3c_jpeg_parse_hdr(&thumb, vaddr + offset, size,
+				       NULL, NULL)) {
+			ctx->src_offset = offset;
+			tmp = thumb;
+		}
+
 		q_data = &ctx->out_q;
 		q_data->w = tmp.w;
 		q_data->h = tmp.h;
@@ -1144,6 +1568,83 @@ static void s3c_jpeg_buf_queue(struct vb2_buffer *vb)
 	}
 	if (ctx->m2m_ctx)
 		v4l2_m2m_buf_queue(ctx->m2m_ctx, vb);
+
+	if (ctx->cam_src) {
+		unsigned long flags;
+
+		spin_lock_irqsave(&ctx->jpeg->slock, flags);
+		s3c_jpeg_cam_try_run(ctx->jpeg);
+		spin_unlock_irqrestore(&ctx->jpeg->slock, flags);
+	}
+}
+
+static int s3c_jpeg_start_streaming(struct vb2_queue *vq, unsigned int count)
+{
+	struct s3c_jpeg_ctx *ctx = vb2_get_drv_priv(vq);
+	struct s3c_jpeg *jpeg = ctx->jpeg;
+	unsigned long flags;
+	int ret;
+
+	if (!ctx->cam_src)
+		return 0;
+
+	/* the raw frames come from the camera, not from the output queue */
+	if (vq->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+		return -EINVAL;
+
+	ret = pm_runtime_get_sync(jpeg->dev);
+	if (ret < 0)
+		return ret;
+
+	ret = 0;
+	spin_lock_irqsave(&jpeg->slock, flags);
+	if (jpeg->cam_ctx)
+		ret = -EBUSY;
+	else
+		jpeg->cam_ctx = ctx;
+	spin_unlock_irqrestore(&jpeg->slock, flags);
+
+	if (ret)
+		pm_runtime_put(jpeg->dev);
+	return ret;
+}
+
+/* Give the camera frames waiting for the codec back to their owner */
+static void s3c_jpeg_cam_flush(struct s3c_jpeg *jpeg)
+{
+	struct s3c_jpeg_frame *frame, *tmp;
+	unsigned long flags;
+	LIST_HEAD(dropped);
+
+	spin_lock_irqsave(&jpeg->slock, flags);
+	list_splice_init(&jpeg->cam_q, &dropped);
+	spin_unlock_irqrestore(&jpeg->slock, flags);
+
+	list_for_each_entry_safe(frame, tmp, &dropped, list) {
+		list_del(&frame->list);
+		frame->done(frame);
+	}
+}
+
+static int s3c_jpeg_stop_streaming(struct vb2_queue *vq)
+{
+	struct s3c_jpeg_ctx *ctx = vb2_get_drv_priv(vq);
+	struct s3c_jpeg *jpeg = ctx->jpeg;
+	unsigned long flags;
+
+	if (jpeg->cam_ctx != ctx || vq->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+		return 0;
+
+	spin_lock_irqsave(&jpeg->slock, flags);
+	jpeg->cam_ctx = NULL;
+	spin_unlock_irqrestore(&jpeg->slock, flags);
+
+	s3c_jpeg_cam_flush(jpeg);
+	/* the frame being encoded still owns one of the capture buffers */
+	wait_event(jpeg->cam_wait, jpeg->cam_frame == NULL);
+
+	pm_runtime_put(jpeg->dev);
+	return 0;
 }
 
 static void s3c_jpeg_wait_prepare(struct vb2_queue *vq)
@@ -1166,6 +1667,8 @@ static struct vb2_ops s3c_jpeg_qops = {
 	.buf_queue		= s3c_jpeg_buf_queue,
 	.wait_prepare		= s3c_jpeg_wait_prepare,
 	.wait_finish		= s3c_jpeg_wait_finish,
+	.start_streaming	= s3c_jpeg_start_streaming,
+	.stop_streaming		= s3c_jpeg_stop_streaming,
 };
 
 static int queue_init(void *priv, struct vb2_queue *src_vq,
@@ -1205,9 +1708,7 @@ static irqreturn_t s3c_jpeg_irq(int irq, void *dev_id)
 {
 	struct s3c_jpeg *jpeg = dev_id;
 	struct s3c_jpeg_ctx *curr_ctx;
-	struct vb2_buffer *src_buf, *dst_buf;
 	unsigned long payload_size = 0;
-	enum vb2_buffer_state state = VB2_BUF_STATE_DONE;
 	bool op_completed = false;
 	u32 stat;
 
@@ -1215,10 +1716,19 @@ static irqreturn_t s3c_jpeg_irq(int irq, void *dev_id)
 
 	stat = jpeg_int_stat(jpeg->regs);
 
-	curr_ctx = v4l2_m2m_get_curr_priv(jpeg->m2m_dev);
-
 	op_completed = jpeg_result_stat_ok(stat);
-	if (curr_ctx->mode == S3C_JPEG_DECODE) {
+
+	if (jpeg->hw_sync) {
+		/* s3c_jpeg_encode_sync() waits for this run */
+		jpeg->hw_result = op_completed ?
+				  jpeg_compressed_size(jpeg->regs) : -EIO;
+		spin_unlock(&jpeg->slock);
+		complete(&jpeg->hw_done);
+		return IRQ_HANDLED;
+	}
+
+	curr_ctx = v4l2_m2m_get_curr_priv(jpeg->m2m_dev);
+	if (!jpeg->cam_frame && curr_ctx->mode == S3C_JPEG_DECODE) {
 		if (jpeg_stream_stat_ok(stat) && jpeg_hdr_stat_ok(stat)) {
 			curr_ctx->subsampling =
 					jpeg_get_subsampling_mode(jpeg->regs);
@@ -1229,27 +1739,67 @@ static irqreturn_t s3c_jpeg_irq(int irq, void *dev_id)
 		op_completed = op_completed && jpeg_stream_stat_ok(stat);
 	}
 
-	if (!op_completed) {
-		state = VB2_BUF_STATE_ERROR;
-	} else {
+	if (op_completed)
 		payload_size = jpeg_compressed_size(jpeg->regs);
-	}
 
-	pm_runtime_put(jpeg->dev);
+	spin_unlock(&jpeg->slock);
 
-	src_buf = v4l2_m2m_src_buf_remove(curr_ctx->m2m_ctx);
-	dst_buf = v4l2_m2m_dst_buf_remove(curr_ctx->m2m_ctx);
+	s3c_jpeg_job_done(jpeg, op_completed, payload_size);
 
-	v4l2_m2m_buf_done(src_buf, state);
-	if (curr_ctx->mode == S3C_JPEG_ENCODE)
-		vb2_set_plane_payload(dst_buf, 0, payload_size);
-	v4l2_m2m_buf_done(dst_buf, state);
-	v4l2_m2m_job_finish(jpeg->m2m_dev, curr_ctx->m2m_ctx);
+	return IRQ_HANDLED;
+}
 
-	spin_unlock(&jpeg->slock);
+/**
+ * s3c_jpeg_encode_frame - queue a raw frame for encoding
+ * @frame: the frame, owned by the JPEG driver until @frame->done is called
+ *
+ * May be called from interrupt context. Returns -ENODEV if no encoder
+ * context takes camera frames.
+ */
+int s3c_jpeg_encode_frame(struct s3c_jpeg_frame *frame)
+{
+	struct s3c_jpeg *jpeg = s3c_jpeg_dev;
+	struct s3c_jpeg_ctx *ctx;
+	unsigned long flags;
+	int ret = 0;
 
-	return IRQ_HANDLED;
+	if (!jpeg)
+		return -ENODEV;
+
+	if (frame->fourcc != V4L2_PIX_FMT_YUYV &&
+	    frame->fourcc != V4L2_PIX_FMT_RGB565)
+		return -EINVAL;
+
+	spin_lock_irqsave(&jpeg->slock, flags);
+	ctx = jpeg->cam_ctx;
+	if (!ctx) {
+		ret = -ENODEV;
+	} else if (frame->width > ctx->cap_q.w ||
+		   frame->height > ctx->cap_q.h) {
+		/* the capture buffers are sized for the capture format */
+		ret = -EINVAL;
+	} else {
+		list_add_tail(&frame->list, &jpeg->cam_q);
+		s3c_jpeg_cam_try_run(jpeg);
+	}
+	spin_unlock_irqrestore(&jpeg->slock, flags);
+
+	return ret;
+}
+EXPORT_SYMBOL(s3c_jpeg_encode_frame);
+
+/**
+ * s3c_jpeg_flush_frames - give back all the frames not being encoded yet
+ *
+ * The done callback of each dropped frame is called before returning. The
+ * frame being encoded, if any, completes as usual.
+ */
+void s3c_jpeg_flush_frames(void)
+{
+	if (s3c_jpeg_dev)
+		s3c_jpeg_cam_flush(s3c_jpeg_dev);
 }
+EXPORT_SYMBOL(s3c_jpeg_flush_frames);
 
 /*
  * Driver basic infrastructure
@@ -1276,6 +1826,39 @@ static int s3c_jpeg_runtime_resume(struct device *dev)
 	return 0;
 }
 
+#ifdef CONFIG_VIDEO_SAMSUNG_S3C_JPEG_SW
+static int s3c_jpeg_sw_probe(struct s3c_jpeg *jpeg)
+{
+	if (!sw_encode)
+		return 0;
+
+	jpeg->sw = s3c_jpeg_sw_init(&s3c_jpeg_sw_tables);
+	if (!jpeg->sw)
+		return -ENOMEM;
+
+	dev_info(jpeg->dev, "using the software encoder\n");
+	return 0;
+}
+
+static void s3c_jpeg_sw_remove(struct s3c_jpeg *jpeg)
+{
+	if (!jpeg->sw)
+		return;
+
+	s3c_jpeg_sw_release(jpeg->sw);
+	jpeg->sw = NULL;
+}
+#else
+static inline int s3c_jpeg_sw_probe(struct s3c_jpeg *jpeg)
+{
+	return 0;
+}
+
+static inline void s3c_jpeg_sw_remove(struct s3c_jpeg *jpeg)
+{
+}
+#endif /* CONFIG_VIDEO_SAMSUNG_S3C_JPEG_SW */
+
 static const struct dev_pm_ops s3c_jpeg_pm_ops = {
 	SET_RUNTIME_PM_OPS(s3c_jpeg_runtime_suspend, s3c_jpeg_runtime_resume, 0)
 };
@@ -1293,6 +1876,10 @@ static int s3c_jpeg_probe(struct platform_device *pdev)
 
 	mutex_init(&jpeg->lock);
 	spin_lock_init(&jpeg->slock);
+	INIT_LIST_HEAD(&jpeg->cam_q);
+	init_waitqueue_head(&jpeg->cam_wait);
+	INIT_WORK(&jpeg->work, s3c_jpeg_work);
+	init_completion(&jpeg->hw_done);
 	jpeg->dev = &pdev->dev;
 
 	/* memory-mapped registers */
@@ -1348,12 +1935,22 @@ static int s3c_jpeg_probe(struct platform_device *pdev)
 	}
 	clk_enable(jpeg->sclk);
 
+	jpeg->wq = create_singlethread_workqueue(S3C_JPEG_M2M_NAME);
+	if (!jpeg->wq) {
+		ret = -ENOMEM;
+		goto sclk_get_rollback;
+	}
+
+	ret = s3c_jpeg_sw_probe(jpeg);
+	if (ret)
+		goto wq_rollback;
+
 	/* videobuf2 context */
 	jpeg->alloc_ctx = vb2_dma_contig_init_ctx(&pdev->dev);
 	if (IS_ERR(jpeg->alloc_ctx)) {
 		v4l2_err(&jpeg->v4l2_dev, "Failed to init memory allocator\n");
 		ret = PTR_ERR(jpeg->alloc_ctx);
-		goto sclk_get_rollback;
+		goto sw_probe_rollback;
 	}
 
 	/* v4l2 device */
@@ -1431,6 +2028,8 @@ static int s3c_jpeg_probe(struct platform_device *pdev)
 	pm_runtime_set_active(jpeg->dev);
 	pm_runtime_enable(jpeg->dev);
 
+	s3c_jpeg_dev = jpeg;
+
 	v4l2_info(&jpeg->v4l2_dev, "Samsung S3C JPEG codec\n");
 
 	return 0;
@@ -1453,6 +2052,12 @@ device_register_rollback:
 vb2_allocator_rollback:
 	vb2_dma_contig_cleanup_ctx(jpeg->alloc_ctx);
 
+sw_probe_rollback:
+	s3c_jpeg_sw_remove(jpeg);
+
+wq_rollback:
+	destroy_workqueue(jpeg->wq);
+
 sclk_get_rollback:
 	clk_disable(jpeg->sclk);
 	clk_put(jpeg->sclk);
@@ -1468,6 +2073,8 @@ static int s3c_jpeg_remove(struct platform_device *pdev)
 {
 	struct s3c_jpeg *jpeg = platform_get_drvdata(pdev);
 
+	s3c_jpeg_dev = NULL;
+
 	pm_runtime_get_sync(jpeg->dev);
 	pm_runtime_disable(jpeg->dev);
 	s3c_jpeg_runtime_suspend(jpeg->dev);
@@ -1482,6 +2089,11 @@ static int s3c_jpeg_remove(struct platform_device *pdev)
 	video_unregister_device(jpeg->vfd_encoder);
 	v4l2_device_unregister(&jpeg->v4l2_dev);
 	vb2_dma_contig_cleanup_ctx(jpeg->alloc_ctx);
+	destroy_workqueue(jpeg->wq);
+	s3c_jpeg_sw_remove(jpeg);
+	if (jpeg->thumb_vaddr)
+		dma_free_coherent(jpeg->dev, S3C_JPEG_THUMB_BUF_SIZE,
+				  jpeg->thumb_vaddr, jpeg->thumb_addr);
 
 	return 0;
 }
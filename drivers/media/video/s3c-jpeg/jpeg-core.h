@@ -13,6 +13,11 @@
 #ifndef JPEG_CORE_H_
 #define JPEG_CORE_H_
 
+#include <linux/completion.h>
+#include <linux/videodev2.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <media/s3c_jpeg.h>
 #include <media/v4l2-device.h>
 #include <media/v4l2-fh.h>
 #include <media/v4l2-ctrls.h>
@@ -34,18 +39,73 @@
 #define S3C_JPEG_COEF32			0x6e
 #define S3C_JPEG_COEF33			0x13
 
+/* Time allowed to the IP block for one image */
+#define S3C_JPEG_TIMEOUT_MS		1000
+
+/* Largest thumbnail embedded in the APP1 (EXIF) segment */
+#define S3C_JPEG_THUMB_MAX_WIDTH	320
+#define S3C_JPEG_THUMB_MAX_HEIGHT	240
+/* raw thumbnail, YUYV, followed by its JPEG which must fit in APP1 */
+#define S3C_JPEG_THUMB_RAW_SIZE		(S3C_JPEG_THUMB_MAX_WIDTH * \
+					 S3C_JPEG_THUMB_MAX_HEIGHT * 2)
+#define S3C_JPEG_THUMB_JPEG_SIZE	0x10000
+#define S3C_JPEG_THUMB_BUF_SIZE		(S3C_JPEG_THUMB_RAW_SIZE + \
+					 S3C_JPEG_THUMB_JPEG_SIZE)
+
 /* a selection of JPEG markers */
 #define TEM				0x01
 #define SOF0				0xc0
+#define DHT				0xc4
 #define RST				0xd0
 #define SOI				0xd8
 #define EOI				0xd9
+#define SOS				0xda
+#define DQT				0xdb
+#define DRI				0xdd
 #define DHP				0xde
+#define APP1				0xe1
 
 /* Flags that indicate a format can be used for capture/output */
 #define MEM2MEM_CAPTURE			(1 << 0)
 #define MEM2MEM_OUTPUT			(1 << 1)
 
+struct s3c_jpeg_ctx;
+struct s3c_jpeg_sw;
+
+/**
+ * struct s3c_jpeg_job - parameters of one encoding run
+ * @fourcc:		raw image format, V4L2_PIX_FMT_YUYV or V4L2_PIX_FMT_RGB565
+ * @width:		image width
+ * @height:		image height
+ * @src_addr:		bus address of the raw image
+ * @src_vaddr:		kernel virtual address of the raw image
+ * @dst_addr:		bus address of the JPEG buffer
+ * @dst_vaddr:		kernel virtual address of the JPEG buffer
+ * @dst_size:		size of the JPEG buffer
+ * @quality:		quantisation tables index, S3C_JPEG_COMPR_QUAL_*
+ * @subsampling:	chroma subsampling, V4L2_JPEG_CHROMA_SUBSAMPLING_*
+ * @restart_interval:	number of MCUs between restart markers, 0 for none
+ * @exif:		prepend an APP1 (EXIF) segment to the image
+ * @thumb_width:	width of the thumbnail stored in APP1, 0 for none
+ * @thumb_height:	height of the thumbnail stored in APP1, 0 for none
+ */
+struct s3c_jpeg_job {
+	u32			fourcc;
+	u32			width;
+	u32			height;
+	dma_addr_t		src_addr;
+	void			*src_vaddr;
+	dma_addr_t		dst_addr;
+	void			*dst_vaddr;
+	unsigned long		dst_size;
+	unsigned int		quality;
+	unsigned int		subsampling;
+	unsigned int		restart_interval;
+	bool			exif;
+	unsigned int		thumb_width;
+	unsigned int		thumb_height;
+};
+
 /**
  * struct s3c_jpeg - JPEG IP abstraction
  * @lock:		the mutex protecting this structure
@@ -60,6 +120,22 @@
  * @clk:		JPEG IP clock
  * @dev:		JPEG IP struct device
  * @alloc_ctx:		videobuf2 memory allocator's context
+ * @busy:		set while an image is being encoded or decoded
+ * @m2m_pending:	mem2mem context whose job waits for a camera frame
+ * @cam_ctx:		encoder context receiving the camera frames
+ * @cam_q:		camera frames waiting for the codec
+ * @cam_frame:		camera frame being encoded
+ * @cam_dst:		destination buffer of @cam_frame
+ * @cam_wait:		waitqueue signalled when @cam_frame is done
+ * @wq:			workqueue running the jobs encoded in process context
+ * @work:		encoding work
+ * @work_job:		job of @work
+ * @hw_sync:		set while the current job is run by @work
+ * @hw_result:		size of the image encoded for @work, or error code
+ * @hw_done:		completion signalled when @hw_result is set
+ * @thumb_vaddr:	kernel virtual address of the thumbnail buffer
+ * @thumb_addr:		bus address of the thumbnail buffer
+ * @sw:			software encoder, NULL if the IP block encodes
  */
 struct s3c_jpeg {
 	struct mutex		lock;
@@ -77,6 +153,26 @@ struct s3c_jpeg {
 	struct clk		*sclk;
 	struct device		*dev;
 	void			*alloc_ctx;
+
+	bool			busy;
+	struct s3c_jpeg_ctx	*m2m_pending;
+	struct s3c_jpeg_ctx	*cam_ctx;
+	struct list_head	cam_q;
+	struct s3c_jpeg_frame	*cam_frame;
+	struct vb2_buffer	*cam_dst;
+	wait_queue_head_t	cam_wait;
+
+	struct workqueue_struct	*wq;
+	struct work_struct	work;
+	struct s3c_jpeg_job	work_job;
+	bool			hw_sync;
+	int			hw_result;
+	struct completion	hw_done;
+	void			*thumb_vaddr;
+	dma_addr_t		thumb_addr;
+#ifdef CONFIG_VIDEO_SAMSUNG_S3C_JPEG_SW
+	struct s3c_jpeg_sw	*sw;
+#endif
 };
 
 /**
@@ -122,6 +218,14 @@ struct s3c_jpeg_q_data {
  * @out_q:		source (output) queue information
  * @cap_fmt:		destination (capture) queue queue information
  * @hdr_parsed:		set if header has been parsed during decompression
+ * @cam_src:		set if raw images come from the camera interface
+ *			instead of the output queue
+ * @exif:		set if the encoded images start with an APP1 segment
+ * @thumb_width:	width of the thumbnail in the APP1 segment
+ * @thumb_height:	height of the thumbnail in the APP1 segment
+ * @dec_thumb:		decode the thumbnail embedded in the APP1 segment,
+ *			when there is one, instead of the main image
+ * @src_offset:		offset of the decoded image in the source buffer
  * @ctrl_handler:	controls handler
  */
 struct s3c_jpeg_ctx {
@@ -135,6 +239,12 @@ struct s3c_jpeg_ctx {
 	struct s3c_jpeg_q_data	cap_q;
 	struct v4l2_fh		fh;
 	bool			hdr_parsed;
+	bool			cam_src;
+	bool			exif;
+	unsigned short		thumb_width;
+	unsigned short		thumb_height;
+	bool			dec_thumb;
+	unsigned long		src_offset;
 	struct v4l2_ctrl_handler ctrl_handler;
 };
 
@@ -150,4 +260,68 @@ struct s3c_jpeg_buffer {
 	unsigned long data;
 };
 
+/* Read the pixel at (x, y) of the raw image of a job, in JFIF YCbCr */
+static inline void s3c_jpeg_read_pixel(const struct s3c_jpeg_job *job,
+				       unsigned int x, unsigned int y,
+				       short *py, short *pcb, short *pcr)
+{
+	const u8 *line = (const u8 *)job->src_vaddr + y * job->width * 2;
+	int r, g, b;
+	u16 v;
+
+	if (job->fourcc == V4L2_PIX_FMT_YUYV) {
+		const u8 *p = line + (x & ~1) * 2;
+
+		*py = p[(x & 1) * 2];
+		*pcb = p[1];
+		*pcr = p[3];
+		return;
+	}
+
+	v = line[x * 2] | line[x * 2 + 1] << 8;
+	r = (v >> 11) & 0x1f;
+	g = (v >> 5) & 0x3f;
+	b = v & 0x1f;
+	r = r << 3 | r >> 2;
+	g = g << 2 | g >> 4;
+	b = b << 3 | b >> 2;
+
+	/* JFIF conversion, the same as the hardware coefficients */
+	*py = (77 * r + 150 * g + 29 * b) >> 8;
+	*pcb = ((-43 * r - 85 * g + 128 * b) >> 8) + 128;
+	*pcr = ((128 * r - 107 * g - 21 * b) >> 8) + 128;
+}
+
+void s3c_jpeg_scale_thumb(const struct s3c_jpeg_job *job, u8 *dst);
+int s3c_jpeg_exif_len(unsigned int thumb_size);
+void s3c_jpeg_exif_build(u8 *buf, unsigned int len,
+			 const struct s3c_jpeg_job *job,
+			 const void *thumb, unsigned int thumb_size);
+bool s3c_jpeg_exif_find_thumb(const u8 *seg, unsigned long len,
+			      unsigned long *offset, unsigned long *size);
+
+#ifdef CONFIG_VIDEO_SAMSUNG_S3C_JPEG_SW
+/**
+ * struct s3c_jpeg_tables - tables shared with the software encoder
+ * @qtbl_lum:	luma quantisation tables, in natural order, per quality
+ * @qtbl_chr:	chroma quantisation tables, in natural order, per quality
+ * @dc_bits:	DC Huffman table code counts, for lengths 1 to 16
+ * @dc_vals:	DC Huffman table symbols
+ * @ac_bits:	AC Huffman table code counts, for lengths 1 to 16
+ * @ac_vals:	AC Huffman table symbols
+ */
+struct s3c_jpeg_tables {
+	const unsigned char	(*qtbl_lum)[64];
+	const unsigned char	(*qtbl_chr)[64];
+	const unsigned char	*dc_bits;
+	const unsigned char	*dc_vals;
+	const unsigned char	*ac_bits;
+	const unsigned char	*ac_vals;
+};
+
+struct s3c_jpeg_sw *s3c_jpeg_sw_init(const struct s3c_jpeg_tables *tbl);
+void s3c_jpeg_sw_release(struct s3c_jpeg_sw *sw);
+int s3c_jpeg_sw_encode(struct s3c_jpeg_sw *sw, const struct s3c_jpeg_job *job);
+#endif
+
 #endif /* JPEG_CORE_H */
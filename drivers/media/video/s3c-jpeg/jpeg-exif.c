@@ -0,0 +1,274 @@
+/* linux/drivers/media/video/s3c-jpeg/jpeg-exif.c
+ *
+ * APP1 (EXIF) segment with an embedded thumbnail: downscaling of the raw
+ * image, generation of the segment when encoding and lookup of the
+ * thumbnail when decoding.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <asm/unaligned.h>
+
+#include "jpeg-core.h"
+
+#define EXIF_HDR_LEN		6	/* "Exif\0\0" */
+#define TIFF_HDR_LEN		8
+#define IFD_ENTRY_LEN		12
+#define IFD_LEN(n)		(2 + (n) * IFD_ENTRY_LEN + 4)
+
+/* TIFF field types */
+#define TIFF_SHORT		3
+#define TIFF_LONG		4
+#define TIFF_UNDEFINED		7
+
+/* TIFF and EXIF tags */
+#define TAG_COMPRESSION		0x0103
+#define TAG_ORIENTATION		0x0112
+#define TAG_JPEG_IF_OFFSET	0x0201
+#define TAG_JPEG_IF_LENGTH	0x0202
+#define TAG_EXIF_IFD		0x8769
+#define TAG_EXIF_VERSION	0x9000
+#define TAG_COLOR_SPACE		0xa001
+#define TAG_PIXEL_X_DIM		0xa002
+#define TAG_PIXEL_Y_DIM		0xa003
+
+/* Layout of the generated TIFF structure, offsets from the TIFF header */
+#define IFD0_OFFSET		TIFF_HDR_LEN
+#define IFD0_ENTRIES		2
+#define EXIF_IFD_OFFSET		(IFD0_OFFSET + IFD_LEN(IFD0_ENTRIES))
+#define EXIF_IFD_ENTRIES	4
+#define IFD1_OFFSET		(EXIF_IFD_OFFSET + IFD_LEN(EXIF_IFD_ENTRIES))
+#define IFD1_ENTRIES		3
+#define THUMB_OFFSET		(IFD1_OFFSET + IFD_LEN(IFD1_ENTRIES))
+
+/* the main image starts at an aligned offset so the IP block can write it */
+#define S3C_JPEG_EXIF_ALIGN	8
+
+/*
+ * Average a 2x2 neighbourhood of the raw image. Only a few pixels around
+ * each sample are read: the raw buffers are mapped uncached and reading
+ * all of a multi-megapixel image would cost more than encoding it.
+ */
+static void sample(const struct s3c_jpeg_job *job, unsigned int x,
+		   unsigned int y, int *py, int *pcb, int *pcr)
+{
+	unsigned int x1 = min(x + 1, job->width - 1);
+	unsigned int y1 = min(y + 1, job->height - 1);
+	short sy[4], scb[4], scr[4];
+
+	s3c_jpeg_read_pixel(job, x, y, &sy[0], &scb[0], &scr[0]);
+	s3c_jpeg_read_pixel(job, x1, y, &sy[1], &scb[1], &scr[1]);
+	s3c_jpeg_read_pixel(job, x, y1, &sy[2], &scb[2], &scr[2]);
+	s3c_jpeg_read_pixel(job, x1, y1, &sy[3], &scb[3], &scr[3]);
+
+	*py = (sy[0] + sy[1] + sy[2] + sy[3] + 2) >> 2;
+	*pcb = (scb[0] + scb[1] + scb[2] + scb[3] + 2) >> 2;
+	*pcr = (scr[0] + scr[1] + scr[2] + scr[3] + 2) >> 2;
+}
+
+/**
+ * s3c_jpeg_scale_thumb - downscale the raw image of a job
+ * @job: the job, its raw image and thumbnail size
+ * @dst: YUYV buffer of @job->thumb_width x @job->thumb_height pixels
+ */
+void s3c_jpeg_scale_thumb(const struct s3c_jpeg_job *job, u8 *dst)
+{
+	unsigned int tx, ty, sy;
+	int y0, cb0, cr0, y1, cb1, cr1;
+
+	for (ty = 0; ty < job->thumb_height; ty++) {
+		sy = ty * job->height / job->thumb_height;
+		for (tx = 0; tx < job->thumb_width; tx += 2) {
+			sample(job, tx * job->width / job->thumb_width, sy,
+			       &y0, &cb0, &cr0);
+			sample(job, (tx + 1) * job->width / job->thumb_width,
+			       sy, &y1, &cb1, &cr1);
+			*dst++ = y0;
+			*dst++ = (cb0 + cb1 + 1) >> 1;
+			*dst++ = y1;
+			*dst++ = (cr0 + cr1 + 1) >> 1;
+		}
+	}
+}
+
+/**
+ * s3c_jpeg_exif_len - size of the header written by s3c_jpeg_exif_build()
+ * @thumb_size: size of the thumbnail JPEG, 0 for none
+ *
+ * The header is made of SOI and the APP1 segment. Its last two bytes
+ * overlap the SOI marker of the main image, which therefore has to be
+ * encoded at offset (length - 2), a multiple of S3C_JPEG_EXIF_ALIGN.
+ * Returns the length, or -E2BIG if the thumbnail does not fit in APP1.
+ */
+int s3c_jpeg_exif_len(unsigned int thumb_size)
+{
+	unsigned int payload, len;
+
+	payload = EXIF_HDR_LEN;
+	if (thumb_size)
+		payload += THUMB_OFFSET + thumb_size;
+	else
+		payload += IFD1_OFFSET;
+
+	/* APP1 marker and segment length, padded */
+	len = 2 + ALIGN(4 + payload, S3C_JPEG_EXIF_ALIGN);
+	if (len - 4 > 0xffff)
+		return -E2BIG;
+	return len;
+}
+
+static u8 *put_entry(u8 *p, u16 tag, u16 type, u32 count, u32 value)
+{
+	put_unaligned_le16(tag, p);
+	put_unaligned_le16(type, p + 2);
+	put_unaligned_le32(count, p + 4);
+	if (type == TIFF_SHORT) {
+		/* left-justified in the value field */
+		put_unaligned_le16(value, p + 8);
+		put_unaligned_le16(0, p + 10);
+	} else {
+		put_unaligned_le32(value, p + 8);
+	}
+	return p + IFD_ENTRY_LEN;
+}
+
+/**
+ * s3c_jpeg_exif_build - write SOI and the APP1 segment
+ * @buf: start of the JPEG buffer
+ * @len: header length, as returned by s3c_jpeg_exif_len()
+ * @job: the job, for the size of the main image
+ * @thumb: thumbnail JPEG, NULL for none
+ * @thumb_size: size of @thumb
+ */
+void s3c_jpeg_exif_build(u8 *buf, unsigned int len,
+			 const struct s3c_jpeg_job *job,
+			 const void *thumb, unsigned int thumb_size)
+{
+	u8 *tiff = buf + 6 + EXIF_HDR_LEN;
+	u8 *p;
+
+	buf[0] = 0xff;
+	buf[1] = SOI;
+	buf[2] = 0xff;
+	buf[3] = APP1;
+	put_unaligned_be16(len - 4, buf + 4);
+	memcpy(buf + 6, "Exif\0\0", EXIF_HDR_LEN);
+
+	/* little endian TIFF header */
+	tiff[0] = 'I';
+	tiff[1] = 'I';
+	put_unaligned_le16(42, tiff + 2);
+	put_unaligned_le32(IFD0_OFFSET, tiff + 4);
+
+	p = tiff + IFD0_OFFSET;
+	put_unaligned_le16(IFD0_ENTRIES, p);
+	p = put_entry(p + 2, TAG_ORIENTATION, TIFF_SHORT, 1, 1);
+	p = put_entry(p, TAG_EXIF_IFD, TIFF_LONG, 1, EXIF_IFD_OFFSET);
+	put_unaligned_le32(thumb ? IFD1_OFFSET : 0, p);
+
+	p = tiff + EXIF_IFD_OFFSET;
+	put_unaligned_le16(EXIF_IFD_ENTRIES, p);
+	p = put_entry(p + 2, TAG_EXIF_VERSION, TIFF_UNDEFINED, 4, 0);
+	memcpy(p - 4, "0220", 4);
+	p = put_entry(p, TAG_COLOR_SPACE, TIFF_SHORT, 1, 1);	/* sRGB */
+	p = put_entry(p, TAG_PIXEL_X_DIM, TIFF_LONG, 1, job->width);
+	p = put_entry(p, TAG_PIXEL_Y_DIM, TIFF_LONG, 1, job->height);
+	put_unaligned_le32(0, p);
+	p += 4;
+
+	if (thumb) {
+		put_unaligned_le16(IFD1_ENTRIES, p);
+		p = put_entry(p + 2, TAG_COMPRESSION, TIFF_SHORT, 1, 6);
+		p = put_entry(p, TAG_JPEG_IF_OFFSET, TIFF_LONG, 1,
+			      THUMB_OFFSET);
+		p = put_entry(p, TAG_JPEG_IF_LENGTH, TIFF_LONG, 1,
+			      thumb_size);
+		put_unaligned_le32(0, p);
+		p += 4;
+		memcpy(p, thumb, thumb_size);
+		p += thumb_size;
+	}
+
+	memset(p, 0, buf + len - p);
+}
+
+static unsigned int tiff_get16(const u8 *p, bool be)
+{
+	return be ? get_unaligned_be16(p) : get_unaligned_le16(p);
+}
+
+static unsigned long tiff_get32(const u8 *p, bool be)
+{
+	return be ? get_unaligned_be32(p) : get_unaligned_le32(p);
+}
+
+/**
+ * s3c_jpeg_exif_find_thumb - locate the thumbnail in an APP1 segment
+ * @seg: APP1 payload, after the segment length
+ * @len: size of the payload
+ * @offset: returns the offset of the thumbnail JPEG from @seg
+ * @size: returns the size of the thumbnail JPEG
+ *
+ * The thumbnail is described by IFD1 of the TIFF structure, in either
+ * byte order. Returns false if @seg holds no JPEG thumbnail.
+ */
+bool s3c_jpeg_exif_find_thumb(const u8 *seg, unsigned long len,
+			      unsigned long *offset, unsigned long *size)
+{
+	const u8 *tiff = seg + EXIF_HDR_LEN;
+	unsigned long tiff_len, ifd, n, i, off = 0, sz = 0;
+	bool be;
+
+	if (len < EXIF_HDR_LEN + TIFF_HDR_LEN ||
+	    memcmp(seg, "Exif\0\0", EXIF_HDR_LEN))
+		return false;
+	tiff_len = len - EXIF_HDR_LEN;
+
+	if (tiff[0] == 'I' && tiff[1] == 'I')
+		be = false;
+	else if (tiff[0] == 'M' && tiff[1] == 'M')
+		be = true;
+	else
+		return false;
+	if (tiff_get16(tiff + 2, be) != 42)
+		return false;
+
+	/* skip IFD0 to find the offset of IFD1 */
+	ifd = tiff_get32(tiff + 4, be);
+	if (ifd > tiff_len - IFD_LEN(0))
+		return false;
+	n = tiff_get16(tiff + ifd, be);
+	if (n > (tiff_len - ifd - IFD_LEN(0)) / IFD_ENTRY_LEN)
+		return false;
+	ifd = tiff_get32(tiff + ifd + 2 + n * IFD_ENTRY_LEN, be);
+	if (!ifd || ifd > tiff_len - 2)
+		return false;
+
+	n = tiff_get16(tiff + ifd, be);
+	if (n > (tiff_len - ifd - 2) / IFD_ENTRY_LEN)
+		return false;
+	for (i = 0; i < n; i++) {
+		const u8 *e = tiff + ifd + 2 + i * IFD_ENTRY_LEN;
+
+		switch (tiff_get16(e, be)) {
+		case TAG_JPEG_IF_OFFSET:
+			off = tiff_get32(e + 8, be);
+			break;
+		case TAG_JPEG_IF_LENGTH:
+			sz = tiff_get32(e + 8, be);
+			break;
+		}
+	}
+
+	if (!off || !sz || off > tiff_len || sz > tiff_len - off)
+		return false;
+
+	*offset = EXIF_HDR_LEN + off;
+	*size = sz;
+	return true;
+}
@@ -0,0 +1,404 @@
+/* linux/drivers/media/video/s3c-jpeg/jpeg-sw.c
+ *
+ * Baseline JPEG encoder running on the CPU, used in place of the codec IP
+ * block. It produces the same stream as the hardware: the quantisation
+ * tables of the selected quality level and Huffman table 0 for all the
+ * components.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/bitops.h>
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/videodev2.h>
+
+#include "jpeg-core.h"
+
+/* natural order index of the n-th coefficient in zig-zag order */
+static const unsigned char zigzag[64] = {
+	 0,  1,  8, 16,  9,  2,  3, 10,
+	17, 24, 32, 25, 18, 11,  4,  5,
+	12, 19, 26, 33, 40, 48, 41, 34,
+	27, 20, 13,  6,  7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36,
+	29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46,
+	53, 60, 61, 54, 47, 55, 62, 63
+};
+
+/* C(u)/2 * cos((2x + 1) * u * pi/16), scaled by 2^12 */
+static const short dct_tbl[8][8] = {
+	{  1448,  1448,  1448,  1448,  1448,  1448,  1448,  1448 },
+	{  2009,  1703,  1138,   400,  -400, -1138, -1703, -2009 },
+	{  1892,   784,  -784, -1892, -1892,  -784,   784,  1892 },
+	{  1703,  -400, -2009, -1138,  1138,  2009,   400, -1703 },
+	{  1448, -1448, -1448,  1448,  1448, -1448, -1448,  1448 },
+	{  1138, -2009,   400,  1703, -1703,  -400,  2009, -1138 },
+	{   784, -1892,  1892,  -784,  -784,  1892, -1892,   784 },
+	{   400, -1138,  1703, -2009,  2009, -1703,  1138,  -400 },
+};
+
+/* Huffman code and code length of each symbol */
+struct s3c_jpeg_huff {
+	u16	code[256];
+	u8	size[256];
+};
+
+/**
+ * struct s3c_jpeg_sw - software encoder state
+ * @tbl:	quantisation and Huffman tables
+ * @dc:		DC coefficients codes
+ * @ac:		AC coefficients codes
+ * @y:		luma samples of the current MCU
+ * @cb:		blue chroma samples of the current MCU, before subsampling
+ * @cr:		red chroma samples of the current MCU, before subsampling
+ * @blk:	block being transformed, in natural order
+ */
+struct s3c_jpeg_sw {
+	const struct s3c_jpeg_tables	*tbl;
+	struct s3c_jpeg_huff		dc;
+	struct s3c_jpeg_huff		ac;
+	short				y[16][16];
+	short				cb[16][16];
+	short				cr[16][16];
+	int				blk[64];
+};
+
+/* entropy coded data writer */
+struct s3c_jpeg_bitbuf {
+	u8		*buf;
+	unsigned long	size;
+	unsigned long	pos;
+	u32		acc;
+	int		bits;
+	bool		overflow;
+};
+
+static void put_byte(struct s3c_jpeg_bitbuf *b, u8 byte)
+{
+	if (b->pos >= b->size) {
+		b->overflow = true;
+		return;
+	}
+	b->buf[b->pos++] = byte;
+}
+
+static void put_word(struct s3c_jpeg_bitbuf *b, u16 word)
+{
+	put_byte(b, word >> 8);
+	put_byte(b, word & 0xff);
+}
+
+static void put_marker(struct s3c_jpeg_bitbuf *b, u8 marker)
+{
+	put_byte(b, 0xff);
+	put_byte(b, marker);
+}
+
+static void put_bits(struct s3c_jpeg_bitbuf *b, u32 val, int n)
+{
+	b->acc = (b->acc << n) | (val & ((1 << n) - 1));
+	b->bits += n;
+
+	while (b->bits >= 8) {
+		u8 byte = b->acc >> (b->bits - 8);
+
+		put_byte(b, byte);
+		/* a 0xff data byte must not be taken for a marker */
+		if (byte == 0xff)
+			put_byte(b, 0);
+		b->bits -= 8;
+	}
+}
+
+static void flush_bits(struct s3c_jpeg_bitbuf *b)
+{
+	/* pad the last byte with ones */
+	if (b->bits)
+		put_bits(b, 0x7f, 8 - b->bits);
+	b->acc = 0;
+}
+
+static unsigned int huff_count(const unsigned char *bits)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < 16; i++)
+		n += bits[i];
+	return n;
+}
+
+/* generate the codes as in ITU T.81 Annex C */
+static void huff_build(struct s3c_jpeg_huff *h, const unsigned char *bits,
+		       const unsigned char *vals)
+{
+	unsigned int code = 0, len, i, k = 0;
+
+	for (len = 1; len <= 16; len++) {
+		for (i = 0; i < bits[len - 1]; i++) {
+			h->code[vals[k]] = code++;
+			h->size[vals[k]] = len;
+			k++;
+		}
+		code <<= 1;
+	}
+}
+
+static void put_huff_table(struct s3c_jpeg_bitbuf *b, u8 class_id,
+			   const unsigned char *bits, const unsigned char *vals)
+{
+	unsigned int i, n = huff_count(bits);
+
+	put_byte(b, class_id);
+	for (i = 0; i < 16; i++)
+		put_byte(b, bits[i]);
+	for (i = 0; i < n; i++)
+		put_byte(b, vals[i]);
+}
+
+static void put_header(struct s3c_jpeg_sw *sw, struct s3c_jpeg_bitbuf *b,
+		       const struct s3c_jpeg_job *job, unsigned int vsamp)
+{
+	const struct s3c_jpeg_tables *tbl = sw->tbl;
+	unsigned int i;
+
+	put_marker(b, SOI);
+
+	/* table 0 for luma and table 1 for chroma, as the hardware does */
+	put_marker(b, DQT);
+	put_word(b, 2 + 2 * 65);
+	put_byte(b, 0);
+	for (i = 0; i < 64; i++)
+		put_byte(b, tbl->qtbl_lum[job->quality][zigzag[i]]);
+	put_byte(b, 1);
+	for (i = 0; i < 64; i++)
+		put_byte(b, tbl->qtbl_chr[job->quality][zigzag[i]]);
+
+	put_marker(b, SOF0);
+	put_word(b, 8 + 3 * 3);
+	put_byte(b, 8);
+	put_word(b, job->height);
+	put_word(b, job->width);
+	put_byte(b, 3);
+	put_byte(b, 1);
+	put_byte(b, 0x20 | vsamp);
+	put_byte(b, 0);
+	put_byte(b, 2);
+	put_byte(b, 0x11);
+	put_byte(b, 1);
+	put_byte(b, 3);
+	put_byte(b, 0x11);
+	put_byte(b, 1);
+
+	put_marker(b, DHT);
+	put_word(b, 2 + 2 * 17 + huff_count(tbl->dc_bits) +
+		 huff_count(tbl->ac_bits));
+	put_huff_table(b, 0x00, tbl->dc_bits, tbl->dc_vals);
+	put_huff_table(b, 0x10, tbl->ac_bits, tbl->ac_vals);
+
+	if (job->restart_interval) {
+		put_marker(b, DRI);
+		put_word(b, 4);
+		put_word(b, job->restart_interval);
+	}
+
+	put_marker(b, SOS);
+	put_word(b, 6 + 2 * 3);
+	put_byte(b, 3);
+	for (i = 1; i <= 3; i++) {
+		put_byte(b, i);
+		put_byte(b, 0x00);
+	}
+	put_byte(b, 0);
+	put_byte(b, 63);
+	put_byte(b, 0);
+}
+
+static void fetch_mcu(struct s3c_jpeg_sw *sw, const struct s3c_jpeg_job *job,
+		      unsigned int x0, unsigned int y0, unsigned int mcu_h)
+{
+	unsigned int i, j, x, y;
+
+	/* replicate the last column and line at the right and bottom edges */
+	for (i = 0; i < mcu_h; i++) {
+		y = min(y0 + i, job->height - 1);
+		for (j = 0; j < 16; j++) {
+			x = min(x0 + j, job->width - 1);
+			s3c_jpeg_read_pixel(job, x, y, &sw->y[i][j],
+					    &sw->cb[i][j], &sw->cr[i][j]);
+		}
+	}
+}
+
+static void luma_block(struct s3c_jpeg_sw *sw, unsigned int bx,
+		       unsigned int by)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < 8; i++)
+		for (j = 0; j < 8; j++)
+			sw->blk[i * 8 + j] = sw->y[by * 8 + i][bx * 8 + j] - 128;
+}
+
+static void chroma_block(struct s3c_jpeg_sw *sw, short (*c)[16],
+			 unsigned int vsamp)
+{
+	unsigned int i, j, n = 2 * vsamp;
+	int s;
+
+	for (i = 0; i < 8; i++) {
+		for (j = 0; j < 8; j++) {
+			s = c[i * vsamp][2 * j] + c[i * vsamp][2 * j + 1];
+			if (vsamp == 2)
+				s += c[2 * i + 1][2 * j] + c[2 * i + 1][2 * j + 1];
+			sw->blk[i * 8 + j] = (s + n / 2) / n - 128;
+		}
+	}
+}
+
+/* separable integer DCT, rows then columns */
+static void fdct(int *blk)
+{
+	int tmp[64];
+	int u, v, x, s;
+
+	for (v = 0; v < 8; v++) {
+		for (u = 0; u < 8; u++) {
+			s = 0;
+			for (x = 0; x < 8; x++)
+				s += blk[v * 8 + x] * dct_tbl[u][x];
+			tmp[v * 8 + u] = (s + (1 << 7)) >> 8;
+		}
+	}
+
+	for (u = 0; u < 8; u++) {
+		for (v = 0; v < 8; v++) {
+			s = 0;
+			for (x = 0; x < 8; x++)
+				s += tmp[x * 8 + u] * dct_tbl[v][x];
+			blk[v * 8 + u] = (s + (1 << 15)) >> 16;
+		}
+	}
+}
+
+static void put_coef(struct s3c_jpeg_bitbuf *b, const struct s3c_jpeg_huff *h,
+		     unsigned int run, int v)
+{
+	unsigned int nbits = fls(abs(v));
+	unsigned int sym = run << 4 | nbits;
+
+	put_bits(b, h->code[sym], h->size[sym]);
+	if (nbits)
+		put_bits(b, v < 0 ? v - 1 : v, nbits);
+}
+
+static void encode_block(struct s3c_jpeg_sw *sw, struct s3c_jpeg_bitbuf *b,
+			 const unsigned char *qtbl, int *dc_pred)
+{
+	int *blk = sw->blk;
+	unsigned int i, run = 0;
+	int q, v;
+
+	fdct(blk);
+
+	for (i = 0; i < 64; i++) {
+		q = qtbl[i];
+		v = blk[i];
+		blk[i] = v < 0 ? -((q / 2 - v) / q) : (v + q / 2) / q;
+	}
+
+	put_coef(b, &sw->dc, 0, blk[0] - *dc_pred);
+	*dc_pred = blk[0];
+
+	for (i = 1; i < 64; i++) {
+		v = blk[zigzag[i]];
+		if (!v) {
+			run++;
+			continue;
+		}
+		for (; run > 15; run -= 16)
+			put_bits(b, sw->ac.code[0xf0], sw->ac.size[0xf0]);
+		put_coef(b, &sw->ac, run, v);
+		run = 0;
+	}
+	if (run)
+		put_bits(b, sw->ac.code[0x00], sw->ac.size[0x00]);
+}
+
+/**
+ * s3c_jpeg_sw_encode - encode an image
+ * @sw: encoder state
+ * @job: image and encoding parameters
+ *
+ * Only 4:2:2 and 4:2:0 subsampling are supported, as for the hardware
+ * encoder. Returns the size of the JPEG image, or -ENOSPC if it does not
+ * fit in the destination buffer.
+ */
+int s3c_jpeg_sw_encode(struct s3c_jpeg_sw *sw, const struct s3c_jpeg_job *job)
+{
+	const unsigned char *qlum = sw->tbl->qtbl_lum[job->quality];
+	const unsigned char *qchr = sw->tbl->qtbl_chr[job->quality];
+	unsigned int vsamp, x0, y0, bx, by, mcus = 0, rst = 0;
+	struct s3c_jpeg_bitbuf b = {
+		.buf	= job->dst_vaddr,
+		.size	= job->dst_size,
+	};
+	int dc_pred[3] = { 0, 0, 0 };
+
+	vsamp = job->subsampling == V4L2_JPEG_CHROMA_SUBSAMPLING_420 ? 2 : 1;
+
+	put_header(sw, &b, job, vsamp);
+
+	for (y0 = 0; y0 < job->height && !b.overflow; y0 += 8 * vsamp) {
+		for (x0 = 0; x0 < job->width; x0 += 16) {
+			if (job->restart_interval && mcus &&
+			    mcus % job->restart_interval == 0) {
+				flush_bits(&b);
+				put_marker(&b, RST + (rst++ & 7));
+				memset(dc_pred, 0, sizeof(dc_pred));
+			}
+			mcus++;
+
+			fetch_mcu(sw, job, x0, y0, 8 * vsamp);
+			for (by = 0; by < vsamp; by++) {
+				for (bx = 0; bx < 2; bx++) {
+					luma_block(sw, bx, by);
+					encode_block(sw, &b, qlum, &dc_pred[0]);
+				}
+			}
+			chroma_block(sw, sw->cb, vsamp);
+			encode_block(sw, &b, qchr, &dc_pred[1]);
+			chroma_block(sw, sw->cr, vsamp);
+			encode_block(sw, &b, qchr, &dc_pred[2]);
+		}
+	}
+
+	flush_bits(&b);
+	put_marker(&b, EOI);
+
+	return b.overflow ? -ENOSPC : b.pos;
+}
+
+struct s3c_jpeg_sw *s3c_jpeg_sw_init(const struct s3c_jpeg_tables *tbl)
+{
+	struct s3c_jpeg_sw *sw;
+
+	sw = kzalloc(sizeof(*sw), GFP_KERNEL);
+	if (!sw)
+		return NULL;
+
+	sw->tbl = tbl;
+	huff_build(&sw->dc, tbl->dc_bits, tbl->dc_vals);
+	huff_build(&sw->ac, tbl->ac_bits, tbl->ac_vals);
+	return sw;
+}
+
+void s3c_jpeg_sw_release(struct s3c_jpeg_sw *sw)
+{
+	kfree(sw);
+}
@@ -43,6 +43,7 @@
 #include <linux/skbuff.h>
 #include <linux/circ_buf.h>
 #include <linux/kthread.h>
+#include <linux/ktime.h>
 #include <linux/fs.h>
 #include <linux/platform_data/spica_dpram.h>
 #include <asm/ioctls.h>
@@ -54,6 +55,16 @@ module_param_string(fw_path, fw_path, 2048, 0);
 
 #define DEFAULT_FW_PATH	"/radio/modem.bin"
 
+static unsigned int tx_coalesce_usecs;
+module_param(tx_coalesce_usecs, uint, 0644);
+MODULE_PARM_DESC(tx_coalesce_usecs,
+	"Time the PDP TX thread waits for more frames before taking the OneDRAM semaphore (0 = disabled)");
+
+static unsigned int tx_coalesce_frames = 8;
+module_param(tx_coalesce_frames, uint, 0644);
+MODULE_PARM_DESC(tx_coalesce_frames,
+	"Number of queued network frames ending the coalescing window early");
+
 /*
  * Utility functions
  */
@@ -62,6 +73,13 @@ static inline struct dpram *dev_to_dpr(struct dpram_device *dev)
 	return container_of(dev, struct dpram, device[dev->idx]);
 }
 
+/* Modem control lines are not connected when running with the simulator */
+static inline void dpram_gpio_set(struct dpram *dpr, unsigned gpio, int val)
+{
+	if (!dpr->sim)
+		gpio_set_value(gpio, val);
+}
+
 /*
  * OneDRAM access
  */
@@ -82,6 +100,8 @@ static inline void onedram_write_mailbox(struct dpram *dpr, u32 cmd)
 #endif
 	dpr->last_cmd = cmd;
 	writel(cmd, dpr->onedram_mailbox[MAILBOX_BA]);
+	if (dpr->sim)
+		dpr->sim->mailbox_write(dpr->sim, cmd);
 }
 
 static inline int onedram_semaphore_held(struct dpram *dpr)
@@ -563,8 +583,8 @@ static int dpram_phone_image_load(struct dpram *dpr)
 {
 	int ret;
 
-	gpio_set_value(dpr->pdata->gpio_cp_boot_sel, 0);
-	gpio_set_value(dpr->pdata->gpio_usim_boot, 0);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_cp_boot_sel, 0);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_usim_boot, 0);
 
 	ret = wait_event_interruptible_timeout(dpr->wq,
 					dpram_phone_bootloader(dpr), 5 * HZ);
@@ -599,8 +619,11 @@ static void dpram_phone_power_off(struct dpram *dpr)
 	dpr->status = DPRAM_PHONE_OFF;
 	wake_up(&dpr->wq);
 
-	gpio_set_value(dpr->pdata->gpio_phone_on, 0);
-	gpio_set_value(dpr->pdata->gpio_phone_rst_n, 0);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_phone_on, 0);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_phone_rst_n, 0);
+
+	if (dpr->sim)
+		dpr->sim->power(dpr->sim, 0);
 }
 
 static void dpram_phone_power_on(struct dpram *dpr)
@@ -615,33 +638,36 @@ static void dpram_phone_power_on(struct dpram *dpr)
 	dpr->status = DPRAM_PHONE_OFF;
 	wake_up(&dpr->wq);
 
-	gpio_set_value(dpr->pdata->gpio_pda_active, 0);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_pda_active, 0);
 
 	(void) onedram_read_mailbox(dpr);
 	onedram_write_mailbox(dpr, 0);
 
 	local_irq_restore(flags);
 
-	gpio_set_value(dpr->pdata->gpio_cp_boot_sel, 1);
-	gpio_set_value(dpr->pdata->gpio_usim_boot, 1);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_cp_boot_sel, 1);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_usim_boot, 1);
 
-	gpio_set_value(dpr->pdata->gpio_phone_on, 0);
-	gpio_set_value(dpr->pdata->gpio_phone_rst_n, 0);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_phone_on, 0);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_phone_rst_n, 0);
 	msleep(400);
 
-	gpio_set_value(dpr->pdata->gpio_phone_on, 1);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_phone_on, 1);
 	msleep(60);
 
-	gpio_set_value(dpr->pdata->gpio_phone_rst_n, 1);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_phone_rst_n, 1);
 	msleep(1000);
 
-	gpio_set_value(dpr->pdata->gpio_phone_on, 0);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_phone_on, 0);
 	msleep(200);
 
-	gpio_set_value(dpr->pdata->gpio_pda_active, 1);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_pda_active, 1);
 
 	dpr->status = DPRAM_PHONE_POWER_ON;
 
+	if (dpr->sim)
+		dpr->sim->power(dpr->sim, 1);
+
 	dev_dbg(dpr->dev, "Phone powered on.\n");
 }
 
@@ -688,6 +714,9 @@ static int dpram_phone_boot_start(struct dpram *dpr, int ramdump)
 
 static int dpram_phone_getstatus(struct dpram *dpr)
 {
+	if (dpr->sim)
+		return dpr->sim->active;
+
 	return gpio_get_value(dpr->pdata->gpio_phone_active);
 }
 
@@ -698,23 +727,28 @@ static void dpram_phone_reset(struct dpram *dpr)
 	dpr->status = DPRAM_PHONE_POWER_ON;
 	wake_up(&dpr->wq);
 
-	gpio_set_value(dpr->pdata->gpio_pda_active, 0);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_pda_active, 0);
 
 	(void) onedram_read_mailbox(dpr);
 	onedram_write_mailbox(dpr, 0);
 
-	gpio_set_value(dpr->pdata->gpio_cp_boot_sel, 1);
-	gpio_set_value(dpr->pdata->gpio_usim_boot, 1);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_cp_boot_sel, 1);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_usim_boot, 1);
 
-	gpio_set_value(dpr->pdata->gpio_phone_rst_n, 0);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_phone_rst_n, 0);
 	msleep(100);
 
-	gpio_set_value(dpr->pdata->gpio_phone_rst_n, 1);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_phone_rst_n, 1);
 	msleep(200);
 
-	gpio_set_value(dpr->pdata->gpio_pda_active, 1);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_pda_active, 1);
 
 	dpr->status = DPRAM_PHONE_POWER_ON;
+
+	if (dpr->sim) {
+		dpr->sim->power(dpr->sim, 0);
+		dpr->sim->power(dpr->sim, 1);
+	}
 }
 
 /*
@@ -1459,8 +1493,23 @@ static void dpram_pdp_send_hdr(struct dpram_device *dev,
 	fifo_write(&dev->tx, &hdr, sizeof(struct pdp_header));
 }
 
+/*
+ * Make sure len bytes can be written to the TX FIFO. If wait is not set,
+ * returns -ENOSPC instead of giving the semaphore back to wait for space.
+ */
+static int dpram_pdp_tx_space(struct dpram *dpr, struct dpram_device *dev,
+						size_t len, bool wait)
+{
+	if (wait)
+		return dpram_wait_for_fifo(dpr, dev, &dev->tx, 0, len);
+
+	dpram_update_device(dev);
+
+	return (dev->tx.avail < len) ? -ENOSPC : 0;
+}
+
 static int dpram_pdp_process_vnet_tx(struct dpram *dpr,
-						struct dpram_device *dev)
+					struct dpram_device *dev, bool wait)
 {
 	const unsigned char start = PDP_START_BYTE;
 	const unsigned char stop = PDP_STOP_BYTE;
@@ -1469,11 +1518,16 @@ static int dpram_pdp_process_vnet_tx(struct dpram *dpr,
 	int ret;
 
 	/* Starts with OneDRAM semaphore held */
-	skb = skb_dequeue(&dpr->pdp_vnet_queue);
+	skb = skb_peek(&dpr->pdp_vnet_queue);
 
 	/* Releases the semaphore and sleeps if no space available */
-	ret = dpram_wait_for_fifo(dpr, dev, &dev->tx, 0,
-				1 + sizeof(struct pdp_header) + skb->len + 1);
+	ret = dpram_pdp_tx_space(dpr, dev,
+			1 + sizeof(struct pdp_header) + skb->len + 1, wait);
+	if (ret == -ENOSPC)
+		return ret;
+
+	/* This thread is the only consumer of the queue */
+	skb_unlink(skb, &dpr->pdp_vnet_queue);
 	if (ret) {
 		dev_kfree_skb(skb);
 		return ret;
@@ -1498,7 +1552,7 @@ static int dpram_pdp_process_vnet_tx(struct dpram *dpr,
 }
 
 static int dpram_pdp_process_vtty_tx(struct dpram *dpr,
-						struct dpram_device *dev)
+					struct dpram_device *dev, bool wait)
 {
 	const unsigned char start = PDP_START_BYTE;
 	const unsigned char stop = PDP_STOP_BYTE;
@@ -1527,8 +1581,8 @@ static int dpram_pdp_process_vtty_tx(struct dpram *dpr,
 		len = ETH_DATA_LEN;
 
 	/* Releases the semaphore and sleeps if no space available */
-	ret = dpram_wait_for_fifo(dpr, dev, &dev->tx, 0,
-				1 + sizeof(struct pdp_header) + len + 1);
+	ret = dpram_pdp_tx_space(dpr, dev,
+				1 + sizeof(struct pdp_header) + len + 1, wait);
 	if (ret)
 		return ret;
 
@@ -1560,32 +1614,93 @@ static int dpram_pdp_process_vtty_tx(struct dpram *dpr,
 	return 0;
 }
 
-static int dpram_pdp_process_tx(struct dpram *dpr, struct dpram_device *dev)
+static int dpram_pdp_process_tx(struct dpram *dpr,
+					struct dpram_device *dev, bool wait)
 {
 	int ret;
 
 	if (!list_empty(&dpr->pdp_vtty_queue)
 				&& !skb_queue_empty(&dpr->pdp_vnet_queue)) {
 		if (dpr->pdp_priority)
-			ret = dpram_pdp_process_vnet_tx(dpr, dev);
+			ret = dpram_pdp_process_vnet_tx(dpr, dev, wait);
 		else
-			ret = dpram_pdp_process_vtty_tx(dpr, dev);
+			ret = dpram_pdp_process_vtty_tx(dpr, dev, wait);
 
-		dpr->pdp_priority ^= 1;
+		if (!ret)
+			dpr->pdp_priority ^= 1;
 		return ret;
 	}
 
 	if (!list_empty(&dpr->pdp_vtty_queue))
-		return dpram_pdp_process_vtty_tx(dpr, dev);
+		return dpram_pdp_process_vtty_tx(dpr, dev, wait);
+
+	return dpram_pdp_process_vnet_tx(dpr, dev, wait);
+}
+
+static bool dpram_pdp_tx_pending(struct dpram *dpr)
+{
+	unsigned long flags;
+	bool ret;
+
+	local_irq_save(flags);
+	ret = !list_empty(&dpr->pdp_vtty_queue)
+				|| !skb_queue_empty(&dpr->pdp_vnet_queue);
+	local_irq_restore(flags);
+
+	return ret;
+}
+
+/*
+ * Give the network stack a chance to queue more frames before taking the
+ * semaphore, so that a burst goes to the modem in a single handshake.
+ * TTY data is latency sensitive and is sent right away.
+ */
+static void dpram_pdp_tx_coalesce(struct dpram *dpr)
+{
+	unsigned int usecs = tx_coalesce_usecs;
+	unsigned long flags;
+	bool vtty;
+
+	if (!usecs)
+		return;
+
+	local_irq_save(flags);
+	vtty = !list_empty(&dpr->pdp_vtty_queue);
+	local_irq_restore(flags);
+
+	if (vtty || skb_queue_len(&dpr->pdp_vnet_queue) >= tx_coalesce_frames)
+		return;
+
+	usleep_range(usecs, usecs + usecs / 4);
+}
+
+static void dpram_pdp_tx_account(struct dpram *dpr, unsigned int frames,
+							s64 sem_wait_us)
+{
+	struct dpram_pdp_tx_stats *stats = &dpr->pdp_tx_stats;
+	unsigned long flags;
+
+	local_irq_save(flags);
+
+	++stats->batches;
+	stats->frames += frames;
+	if (frames > stats->max_frames)
+		stats->max_frames = frames;
+	stats->sem_wait_us += sem_wait_us;
+	if (sem_wait_us > stats->max_sem_wait_us)
+		stats->max_sem_wait_us = sem_wait_us;
 
-	return dpram_pdp_process_vnet_tx(dpr, dev);
+	local_irq_restore(flags);
 }
 
 static int dpram_pdp_tx_thread(void *data)
 {
 	struct dpram_device *dev = data;
 	struct dpram *dpr = dev_to_dpr(dev);
+	unsigned int frames;
 	unsigned long flags;
+	s64 sem_wait_us;
+	ktime_t start;
 	int ret;
 
 	allow_signal(SIGTERM);
@@ -1610,6 +1725,9 @@ wait_for_phone:
 		}
 		local_irq_restore(flags);
 
+		dpram_pdp_tx_coalesce(dpr);
+
+		start = ktime_get();
 		ret = onedram_semaphore_get(dpr);
 		if (ret == -ENODEV) {
 			dev_warn(dpr->dev, "%s: Phone offline.\n", __func__);
@@ -1618,9 +1736,23 @@ wait_for_phone:
 		if (ret)
 			goto finish;
 		/* Semaphore is held here */
+		sem_wait_us = ktime_us_delta(ktime_get(), start);
 
-		/* Exits with semaphore released on error */
-		ret = dpram_pdp_process_tx(dpr, dev);
+		/*
+		 * Send everything that fits in the FIFO before giving the
+		 * semaphore back. Only the first frame may wait for space,
+		 * the following ones end the batch instead.
+		 * Exits with semaphore released on error.
+		 */
+		frames = 0;
+		do {
+			ret = dpram_pdp_process_tx(dpr, dev, !frames);
+			if (ret)
+				break;
+			++frames;
+		} while (dpram_pdp_tx_pending(dpr) && !kthread_should_stop());
+		if (ret == -ENOSPC)
+			ret = 0;
 		if (ret == -ENODEV) {
 			dev_warn(dpr->dev, "%s: Phone offline.\n", __func__);
 			goto wait_for_phone;
@@ -1628,6 +1760,8 @@ wait_for_phone:
 		if (ret)
 			goto finish;
 
+		dpram_pdp_tx_account(dpr, frames, sem_wait_us);
+
 		onedram_semaphore_put(dpr, dev->send_bits);
 		/* Semaphore is no longer held here */
 	} while(!kthread_should_stop());
@@ -1661,6 +1795,26 @@ static void dpram_pdp_demux_packet(struct dpram_device *dev,
 	vdev->handle_rx(vdev, hdr->len - sizeof(struct pdp_header));
 }
 
+/*
+ * Called by the RX thread once the FIFO is drained, so that consumers
+ * buffering packets (network devices) can process the whole burst at once.
+ */
+static void dpram_pdp_flush_rx(struct dpram *dpr)
+{
+	struct dpram_pdp_vdev *vdev;
+	unsigned long flags;
+
+	/* Pending softirqs run when re-enabling bottom halves */
+	local_bh_disable();
+	local_irq_save(flags);
+	list_for_each_entry(vdev, &dpr->pdp_vdev_list, list) {
+		if (vdev->flush_rx)
+			vdev->flush_rx(vdev);
+	}
+	local_irq_restore(flags);
+	local_bh_enable();
+}
+
 static int dpram_pdp_rx_thread(void *data)
 {
 	struct dpram_device *dev = data;
@@ -1688,6 +1842,11 @@ wait_for_phone:
 
 	/* The semaphore is held here */
 	do {
+		/* Hand received packets over before waiting for more data */
+		dpram_update_device(dev);
+		if (dev->rx.avail < sizeof(struct pdp_header) + 1)
+			dpram_pdp_flush_rx(dpr);
+
 		/* Releases the semaphore and sleeps if no data available */
 		ret = dpram_wait_for_fifo(dpr, dev, &dev->rx, bits,
 						sizeof(struct pdp_header) + 1);
@@ -2026,16 +2185,106 @@ static void dpram_vtty_rm_dev(struct dpram_pdp_vdev *vdev)
 
 /*
  * PDP virtual network devices
+ *
+ * Packets can only be copied out of the FIFO with the OneDRAM semaphore
+ * held, which may sleep, so the RX thread still does the copy. Packets
+ * are queued and handed to the stack by the NAPI poll function, once per
+ * burst, instead of raising the network softirq for each of them.
+ * Buffers come from a per device pool of preallocated skbs, refilled
+ * from the poll function. This is preallocation, not recycling: skbs
+ * handed to GRO are freed by the stack and never come back, only the
+ * packets still queued when the interface goes down return to the pool.
  */
+static struct sk_buff *dpram_vnet_get_skb(struct dpram_vnet_priv *vnet,
+								size_t len)
+{
+	struct net_device *net = vnet->vdev.priv;
+	struct sk_buff *skb;
+
+	if (len <= VNET_RX_BUF_LEN) {
+		skb = skb_dequeue(&vnet->rx_pool);
+		if (skb)
+			return skb;
+		len = VNET_RX_BUF_LEN;
+	}
+
+	return netdev_alloc_skb_ip_align(net, len);
+}
+
+/* Return an undelivered packet to the pool, or free it */
+static void dpram_vnet_put_skb(struct dpram_vnet_priv *vnet,
+							struct sk_buff *skb)
+{
+	if (skb_queue_len(&vnet->rx_pool) < VNET_RX_POOL_LEN
+	    && skb_recycle_check(skb, VNET_RX_BUF_LEN + NET_IP_ALIGN)) {
+		skb_reserve(skb, NET_IP_ALIGN);
+		skb_queue_tail(&vnet->rx_pool, skb);
+		return;
+	}
+
+	dev_kfree_skb_any(skb);
+}
+
+static void dpram_vnet_refill(struct dpram_vnet_priv *vnet)
+{
+	struct net_device *net = vnet->vdev.priv;
+	struct sk_buff *skb;
+
+	while (skb_queue_len(&vnet->rx_pool) < VNET_RX_POOL_LEN) {
+		skb = netdev_alloc_skb_ip_align(net, VNET_RX_BUF_LEN);
+		if (!skb)
+			break;
+		skb_queue_tail(&vnet->rx_pool, skb);
+	}
+}
+
+static int dpram_vnet_poll(struct napi_struct *napi, int budget)
+{
+	struct dpram_vnet_priv *vnet =
+			container_of(napi, struct dpram_vnet_priv, napi);
+	struct sk_buff *skb;
+	int work = 0;
+
+	while (work < budget) {
+		skb = skb_dequeue(&vnet->rx_queue);
+		if (!skb)
+			break;
+
+		napi_gro_receive(napi, skb);
+		++work;
+	}
+
+	/* Allocations are kept out of the RX thread */
+	dpram_vnet_refill(vnet);
+
+	if (work < budget) {
+		napi_complete(napi);
+		/* Packets queued after the last dequeue */
+		if (!skb_queue_empty(&vnet->rx_queue))
+			napi_schedule(napi);
+	}
+
+	return work;
+}
+
 static int dpram_vnet_open(struct net_device *net)
 {
+	struct dpram_vnet_priv *vnet = netdev_priv(net);
+
+	napi_enable(&vnet->napi);
 	netif_start_queue(net);
 	return 0;
 }
 
 static int dpram_vnet_stop(struct net_device *net)
 {
+	struct dpram_vnet_priv *vnet = netdev_priv(net);
+	struct sk_buff *skb;
+
 	netif_stop_queue(net);
+	napi_disable(&vnet->napi);
+	while ((skb = skb_dequeue(&vnet->rx_queue)))
+		dpram_vnet_put_skb(vnet, skb);
 	return 0;
 }
 
@@ -2107,6 +2356,8 @@ static int dpram_vnet_stop_tx(struct dpram *dpr, struct dpram_device *dev)
 
 static void dpram_vnet_handle_rx(struct dpram_pdp_vdev *vdev, size_t len)
 {
+	struct dpram_vnet_priv *vnet =
+			container_of(vdev, struct dpram_vnet_priv, vdev);
 	struct dpram_device *dev = vdev->dev;
 	struct dpram *dpr = dev_to_dpr(dev);
 	struct net_device *net = vdev->priv;
@@ -2120,11 +2371,18 @@ static void dpram_vnet_handle_rx(struct dpram_pdp_vdev *vdev, size_t len)
 		return;
 	}
 
-	skb = alloc_skb(len + 2, GFP_KERNEL);
+	if (skb_queue_len(&vnet->rx_queue) >= VNET_RX_QUEUE_LEN) {
+		++net->stats.rx_dropped;
+		fifo_skip(&dev->rx, len);
+		return;
+	}
+
+	skb = dpram_vnet_get_skb(vnet, len);
 	if (!skb) {
 		if (net_ratelimit())
 			dev_warn(dpr->dev, "%s: Failed to allocate socket buffer, dropping packet.\n",
 								__func__);
+		++net->stats.rx_dropped;
 		fifo_skip(&dev->rx, len);
 		return;
 	}
@@ -2132,8 +2390,30 @@ static void dpram_vnet_handle_rx(struct dpram_pdp_vdev *vdev, size_t len)
 	fifo_read(&dev->rx, skb_put(skb, len), len);
 	skb->dev = net;
 	skb->protocol = __constant_htons(ETH_P_IP);
+	skb_reset_mac_header(skb);
+	skb_reset_network_header(skb);
+
+	++net->stats.rx_packets;
+	net->stats.rx_bytes += len;
 
-	netif_rx_ni(skb);
+	skb_queue_tail(&vnet->rx_queue, skb);
+
+	/* Do not let a long burst pile up */
+	if (skb_queue_len(&vnet->rx_queue) >= VNET_NAPI_WEIGHT) {
+		local_bh_disable();
+		napi_schedule(&vnet->napi);
+		local_bh_enable();
+	}
+}
+
+/* Called with interrupts disabled, see dpram_pdp_flush_rx() */
+static void dpram_vnet_flush_rx(struct dpram_pdp_vdev *vdev)
+{
+	struct dpram_vnet_priv *vnet =
+			container_of(vdev, struct dpram_vnet_priv, vdev);
+
+	if (!skb_queue_empty(&vnet->rx_queue))
+		napi_schedule(&vnet->napi);
 }
 
 static void dpram_vnet_get_name(struct dpram_pdp_vdev *vdev,
@@ -2147,6 +2427,7 @@ static void dpram_vnet_get_name(struct dpram_pdp_vdev *vdev,
 static struct dpram_pdp_vdev *dpram_vnet_add_dev(struct dpram_device *dev,
 					unsigned int id, const char *name)
 {
+	struct dpram_vnet_priv *vnet;
 	struct net_device *net;
 	struct dpram_pdp_vdev *vdev;
 	int ret;
@@ -2154,20 +2435,29 @@ static struct dpram_pdp_vdev *dpram_vnet_add_dev(struct dpram_device *dev,
 	if (id > PDP_ID_MAX)
 		return ERR_PTR(-EINVAL);
 
-	net = alloc_netdev(sizeof(struct dpram_pdp_vdev),
+	net = alloc_netdev(sizeof(struct dpram_vnet_priv),
 						"pdp%d", dpram_vnet_setup);
 	if (!net)
 		return ERR_PTR(-ENOMEM);
 
-	vdev = netdev_priv(net);
+	vnet = netdev_priv(net);
+	skb_queue_head_init(&vnet->rx_queue);
+	skb_queue_head_init(&vnet->rx_pool);
+	netif_napi_add(net, &vnet->napi, dpram_vnet_poll, VNET_NAPI_WEIGHT);
+
+	vdev = &vnet->vdev;
 	vdev->type	= DPRAM_VNET;
 	vdev->id	= id;
 	vdev->handle_rx	= dpram_vnet_handle_rx;
+	vdev->flush_rx	= dpram_vnet_flush_rx;
 	vdev->priv	= net;
 	vdev->dev	= dev;
 
+	dpram_vnet_refill(vnet);
+
 	ret = register_netdev(net);
 	if (ret) {
+		skb_queue_purge(&vnet->rx_pool);
 		free_netdev(net);
 		return ERR_PTR(ret);
 	}
@@ -2177,9 +2467,13 @@ static struct dpram_pdp_vdev *dpram_vnet_add_dev(struct dpram_device *dev,
 
 static void dpram_vnet_rm_dev(struct dpram_pdp_vdev *vdev)
 {
+	struct dpram_vnet_priv *vnet =
+			container_of(vdev, struct dpram_vnet_priv, vdev);
 	struct net_device *net = vdev->priv;
 
 	unregister_netdev(net);
+	skb_queue_purge(&vnet->rx_queue);
+	skb_queue_purge(&vnet->rx_pool);
 	free_netdev(net);
 }
 
@@ -2433,6 +2727,7 @@ static int dpram_read_proc(char *page, char **start, off_t off,
 	int fmt_rx_avail, fmt_tx_free, raw_rx_avail, raw_tx_free, sem;
 	unsigned int fmt_rx, fmt_tx, raw_rx, raw_tx;
 	char buf[SIZ_ERROR_HDR + SIZ_ERROR_MSG + 1];
+	struct dpram_pdp_tx_stats tx_stats;
 	unsigned long flags;
 
 	local_irq_save(flags);
@@ -2445,6 +2740,7 @@ static int dpram_read_proc(char *page, char **start, off_t off,
 	raw_tx_free = dpr->device[DPRAM_RAW].tx.avail;
 	raw_rx = dpr->device[DPRAM_RAW].rx_bytes;
 	raw_tx = dpr->device[DPRAM_RAW].tx_bytes;
+	tx_stats = dpr->pdp_tx_stats;
 
 	local_irq_restore(flags);
 
@@ -2478,6 +2774,11 @@ static int dpram_read_proc(char *page, char **start, off_t off,
 			"| LAST PHONE ERR MSG\t| %s\n"
 			"| PHONE ACTIVE\t\t| %s\n"
 			"| DPRAM IRQ active\t| %d\n"
+			"| PDP TX batches   \t| %u\n"
+			"| PDP TX frames    \t| %u\n"
+			"| PDP TX max batch \t| %u\n"
+			"| PDP TX sem wait us\t| %llu\n"
+			"| PDP TX max wait us\t| %u\n"
 			"-------------------------------------\n",
 			dpr->status, sem,
 			dpr->sem_req_count,
@@ -2486,7 +2787,10 @@ static int dpram_read_proc(char *page, char **start, off_t off,
 			in_interrupt, out_interrupt,
 			(buf[0] != '\0' ? buf : "NONE"),
 			(dpram_phone_getstatus(dpr) ? "ACTIVE" : "INACTIVE"),
-			!gpio_get_value(dpr->pdata->gpio_onedram_int_n));
+			dpr->sim ? 0 : !gpio_get_value(dpr->pdata->gpio_onedram_int_n),
+			tx_stats.batches, tx_stats.frames, tx_stats.max_frames,
+			(unsigned long long)tx_stats.sem_wait_us,
+			tx_stats.max_sem_wait_us);
 
 	len = (p - page) - off;
 	if (len < 0)
@@ -2526,6 +2830,9 @@ static int dpram_check_pdata(struct platform_device *pdev)
 {
 	struct dpram_platform_data *pdata = pdev->dev.platform_data;
 
+	if (pdata->sim)
+		return 0;
+
 	if (!gpio_is_valid(pdata->gpio_phone_on)) {
 		dev_err(&pdev->dev, "Invalid PHONE_ON gpio specified.\n");
 		return -EINVAL;
@@ -2574,6 +2881,9 @@ static int dpram_init_gpio(struct dpram *dpr)
 	struct dpram_platform_data *pdata = dpr->pdata;
 	int ret = 0;
 
+	if (dpr->sim)
+		return 0;
+
 	ret = gpio_request(pdata->gpio_phone_on, "Phone on");
 	if (ret) {
 		dev_err(dpr->dev, "Failed to request PHONE_ON gpio.\n");
@@ -2688,6 +2998,11 @@ static int dpram_init_driver_data(struct dpram *dpr)
 
 static int dpram_map(struct dpram *dpr)
 {
+	if (dpr->sim) {
+		dpr->base = dpr->sim->base;
+		goto setup;
+	}
+
 	dpr->res = request_mem_region(dpr->mem->start,
 				resource_size(dpr->mem), dev_name(dpr->dev));
 	if (!dpr->res) {
@@ -2705,6 +3020,7 @@ static int dpram_map(struct dpram *dpr)
 		return -ENOMEM;
 	}
 
+setup:
 	dpr->onedram_sem = dpr->base + DPRAM_SMP;
 	dpr->onedram_mailbox[MAILBOX_BA] = dpr->base + DPRAM_MBX_BA;
 	dpr->onedram_mailbox[MAILBOX_AB] = dpr->base + DPRAM_MBX_AB;
@@ -2721,6 +3037,13 @@ static int dpram_init_irq(struct dpram *dpr)
 {
 	int ret = 0;
 
+	/* The simulator calls the mailbox handler directly */
+	if (dpr->sim) {
+		dpr->sim->irq_data = dpr;
+		dpr->sim->mailbox_irq = dpram_mailbox_irq;
+		return 0;
+	}
+
 	/* OneDRAM interrupt */
 	ret = gpio_to_irq(dpr->pdata->gpio_onedram_int_n);
 	if (ret < 0) {
@@ -2787,6 +3110,11 @@ err_phone_active:
  */
 static void dpram_clean_irq(struct dpram *dpr)
 {
+	if (dpr->sim) {
+		dpr->sim->mailbox_irq = NULL;
+		return;
+	}
+
 	disable_irq_wake(dpr->phone_active_irq);
 	disable_irq_wake(dpr->onedram_irq);
 	disable_irq_wake(dpr->sim_detect_irq);
@@ -2800,6 +3128,9 @@ static void dpram_clean_gpio(struct dpram *dpr)
 {
 	struct dpram_platform_data *pdata = dpr->pdata;
 
+	if (dpr->sim)
+		return;
+
 	gpio_free(pdata->gpio_cp_boot_sel);
 	gpio_free(pdata->gpio_onedram_int_n);
 	gpio_free(pdata->gpio_pda_active);
@@ -2820,6 +3151,9 @@ static void dpram_clean_driver_data(struct dpram *dpr)
 
 static void dpram_unmap(struct dpram *dpr)
 {
+	if (dpr->sim)
+		return;
+
 	iounmap(dpr->base);
 	release_mem_region(dpr->phys_base, dpr->size);
 }
@@ -2848,7 +3182,7 @@ static int __init dpram_probe(struct platform_device *pdev)
 		return ret;
 
 	mem = platform_get_resource(pdev, IORESOURCE_MEM, 0);
-	if (!mem) {
+	if (!mem && !pdata->sim) {
 		dev_err(&pdev->dev, "Could not get memory resource.\n");
 		return -ENOMEM;
 	}
@@ -2862,6 +3196,7 @@ static int __init dpram_probe(struct platform_device *pdev)
 	dpr->dev = &pdev->dev;
 	dpr->pdata = pdata;
 	dpr->mem = mem;
+	dpr->sim = pdata->sim;
 
 	dpr->sec_dpram_dev = device_create(sec_class,
 						dpr->dev, 0, dpr, "dpram");
@@ -2908,7 +3243,8 @@ static int __init dpram_probe(struct platform_device *pdev)
 		goto err_dpram_err_register;
 	}
 
-	dpr->sim_state = gpio_get_value(pdata->gpio_sim_detect_n);
+	if (!dpr->sim)
+		dpr->sim_state = gpio_get_value(pdata->gpio_sim_detect_n);
 	dev_dbg(dpr->dev, "SIM state: %d\n", dpr->sim_state);
 
 	if ((ret = dpram_init_irq(dpr)) < 0) {
@@ -2971,15 +3307,15 @@ static void dpram_shutdown(struct platform_device *pdev)
 {
 	struct dpram *dpr = platform_get_drvdata(pdev);
 
-	gpio_set_value(dpr->pdata->gpio_phone_on, 0);
-	gpio_set_value(dpr->pdata->gpio_phone_rst_n, 0);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_phone_on, 0);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_phone_rst_n, 0);
 }
 
 static int dpram_suspend(struct device *dev)
 {
 	struct dpram *dpr = dev_get_drvdata(dev);
 
-	gpio_set_value(dpr->pdata->gpio_pda_active, 0);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_pda_active, 0);
 
 	return 0;
 }
@@ -2988,7 +3324,7 @@ static int dpram_resume(struct device *dev)
 {
 	struct dpram *dpr = dev_get_drvdata(dev);
 
-	gpio_set_value(dpr->pdata->gpio_pda_active, 1);
+	dpram_gpio_set(dpr, dpr->pdata->gpio_pda_active, 1);
 
 	return 0;
 }
@@ -220,6 +220,7 @@ struct dpram_pdp_vdev {
 	unsigned int		id;
 	enum dpram_vdev_type	type;
 	void (*handle_rx)(struct dpram_pdp_vdev *, size_t);
+	void (*flush_rx)(struct dpram_pdp_vdev *);
 	void 			*priv;
 	struct list_head	list;
 };
@@ -235,6 +236,17 @@ struct dpram_vtty_priv {
 	struct list_head	list;
 };
 
+#define VNET_RX_BUF_LEN		(ETH_DATA_LEN)
+#define VNET_RX_POOL_LEN	32
+#define VNET_RX_QUEUE_LEN	256
+#define VNET_NAPI_WEIGHT	64
+struct dpram_vnet_priv {
+	struct dpram_pdp_vdev	vdev;
+	struct napi_struct	napi;
+	struct sk_buff_head	rx_queue;
+	struct sk_buff_head	rx_pool;
+};
+
 struct dpram_device {
 	struct m_fifo rx;
 	struct m_fifo tx;
@@ -267,10 +279,20 @@ enum mailbox {
 	MAILBOX_NUM
 };
 
+/* PDP TX statistics, a batch is sent per semaphore acquisition */
+struct dpram_pdp_tx_stats {
+	unsigned int	batches;
+	unsigned int	frames;
+	unsigned int	max_frames;
+	u64		sem_wait_us;
+	unsigned int	max_sem_wait_us;
+};
+
 struct dpram {
 	struct device			*dev;
 	struct device			*sec_dpram_dev;
 	struct dpram_platform_data	*pdata;
+	struct dpram_sim_link		*sim;
 	struct proc_dir_entry		*proc_entry;
 
 	wait_queue_head_t	wq;
@@ -319,6 +341,7 @@ struct dpram {
 	int			pdp_adjust;
 	struct task_struct	*pdp_tx_task;
 	struct task_struct	*pdp_rx_task;
+	struct dpram_pdp_tx_stats pdp_tx_stats;
 
 	struct miscdevice	err_mdev;
 	struct fasync_struct	*err_async;
@@ -0,0 +1,405 @@
+/*
+ * Loopback modem simulator for the Spica OneDRAM driver
+ *
+ * Registers a spica-dpram platform device whose OneDRAM is ordinary
+ * memory and runs a kernel thread playing the modem side: it goes through
+ * the boot handshake, arbitrates the semaphore over the mailbox and sends
+ * every PDP frame and formatted message back to the AP. Source and
+ * destination of IPv4 packets are swapped, so that traffic sent through
+ * a pdp interface comes back addressed to the phone.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+#include <linux/interrupt.h>
+#include <linux/delay.h>
+#include <linux/platform_device.h>
+#include <linux/vmalloc.h>
+#include <linux/kthread.h>
+#include <linux/kfifo.h>
+#include <linux/io.h>
+#include <linux/ip.h>
+#include <linux/wakelock.h>
+#include <linux/miscdevice.h>
+#include <linux/tty.h>
+#include <linux/circ_buf.h>
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+#include <linux/platform_data/spica_dpram.h>
+#include <net/checksum.h>
+
+#include "spica_dpram.h"
+
+#define SIM_MEM_SIZE		(16 * 1024 * 1024)	/* SFRs at the end */
+#define SIM_MBOX_LEN		16
+#define SIM_FRAME_MAX		(1 + sizeof(struct pdp_header) + 0xffff + 1)
+
+static unsigned int latency_us;
+module_param(latency_us, uint, 0644);
+MODULE_PARM_DESC(latency_us, "Time the modem takes to answer, in microseconds");
+
+enum {
+	SIM_EV_POWER_ON,
+	SIM_EV_POWER_OFF,
+};
+
+struct dpram_sim {
+	struct dpram_sim_link	link;
+	struct dpram_platform_data pdata;
+	struct platform_device	*pdev;
+	void			*base;
+
+	struct task_struct	*task;
+	wait_queue_head_t	wq;
+	spinlock_t		lock;
+	DECLARE_KFIFO(mbox, u32, SIM_MBOX_LEN);
+	unsigned long		events;
+	bool			running;
+
+	/* named from the modem side */
+	struct m_fifo		fmt_rx;
+	struct m_fifo		fmt_tx;
+	struct m_fifo		raw_rx;
+	struct m_fifo		raw_tx;
+	u8			*frame;
+};
+
+static struct dpram_sim *dpram_sim;
+
+/*
+ * FIFO access, the same ring layout as in the driver
+ */
+static unsigned sim_fifo_count(struct m_fifo *q)
+{
+	return (*q->head + q->size - *q->tail) % q->size;
+}
+
+static unsigned sim_fifo_space(struct m_fifo *q)
+{
+	return q->size - 1 - sim_fifo_count(q);
+}
+
+static void sim_fifo_read(struct m_fifo *q, void *dst, unsigned count)
+{
+	unsigned tail = *q->tail;
+	unsigned n = min(count, q->size - tail);
+
+	memcpy(dst, q->data + tail, n);
+	memcpy(dst + n, q->data, count - n);
+	*q->tail = (tail + count) % q->size;
+}
+
+static void sim_fifo_write(struct m_fifo *q, const void *src, unsigned count)
+{
+	unsigned head = *q->head;
+	unsigned n = min(count, q->size - head);
+
+	memcpy(q->data + head, src, n);
+	memcpy(q->data, src + n, count - n);
+	*q->head = (head + count) % q->size;
+}
+
+/*
+ * Semaphore and mailbox, modem side
+ */
+static bool sim_semaphore_ap(struct dpram_sim *sim)
+{
+	return readl(sim->base + DPRAM_SMP) != 0;
+}
+
+static void sim_semaphore_give(struct dpram_sim *sim)
+{
+	wmb();
+	writel(1, sim->base + DPRAM_SMP);
+}
+
+/* Raise the CP->AP mailbox interrupt */
+static void sim_send(struct dpram_sim *sim, u32 cmd)
+{
+	unsigned long flags;
+
+	if (latency_us)
+		usleep_range(latency_us, latency_us + latency_us / 4);
+
+	writel(cmd, sim->base + DPRAM_MBX_AB);
+
+	local_irq_save(flags);
+	if (sim->link.mailbox_irq)
+		sim->link.mailbox_irq(0, sim->link.irq_data);
+	local_irq_restore(flags);
+}
+
+static void sim_mailbox_write(struct dpram_sim_link *link, u32 cmd)
+{
+	struct dpram_sim *sim = container_of(link, struct dpram_sim, link);
+
+	if (!kfifo_in_spinlocked(&sim->mbox, &cmd, 1, &sim->lock))
+		pr_warn("dpram-sim: mailbox overrun, dropping %08x\n", cmd);
+
+	wake_up(&sim->wq);
+}
+
+static void sim_power(struct dpram_sim_link *link, int on)
+{
+	struct dpram_sim *sim = container_of(link, struct dpram_sim, link);
+
+	set_bit(on ? SIM_EV_POWER_ON : SIM_EV_POWER_OFF, &sim->events);
+	wake_up(&sim->wq);
+}
+
+/*
+ * Loopback
+ */
+static void sim_reflect_ip(u8 *data, unsigned len)
+{
+	struct iphdr *iph = (struct iphdr *)data;
+	__be32 addr;
+
+	if (len < sizeof(*iph) || iph->version != 4 || iph->ihl < 5
+	    || len < iph->ihl * 4 || ntohs(iph->tot_len) != len
+	    || ip_fast_csum(data, iph->ihl))
+		return;
+
+	/* Neither the IP nor the transport checksums change */
+	addr = iph->saddr;
+	iph->saddr = iph->daddr;
+	iph->daddr = addr;
+}
+
+/* Returns true if frames were left in the FIFO for lack of space */
+static bool sim_loop_raw(struct dpram_sim *sim, bool *sent)
+{
+	struct pdp_header *hdr = (struct pdp_header *)(sim->frame + 1);
+	unsigned len, tail;
+
+	while (sim_fifo_count(&sim->raw_rx) >= 1 + sizeof(*hdr)) {
+		tail = *sim->raw_rx.tail;
+		sim_fifo_read(&sim->raw_rx, sim->frame, 1 + sizeof(*hdr));
+		if (sim->frame[0] != PDP_START_BYTE
+		    || hdr->len < sizeof(*hdr)
+		    || sim_fifo_count(&sim->raw_rx) < hdr->len - sizeof(*hdr) + 1) {
+			pr_warn("dpram-sim: framing error, purging RAW FIFO\n");
+			*sim->raw_rx.tail = *sim->raw_rx.head;
+			return false;
+		}
+
+		len = 1 + hdr->len + 1;
+		if (sim_fifo_space(&sim->raw_tx) < len) {
+			/* Rewind, the AP will make room */
+			*sim->raw_rx.tail = tail;
+			return true;
+		}
+
+		sim_fifo_read(&sim->raw_rx, sim->frame + 1 + sizeof(*hdr),
+						hdr->len - sizeof(*hdr) + 1);
+		sim_reflect_ip(sim->frame + 1 + sizeof(*hdr),
+						hdr->len - sizeof(*hdr));
+		sim_fifo_write(&sim->raw_tx, sim->frame, len);
+		*sent = true;
+	}
+
+	return false;
+}
+
+static bool sim_loop_fmt(struct dpram_sim *sim, bool *sent)
+{
+	unsigned count = sim_fifo_count(&sim->fmt_rx);
+	unsigned len = min(count, sim_fifo_space(&sim->fmt_tx));
+
+	if (len) {
+		sim_fifo_read(&sim->fmt_rx, sim->frame, len);
+		sim_fifo_write(&sim->fmt_tx, sim->frame, len);
+		*sent = true;
+	}
+
+	return len < count;
+}
+
+/* Called with the semaphore owned by the modem, gives it back to the AP */
+static void sim_exchange(struct dpram_sim *sim)
+{
+	bool sent_f = false, sent_r = false;
+	u32 bits = 0;
+
+	rmb();
+
+	if (sim_loop_fmt(sim, &sent_f))
+		bits |= INT_MASK_REQ_ACK_F;
+	if (sim_loop_raw(sim, &sent_r))
+		bits |= INT_MASK_REQ_ACK_R;
+
+	if (sent_f)
+		bits |= INT_MASK_SEND_F;
+	if (sent_r)
+		bits |= INT_MASK_SEND_R;
+
+	sim_semaphore_give(sim);
+	sim_send(sim, INT_NON_COMMAND(bits));
+}
+
+static void sim_handle_cmd(struct dpram_sim *sim, u32 cmd)
+{
+	switch (cmd) {
+	case DPRAM_CMD_BINARY_LOAD:
+		sim_send(sim, DPRAM_MSG_BINARY_DONE);
+		/* The AP sets up the shared memory when the phone starts */
+		sim_semaphore_give(sim);
+		sim_send(sim, INT_COMMAND(CMD_PHONE_START));
+		return;
+	case INT_COMMAND(CMD_INIT_END):
+		sim->running = true;
+		return;
+	case INT_COMMAND(CMD_SMP_REQ):
+		if (sim_semaphore_ap(sim))
+			sim_send(sim, INT_COMMAND(CMD_SMP_REP));
+		return;
+	case INT_COMMAND(CMD_REQ_ACTIVE):
+		if (sim_semaphore_ap(sim))
+			sim_send(sim, INT_COMMAND(CMD_RES_ACTIVE));
+		return;
+	}
+}
+
+static void sim_handle_power(struct dpram_sim *sim)
+{
+	unsigned long flags;
+
+	if (test_and_clear_bit(SIM_EV_POWER_OFF, &sim->events)) {
+		sim->running = false;
+		sim->link.active = 0;
+		spin_lock_irqsave(&sim->lock, flags);
+		kfifo_reset(&sim->mbox);
+		spin_unlock_irqrestore(&sim->lock, flags);
+	}
+
+	if (test_and_clear_bit(SIM_EV_POWER_ON, &sim->events)) {
+		sim->link.active = 1;
+		/* The bootloader hands the memory over for the image */
+		sim_semaphore_give(sim);
+		sim_send(sim, DPRAM_MSG_SBL_DONE);
+	}
+}
+
+static int sim_thread(void *data)
+{
+	struct dpram_sim *sim = data;
+	u32 cmd;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(sim->wq, kthread_should_stop()
+				|| sim->events || !kfifo_is_empty(&sim->mbox));
+
+		sim_handle_power(sim);
+
+		while (kfifo_out_spinlocked(&sim->mbox, &cmd, 1, &sim->lock)) {
+			sim_handle_cmd(sim, cmd);
+
+			/* Any message may come with the semaphore */
+			if (sim->running && !sim_semaphore_ap(sim))
+				sim_exchange(sim);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Module
+ */
+static int __init dpram_sim_init(void)
+{
+	struct dpram_sim *sim;
+	int ret;
+
+	sim = kzalloc(sizeof(*sim), GFP_KERNEL);
+	if (!sim)
+		return -ENOMEM;
+
+	sim->base = vzalloc(SIM_MEM_SIZE);
+	sim->frame = kmalloc(SIM_FRAME_MAX, GFP_KERNEL);
+	if (!sim->base || !sim->frame) {
+		ret = -ENOMEM;
+		goto err_alloc;
+	}
+
+	init_waitqueue_head(&sim->wq);
+	spin_lock_init(&sim->lock);
+	INIT_KFIFO(sim->mbox);
+
+	/* The modem reads what the AP transmits and the other way round */
+	INIT_M_FIFO(&sim->fmt_rx, FMT, TX, sim->base);
+	INIT_M_FIFO(&sim->fmt_tx, FMT, RX, sim->base);
+	INIT_M_FIFO(&sim->raw_rx, RAW, TX, sim->base);
+	INIT_M_FIFO(&sim->raw_tx, RAW, RX, sim->base);
+
+	sim->link.base = sim->base;
+	sim->link.power = sim_power;
+	sim->link.mailbox_write = sim_mailbox_write;
+	sim->pdata.sim = &sim->link;
+
+	sim->task = kthread_run(sim_thread, sim, "dpramsim");
+	if (IS_ERR(sim->task)) {
+		ret = PTR_ERR(sim->task);
+		goto err_alloc;
+	}
+
+	sim->pdev = platform_device_alloc("spica-dpram", -1);
+	if (!sim->pdev) {
+		ret = -ENOMEM;
+		goto err_pdev;
+	}
+
+	ret = platform_device_add_data(sim->pdev, &sim->pdata,
+							sizeof(sim->pdata));
+	if (ret)
+		goto err_pdev_add;
+
+	ret = platform_device_add(sim->pdev);
+	if (ret)
+		goto err_pdev_add;
+
+	dpram_sim = sim;
+
+	pr_info("dpram-sim: loopback modem ready\n");
+
+	return 0;
+
+err_pdev_add:
+	platform_device_put(sim->pdev);
+err_pdev:
+	kthread_stop(sim->task);
+err_alloc:
+	kfree(sim->frame);
+	vfree(sim->base);
+	kfree(sim);
+	return ret;
+}
+
+static void __exit dpram_sim_exit(void)
+{
+	struct dpram_sim *sim = dpram_sim;
+
+	platform_device_unregister(sim->pdev);
+	kthread_stop(sim->task);
+	kfree(sim->frame);
+	vfree(sim->base);
+	kfree(sim);
+}
+
+/* The device has to exist before the driver probes it */
+subsys_initcall(dpram_sim_init);
+module_exit(dpram_sim_exit);
+
+MODULE_DESCRIPTION("Loopback modem simulator for the Spica OneDRAM driver");
+MODULE_LICENSE("GPL");
@@ -81,6 +81,24 @@ struct mmc_test_area {
 	struct scatterlist *sg;
 };
 
+/**
+ * struct mmc_test_async_req - one slot of a non-blocking transfer.
+ * @areq: asynchronous request handed to mmc_start_req()
+ * @test: test information, for the completion check
+ * @mrq: request
+ * @cmd: read or write command
+ * @stop: stop command
+ * @data: data phase
+ */
+struct mmc_test_async_req {
+	struct mmc_async_req	areq;
+	struct mmc_test_card	*test;
+	struct mmc_request	mrq;
+	struct mmc_command	cmd;
+	struct mmc_command	stop;
+	struct mmc_data		data;
+};
+
 /**
  * struct mmc_test_transfer_result - transfer results for performance tests.
  * @link: double-linked list
@@ -745,6 +763,67 @@ static int mmc_test_simple_transfer(struct mmc_test_card *test,
 	return mmc_test_check_result(test, &mrq);
 }
 
+/*
+ * Completion check for a non-blocking transfer, run by mmc_start_req()
+ * before the next request is started.
+ */
+static int mmc_test_check_result_async(struct mmc_card *card,
+				       struct mmc_async_req *areq)
+{
+	struct mmc_test_async_req *test_areq =
+		container_of(areq, struct mmc_test_async_req, areq);
+
+	mmc_test_wait_busy(test_areq->test);
+
+	return mmc_test_check_result(test_areq->test, areq->mrq);
+}
+
+static void mmc_test_async_req_init(struct mmc_test_async_req *test_areq,
+				    struct mmc_test_card *test)
+{
+	memset(test_areq, 0, sizeof(struct mmc_test_async_req));
+
+	test_areq->test = test;
+	test_areq->mrq.cmd = &test_areq->cmd;
+	test_areq->mrq.data = &test_areq->data;
+	test_areq->mrq.stop = &test_areq->stop;
+	test_areq->areq.mrq = &test_areq->mrq;
+	test_areq->areq.err_check = mmc_test_check_result_async;
+}
+
+/*
+ * Tests @count consecutive transfers of the same buffer, each one
+ * prepared by the host while the previous one is still in progress.
+ */
+static int mmc_test_nonblock_transfer(struct mmc_test_card *test,
+	struct scatterlist *sg, unsigned sg_len, unsigned dev_addr,
+	unsigned blocks, unsigned blksz, int write, unsigned count)
+{
+	struct mmc_test_async_req test_areq[2];
+	struct mmc_host *host = test->card->host;
+	unsigned i;
+	int ret = 0;
+
+	for (i = 0; i < count; i++) {
+		/* The slot was completed by the previous mmc_start_req() */
+		struct mmc_test_async_req *cur = &test_areq[i & 1];
+
+		mmc_test_async_req_init(cur, test);
+		mmc_test_prepare_mrq(test, &cur->mrq, sg, sg_len, dev_addr,
+				     blocks, blksz, write);
+
+		mmc_start_req(host, &cur->areq, &ret);
+		if (ret)
+			return ret;
+
+		dev_addr += blocks;
+	}
+
+	mmc_start_req(host, NULL, &ret);
+
+	return ret;
+}
+
 /*
  * Tests a transfer where the card will fail completely or partly
  */
@@ -1336,13 +1415,18 @@ static int mmc_test_area_transfer(struct mmc_test_card *test,
 }
 
 /*
- * Map and transfer bytes.
+ * Map and transfer bytes @count times to consecutive addresses, either one
+ * request at a time or, with @nonblock, preparing each request while the
+ * previous one is in progress.
  */
-static int mmc_test_area_io(struct mmc_test_card *test, unsigned long sz,
-			    unsigned int dev_addr, int write, int max_scatter,
-			    int timed)
+static int mmc_test_area_io_seq(struct mmc_test_card *test, unsigned long sz,
+				unsigned int dev_addr, int write,
+				int max_scatter, int timed, unsigned int count,
+				bool nonblock)
 {
+	struct mmc_test_area *t = &test->area;
 	struct timespec ts1, ts2;
+	unsigned int i;
 	int ret;
 
 	/*
@@ -1350,7 +1434,6 @@ static int mmc_test_area_io(struct mmc_test_card *test, unsigned long sz,
 	 * size is further limited by using PAGE_SIZE segments.
 	 */
 	if (max_scatter) {
-		struct mmc_test_area *t = &test->area;
 		unsigned long max_tfr;
 
 		if (t->max_seg_sz >= PAGE_SIZE)
@@ -1368,19 +1451,42 @@ static int mmc_test_area_io(struct mmc_test_card *test, unsigned long sz,
 	if (timed)
 		getnstimeofday(&ts1);
 
-	ret = mmc_test_area_transfer(test, dev_addr, write);
-	if (ret)
-		return ret;
+	if (nonblock) {
+		ret = mmc_test_nonblock_transfer(test, t->sg, t->sg_len,
+				dev_addr, t->blocks, 512, write, count);
+		if (ret)
+			return ret;
+	} else {
+		for (i = 0; i < count; i++) {
+			ret = mmc_test_area_transfer(test, dev_addr, write);
+			if (ret)
+				return ret;
+			dev_addr += t->blocks;
+		}
+	}
 
 	if (timed)
 		getnstimeofday(&ts2);
 
-	if (timed)
+	if (timed && count == 1)
 		mmc_test_print_rate(test, sz, &ts1, &ts2);
+	else if (timed)
+		mmc_test_print_avg_rate(test, sz, count, &ts1, &ts2);
 
 	return 0;
 }
 
+/*
+ * Map and transfer bytes.
+ */
+static int mmc_test_area_io(struct mmc_test_card *test, unsigned long sz,
+			    unsigned int dev_addr, int write, int max_scatter,
+			    int timed)
+{
+	return mmc_test_area_io_seq(test, sz, dev_addr, write, max_scatter,
+				    timed, 1, false);
+}
+
 /*
  * Write the test area entirely.
  */
@@ -1954,6 +2060,64 @@ static int mmc_test_large_seq_write_perf(struct mmc_test_card *test)
 	return mmc_test_large_seq_perf(test, 1);
 }
 
+/*
+ * Transfer the whole test area with requests from 4KiB up to the maximum
+ * transfer size, either blocking or non-blocking, to measure the gain of
+ * preparing the next request while the current one is in progress.
+ */
+static int mmc_test_rw_multiple(struct mmc_test_card *test, int write,
+				bool nonblock)
+{
+	struct mmc_test_area *t = &test->area;
+	unsigned long sz;
+	int ret;
+
+	for (sz = 4096; sz <= t->max_tfr; sz <<= 1) {
+		if (write) {
+			ret = mmc_test_area_erase(test);
+			if (ret)
+				return ret;
+		}
+		ret = mmc_test_area_io_seq(test, sz, t->dev_addr, write, 0, 1,
+					   t->max_sz / sz, nonblock);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/*
+ * Write performance with blocking requests.
+ */
+static int mmc_test_profile_write_blocking_perf(struct mmc_test_card *test)
+{
+	return mmc_test_rw_multiple(test, 1, false);
+}
+
+/*
+ * Write performance with non-blocking requests.
+ */
+static int mmc_test_profile_write_nonblock_perf(struct mmc_test_card *test)
+{
+	return mmc_test_rw_multiple(test, 1, true);
+}
+
+/*
+ * Read performance with blocking requests.
+ */
+static int mmc_test_profile_read_blocking_perf(struct mmc_test_card *test)
+{
+	return mmc_test_rw_multiple(test, 0, false);
+}
+
+/*
+ * Read performance with non-blocking requests.
+ */
+static int mmc_test_profile_read_nonblock_perf(struct mmc_test_card *test)
+{
+	return mmc_test_rw_multiple(test, 0, true);
+}
+
 static const struct mmc_test_case mmc_test_cases[] = {
 	{
 		.name = "Basic write (no data verification)",
@@ -2221,6 +2385,34 @@ static const struct mmc_test_case mmc_test_cases[] = {
 		.cleanup = mmc_test_area_cleanup,
 	},
 
+	{
+		.name = "Write performance with blocking req 4k to max",
+		.prepare = mmc_test_area_prepare,
+		.run = mmc_test_profile_write_blocking_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
+	{
+		.name = "Write performance with non-blocking req 4k to max",
+		.prepare = mmc_test_area_prepare,
+		.run = mmc_test_profile_write_nonblock_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
+	{
+		.name = "Read performance with blocking req 4k to max",
+		.prepare = mmc_test_area_prepare_fill,
+		.run = mmc_test_profile_read_blocking_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
+	{
+		.name = "Read performance with non-blocking req 4k to max",
+		.prepare = mmc_test_area_prepare_fill,
+		.run = mmc_test_profile_read_nonblock_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
 };
 
 static DEFINE_MUTEX(mmc_test_lock);
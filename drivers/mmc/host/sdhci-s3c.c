@@ -521,6 +521,12 @@ static int __devinit sdhci_s3c_probe(struct platform_device *pdev)
 	host->quirks |= (SDHCI_QUIRK_32BIT_DMA_ADDR |
 			 SDHCI_QUIRK_32BIT_DMA_SIZE);
 
+	/*
+	 * Without ADMA, chain SDMA across scatterlist entries so that the
+	 * block layer does not have to bounce every request.
+	 */
+	host->quirks2 |= SDHCI_QUIRK2_SDMA_SG;
+
 	/* HSMMC on Samsung SoCs uses SDCLK as timeout clock */
 	host->quirks |= SDHCI_QUIRK_DATA_TIMEOUT_USES_SDCLK;
 
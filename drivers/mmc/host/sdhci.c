@@ -419,6 +419,94 @@ static void sdhci_set_adma_desc(u8 *desc, u32 addr, int len, unsigned cmd)
 	dataddr[0] = cpu_to_le32(addr);
 }
 
+/*
+ * Check whether @data can be transferred by the DMA engine in use, or
+ * whether the controller quirks force a fallback to PIO.
+ */
+static bool sdhci_data_dma_capable(struct sdhci_host *host,
+	struct mmc_data *data)
+{
+	struct scatterlist *sg;
+	int i;
+
+	/*
+	 * FIXME: This doesn't account for merging when mapping the
+	 * scatterlist.
+	 */
+	if ((host->flags & SDHCI_USE_ADMA) ?
+	    (host->quirks & SDHCI_QUIRK_32BIT_ADMA_SIZE) :
+	    (host->quirks & SDHCI_QUIRK_32BIT_DMA_SIZE)) {
+		for_each_sg(data->sg, sg, data->sg_len, i) {
+			if (sg->length & 0x3) {
+				DBG("Reverting to PIO because of "
+					"transfer size (%d)\n",
+					sg->length);
+				return false;
+			}
+		}
+	}
+
+	/*
+	 * The assumption here being that alignment is the same after
+	 * translation to device address space.
+	 *
+	 * As ADMA uses 3 byte chunks to work around alignment problems,
+	 * we need to check the size quirk there too.
+	 */
+	if ((host->flags & SDHCI_USE_ADMA) ?
+	    (host->quirks & SDHCI_QUIRK_32BIT_ADMA_SIZE) :
+	    (host->quirks & SDHCI_QUIRK_32BIT_DMA_ADDR)) {
+		for_each_sg(data->sg, sg, data->sg_len, i) {
+			if (sg->offset & 0x3) {
+				DBG("Reverting to PIO because of "
+					"bad alignment\n");
+				return false;
+			}
+		}
+	}
+
+	/*
+	 * Chained SDMA can only move on to the next entry when the engine
+	 * pauses at a buffer boundary, so every entry but the last has to
+	 * end on one.
+	 */
+	if (!(host->flags & SDHCI_USE_ADMA) && data->sg_len > 1) {
+		for_each_sg(data->sg, sg, data->sg_len - 1, i) {
+			if ((sg->offset + sg->length) &
+			    (SDHCI_SG_BOUNDARY_SIZE - 1)) {
+				DBG("Reverting to PIO because of "
+					"unchainable sg entry\n");
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Map @data for DMA and return the number of mapped entries, or -EINVAL.
+ * Requests already mapped by sdhci_pre_req() carry the mapped entry count
+ * in host_cookie, and are unmapped by sdhci_post_req() rather than when
+ * the transfer finishes.
+ */
+static int sdhci_pre_dma_transfer(struct sdhci_host *host,
+	struct mmc_data *data)
+{
+	int sg_count;
+
+	if (data->host_cookie)
+		return data->host_cookie;
+
+	sg_count = dma_map_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+			(data->flags & MMC_DATA_READ) ?
+				DMA_FROM_DEVICE : DMA_TO_DEVICE);
+	if (sg_count == 0)
+		return -EINVAL;
+
+	return sg_count;
+}
+
 static int sdhci_adma_table_pre(struct sdhci_host *host,
 	struct mmc_data *data)
 {
@@ -456,9 +544,8 @@ static int sdhci_adma_table_pre(struct sdhci_host *host,
 		goto fail;
 	BUG_ON(host->align_addr & 0x3);
 
-	host->sg_count = dma_map_sg(mmc_dev(host->mmc),
-		data->sg, data->sg_len, direction);
-	if (host->sg_count == 0)
+	host->sg_count = sdhci_pre_dma_transfer(host, data);
+	if (host->sg_count < 0)
 		goto unmap_align;
 
 	desc = host->adma_desc;
@@ -547,8 +634,9 @@ static int sdhci_adma_table_pre(struct sdhci_host *host,
 	return 0;
 
 unmap_entries:
-	dma_unmap_sg(mmc_dev(host->mmc), data->sg,
-		data->sg_len, direction);
+	if (!data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg,
+			data->sg_len, direction);
 unmap_align:
 	dma_unmap_single(mmc_dev(host->mmc), host->align_addr,
 		128 * 4, direction);
@@ -598,8 +686,9 @@ static void sdhci_adma_table_post(struct sdhci_host *host,
 		}
 	}
 
-	dma_unmap_sg(mmc_dev(host->mmc), data->sg,
-		data->sg_len, direction);
+	if (!data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg,
+			data->sg_len, direction);
 }
 
 static u8 sdhci_calc_timeout(struct sdhci_host *host, struct mmc_command *cmd)
@@ -697,72 +786,12 @@ static void sdhci_prepare_data(struct sdhci_host *host, struct mmc_command *cmd)
 	host->data_early = 0;
 	host->data->bytes_xfered = 0;
 
-	if (host->flags & (SDHCI_USE_SDMA | SDHCI_USE_ADMA))
+	host->flags &= ~SDHCI_REQ_USE_DMA;
+	if ((host->flags & (SDHCI_USE_SDMA | SDHCI_USE_ADMA)) &&
+	    sdhci_data_dma_capable(host, data))
 		host->flags |= SDHCI_REQ_USE_DMA;
 
-	/*
-	 * FIXME: This doesn't account for merging when mapping the
-	 * scatterlist.
-	 */
-	if (host->flags & SDHCI_REQ_USE_DMA) {
-		int broken, i;
-		struct scatterlist *sg;
-
-		broken = 0;
-		if (host->flags & SDHCI_USE_ADMA) {
-			if (host->quirks & SDHCI_QUIRK_32BIT_ADMA_SIZE)
-				broken = 1;
-		} else {
-			if (host->quirks & SDHCI_QUIRK_32BIT_DMA_SIZE)
-				broken = 1;
-		}
-
-		if (unlikely(broken)) {
-			for_each_sg(data->sg, sg, data->sg_len, i) {
-				if (sg->length & 0x3) {
-					DBG("Reverting to PIO because of "
-						"transfer size (%d)\n",
-						sg->length);
-					host->flags &= ~SDHCI_REQ_USE_DMA;
-					break;
-				}
-			}
-		}
-	}
-
-	/*
-	 * The assumption here being that alignment is the same after
-	 * translation to device address space.
-	 */
-	if (host->flags & SDHCI_REQ_USE_DMA) {
-		int broken, i;
-		struct scatterlist *sg;
-
-		broken = 0;
-		if (host->flags & SDHCI_USE_ADMA) {
-			/*
-			 * As we use 3 byte chunks to work around
-			 * alignment problems, we need to check this
-			 * quirk.
-			 */
-			if (host->quirks & SDHCI_QUIRK_32BIT_ADMA_SIZE)
-				broken = 1;
-		} else {
-			if (host->quirks & SDHCI_QUIRK_32BIT_DMA_ADDR)
-				broken = 1;
-		}
-
-		if (unlikely(broken)) {
-			for_each_sg(data->sg, sg, data->sg_len, i) {
-				if (sg->offset & 0x3) {
-					DBG("Reverting to PIO because of "
-						"bad alignment\n");
-					host->flags &= ~SDHCI_REQ_USE_DMA;
-					break;
-				}
-			}
-		}
-	}
+	host->sdma_boundary = SDHCI_DEFAULT_BOUNDARY_SIZE;
 
 	if (host->flags & SDHCI_REQ_USE_DMA) {
 		if (host->flags & SDHCI_USE_ADMA) {
@@ -781,12 +810,8 @@ static void sdhci_prepare_data(struct sdhci_host *host, struct mmc_command *cmd)
 		} else {
 			int sg_cnt;
 
-			sg_cnt = dma_map_sg(mmc_dev(host->mmc),
-					data->sg, data->sg_len,
-					(data->flags & MMC_DATA_READ) ?
-						DMA_FROM_DEVICE :
-						DMA_TO_DEVICE);
-			if (sg_cnt == 0) {
+			sg_cnt = sdhci_pre_dma_transfer(host, data);
+			if (sg_cnt <= 0) {
 				/*
 				 * This only happens when someone fed
 				 * us an invalid request.
@@ -794,8 +819,19 @@ static void sdhci_prepare_data(struct sdhci_host *host, struct mmc_command *cmd)
 				WARN_ON(1);
 				host->flags &= ~SDHCI_REQ_USE_DMA;
 			} else {
-				WARN_ON(sg_cnt != 1);
-				sdhci_writel(host, sg_dma_address(data->sg),
+				WARN_ON(sg_cnt != 1 &&
+					!(host->flags & SDHCI_USE_SDMA_SG));
+				/*
+				 * The small boundary costs a DMA interrupt
+				 * per 4K, only pay for it when chaining.
+				 */
+				if (sg_cnt > 1)
+					host->sdma_boundary =
+						SDHCI_SG_BOUNDARY_SIZE;
+				host->sdma_sg = data->sg;
+				host->sdma_left = sg_cnt;
+				host->sdma_addr = sg_dma_address(data->sg);
+				sdhci_writel(host, host->sdma_addr,
 					SDHCI_DMA_ADDRESS);
 			}
 		}
@@ -832,7 +868,7 @@ static void sdhci_prepare_data(struct sdhci_host *host, struct mmc_command *cmd)
 	sdhci_set_transfer_irqs(host);
 
 	/* Set the DMA boundary value and block size */
-	sdhci_writew(host, SDHCI_MAKE_BLKSZ(SDHCI_DEFAULT_BOUNDARY_ARG,
+	sdhci_writew(host, SDHCI_MAKE_BLKSZ((ilog2(host->sdma_boundary) - 12),
 		data->blksz), SDHCI_BLOCK_SIZE);
 	sdhci_writew(host, data->blocks, SDHCI_BLOCK_COUNT);
 }
@@ -883,7 +919,7 @@ static void sdhci_finish_data(struct sdhci_host *host)
 	if (host->flags & SDHCI_REQ_USE_DMA) {
 		if (host->flags & SDHCI_USE_ADMA)
 			sdhci_adma_table_post(host, data);
-		else {
+		else if (!data->host_cookie) {
 			dma_unmap_sg(mmc_dev(host->mmc), data->sg,
 				data->sg_len, (data->flags & MMC_DATA_READ) ?
 					DMA_FROM_DEVICE : DMA_TO_DEVICE);
@@ -1267,6 +1303,44 @@ static void sdhci_request(struct mmc_host *mmc, struct mmc_request *mrq)
 	spin_unlock_irqrestore(&host->lock, flags);
 }
 
+/*
+ * Map the data of the next request for DMA while the current one is still
+ * on the bus, so that the cache maintenance is off the critical path.
+ */
+static void sdhci_pre_req(struct mmc_host *mmc, struct mmc_request *mrq,
+	bool is_first_req)
+{
+	struct sdhci_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+	int sg_count;
+
+	if (!data || data->host_cookie)
+		return;
+
+	if (!(host->flags & (SDHCI_USE_SDMA | SDHCI_USE_ADMA)) ||
+	    !sdhci_data_dma_capable(host, data))
+		return;
+
+	sg_count = sdhci_pre_dma_transfer(host, data);
+	if (sg_count > 0)
+		data->host_cookie = sg_count;
+}
+
+static void sdhci_post_req(struct mmc_host *mmc, struct mmc_request *mrq,
+	int err)
+{
+	struct sdhci_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+
+	if (!data || !data->host_cookie)
+		return;
+
+	dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+		(data->flags & MMC_DATA_READ) ?
+			DMA_FROM_DEVICE : DMA_TO_DEVICE);
+	data->host_cookie = 0;
+}
+
 static void sdhci_set_ios(struct mmc_host *mmc, struct mmc_ios *ios)
 {
 	struct sdhci_host *host;
@@ -1799,6 +1873,8 @@ static void sdhci_enable_preset_value(struct mmc_host *mmc, bool enable)
 }
 
 static const struct mmc_host_ops sdhci_ops = {
+	.pre_req	= sdhci_pre_req,
+	.post_req	= sdhci_post_req,
 	.request	= sdhci_request,
 	.set_ios	= sdhci_set_ios,
 	.get_ro		= sdhci_get_ro,
@@ -2033,6 +2109,39 @@ static void sdhci_show_adma_error(struct sdhci_host *host)
 static void sdhci_show_adma_error(struct sdhci_host *host) { }
 #endif
 
+/*
+ * The SDMA engine pauses at every buffer boundary and has to be restarted
+ * with the address to continue from.
+ *
+ * According to the spec sdhci_readl(host, SDHCI_DMA_ADDRESS) should return
+ * a valid address to continue from, but as some controllers are faulty,
+ * don't trust them: the engine stopped at the first boundary past the
+ * address it was last started at.  Continue from there, or, if that
+ * boundary ends the current sg entry, from the start of the next entry.
+ */
+static void sdhci_sdma_restart(struct sdhci_host *host)
+{
+	u32 boundary = host->sdma_boundary;
+	u32 seg_end, dmanow;
+
+	seg_end = sg_dma_address(host->sdma_sg) + sg_dma_len(host->sdma_sg);
+	dmanow = (host->sdma_addr & ~(boundary - 1)) + boundary;
+
+	if (dmanow >= seg_end && host->sdma_left > 1) {
+		WARN_ON_ONCE(dmanow != seg_end);
+		host->sdma_sg = sg_next(host->sdma_sg);
+		host->sdma_left--;
+		dmanow = sg_dma_address(host->sdma_sg);
+	}
+
+	DBG("%s: DMA paused at 0x%08x, next 0x%08x, %d sg entries left\n",
+		mmc_hostname(host->mmc), host->sdma_addr, dmanow,
+		host->sdma_left);
+
+	host->sdma_addr = dmanow;
+	sdhci_writel(host, dmanow, SDHCI_DMA_ADDRESS);
+}
+
 static void sdhci_data_irq(struct sdhci_host *host, u32 intmask)
 {
 	BUG_ON(intmask == 0);
@@ -2088,32 +2197,8 @@ static void sdhci_data_irq(struct sdhci_host *host, u32 intmask)
 		if (intmask & (SDHCI_INT_DATA_AVAIL | SDHCI_INT_SPACE_AVAIL))
 			sdhci_transfer_pio(host);
 
-		/*
-		 * We currently don't do anything fancy with DMA
-		 * boundaries, but as we can't disable the feature
-		 * we need to at least restart the transfer.
-		 *
-		 * According to the spec sdhci_readl(host, SDHCI_DMA_ADDRESS)
-		 * should return a valid address to continue from, but as
-		 * some controllers are faulty, don't trust them.
-		 */
-		if (intmask & SDHCI_INT_DMA_END) {
-			u32 dmastart, dmanow;
-			dmastart = sg_dma_address(host->data->sg);
-			dmanow = dmastart + host->data->bytes_xfered;
-			/*
-			 * Force update to the next DMA block boundary.
-			 */
-			dmanow = (dmanow &
-				~(SDHCI_DEFAULT_BOUNDARY_SIZE - 1)) +
-				SDHCI_DEFAULT_BOUNDARY_SIZE;
-			host->data->bytes_xfered = dmanow - dmastart;
-			DBG("%s: DMA base 0x%08x, transferred 0x%06x bytes,"
-				" next 0x%08x\n",
-				mmc_hostname(host->mmc), dmastart,
-				host->data->bytes_xfered, dmanow);
-			sdhci_writel(host, dmanow, SDHCI_DMA_ADDRESS);
-		}
+		if (intmask & SDHCI_INT_DMA_END)
+			sdhci_sdma_restart(host);
 
 		if (intmask & SDHCI_INT_DATA_END) {
 			if (host->cmd) {
@@ -2406,6 +2491,12 @@ int sdhci_add_host(struct sdhci_host *host)
 		}
 	}
 
+	/* Without ADMA, scatter/gather can still be had by chaining SDMA */
+	if ((host->quirks2 & SDHCI_QUIRK2_SDMA_SG) &&
+		(host->flags & SDHCI_USE_SDMA) &&
+		!(host->flags & SDHCI_USE_ADMA))
+		host->flags |= SDHCI_USE_SDMA_SG;
+
 	/*
 	 * If we use DMA, then it's up to the caller to set the DMA
 	 * mask, but PIO does not need the hw shim so we set a new
@@ -2642,6 +2733,8 @@ int sdhci_add_host(struct sdhci_host *host)
 	 */
 	if (host->flags & SDHCI_USE_ADMA)
 		mmc->max_segs = 128;
+	else if (host->flags & SDHCI_USE_SDMA_SG)
+		mmc->max_segs = 128;
 	else if (host->flags & SDHCI_USE_SDMA)
 		mmc->max_segs = 1;
 	else /* PIO */
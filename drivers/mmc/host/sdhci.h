@@ -249,6 +249,13 @@
 #define SDHCI_DEFAULT_BOUNDARY_SIZE  (512 * 1024)
 #define SDHCI_DEFAULT_BOUNDARY_ARG   (ilog2(SDHCI_DEFAULT_BOUNDARY_SIZE) - 12)
 
+/*
+ * Boundary used for requests which chain SDMA across sg entries: every
+ * entry but the last has to end on it, which page cache I/O does at 4K.
+ * Single entry requests keep the default boundary.
+ */
+#define SDHCI_SG_BOUNDARY_SIZE       (4 * 1024)
+
 struct sdhci_ops {
 #ifdef CONFIG_MMC_SDHCI_IO_ACCESSORS
 	u32		(*read_l)(struct sdhci_host *host, int reg);
@@ -34,6 +34,8 @@
 #include <linux/sort.h>
 #include <linux/bsearch.h>
 #include <linux/suspend.h>
+#include <linux/workqueue.h>
+#include <linux/moduleparam.h>
 
 #include <linux/mtd/partitions.h>
 #include <linux/mtd/bml.h>
@@ -96,14 +98,26 @@ struct bml_map_info {
 	struct bml_map_entry	table[];
 };
 
+struct bml_cache_entry {
+	struct list_head lru;
+	unsigned char *data;
+	unsigned long offset;
+	enum { STATE_EMPTY, STATE_CLEAN, STATE_DIRTY } state;
+};
+
 struct bml_dev {
 	struct mtd_blktrans_dev mbd;
+	struct list_head list;
 	int count;
 	struct mutex cache_mutex;
-	unsigned char *cache_data;
-	unsigned long cache_offset;
+	struct bml_cache_entry *cache;
+	struct list_head cache_lru;	/* most recently used first */
 	unsigned int cache_size;
-	enum { STATE_EMPTY, STATE_CLEAN, STATE_DIRTY } cache_state;
+	struct delayed_work flush_work;
+	unsigned char *ra_data;
+	unsigned long ra_offset;
+	unsigned int ra_len;
+	unsigned long ra_next;
 	unsigned long *bad_bitmap;
 	size_t offset;
 };
@@ -111,6 +125,19 @@ struct bml_dev {
 static struct bml_map_info *bml_map_info;
 static const struct bml_platform_data *bml_pdata;
 static struct mutex bmls_lock;
+static LIST_HEAD(bml_devs);
+
+static unsigned int cache_blocks = 4;
+module_param(cache_blocks, uint, 0444);
+MODULE_PARM_DESC(cache_blocks, "Number of erase blocks cached per device");
+
+static unsigned int flush_delay_ms = 3000;
+module_param(flush_delay_ms, uint, 0644);
+MODULE_PARM_DESC(flush_delay_ms, "Time dirty blocks are kept before write back");
+
+static unsigned int readahead_kb = 64;
+module_param(readahead_kb, uint, 0444);
+MODULE_PARM_DESC(readahead_kb, "Size of sequential read-ahead, 0 to disable");
 
 /*
  * BML stuff...
@@ -592,49 +619,208 @@ static int build_bad_bitmap(struct bml_dev *bml)
  * Since typical flash erasable sectors are much larger than what Linux's
  * buffer cache can handle, we must implement read-modify-write on flash
  * sectors for each block write requests.  To avoid over-erasing flash sectors
- * and to speed things up, we locally cache a whole flash sector while it is
- * being written to until a different sector is required.
+ * and to speed things up, we locally cache a few whole flash sectors, so
+ * that writes interleaved between them are merged, and write them back
+ * when evicted, after flush_delay_ms or when the device is flushed.
+ *
+ * Reads not covered by the cache go through a read-ahead buffer, which
+ * grows from a single page to readahead_kb for sequential accesses.
  */
 
-static int write_cached_data (struct bml_dev *bmldev)
+static void bml_ra_invalidate(struct bml_dev *bmldev, unsigned long pos,
+								int len)
+{
+	if (pos < bmldev->ra_offset + bmldev->ra_len &&
+	    pos + len > bmldev->ra_offset)
+		bmldev->ra_len = 0;
+}
+
+static int write_cached_entry(struct bml_dev *bmldev,
+						struct bml_cache_entry *entry)
 {
 	struct mtd_info *mtd = bmldev->mbd.mtd;
 	int ret;
 
-	if (bmldev->cache_state != STATE_DIRTY)
+	if (entry->state != STATE_DIRTY)
 		return 0;
 
 	DEBUG(MTD_DEBUG_LEVEL2, "bml: writing cached data for \"%s\" "
 			"at 0x%lx, size 0x%x\n", mtd->name,
-			bmldev->cache_offset, bmldev->cache_size);
+			entry->offset, bmldev->cache_size);
 
-	ret = bml_erase_write (bmldev, bmldev->cache_offset,
-			   bmldev->cache_size, bmldev->cache_data);
+	ret = bml_erase_write (bmldev, entry->offset,
+			   bmldev->cache_size, entry->data);
+	bml_ra_invalidate(bmldev, entry->offset, bmldev->cache_size);
 	if (ret)
 		return ret;
 
 	/*
-	 * Here we could arguably set the cache state to STATE_CLEAN.
-	 * However this could lead to inconsistency since we will not
-	 * be notified if this content is altered on the flash by other
-	 * means.  Let's declare it empty and leave buffering tasks to
-	 * the buffer cache instead.
+	 * The entry now matches the flash, so keep it as a clean copy
+	 * rather than dropping it: the next partial write to this sector
+	 * then needs no read.  Content altered on the flash by other means
+	 * would not be noticed, but the cache only lives while the device
+	 * is open, and all writes through it are serialised by cache_mutex.
 	 */
-	bmldev->cache_state = STATE_EMPTY;
+	entry->state = STATE_CLEAN;
+	return 0;
+}
+
+/* Write back all dirty sectors, in flash order */
+static int write_cached_data (struct bml_dev *bmldev)
+{
+	struct bml_cache_entry *entry, *next;
+	int ret;
+
+	if (!bmldev->cache)
+		return 0;
+
+	do {
+		next = NULL;
+		list_for_each_entry(entry, &bmldev->cache_lru, lru)
+			if (entry->state == STATE_DIRTY &&
+			    (!next || entry->offset < next->offset))
+				next = entry;
+
+		if (next) {
+			ret = write_cached_entry(bmldev, next);
+			if (ret)
+				return ret;
+		}
+	} while (next);
+
 	return 0;
 }
 
+static void bml_flush_work(struct work_struct *work)
+{
+	struct bml_dev *bmldev =
+		container_of(to_delayed_work(work), struct bml_dev, flush_work);
+
+	mutex_lock(&bmldev->cache_mutex);
+	write_cached_data(bmldev);
+	mutex_unlock(&bmldev->cache_mutex);
+}
+
+static struct bml_cache_entry *bml_cache_find(struct bml_dev *bmldev,
+						unsigned long sect_start)
+{
+	struct bml_cache_entry *entry;
+
+	list_for_each_entry(entry, &bmldev->cache_lru, lru)
+		if (entry->state != STATE_EMPTY &&
+		    entry->offset == sect_start)
+			return entry;
+
+	return NULL;
+}
+
+/* Get the cache entry of a sector, evicting the least recently used one */
+static struct bml_cache_entry *bml_cache_get(struct bml_dev *bmldev,
+						unsigned long sect_start)
+{
+	struct bml_cache_entry *entry;
+	int ret;
+
+	entry = bml_cache_find(bmldev, sect_start);
+	if (entry)
+		goto found;
+
+	entry = list_entry(bmldev->cache_lru.prev,
+					struct bml_cache_entry, lru);
+	ret = write_cached_entry(bmldev, entry);
+	if (ret)
+		return ERR_PTR(ret);
+
+	entry->state = STATE_EMPTY;
+	if (!entry->data) {
+		entry->data = vmalloc(bmldev->cache_size);
+		if (!entry->data)
+			return ERR_PTR(-ENOMEM);
+	}
+
+	/* fill the cache with the current sector */
+	ret = bml_read(bmldev, sect_start, bmldev->cache_size, entry->data);
+	if (ret)
+		return ERR_PTR(ret);
+
+	entry->offset = sect_start;
+	entry->state = STATE_CLEAN;
+
+	/* reads of this sector are served from the cache from now on */
+	bml_ra_invalidate(bmldev, sect_start, bmldev->cache_size);
+
+found:
+	list_move(&entry->lru, &bmldev->cache_lru);
+	return entry;
+}
+
+static int bml_read_ahead(struct bml_dev *bmldev, unsigned long pos,
+						int len, char *buf)
+{
+	struct mtd_info *mtd = bmldev->mbd.mtd;
+	unsigned long start, end;
+	unsigned int size;
+	int ret;
+
+	if (pos >= bmldev->ra_offset &&
+	    pos + len <= bmldev->ra_offset + bmldev->ra_len)
+		goto hit;
+
+	/* A page costs as much to read as a sector */
+	size = max_t(unsigned int, mtd->writesize, BML_SECT_SIZE);
+	if (pos == bmldev->ra_next)
+		size = readahead_kb * 1024;
+
+	start = rounddown(pos, max_t(unsigned int, mtd->writesize, 1));
+	if (size > mtd->size - start)
+		size = mtd->size - start;
+
+	/*
+	 * Never read ahead into a sector held in the cache: a dirty one
+	 * has newer data than the flash.  The sector of @pos is not cached
+	 * (do_cached_read checked), so extend the window sector by sector
+	 * and stop at the first cached one.
+	 */
+	end = roundup(pos + 1, bmldev->cache_size);
+	while (end < start + size && !bml_cache_find(bmldev, end))
+		end += bmldev->cache_size;
+	if (size > end - start)
+		size = end - start;
+
+	/* ra_data holds readahead_kb, which may be less than a page */
+	if (size > readahead_kb * 1024)
+		size = readahead_kb * 1024;
+
+	if (!bmldev->ra_data || pos + len > start + size)
+		return bml_read(bmldev, pos, len, buf);
+
+	bmldev->ra_len = 0;
+	ret = bml_read(bmldev, start, size, bmldev->ra_data);
+	if (ret)
+		return ret;
+
+	bmldev->ra_offset = start;
+	bmldev->ra_len = size;
+
+hit:
+	memcpy(buf, bmldev->ra_data + (pos - bmldev->ra_offset), len);
+	bmldev->ra_next = pos + len;
+	return 0;
+}
 
 static int do_cached_write (struct bml_dev *bmldev, unsigned long pos,
 			    int len, const char *buf)
 {
 	struct mtd_info *mtd = bmldev->mbd.mtd;
 	unsigned int sect_size = bmldev->cache_size;
+	struct bml_cache_entry *entry;
 	int ret;
 
 	DEBUG(MTD_DEBUG_LEVEL2, "bml: write on \"%s\" at 0x%lx, size 0x%x\n",
 		mtd->name, pos, len);
 
+	bml_ra_invalidate(bmldev, pos, len);
+
 	while (len > 0) {
 		unsigned long sect_start = (pos/sect_size)*sect_size;
 		unsigned int offset = pos - sect_start;
@@ -642,7 +828,8 @@ static int do_cached_write (struct bml_dev *bmldev, unsigned long pos,
 		if( size > len )
 			size = len;
 
-		if (size == sect_size) {
+		entry = bml_cache_find(bmldev, sect_start);
+		if (size == sect_size && !entry) {
 			/*
 			 * We are covering a whole sector.  Thus there is no
 			 * need to bother with the cache while it may still be
@@ -653,31 +840,17 @@ static int do_cached_write (struct bml_dev *bmldev, unsigned long pos,
 				return ret;
 		} else {
 			/* Partial sector: need to use the cache */
-
-			if (bmldev->cache_state == STATE_DIRTY &&
-			    bmldev->cache_offset != sect_start) {
-				ret = write_cached_data(bmldev);
-				if (ret)
-					return ret;
-			}
-
-			if (bmldev->cache_state == STATE_EMPTY ||
-			    bmldev->cache_offset != sect_start) {
-				/* fill the cache with the current sector */
-				bmldev->cache_state = STATE_EMPTY;
-				ret = bml_read(bmldev, sect_start, sect_size,
-							bmldev->cache_data);
-				if (ret)
-					return ret;
-
-				bmldev->cache_offset = sect_start;
-				bmldev->cache_size = sect_size;
-				bmldev->cache_state = STATE_CLEAN;
-			}
+			entry = bml_cache_get(bmldev, sect_start);
+			if (IS_ERR(entry))
+				return PTR_ERR(entry);
 
 			/* write data to our local cache */
-			memcpy (bmldev->cache_data + offset, buf, size);
-			bmldev->cache_state = STATE_DIRTY;
+			memcpy (entry->data + offset, buf, size);
+			entry->state = STATE_DIRTY;
+
+			/* no-op if already pending */
+			schedule_delayed_work(&bmldev->flush_work,
+					msecs_to_jiffies(flush_delay_ms));
 		}
 
 		buf += size;
@@ -694,6 +867,7 @@ static int do_cached_read (struct bml_dev *bmldev, unsigned long pos,
 {
 	struct mtd_info *mtd = bmldev->mbd.mtd;
 	unsigned int sect_size = bmldev->cache_size;
+	struct bml_cache_entry *entry;
 	int ret;
 
 	DEBUG(MTD_DEBUG_LEVEL2, "bml: read on \"%s\" at 0x%lx, size 0x%x\n",
@@ -709,14 +883,15 @@ static int do_cached_read (struct bml_dev *bmldev, unsigned long pos,
 		/*
 		 * Check if the requested data is already cached
 		 * Read the requested amount of data from our internal cache if it
-		 * contains what we want, otherwise we read the data directly
-		 * from flash.
+		 * contains what we want, otherwise we read the data through
+		 * the read-ahead buffer.
 		 */
-		if (bmldev->cache_state != STATE_EMPTY &&
-		    bmldev->cache_offset == sect_start) {
-			memcpy (buf, bmldev->cache_data + offset, size);
+		entry = bml_cache_find(bmldev, sect_start);
+		if (entry) {
+			memcpy (buf, entry->data + offset, size);
+			list_move(&entry->lru, &bmldev->cache_lru);
 		} else {
-			ret = bml_read(bmldev, pos, size, buf);
+			ret = bml_read_ahead(bmldev, pos, size, buf);
 			if (ret)
 				return ret;
 		}
@@ -729,27 +904,70 @@ static int do_cached_read (struct bml_dev *bmldev, unsigned long pos,
 	return 0;
 }
 
+static int bml_cache_init(struct bml_dev *bmldev)
+{
+	int i;
+
+	INIT_LIST_HEAD(&bmldev->cache_lru);
+	bmldev->cache_size = bmldev->mbd.mtd->erasesize;
+
+	/* Sector data is allocated on first use */
+	bmldev->cache = kcalloc(max(cache_blocks, 1U),
+				sizeof(*bmldev->cache), GFP_KERNEL);
+	if (!bmldev->cache)
+		return -ENOMEM;
+
+	for (i = 0; i < max(cache_blocks, 1U); ++i)
+		list_add_tail(&bmldev->cache[i].lru, &bmldev->cache_lru);
+
+	bmldev->ra_len = 0;
+	bmldev->ra_next = 0;
+	if (readahead_kb)
+		bmldev->ra_data = vmalloc(readahead_kb * 1024);
+
+	return 0;
+}
+
+static void bml_cache_free(struct bml_dev *bmldev)
+{
+	int i;
+
+	if (!bmldev->cache)
+		return;
+
+	for (i = 0; i < max(cache_blocks, 1U); ++i)
+		vfree(bmldev->cache[i].data);
+	kfree(bmldev->cache);
+	bmldev->cache = NULL;
+
+	vfree(bmldev->ra_data);
+	bmldev->ra_data = NULL;
+}
+
 static int bml_readsect(struct mtd_blktrans_dev *dev,
 			      unsigned long block, char *buf)
 {
 	struct bml_dev *bmldev = container_of(dev, struct bml_dev, mbd);
-	return do_cached_read(bmldev, block<<9, 512, buf);
+	int ret;
+
+	mutex_lock(&bmldev->cache_mutex);
+	ret = do_cached_read(bmldev, block<<9, 512, buf);
+	mutex_unlock(&bmldev->cache_mutex);
+
+	return ret;
 }
 
 static int bml_writesect(struct mtd_blktrans_dev *dev,
 			      unsigned long block, char *buf)
 {
 	struct bml_dev *bmldev = container_of(dev, struct bml_dev, mbd);
-	if (unlikely(!bmldev->cache_data)) {
-		bmldev->cache_data = vmalloc(bmldev->mbd.mtd->erasesize);
-		if (!bmldev->cache_data)
-			return -EINTR;
-		/* -EINTR is not really correct, but it is the best match
-		 * documented in man 2 write for all cases.  We could also
-		 * return -EAGAIN sometimes, but why bother?
-		 */
-	}
-	return do_cached_write(bmldev, block<<9, 512, buf);
+	int ret;
+
+	mutex_lock(&bmldev->cache_mutex);
+	ret = do_cached_write(bmldev, block<<9, 512, buf);
+	mutex_unlock(&bmldev->cache_mutex);
+
+	return ret;
 }
 
 static int bml_open(struct mtd_blktrans_dev *mbd)
@@ -767,11 +985,10 @@ static int bml_open(struct mtd_blktrans_dev *mbd)
 	}
 
 	/* OK, it's not open. Create cache info for it */
+	ret = bml_cache_init(bmldev);
+	if (ret)
+		goto error;
 	bmldev->count = 1;
-	mutex_init(&bmldev->cache_mutex);
-	bmldev->cache_state = STATE_EMPTY;
-	bmldev->cache_size = mbd->mtd->erasesize;
-	bmldev->cache_data = NULL;
 	if (unlikely(!bml_map_info))
 		if((ret = build_map_info()) != 0)
 			goto error;
@@ -779,6 +996,10 @@ static int bml_open(struct mtd_blktrans_dev *mbd)
 		ret = build_bad_bitmap(bmldev);
 
 error:
+	if (ret && bmldev->count == 1) {
+		bmldev->count = 0;
+		bml_cache_free(bmldev);
+	}
 	mutex_unlock(&bmls_lock);
 
 	DEBUG(MTD_DEBUG_LEVEL1, "ok\n");
@@ -794,15 +1015,19 @@ static int bml_release(struct mtd_blktrans_dev *mbd)
 
 	mutex_lock(&bmls_lock);
 
-	mutex_lock(&bmldev->cache_mutex);
-	write_cached_data(bmldev);
-	mutex_unlock(&bmldev->cache_mutex);
-
-	if (!--bmldev->count) {
+	if (--bmldev->count) {
+		mutex_lock(&bmldev->cache_mutex);
+		write_cached_data(bmldev);
+		mutex_unlock(&bmldev->cache_mutex);
+	} else {
 		/* It was the last usage. Free the cache */
+		cancel_delayed_work_sync(&bmldev->flush_work);
+		mutex_lock(&bmldev->cache_mutex);
+		write_cached_data(bmldev);
+		bml_cache_free(bmldev);
+		mutex_unlock(&bmldev->cache_mutex);
 		if (mbd->mtd->sync)
 			mbd->mtd->sync(mbd->mtd);
-		vfree(bmldev->cache_data);
 	}
 
 	mutex_unlock(&bmls_lock);
@@ -853,6 +1078,8 @@ static void bml_add_mtd(struct mtd_blktrans_ops *tr, struct mtd_info *mtd)
 	}
 
 	dev->offset = bml_pdata->parts[i].offset;
+	mutex_init(&dev->cache_mutex);
+	INIT_DELAYED_WORK(&dev->flush_work, bml_flush_work);
 
 	dev->mbd.mtd = mtd;
 	dev->mbd.devnum = mtd->index;
@@ -863,16 +1090,29 @@ static void bml_add_mtd(struct mtd_blktrans_ops *tr, struct mtd_info *mtd)
 	if (!(mtd->flags & MTD_WRITEABLE))
 		dev->mbd.readonly = 1;
 
-	if (add_mtd_blktrans_dev(&dev->mbd))
+	if (add_mtd_blktrans_dev(&dev->mbd)) {
 		kfree(dev);
+		return;
+	}
+
+	mutex_lock(&bmls_lock);
+	list_add_tail(&dev->list, &bml_devs);
+	mutex_unlock(&bmls_lock);
 }
 
 static void bml_remove_dev(struct mtd_blktrans_dev *dev)
 {
 	struct bml_dev *bmldev = container_of(dev, struct bml_dev, mbd);
 
+	mutex_lock(&bmls_lock);
+	list_del(&bmldev->list);
+	mutex_unlock(&bmls_lock);
+
 	del_mtd_blktrans_dev(dev);
+	cancel_delayed_work_sync(&bmldev->flush_work);
 
+	/* release() runs once even if the device was opened several times */
+	bml_cache_free(bmldev);
 	vfree(bmldev->bad_bitmap);
 	kfree(bmldev);
 }
@@ -896,10 +1136,24 @@ static int bml_pm_notification(struct notifier_block *nb,
 					unsigned long mode, void *_unused)
 {
 	struct bml_map_entry *entry;
+	struct bml_dev *bmldev;
 	struct mtd_info *mtd;
 	int i;
 
 	switch (mode) {
+	case PM_SUSPEND_PREPARE:
+		/* Do not leave dirty sectors behind */
+		mutex_lock(&bmls_lock);
+		list_for_each_entry(bmldev, &bml_devs, list) {
+			if (!bmldev->count)
+				continue;
+			mutex_lock(&bmldev->cache_mutex);
+			write_cached_data(bmldev);
+			mutex_unlock(&bmldev->cache_mutex);
+		}
+		mutex_unlock(&bmls_lock);
+		break;
+
 	case PM_POST_SUSPEND:
 		if (!bml_map_info) {
 			mtd = get_mtd_device_nm("reservoir");
@@ -1099,6 +1099,51 @@ static int onenand_recover_lsb(struct mtd_info *mtd, loff_t addr, int status)
 	return this->wait(mtd, FL_READING);
 }
 
+/**
+ * onenand_read_ahead - [GENERIC] Start a pipelined read of following pages
+ * @param mtd		MTD device structure
+ * @param from		offset of the next page to be loaded
+ * @param len		number of bytes left to read from @from
+ * @return		1 if the pipelined read was started, otherwise 0
+ *
+ * Tell the chip driver that READ commands for all the pages up to the end
+ * of the block will follow, so it can load the next page into the other
+ * DataRAM while the current one is transferred. A pipelined read never
+ * crosses a block boundary, callers restart it at the start of each block.
+ * Drivers must cancel it when any other command is issued.
+ */
+static int onenand_read_ahead(struct mtd_info *mtd, loff_t from, size_t len)
+{
+	struct onenand_chip *this = mtd->priv;
+	loff_t end;
+
+	if (!this->read_ahead)
+		return 0;
+
+	len += from & (this->writesize - 1);
+	from &= ~((loff_t) this->writesize - 1);
+
+	end = onenand_addr(this, onenand_block(this, from) + 1);
+	if (len > end - from)
+		len = end - from;
+
+	/* Nothing to overlap with */
+	if (len <= this->writesize)
+		return 0;
+
+	return !this->read_ahead(mtd, from, len);
+}
+
+/**
+ * onenand_block_start - [GENERIC] Check if an address starts a block
+ * @param this		OneNAND device structure
+ * @param addr		address to check
+ */
+static inline int onenand_block_start(struct onenand_chip *this, loff_t addr)
+{
+	return onenand_addr(this, onenand_block(this, addr)) == addr;
+}
+
 /**
  * onenand_mlc_read_ops_nolock - MLC OneNAND read main and/or out-of-band
  * @param mtd		MTD device structure
@@ -1119,7 +1164,7 @@ static int onenand_mlc_read_ops_nolock(struct mtd_info *mtd, loff_t from,
 	u_char *oobbuf = ops->oobbuf;
 	int read = 0, column, thislen;
 	int oobread = 0, oobcolumn, thisooblen, oobsize;
-	int ret = 0;
+	int ret = 0, pipelined = 0;
 	int writesize = this->writesize;
 
 	DEBUG(MTD_DEBUG_LEVEL3, "%s: from = 0x%08x, len = %i\n",
@@ -1152,7 +1197,12 @@ static int onenand_mlc_read_ops_nolock(struct mtd_info *mtd, loff_t from,
 		if (column + thislen > writesize)
 			thislen = writesize - column;
 
-		if (!onenand_check_bufferram(mtd, from)) {
+		/* Every page of a pipelined read has to be loaded */
+		if (pipelined || !onenand_check_bufferram(mtd, from)) {
+			if (!pipelined || onenand_block_start(this, from))
+				pipelined = onenand_read_ahead(mtd, from,
+							       len - read);
+
 			this->command(mtd, ONENAND_CMD_READ, from, writesize);
 
 			ret = this->wait(mtd, FL_READING);
@@ -1223,7 +1273,7 @@ static int onenand_read_ops_nolock(struct mtd_info *mtd, loff_t from,
 	u_char *oobbuf = ops->oobbuf;
 	int read = 0, column, thislen;
 	int oobread = 0, oobcolumn, thisooblen, oobsize;
-	int ret = 0, boundary = 0;
+	int ret = 0, boundary = 0, pipelined = 0;
 	int writesize = this->writesize;
 
 	DEBUG(MTD_DEBUG_LEVEL3, "%s: from = 0x%08x, len = %i\n",
@@ -1252,6 +1302,7 @@ static int onenand_read_ops_nolock(struct mtd_info *mtd, loff_t from,
  	/* Do first load to bufferRAM */
  	if (read < len) {
  		if (!onenand_check_bufferram(mtd, from)) {
+			pipelined = onenand_read_ahead(mtd, from, len);
 			this->command(mtd, ONENAND_CMD_READ, from, writesize);
  			ret = this->wait(mtd, FL_READING);
  			onenand_update_bufferram(mtd, from, !ret);
@@ -1269,6 +1320,9 @@ static int onenand_read_ops_nolock(struct mtd_info *mtd, loff_t from,
  		/* If there is more to load then start next load */
  		from += thislen;
  		if (read + thislen < len) {
+			if (!pipelined || onenand_block_start(this, from))
+				pipelined = onenand_read_ahead(mtd, from,
+						len - read - thislen);
 			this->command(mtd, ONENAND_CMD_READ, from, writesize);
  			/*
  			 * Chip boundary handling in DDP
@@ -20,6 +20,9 @@
 #include <linux/module.h>
 #include <linux/init.h>
 #include <linux/vmalloc.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/moduleparam.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/partitions.h>
 #include <linux/mtd/onenand.h>
@@ -62,9 +65,22 @@ static int boundary[] = {
 	CONFIG_FLEXONENAND_SIM_DIE1_BOUNDARY,
 };
 
+static unsigned int load_delay_us;
+module_param(load_delay_us, uint, 0644);
+MODULE_PARM_DESC(load_delay_us, "Simulated page load time in microseconds");
+
+static bool read_ahead = 1;
+module_param(read_ahead, bool, 0644);
+MODULE_PARM_DESC(read_ahead, "Simulate pipelined reads of sequential pages");
+
 struct onenand_flash {
 	void __iomem *base;
 	void __iomem *data;
+
+	/* Pipelined read in progress */
+	unsigned int ra_next;
+	unsigned int ra_pages;
+	ktime_t load_start;
 };
 
 #define ONENAND_CORE(flash)		(flash->data)
@@ -246,6 +262,62 @@ static int onenand_check_overwrite(void *dest, void *src, size_t count)
 	return 0;
 }
 
+/**
+ * onenand_read_ahead - Start a pipelined read
+ * @mtd:		MTD device structure
+ * @from:		offset of the first page
+ * @len:		length of the pipelined read
+ *
+ * Following pages are considered loaded in the background from the time
+ * the previous page was requested.
+ */
+static int onenand_read_ahead(struct mtd_info *mtd, loff_t from, size_t len)
+{
+	struct onenand_chip *this = mtd->priv;
+	struct onenand_flash *flash = this->priv;
+
+	if (!read_ahead)
+		return -EINVAL;
+
+	flash->ra_next = from;
+	flash->ra_pages = len >> this->page_shift;
+	flash->load_start = ktime_get();
+
+	return 0;
+}
+
+/**
+ * onenand_load_delay - Simulate the time to load a page
+ * @this:		OneNAND device structure
+ * @cmd:		The command to be sent
+ * @offset:		The offset to OneNAND Core
+ *
+ * Wait for the part of the load time not hidden by a pipelined read.
+ */
+static void onenand_load_delay(struct onenand_chip *this, int cmd,
+			       unsigned int offset)
+{
+	struct onenand_flash *flash = this->priv;
+	s64 elapsed = 0;
+
+	if (flash->ra_pages) {
+		if (cmd == ONENAND_CMD_READ && offset == flash->ra_next) {
+			elapsed = ktime_us_delta(ktime_get(), flash->load_start);
+			flash->ra_next += this->writesize;
+			flash->ra_pages--;
+		} else
+			flash->ra_pages = 0;
+	}
+
+	if (cmd != ONENAND_CMD_READ && cmd != ONENAND_CMD_READOOB)
+		return;
+
+	if (elapsed < load_delay_us)
+		udelay(load_delay_us - elapsed);
+
+	flash->load_start = ktime_get();
+}
+
 /**
  * onenand_data_handle - Handle OneNAND Core and DataRAM
  * @this:		OneNAND device structure
@@ -410,6 +482,7 @@ static void onenand_command_handle(struct onenand_chip *this, int cmd)
 	if (page != -1)
 		offset += page << this->page_shift;
 
+	onenand_load_delay(this, cmd, offset);
 	onenand_data_handle(this, cmd, dataram, offset);
 
 	onenand_update_interrupt(this, cmd);
@@ -515,6 +588,7 @@ static int __init onenand_sim_init(void)
 
 	/* Override write_word function */
 	info->onenand.write_word = onenand_writew;
+	info->onenand.read_ahead = onenand_read_ahead;
 
 	if (flash_init(&info->flash)) {
 		printk(KERN_ERR "Unable to allocate flash.\n");
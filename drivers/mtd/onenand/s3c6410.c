@@ -123,6 +123,10 @@ struct s3c6410_onenand {
 	void		*page_buf;
 	void		*oob_buf;
 
+	/* Pipelined read in progress */
+	loff_t		ra_next;
+	unsigned int	ra_pages;
+
 	unsigned int	(*mem_addr)(int fba, int fpa, int fsa);
 	unsigned int	(*cmd_map)(unsigned int type, unsigned int val);
 
@@ -378,6 +382,81 @@ static inline void s3c6410_onenand_dummy_write(
 }
 #endif
 
+#ifdef CONFIG_MTD_ONENAND_S3C6410_PIPELINE_READ
+static void s3c6410_onenand_cancel_read_ahead(void)
+{
+	unsigned long timeout = 0x10000;
+	int stat;
+
+	/* Warm reset keeps the lock status of the blocks */
+	s3c6410_onenand_write_reg(ONENAND_MEM_RESET_WARM, MEM_RESET_OFFSET);
+	while (timeout--) {
+		stat = s3c6410_onenand_read_reg(INT_ERR_STAT_OFFSET);
+		if (stat & RST_CMP)
+			break;
+	}
+	stat = s3c6410_onenand_read_reg(INT_ERR_STAT_OFFSET);
+	s3c6410_onenand_write_reg(stat, INT_ERR_ACK_OFFSET);
+
+	onenand->ra_pages = 0;
+}
+
+/*
+ * Pipeline read-ahead: the controller loads the given number of pages,
+ * starting from the given one, alternating between both DataRAMs, so that
+ * loading of the next page overlaps with the transfer of the current one.
+ * The pages must then be read in order through MAP_01.
+ */
+static int s3c6410_onenand_read_ahead(struct mtd_info *mtd, loff_t from,
+							size_t len)
+{
+	struct onenand_chip *this = mtd->priv;
+	unsigned int pages = len >> this->page_shift;
+	int fba, fpa;
+
+	fba = (int) (from >> this->erase_shift);
+	fpa = (int) (from >> this->page_shift);
+	fpa &= this->page_mask;
+
+	/* A pipeline still running must be ended before starting another */
+	if (onenand->ra_pages)
+		s3c6410_onenand_cancel_read_ahead();
+
+	s3c6410_onenand_write_cmd(ONENAND_PIPELINE_READ | pages,
+			CMD_MAP_10(onenand, onenand->mem_addr(fba, fpa, 0)));
+
+	onenand->ra_next = from;
+	onenand->ra_pages = pages;
+
+	return 0;
+}
+
+/*
+ * Any command other than the read of the next pipelined page ends the
+ * pipelined read.
+ */
+static void s3c6410_onenand_check_read_ahead(struct mtd_info *mtd, int cmd,
+								loff_t addr)
+{
+	struct onenand_chip *this = mtd->priv;
+
+	if (!onenand->ra_pages)
+		return;
+
+	addr &= ~((loff_t) this->writesize - 1);
+	if (cmd == ONENAND_CMD_READ && addr == onenand->ra_next) {
+		onenand->ra_next += this->writesize;
+		onenand->ra_pages--;
+		return;
+	}
+
+	s3c6410_onenand_cancel_read_ahead();
+}
+#else
+static inline void s3c6410_onenand_check_read_ahead(struct mtd_info *mtd,
+						int cmd, loff_t addr) {}
+#endif
+
 static int s3c6410_onenand_command(struct mtd_info *mtd, int cmd, loff_t addr,
 			       size_t len)
 {
@@ -396,6 +475,8 @@ static int s3c6410_onenand_command(struct mtd_info *mtd, int cmd, loff_t addr,
 	cmd_map_01 = CMD_MAP_01(onenand, mem_addr);
 	cmd_map_10 = CMD_MAP_10(onenand, mem_addr);
 
+	s3c6410_onenand_check_read_ahead(mtd, cmd, addr);
+
 	switch (cmd) {
 	case ONENAND_CMD_READ:
 	case ONENAND_CMD_READOOB:
@@ -533,6 +614,21 @@ static int s3c6410_onenand_wait(struct mtd_info *mtd, int state)
 		break;
 	}
 
+	/*
+	 * Within a pipelined read the data has already been transferred
+	 * and completion is only signalled after the last page.
+	 */
+	if (state == FL_READING && onenand->ra_pages) {
+		ecc = s3c6410_onenand_read_reg(ECC_ERR_STAT_OFFSET);
+		if (ecc & ONENAND_ECC_4BIT_UNCORRECTABLE) {
+			dev_info(dev, "%s: ECC error = 0x%04x\n", __func__,
+				 ecc);
+			mtd->ecc_stats.failed++;
+			return -EBADMSG;
+		}
+		return 0;
+	}
+
 	/* The 20 msec is enough */
 	timeout = jiffies + msecs_to_jiffies(20);
 	while (time_before(jiffies, timeout)) {
@@ -746,6 +842,9 @@ static void s3c6410_onenand_setup(struct mtd_info *mtd)
 
 	this->read_bufferram = s3c6410_onenand_read_bufferram;
 	this->write_bufferram = s3c6410_onenand_write_bufferram;
+#ifdef CONFIG_MTD_ONENAND_S3C6410_PIPELINE_READ
+	this->read_ahead = s3c6410_onenand_read_ahead;
+#endif
 }
 
 /*
@@ -44,6 +44,8 @@
 #include <linux/kthread.h>
 #include <linux/kernel.h>
 #include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/reboot.h>
 #include "ubi.h"
 
 /* Maximum length of the 'mtd=' parameter */
@@ -131,6 +133,20 @@ static struct device_attribute dev_bgt_enabled =
 	__ATTR(bgt_enabled, S_IRUGO, dev_attribute_show, NULL);
 static struct device_attribute dev_mtd_num =
 	__ATTR(mtd_num, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_erase_pending =
+	__ATTR(erase_pending, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_wl_pending =
+	__ATTR(wl_pending, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_erase_count =
+	__ATTR(erase_count, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_erase_latency_avg_us =
+	__ATTR(erase_latency_avg_us, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_erase_latency_max_us =
+	__ATTR(erase_latency_max_us, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_wl_move_count =
+	__ATTR(wl_move_count, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_bgt_deferred =
+	__ATTR(bgt_deferred, S_IRUGO, dev_attribute_show, NULL);
 
 /**
  * ubi_volume_notify - send a volume change notification.
@@ -355,6 +371,28 @@ static ssize_t dev_attribute_show(struct device *dev,
 		ret = sprintf(buf, "%d\n", ubi->thread_enabled);
 	else if (attr == &dev_mtd_num)
 		ret = sprintf(buf, "%d\n", ubi->mtd->index);
+	else if (attr == &dev_erase_pending)
+		ret = sprintf(buf, "%d\n",
+			      ubi->works_count - ubi->wl_works_count);
+	else if (attr == &dev_wl_pending)
+		ret = sprintf(buf, "%d\n", ubi->wl_works_count);
+	else if (attr == &dev_erase_count)
+		ret = sprintf(buf, "%lu\n", ubi->erase_count);
+	else if (attr == &dev_erase_latency_avg_us) {
+		unsigned long long avg;
+
+		spin_lock(&ubi->wl_lock);
+		avg = ubi->erase_time_us;
+		if (ubi->erase_count)
+			do_div(avg, ubi->erase_count);
+		spin_unlock(&ubi->wl_lock);
+		ret = sprintf(buf, "%llu\n", avg);
+	} else if (attr == &dev_erase_latency_max_us)
+		ret = sprintf(buf, "%u\n", ubi->erase_max_us);
+	else if (attr == &dev_wl_move_count)
+		ret = sprintf(buf, "%lu\n", ubi->wl_move_count);
+	else if (attr == &dev_bgt_deferred)
+		ret = sprintf(buf, "%lu\n", ubi->bgt_deferred);
 	else
 		ret = -EINVAL;
 
@@ -422,6 +460,27 @@ static int ubi_sysfs_init(struct ubi_device *ubi, int *ref)
 	if (err)
 		return err;
 	err = device_create_file(&ubi->dev, &dev_mtd_num);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_erase_pending);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_wl_pending);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_erase_count);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_erase_latency_avg_us);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_erase_latency_max_us);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_wl_move_count);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_bgt_deferred);
 	return err;
 }
 
@@ -431,6 +490,13 @@ static int ubi_sysfs_init(struct ubi_device *ubi, int *ref)
  */
 static void ubi_sysfs_close(struct ubi_device *ubi)
 {
+	device_remove_file(&ubi->dev, &dev_bgt_deferred);
+	device_remove_file(&ubi->dev, &dev_wl_move_count);
+	device_remove_file(&ubi->dev, &dev_erase_latency_max_us);
+	device_remove_file(&ubi->dev, &dev_erase_latency_avg_us);
+	device_remove_file(&ubi->dev, &dev_erase_count);
+	device_remove_file(&ubi->dev, &dev_wl_pending);
+	device_remove_file(&ubi->dev, &dev_erase_pending);
 	device_remove_file(&ubi->dev, &dev_mtd_num);
 	device_remove_file(&ubi->dev, &dev_bgt_enabled);
 	device_remove_file(&ubi->dev, &dev_min_io_size);
@@ -575,20 +641,29 @@ static void free_internal_volumes(struct ubi_device *ubi)
  * This function returns zero in case of success and a negative error code in
  * case of failure.
  *
- * Note, currently this is the only method to attach UBI devices. Hopefully in
- * the future we'll have more scalable attaching methods and avoid full media
- * scanning. But even in this case scanning will be needed as a fall-back
- * attaching method if there are some on-flash table corruptions.
+ * If the fastmap is enabled and a valid fastmap is found, the scanning
+ * information is built from it instead of reading the headers of all physical
+ * eraseblocks. Full scanning is the fall-back if the fastmap is missing or
+ * cannot be used.
  */
 static int attach_by_scanning(struct ubi_device *ubi)
 {
 	int err;
 	struct ubi_scan_info *si;
+	ktime_t start = ktime_get();
+	const char *method = "fastmap";
 
-	si = ubi_scan(ubi);
+	si = ubi_fastmap_scan(ubi);
+	if (!si) {
+		method = "scanning";
+		si = ubi_scan(ubi);
+	}
 	if (IS_ERR(si))
 		return PTR_ERR(si);
 
+	ubi_msg("attached by %s in %lld ms", method,
+		ktime_to_ms(ktime_sub(ktime_get(), start)));
+
 	ubi->bad_peb_count = si->bad_peb_count;
 	ubi->good_peb_count = ubi->peb_count - ubi->bad_peb_count;
 	ubi->corr_peb_count = si->corr_peb_count;
@@ -608,6 +683,7 @@ static int attach_by_scanning(struct ubi_device *ubi)
 	if (err)
 		goto out_wl;
 
+	ubi_fastmap_init(ubi);
 	ubi_scan_destroy_si(si);
 	return 0;
 
@@ -935,6 +1011,10 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	mutex_init(&ubi->ckvol_mutex);
 	mutex_init(&ubi->device_mutex);
 	spin_lock_init(&ubi->volumes_lock);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	init_rwsem(&ubi->fm_sem);
+	mutex_init(&ubi->fm_mutex);
+#endif
 
 	ubi_msg("attaching mtd%d to ubi%d", mtd->index, ubi_num);
 	dbg_msg("sizeof(struct ubi_scan_leb) %zu", sizeof(struct ubi_scan_leb));
@@ -1039,6 +1119,7 @@ out_free:
  */
 int ubi_detach_mtd_dev(int ubi_num, int anyway)
 {
+	int err;
 	struct ubi_device *ubi;
 
 	if (ubi_num < 0 || ubi_num >= UBI_MAX_DEVICES)
@@ -1074,6 +1155,10 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 	if (ubi->bgt_thread)
 		kthread_stop(ubi->bgt_thread);
 
+	err = ubi_fastmap_update(ubi);
+	if (err)
+		ubi_warn("cannot write fastmap, error %d", err);
+
 	/*
 	 * Get a reference to the device in order to prevent 'dev_release()'
 	 * from freeing the @ubi object.
@@ -1160,6 +1245,42 @@ static struct mtd_info * __init open_mtd_device(const char *mtd_dev)
 	return mtd;
 }
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * ubi_reboot_notify - write the fastmap of all UBI devices.
+ * @nb: notifier block
+ * @event: reboot event
+ * @unused: unused
+ *
+ * UBI devices are usually not detached before a reboot, so the fastmap is
+ * written from here to make the next attach fast.
+ */
+static int ubi_reboot_notify(struct notifier_block *nb, unsigned long event,
+			     void *unused)
+{
+	int i, err;
+	struct ubi_device *ubi;
+
+	for (i = 0; i < UBI_MAX_DEVICES; i++) {
+		ubi = ubi_get_device(i);
+		if (!ubi)
+			continue;
+
+		err = ubi_fastmap_update(ubi);
+		if (err)
+			ubi_warn("cannot write fastmap of ubi%d, error %d",
+				 i, err);
+		ubi_put_device(ubi);
+	}
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block ubi_reboot_nb = {
+	.notifier_call = ubi_reboot_notify,
+};
+#endif
+
 static int __init ubi_init(void)
 {
 	int err, i, k;
@@ -1238,6 +1359,9 @@ static int __init ubi_init(void)
 		}
 	}
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	register_reboot_notifier(&ubi_reboot_nb);
+#endif
 	return 0;
 
 out_detach:
@@ -1264,6 +1388,10 @@ static void __exit ubi_exit(void)
 {
 	int i;
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	unregister_reboot_notifier(&ubi_reboot_nb);
+#endif
+
 	for (i = 0; i < UBI_MAX_DEVICES; i++)
 		if (ubi_devices[i]) {
 			mutex_lock(&ubi_devices_mutex);
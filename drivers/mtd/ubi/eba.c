@@ -50,14 +50,14 @@
 #define EBA_RESERVED_PEBS 1
 
 /**
- * next_sqnum - get next sequence number.
+ * ubi_next_sqnum - get next sequence number.
  * @ubi: UBI device description object
  *
  * This function returns next sequence number to use, which is just the current
  * global sequence counter value. It also increases the global sequence
  * counter.
  */
-static unsigned long long next_sqnum(struct ubi_device *ubi)
+unsigned long long ubi_next_sqnum(struct ubi_device *ubi)
 {
 	unsigned long long sqnum;
 
@@ -193,6 +193,31 @@ static struct ubi_ltree_entry *ltree_add_entry(struct ubi_device *ubi,
 	return le;
 }
 
+/**
+ * fg_io_start - account a LEB access.
+ * @ubi: UBI device description object
+ *
+ * The background thread defers its works while LEBs are being accessed, see
+ * 'ubi_thread()'.
+ */
+static inline void fg_io_start(struct ubi_device *ubi)
+{
+	atomic_inc(&ubi->fg_io);
+}
+
+/**
+ * fg_io_end - account the end of a LEB access.
+ * @ubi: UBI device description object
+ *
+ * Accesses done by the background thread itself do not make the device busy.
+ */
+static inline void fg_io_end(struct ubi_device *ubi)
+{
+	if (current != ubi->bgt_thread)
+		ubi->fg_io_stamp = jiffies;
+	atomic_dec(&ubi->fg_io);
+}
+
 /**
  * leb_read_lock - lock logical eraseblock for reading.
  * @ubi: UBI device description object
@@ -210,6 +235,7 @@ static int leb_read_lock(struct ubi_device *ubi, int vol_id, int lnum)
 	if (IS_ERR(le))
 		return PTR_ERR(le);
 	down_read(&le->mutex);
+	fg_io_start(ubi);
 	return 0;
 }
 
@@ -223,6 +249,7 @@ static void leb_read_unlock(struct ubi_device *ubi, int vol_id, int lnum)
 {
 	struct ubi_ltree_entry *le;
 
+	fg_io_end(ubi);
 	spin_lock(&ubi->ltree_lock);
 	le = ltree_lookup(ubi, vol_id, lnum);
 	le->users -= 1;
@@ -241,17 +268,23 @@ static void leb_read_unlock(struct ubi_device *ubi, int vol_id, int lnum)
  * @vol_id: volume ID
  * @lnum: logical eraseblock number
  *
- * This function locks a logical eraseblock for writing. Returns zero in case
- * of success and a negative error code in case of failure.
+ * This function locks a logical eraseblock for writing. Writers also hold
+ * the fastmap semaphore for reading, so that a fastmap is never taken while
+ * the eraseblock assignment is changing. Returns zero in case of success and
+ * a negative error code in case of failure.
  */
 static int leb_write_lock(struct ubi_device *ubi, int vol_id, int lnum)
 {
 	struct ubi_ltree_entry *le;
 
+	ubi_fm_down_read(ubi);
 	le = ltree_add_entry(ubi, vol_id, lnum);
-	if (IS_ERR(le))
+	if (IS_ERR(le)) {
+		ubi_fm_up_read(ubi);
 		return PTR_ERR(le);
+	}
 	down_write(&le->mutex);
+	fg_io_start(ubi);
 	return 0;
 }
 
@@ -270,11 +303,18 @@ static int leb_write_trylock(struct ubi_device *ubi, int vol_id, int lnum)
 {
 	struct ubi_ltree_entry *le;
 
+	if (!ubi_fm_down_read_trylock(ubi))
+		return 1;
+
 	le = ltree_add_entry(ubi, vol_id, lnum);
-	if (IS_ERR(le))
+	if (IS_ERR(le)) {
+		ubi_fm_up_read(ubi);
 		return PTR_ERR(le);
-	if (down_write_trylock(&le->mutex))
+	}
+	if (down_write_trylock(&le->mutex)) {
+		fg_io_start(ubi);
 		return 0;
+	}
 
 	/* Contention, cancel */
 	spin_lock(&ubi->ltree_lock);
@@ -285,6 +325,7 @@ static int leb_write_trylock(struct ubi_device *ubi, int vol_id, int lnum)
 		kfree(le);
 	}
 	spin_unlock(&ubi->ltree_lock);
+	ubi_fm_up_read(ubi);
 
 	return 1;
 }
@@ -299,6 +340,7 @@ static void leb_write_unlock(struct ubi_device *ubi, int vol_id, int lnum)
 {
 	struct ubi_ltree_entry *le;
 
+	fg_io_end(ubi);
 	spin_lock(&ubi->ltree_lock);
 	le = ltree_lookup(ubi, vol_id, lnum);
 	le->users -= 1;
@@ -309,6 +351,7 @@ static void leb_write_unlock(struct ubi_device *ubi, int vol_id, int lnum)
 		kfree(le);
 	}
 	spin_unlock(&ubi->ltree_lock);
+	ubi_fm_up_read(ubi);
 }
 
 /**
@@ -340,6 +383,10 @@ int ubi_eba_unmap_leb(struct ubi_device *ubi, struct ubi_volume *vol,
 
 	dbg_eba("erase LEB %d:%d, PEB %d", vol_id, lnum, pnum);
 
+	err = ubi_fastmap_invalidate(ubi);
+	if (err)
+		goto out_unlock;
+
 	vol->eba_tbl[lnum] = UBI_LEB_UNMAPPED;
 	err = ubi_wl_put_peb(ubi, pnum, 0);
 
@@ -506,6 +553,12 @@ static int recover_peb(struct ubi_device *ubi, int pnum, int vol_id, int lnum,
 	if (!vid_hdr)
 		return -ENOMEM;
 
+	err = ubi_fastmap_invalidate(ubi);
+	if (err) {
+		ubi_free_vid_hdr(ubi, vid_hdr);
+		return err;
+	}
+
 retry:
 	new_pnum = ubi_wl_get_peb(ubi, UBI_UNKNOWN);
 	if (new_pnum < 0) {
@@ -522,7 +575,7 @@ retry:
 		goto out_put;
 	}
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 	err = ubi_io_write_vid_hdr(ubi, new_pnum, vid_hdr);
 	if (err)
 		goto write_error;
@@ -627,6 +680,12 @@ int ubi_eba_write_leb(struct ubi_device *ubi, struct ubi_volume *vol, int lnum,
 	 * The logical eraseblock is not mapped. We have to get a free physical
 	 * eraseblock and write the volume identifier header there first.
 	 */
+	err = ubi_fastmap_invalidate(ubi);
+	if (err) {
+		leb_write_unlock(ubi, vol_id, lnum);
+		return err;
+	}
+
 	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_NOFS);
 	if (!vid_hdr) {
 		leb_write_unlock(ubi, vol_id, lnum);
@@ -634,7 +693,7 @@ int ubi_eba_write_leb(struct ubi_device *ubi, struct ubi_volume *vol, int lnum,
 	}
 
 	vid_hdr->vol_type = UBI_VID_DYNAMIC;
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 	vid_hdr->vol_id = cpu_to_be32(vol_id);
 	vid_hdr->lnum = cpu_to_be32(lnum);
 	vid_hdr->compat = ubi_get_compat(ubi, vol_id);
@@ -695,7 +754,7 @@ write_error:
 		return err;
 	}
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 	ubi_msg("try another PEB");
 	goto retry;
 }
@@ -750,7 +809,14 @@ int ubi_eba_write_leb_st(struct ubi_device *ubi, struct ubi_volume *vol,
 		return err;
 	}
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	err = ubi_fastmap_invalidate(ubi);
+	if (err) {
+		leb_write_unlock(ubi, vol_id, lnum);
+		ubi_free_vid_hdr(ubi, vid_hdr);
+		return err;
+	}
+
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 	vid_hdr->vol_id = cpu_to_be32(vol_id);
 	vid_hdr->lnum = cpu_to_be32(lnum);
 	vid_hdr->compat = ubi_get_compat(ubi, vol_id);
@@ -815,7 +881,7 @@ write_error:
 		return err;
 	}
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 	ubi_msg("try another PEB");
 	goto retry;
 }
@@ -868,7 +934,11 @@ int ubi_eba_atomic_leb_change(struct ubi_device *ubi, struct ubi_volume *vol,
 	if (err)
 		goto out_mutex;
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	err = ubi_fastmap_invalidate(ubi);
+	if (err)
+		goto out_leb_unlock;
+
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 	vid_hdr->vol_id = cpu_to_be32(vol_id);
 	vid_hdr->lnum = cpu_to_be32(lnum);
 	vid_hdr->compat = ubi_get_compat(ubi, vol_id);
@@ -936,7 +1006,7 @@ write_error:
 		goto out_leb_unlock;
 	}
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 	ubi_msg("try another PEB");
 	goto retry;
 }
@@ -1051,6 +1121,10 @@ int ubi_eba_copy_leb(struct ubi_device *ubi, int from, int to,
 		goto out_unlock_leb;
 	}
 
+	err = ubi_fastmap_invalidate(ubi);
+	if (err)
+		goto out_unlock_leb;
+
 	/*
 	 * OK, now the LEB is locked and we can safely start moving it. Since
 	 * this function utilizes the @ubi->peb_buf1 buffer which is shared
@@ -1096,7 +1170,7 @@ int ubi_eba_copy_leb(struct ubi_device *ubi, int from, int to,
 		vid_hdr->data_size = cpu_to_be32(data_size);
 		vid_hdr->data_crc = cpu_to_be32(crc);
 	}
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 
 	err = ubi_io_write_vid_hdr(ubi, to, vid_hdr);
 	if (err) {
@@ -0,0 +1,874 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+ * the GNU General Public License for more details.
+ */
+
+/*
+ * UBI fastmap.
+ *
+ * Attaching an UBI device normally means reading the EC and VID headers of
+ * every physical eraseblock, which takes time proportional to the flash size.
+ * The fastmap is a snapshot of what scanning would find: the erase counter of
+ * each PEB and whether it is free, has to be erased, is bad or corrupted, or
+ * which LEB it is mapped to. It is written to a few PEBs when the device is
+ * detached or synchronized, and at attach time the scanning information is
+ * built from it. Only the VID headers of the first %UBI_FM_MAX_START PEBs
+ * have to be read to find it.
+ *
+ * The fastmap PEBs belong to the fastmap code: they are kept out of the WL
+ * trees and given back to the WL sub-system only when a new fastmap is
+ * written. The anchor (the first fastmap PEB) is written last, so a fastmap
+ * is either complete or not found.
+ *
+ * A fastmap is only usable as long as the eraseblock assignment does not
+ * change. The last minimal I/O unit of the anchor is left erased when the
+ * fastmap is written, and before anything which changes the assignment
+ * touches the flash, 'ubi_fastmap_invalidate()' programs it. A fastmap whose
+ * marker is programmed is ignored. The LEB writers hold @ubi->fm_sem for
+ * reading, so a new fastmap is never taken in the middle of a change.
+ *
+ * If the fastmap is missing, stale or corrupted, the device is attached by
+ * scanning as usual, and the scanning code erases the old anchor.
+ */
+
+#include <linux/crc32.h>
+#include "ubi.h"
+
+/**
+ * fm_size - size of a fastmap.
+ * @ubi: UBI device description object
+ * @vol_count: count of volumes
+ */
+static size_t fm_size(const struct ubi_device *ubi, int vol_count)
+{
+	return sizeof(struct ubi_fm_hdr) +
+	       vol_count * sizeof(struct ubi_fm_vol) +
+	       ubi->peb_count * sizeof(struct ubi_fm_peb);
+}
+
+/*
+ * How many bytes of the fastmap the anchor stores: its last min. I/O unit is
+ * the staleness marker.
+ */
+static int fm_anchor_size(const struct ubi_device *ubi)
+{
+	return ubi->leb_size - ubi->min_io_size;
+}
+
+/**
+ * fm_peb_count - count of PEBs needed to store a fastmap.
+ * @ubi: UBI device description object
+ * @size: size of the fastmap
+ */
+static int fm_peb_count(const struct ubi_device *ubi, size_t size)
+{
+	int cap = fm_anchor_size(ubi);
+
+	if (size <= cap)
+		return 1;
+	return 1 + DIV_ROUND_UP(size - cap, ubi->leb_size);
+}
+
+/**
+ * fm_add_to_list - add a physical eraseblock to a scanning information list.
+ * @si: scanning information
+ * @pnum: physical eraseblock number
+ * @ec: erase counter of the physical eraseblock
+ * @list: the list to add to
+ */
+static int fm_add_to_list(struct ubi_scan_info *si, int pnum, int ec,
+			  struct list_head *list)
+{
+	struct ubi_scan_leb *seb;
+
+	seb = kmem_cache_alloc(si->scan_leb_slab, GFP_KERNEL);
+	if (!seb)
+		return -ENOMEM;
+
+	seb->pnum = pnum;
+	seb->ec = ec;
+	list_add_tail(&seb->u.list, list);
+	return 0;
+}
+
+/**
+ * fm_add_volume - add a volume to the scanning information.
+ * @si: scanning information
+ * @fvol: fastmap record of the volume
+ *
+ * Returns a pointer to the scanning volume object in case of success and a
+ * negative error code in case of failure.
+ */
+static struct ubi_scan_volume *fm_add_volume(struct ubi_scan_info *si,
+					     const struct ubi_fm_vol *fvol)
+{
+	int vol_id = be32_to_cpu(fvol->vol_id);
+	struct ubi_scan_volume *sv;
+	struct rb_node **p = &si->volumes.rb_node, *parent = NULL;
+
+	while (*p) {
+		parent = *p;
+		sv = rb_entry(parent, struct ubi_scan_volume, rb);
+
+		if (vol_id == sv->vol_id)
+			return ERR_PTR(-EINVAL);
+
+		if (vol_id > sv->vol_id)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+
+	sv = kmalloc(sizeof(struct ubi_scan_volume), GFP_KERNEL);
+	if (!sv)
+		return ERR_PTR(-ENOMEM);
+
+	sv->highest_lnum = sv->leb_count = 0;
+	sv->vol_id = vol_id;
+	sv->root = RB_ROOT;
+	sv->vol_type = fvol->vol_type;
+	sv->compat = fvol->compat;
+	sv->used_ebs = be32_to_cpu(fvol->used_ebs);
+	sv->data_pad = be32_to_cpu(fvol->data_pad);
+	sv->last_data_size = be32_to_cpu(fvol->last_data_size);
+	if (vol_id > si->highest_vol_id)
+		si->highest_vol_id = vol_id;
+
+	rb_link_node(&sv->rb, parent, p);
+	rb_insert_color(&sv->rb, &si->volumes);
+	si->vols_found += 1;
+	return sv;
+}
+
+/**
+ * fm_add_leb - add a used physical eraseblock to the scanning information.
+ * @si: scanning information
+ * @fvol: fastmap volume records
+ * @vol_count: count of records in @fvol
+ * @pnum: physical eraseblock number
+ * @ec: erase counter of the physical eraseblock
+ * @vol_id: volume the physical eraseblock is mapped to
+ * @lnum: logical eraseblock the physical eraseblock is mapped to
+ */
+static int fm_add_leb(struct ubi_scan_info *si, const struct ubi_fm_vol *fvol,
+		      int vol_count, int pnum, int ec, int vol_id, int lnum)
+{
+	int i;
+	struct ubi_scan_volume *sv;
+	struct ubi_scan_leb *seb, *seb1;
+	struct rb_node **p, *parent = NULL;
+
+	sv = ubi_scan_find_sv(si, vol_id);
+	if (!sv) {
+		for (i = 0; i < vol_count; i++)
+			if (be32_to_cpu(fvol[i].vol_id) == vol_id)
+				break;
+		if (i == vol_count)
+			return -EINVAL;
+
+		sv = fm_add_volume(si, &fvol[i]);
+		if (IS_ERR(sv))
+			return PTR_ERR(sv);
+	}
+
+	p = &sv->root.rb_node;
+	while (*p) {
+		parent = *p;
+		seb1 = rb_entry(parent, struct ubi_scan_leb, u.rb);
+		if (lnum == seb1->lnum)
+			return -EINVAL;
+
+		if (lnum < seb1->lnum)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+
+	seb = kmem_cache_alloc(si->scan_leb_slab, GFP_KERNEL);
+	if (!seb)
+		return -ENOMEM;
+
+	seb->ec = ec;
+	seb->pnum = pnum;
+	seb->lnum = lnum;
+	seb->scrub = 0;
+	seb->copy_flag = 0;
+	seb->sqnum = 0;
+
+	if (sv->highest_lnum <= lnum)
+		sv->highest_lnum = lnum;
+	sv->leb_count += 1;
+	rb_link_node(&seb->u.rb, parent, p);
+	rb_insert_color(&seb->u.rb, &sv->root);
+	return 0;
+}
+
+/**
+ * fm_is_fm_peb - check whether a physical eraseblock belongs to the fastmap.
+ * @hdr: fastmap header
+ * @pnum: physical eraseblock number
+ */
+static int fm_is_fm_peb(const struct ubi_fm_hdr *hdr, int pnum)
+{
+	int i;
+
+	for (i = 0; i < be32_to_cpu(hdr->fm_count); i++)
+		if (be32_to_cpu(hdr->fm_pebs[i]) == pnum)
+			return 1;
+	return 0;
+}
+
+/**
+ * fm_build_si - build scanning information from a fastmap.
+ * @ubi: UBI device description object
+ * @buf: the fastmap, already checked
+ *
+ * Returns the scanning information in case of success and an error code in
+ * case of failure.
+ */
+static struct ubi_scan_info *fm_build_si(struct ubi_device *ubi,
+					 const void *buf)
+{
+	int err, pnum, vol_count;
+	const struct ubi_fm_hdr *hdr = buf;
+	const struct ubi_fm_vol *fvol = buf + sizeof(struct ubi_fm_hdr);
+	const struct ubi_fm_peb *fpeb;
+	struct ubi_scan_info *si;
+
+	vol_count = be32_to_cpu(hdr->vol_count);
+	fpeb = (const struct ubi_fm_peb *)(fvol + vol_count);
+
+	si = ubi_scan_alloc_si();
+	if (!si)
+		return ERR_PTR(-ENOMEM);
+	si->min_ec = UBI_MAX_ERASECOUNTER;
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		int ec = be32_to_cpu(fpeb[pnum].ec);
+		u32 vol_id = be32_to_cpu(fpeb[pnum].vol_id);
+
+		if (vol_id == UBI_FM_PEB_BAD) {
+			si->bad_peb_count += 1;
+			continue;
+		}
+
+		err = -EINVAL;
+		if (ec < 0 || ec > UBI_MAX_ERASECOUNTER)
+			goto out_si;
+
+		if (fm_is_fm_peb(hdr, pnum))
+			err = fm_add_to_list(si, pnum, ec, &si->fastmap);
+		else if (vol_id == UBI_FM_PEB_FREE)
+			err = fm_add_to_list(si, pnum, ec, &si->free);
+		else if (vol_id == UBI_FM_PEB_ERASE)
+			err = fm_add_to_list(si, pnum, ec, &si->erase);
+		else if (vol_id == UBI_FM_PEB_CORR) {
+			si->corr_peb_count += 1;
+			err = fm_add_to_list(si, pnum, ec, &si->corr);
+			if (err)
+				goto out_si;
+			continue;
+		} else
+			err = fm_add_leb(si, fvol, vol_count, pnum, ec, vol_id,
+					 be32_to_cpu(fpeb[pnum].lnum));
+		if (err)
+			goto out_si;
+
+		si->ec_sum += ec;
+		si->ec_count += 1;
+		if (ec > si->max_ec)
+			si->max_ec = ec;
+		if (ec < si->min_ec)
+			si->min_ec = ec;
+	}
+
+	if (si->ec_count)
+		si->mean_ec = div_u64(si->ec_sum, si->ec_count);
+	si->max_sqnum = be64_to_cpu(hdr->sqnum);
+	return si;
+
+out_si:
+	ubi_scan_destroy_si(si);
+	return ERR_PTR(err);
+}
+
+/**
+ * fm_read - read and check a fastmap.
+ * @ubi: UBI device description object
+ * @anchor: the fastmap anchor PEB
+ * @sqnum: sequence number of the anchor VID header
+ *
+ * Returns the fastmap, which has to be freed with 'vfree()', or %NULL if it
+ * cannot be used.
+ */
+static void *fm_read(struct ubi_device *ubi, int anchor,
+		     unsigned long long sqnum)
+{
+	int err, i, pnum, len, fm_count, vol_count, cap = fm_anchor_size(ubi);
+	size_t size, offs;
+	void *buf = NULL;
+	struct ubi_fm_hdr *hdr;
+	struct ubi_ec_hdr *ech;
+	struct ubi_vid_hdr *vidh;
+
+	/* The buffers are big enough for the header and the marker */
+	hdr = kmalloc(max_t(size_t, sizeof(struct ubi_fm_hdr),
+			    ubi->min_io_size), GFP_KERNEL);
+	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+	vidh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!hdr || !ech || !vidh)
+		goto out_free;
+
+	err = ubi_io_read_data(ubi, hdr, anchor, cap, ubi->min_io_size);
+	if (err && err != UBI_IO_BITFLIPS)
+		goto out_free;
+	if (!ubi_check_pattern(hdr, 0xFF, ubi->min_io_size)) {
+		ubi_msg("fastmap at PEB %d is out of date", anchor);
+		goto out_free;
+	}
+
+	err = ubi_io_read_ec_hdr(ubi, anchor, ech, 0);
+	if (err && err != UBI_IO_BITFLIPS)
+		goto out_corrupted;
+
+	err = ubi_io_read_data(ubi, hdr, anchor, 0, sizeof(struct ubi_fm_hdr));
+	if (err && err != UBI_IO_BITFLIPS)
+		goto out_corrupted;
+
+	if (be32_to_cpu(hdr->magic) != UBI_FM_HDR_MAGIC ||
+	    be32_to_cpu(hdr->version) != UBI_FM_FMT_VERSION ||
+	    crc32(UBI_CRC32_INIT, hdr, UBI_FM_HDR_SIZE_CRC) !=
+	    be32_to_cpu(hdr->hdr_crc))
+		goto out_corrupted;
+
+	fm_count = be32_to_cpu(hdr->fm_count);
+	vol_count = be32_to_cpu(hdr->vol_count);
+	size = sizeof(struct ubi_fm_hdr) + be32_to_cpu(hdr->data_size);
+	if (be32_to_cpu(hdr->peb_count) != ubi->peb_count ||
+	    be32_to_cpu(hdr->leb_size) != ubi->leb_size ||
+	    be32_to_cpu(hdr->image_seq) != be32_to_cpu(ech->image_seq) ||
+	    be64_to_cpu(hdr->sqnum) != sqnum ||
+	    vol_count < 0 || vol_count > UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT ||
+	    size != fm_size(ubi, vol_count) ||
+	    fm_count != fm_peb_count(ubi, size) ||
+	    fm_count > UBI_FM_MAX_BLOCKS ||
+	    be32_to_cpu(hdr->fm_pebs[0]) != anchor)
+		goto out_corrupted;
+
+	buf = vmalloc(cap + (fm_count - 1) * ubi->leb_size);
+	if (!buf)
+		goto out_free;
+
+	len = min_t(size_t, size, cap);
+	err = ubi_io_read_data(ubi, buf, anchor, 0, len);
+	if (err && err != UBI_IO_BITFLIPS)
+		goto out_corrupted;
+
+	for (i = 1, offs = cap; i < fm_count; i++, offs += ubi->leb_size) {
+		pnum = be32_to_cpu(hdr->fm_pebs[i]);
+		if (pnum < 0 || pnum >= ubi->peb_count)
+			goto out_corrupted;
+
+		err = ubi_io_read_vid_hdr(ubi, pnum, vidh, 0);
+		if (err && err != UBI_IO_BITFLIPS)
+			goto out_corrupted;
+		if (be32_to_cpu(vidh->vol_id) != UBI_FM_VOLUME_ID ||
+		    be32_to_cpu(vidh->lnum) != i ||
+		    be64_to_cpu(vidh->sqnum) != sqnum)
+			goto out_corrupted;
+
+		len = min_t(size_t, size - offs, ubi->leb_size);
+		err = ubi_io_read_data(ubi, buf + offs, pnum, 0, len);
+		if (err && err != UBI_IO_BITFLIPS)
+			goto out_corrupted;
+	}
+
+	if (crc32(UBI_CRC32_INIT, buf + sizeof(struct ubi_fm_hdr),
+		  size - sizeof(struct ubi_fm_hdr)) != be32_to_cpu(hdr->data_crc))
+		goto out_corrupted;
+
+	kfree(hdr);
+	kfree(ech);
+	ubi_free_vid_hdr(ubi, vidh);
+	return buf;
+
+out_corrupted:
+	ubi_warn("bad fastmap at PEB %d", anchor);
+out_free:
+	vfree(buf);
+	ubi_free_vid_hdr(ubi, vidh);
+	kfree(ech);
+	kfree(hdr);
+	return NULL;
+}
+
+/**
+ * ubi_fastmap_scan - build scanning information from the fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function looks for the most recent fastmap anchor among the first
+ * %UBI_FM_MAX_START physical eraseblocks, and builds the scanning information
+ * from the fastmap. Returns the scanning information, or %NULL if there is no
+ * usable fastmap and the device has to be scanned.
+ */
+struct ubi_scan_info *ubi_fastmap_scan(struct ubi_device *ubi)
+{
+	int err = 0, i, pnum, anchor = -1;
+	unsigned long long sqnum = 0;
+	const struct ubi_fm_hdr *hdr;
+	struct ubi_vid_hdr *vidh;
+	struct ubi_scan_info *si;
+	void *buf;
+
+	vidh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vidh)
+		return NULL;
+
+	for (pnum = 0; pnum < min(ubi->peb_count, UBI_FM_MAX_START); pnum++) {
+		cond_resched();
+
+		err = ubi_io_is_bad(ubi, pnum);
+		if (err < 0)
+			break;
+		if (err)
+			continue;
+
+		err = ubi_io_read_vid_hdr(ubi, pnum, vidh, 0);
+		if (err < 0)
+			break;
+		if (err && err != UBI_IO_BITFLIPS)
+			continue;
+
+		if (be32_to_cpu(vidh->vol_id) != UBI_FM_VOLUME_ID ||
+		    be32_to_cpu(vidh->lnum) != 0)
+			continue;
+
+		if (anchor < 0 || be64_to_cpu(vidh->sqnum) > sqnum) {
+			anchor = pnum;
+			sqnum = be64_to_cpu(vidh->sqnum);
+		}
+	}
+	ubi_free_vid_hdr(ubi, vidh);
+
+	if (anchor < 0 || err < 0) {
+		dbg_bld("no fastmap found");
+		return NULL;
+	}
+
+	buf = fm_read(ubi, anchor, sqnum);
+	if (!buf)
+		return NULL;
+
+	si = fm_build_si(ubi, buf);
+	if (IS_ERR(si)) {
+		ubi_warn("bad fastmap at PEB %d, error %d", anchor,
+			 (int)PTR_ERR(si));
+		vfree(buf);
+		return NULL;
+	}
+
+	hdr = buf;
+	ubi->image_seq = be32_to_cpu(hdr->image_seq);
+	ubi->fm_count = be32_to_cpu(hdr->fm_count);
+	for (i = 0; i < ubi->fm_count; i++)
+		ubi->fm_pebs[i] = be32_to_cpu(hdr->fm_pebs[i]);
+	ubi->fm_valid = 1;
+	vfree(buf);
+
+	ubi_msg("fastmap found at PEB %d", anchor);
+	return si;
+}
+
+/**
+ * fm_put_pebs - give fastmap PEBs back to the WL sub-system.
+ * @ubi: UBI device description object
+ * @from: index of the first PEB in @ubi->fm_pebs to give back
+ *
+ * This function returns zero in case of success and a negative error code in
+ * case of failure.
+ */
+static int fm_put_pebs(struct ubi_device *ubi, int from)
+{
+	int err;
+
+	while (ubi->fm_count > from) {
+		err = ubi_wl_put_fm_peb(ubi, ubi->fm_pebs[ubi->fm_count - 1], 0);
+		if (err)
+			return err;
+		ubi->fm_count -= 1;
+	}
+
+	return 0;
+}
+
+/**
+ * ubi_fastmap_init - reserve physical eraseblocks for the fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function is called when the device is attached. It reserves enough
+ * physical eraseblocks for a fastmap with the maximum count of volumes, or
+ * disables the fastmap if there are not enough of them.
+ */
+void ubi_fastmap_init(struct ubi_device *ubi)
+{
+	int count;
+
+	count = fm_peb_count(ubi, fm_size(ubi, UBI_MAX_VOLUMES +
+					      UBI_INT_VOL_COUNT));
+	if (count <= UBI_FM_MAX_BLOCKS && count <= ubi->avail_pebs) {
+		ubi->avail_pebs -= count;
+		ubi->rsvd_pebs += count;
+		ubi->fm_rsvd_pebs = count;
+		return;
+	}
+
+	ubi_warn("not enough PEBs for the fastmap (%d needed), disable it",
+		 count);
+	if (!ubi_fastmap_invalidate(ubi))
+		fm_put_pebs(ubi, 0);
+}
+
+/**
+ * fm_get_pebs - get the physical eraseblocks for a new fastmap.
+ * @ubi: UBI device description object
+ * @count: how many PEBs are needed
+ *
+ * The PEBs of the previous fastmap are given back to the WL sub-system and
+ * the least worn free PEB among the first %UBI_FM_MAX_START becomes the new
+ * anchor, so the anchor moves around and is wear-leveled like any other PEB.
+ * Only if there is no such free PEB yet (one is being scrubbed) is the old
+ * anchor erased and reused in place. This function returns zero in case of
+ * success and a negative error code in case of failure.
+ */
+static int fm_get_pebs(struct ubi_device *ubi, int count)
+{
+	int err, pnum, anchor;
+
+	err = fm_put_pebs(ubi, 1);
+	if (err)
+		return err;
+
+	pnum = ubi_wl_get_fm_peb(ubi, UBI_FM_MAX_START);
+	if (ubi->fm_count) {
+		anchor = ubi->fm_pebs[0];
+		if (pnum >= 0) {
+			err = ubi_wl_put_fm_peb(ubi, anchor, 0);
+			if (err) {
+				ubi_wl_put_fm_peb(ubi, pnum, 0);
+				return err;
+			}
+		} else if (pnum == -ENOSPC) {
+			pnum = anchor;
+			err = ubi_wl_erase_fm_peb(ubi, pnum);
+			if (err) {
+				ubi_warn("cannot erase fastmap anchor PEB %d, "
+					 "error %d", pnum, err);
+				err = ubi_wl_put_fm_peb(ubi, pnum, 1);
+				ubi->fm_count = 0;
+				return err ? err : -ENOSPC;
+			}
+		} else
+			return pnum;
+		ubi->fm_count = 0;
+	}
+	if (pnum < 0)
+		return pnum;
+	ubi->fm_pebs[ubi->fm_count++] = pnum;
+
+	while (ubi->fm_count < count) {
+		pnum = ubi_wl_get_fm_peb(ubi, ubi->peb_count);
+		if (pnum < 0)
+			return pnum;
+		ubi->fm_pebs[ubi->fm_count++] = pnum;
+	}
+
+	return 0;
+}
+
+/**
+ * fm_fill - take a snapshot of the eraseblock assignment.
+ * @ubi: UBI device description object
+ * @fvol: where to store the volume records
+ * @fpeb: where to store the PEB records
+ *
+ * Returns the count of bad PEBs in case of success and a negative error code
+ * in case of failure.
+ */
+static int fm_fill(struct ubi_device *ubi, struct ubi_fm_vol *fvol,
+		   struct ubi_fm_peb *fpeb)
+{
+	int err, i, pnum, lnum, bad = 0, vol_count = 0;
+	struct ubi_volume *vol;
+	struct ubi_wl_entry *e;
+	struct rb_node *rb;
+
+	/*
+	 * PEBs known to the WL sub-system are either free or will be erased,
+	 * unless they are mapped. Unknown PEBs are bad or corrupted.
+	 */
+	spin_lock(&ubi->wl_lock);
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		e = ubi->lookuptbl[pnum];
+		if (e) {
+			fpeb[pnum].ec = cpu_to_be32(e->ec);
+			fpeb[pnum].vol_id = cpu_to_be32(UBI_FM_PEB_ERASE);
+		} else
+			fpeb[pnum].vol_id = cpu_to_be32(UBI_FM_PEB_CORR);
+	}
+	ubi_rb_for_each_entry(rb, e, &ubi->free, u.rb)
+		fpeb[e->pnum].vol_id = cpu_to_be32(UBI_FM_PEB_FREE);
+	spin_unlock(&ubi->wl_lock);
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		if (be32_to_cpu(fpeb[pnum].vol_id) != UBI_FM_PEB_CORR)
+			continue;
+
+		err = ubi_io_is_bad(ubi, pnum);
+		if (err < 0)
+			return err;
+		if (err) {
+			fpeb[pnum].vol_id = cpu_to_be32(UBI_FM_PEB_BAD);
+			bad += 1;
+		}
+	}
+
+	spin_lock(&ubi->volumes_lock);
+	for (i = 0; i < ubi->vtbl_slots + UBI_INT_VOL_COUNT; i++) {
+		vol = ubi->volumes[i];
+		if (!vol)
+			continue;
+
+		/* The records must not overflow into the PEB records */
+		if (++vol_count > ubi->vol_count) {
+			spin_unlock(&ubi->volumes_lock);
+			ubi_err("volume count mismatch");
+			return -EINVAL;
+		}
+
+		fvol->vol_id = cpu_to_be32(vol->vol_id);
+		fvol->vol_type = vol->vol_type;
+		fvol->compat = vol->vol_id == UBI_LAYOUT_VOLUME_ID ?
+			       UBI_LAYOUT_VOLUME_COMPAT : 0;
+		fvol->data_pad = cpu_to_be32(vol->data_pad);
+		if (vol->vol_type == UBI_STATIC_VOLUME) {
+			fvol->used_ebs = cpu_to_be32(vol->used_ebs);
+			fvol->last_data_size = cpu_to_be32(vol->last_eb_bytes);
+		}
+		fvol += 1;
+
+		for (lnum = 0; lnum < vol->reserved_pebs; lnum++) {
+			pnum = vol->eba_tbl[lnum];
+			if (pnum < 0)
+				continue;
+			fpeb[pnum].vol_id = cpu_to_be32(vol->vol_id);
+			fpeb[pnum].lnum = cpu_to_be32(lnum);
+		}
+	}
+	spin_unlock(&ubi->volumes_lock);
+
+	return bad;
+}
+
+/**
+ * fm_write - write a new fastmap.
+ * @ubi: UBI device description object
+ *
+ * The fastmap PEBs have to be already in @ubi->fm_pebs. This function returns
+ * zero in case of success and a negative error code in case of failure.
+ */
+static int fm_write(struct ubi_device *ubi)
+{
+	int err, i, pnum, bad, len, cap = fm_anchor_size(ubi);
+	size_t size = fm_size(ubi, ubi->vol_count), offs;
+	unsigned long long sqnum;
+	struct ubi_fm_hdr *hdr;
+	struct ubi_fm_vol *fvol;
+	struct ubi_fm_peb *fpeb;
+	struct ubi_vid_hdr *vidh;
+	void *buf;
+
+	ubi_assert(ubi->fm_count == fm_peb_count(ubi, size));
+
+	buf = vzalloc(cap + (ubi->fm_count - 1) * ubi->leb_size);
+	if (!buf)
+		return -ENOMEM;
+
+	err = -ENOMEM;
+	vidh = ubi_zalloc_vid_hdr(ubi, GFP_NOFS);
+	if (!vidh)
+		goto out_free;
+
+	hdr = buf;
+	fvol = buf + sizeof(struct ubi_fm_hdr);
+	fpeb = (struct ubi_fm_peb *)(fvol + ubi->vol_count);
+	bad = fm_fill(ubi, fvol, fpeb);
+	if (bad < 0) {
+		err = bad;
+		goto out_vidh;
+	}
+
+	sqnum = ubi_next_sqnum(ubi);
+	hdr->magic = cpu_to_be32(UBI_FM_HDR_MAGIC);
+	hdr->version = cpu_to_be32(UBI_FM_FMT_VERSION);
+	hdr->peb_count = cpu_to_be32(ubi->peb_count);
+	hdr->vol_count = cpu_to_be32(ubi->vol_count);
+	hdr->fm_count = cpu_to_be32(ubi->fm_count);
+	hdr->bad_peb_count = cpu_to_be32(bad);
+	hdr->image_seq = cpu_to_be32(ubi->image_seq);
+	hdr->leb_size = cpu_to_be32(ubi->leb_size);
+	hdr->data_size = cpu_to_be32(size - sizeof(struct ubi_fm_hdr));
+	hdr->sqnum = cpu_to_be64(sqnum);
+	hdr->data_crc = cpu_to_be32(crc32(UBI_CRC32_INIT, fvol,
+					  size - sizeof(struct ubi_fm_hdr)));
+	for (i = 0; i < ubi->fm_count; i++)
+		hdr->fm_pebs[i] = cpu_to_be32(ubi->fm_pebs[i]);
+	hdr->hdr_crc = cpu_to_be32(crc32(UBI_CRC32_INIT, hdr,
+					 UBI_FM_HDR_SIZE_CRC));
+
+	vidh->vol_type = UBI_FM_VOLUME_TYPE;
+	vidh->vol_id = cpu_to_be32(UBI_FM_VOLUME_ID);
+	vidh->compat = UBI_FM_VOLUME_COMPAT;
+	vidh->sqnum = cpu_to_be64(sqnum);
+
+	/* The anchor goes last, so that the fastmap is found only if complete */
+	for (i = ubi->fm_count - 1; i >= 0; i--) {
+		pnum = ubi->fm_pebs[i];
+		if (i == 0) {
+			offs = 0;
+			len = min_t(size_t, size, cap);
+		} else {
+			offs = cap + (i - 1) * ubi->leb_size;
+			len = min_t(size_t, size - offs, ubi->leb_size);
+		}
+
+		vidh->lnum = cpu_to_be32(i);
+		err = ubi_io_write_vid_hdr(ubi, pnum, vidh);
+		if (err)
+			goto out_vidh;
+
+		err = ubi_io_write_data(ubi, buf + offs, pnum, 0,
+					ALIGN(len, ubi->min_io_size));
+		if (err)
+			goto out_vidh;
+	}
+
+	dbg_gen("fastmap written to PEB %d, %d PEBs, sqnum %llu",
+		ubi->fm_pebs[0], ubi->fm_count, sqnum);
+
+out_vidh:
+	ubi_free_vid_hdr(ubi, vidh);
+out_free:
+	vfree(buf);
+	return err;
+}
+
+/**
+ * ubi_fastmap_update - write a new fastmap if the current one is stale.
+ * @ubi: UBI device description object
+ *
+ * This function is called when the device is detached or synchronized. It
+ * does nothing if the fastmap is disabled or still valid. If there is no free
+ * PEB for the anchor yet, one is made free in background and the fastmap is
+ * written the next time. This function returns zero in case of success and a
+ * negative error code in case of failure.
+ */
+int ubi_fastmap_update(struct ubi_device *ubi)
+{
+	int err = 0;
+
+	if (!ubi->fm_rsvd_pebs || ubi->ro_mode)
+		return 0;
+
+	/*
+	 * The device mutex keeps the volumes as they are, and taking the
+	 * fastmap semaphore for writing waits for the LEB writers to finish.
+	 */
+	mutex_lock(&ubi->device_mutex);
+	down_write(&ubi->fm_sem);
+	if (ubi->fm_valid)
+		goto out_unlock;
+
+	err = fm_get_pebs(ubi, fm_peb_count(ubi, fm_size(ubi, ubi->vol_count)));
+	if (err == -ENOSPC) {
+		dbg_gen("no room for the fastmap anchor yet");
+		err = 0;
+		goto out_unlock;
+	}
+	if (err)
+		goto out_unlock;
+
+	err = fm_write(ubi);
+	if (err) {
+		/*
+		 * Give the half-written PEBs back for erasure, so that no
+		 * partial fastmap can be found, and try again next time.
+		 */
+		fm_put_pebs(ubi, 0);
+		goto out_unlock;
+	}
+
+	mutex_lock(&ubi->fm_mutex);
+	ubi->fm_valid = 1;
+	mutex_unlock(&ubi->fm_mutex);
+
+out_unlock:
+	up_write(&ubi->fm_sem);
+	mutex_unlock(&ubi->device_mutex);
+	return err;
+}
+
+/**
+ * ubi_fastmap_invalidate - mark the fastmap as out of date.
+ * @ubi: UBI device description object
+ *
+ * This function has to be called before the eraseblock assignment changes on
+ * flash. It programs the staleness marker of the fastmap anchor, or erases
+ * the anchor if the marker cannot be written. This function returns zero in
+ * case of success and a negative error code in case of failure.
+ */
+int ubi_fastmap_invalidate(struct ubi_device *ubi)
+{
+	int err = 0, anchor;
+	void *buf;
+
+	mutex_lock(&ubi->fm_mutex);
+	if (!ubi->fm_valid)
+		goto out_unlock;
+
+	anchor = ubi->fm_pebs[0];
+	dbg_gen("invalidate fastmap at PEB %d", anchor);
+
+	err = -ENOMEM;
+	buf = kzalloc(ubi->min_io_size, GFP_NOFS);
+	if (!buf)
+		goto out_unlock;
+
+	err = ubi_io_write_data(ubi, buf, anchor, fm_anchor_size(ubi),
+				ubi->min_io_size);
+	kfree(buf);
+	if (err) {
+		ubi_warn("cannot invalidate fastmap at PEB %d, error %d",
+			 anchor, err);
+		err = ubi_io_sync_erase(ubi, anchor, 0);
+		if (err < 0) {
+			ubi_err("cannot erase fastmap anchor PEB %d", anchor);
+			ubi_ro_mode(ubi);
+			err = -EROFS;
+			goto out_unlock;
+		}
+		err = 0;
+	}
+
+	ubi->fm_valid = 0;
+
+out_unlock:
+	mutex_unlock(&ubi->fm_mutex);
+	return err;
+}
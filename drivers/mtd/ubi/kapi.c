@@ -703,17 +703,24 @@ EXPORT_SYMBOL_GPL(ubi_is_mapped);
  * @ubi_num: UBI device to synchronize
  *
  * The underlying MTD device may cache data in hardware or in software. This
- * function ensures the caches are flushed. Returns zero in case of success and
- * a negative error code in case of failure.
+ * function ensures the caches are flushed. It also writes the fastmap if it
+ * is enabled and out of date; failing to do so only means the next attach
+ * scans, so it is not reported. Returns zero in case of success and a
+ * negative error code in case of failure.
  */
 int ubi_sync(int ubi_num)
 {
+	int err;
 	struct ubi_device *ubi;
 
 	ubi = ubi_get_device(ubi_num);
 	if (!ubi)
 		return -ENODEV;
 
+	err = ubi_fastmap_update(ubi);
+	if (err)
+		ubi_warn("cannot write fastmap, error %d", err);
+
 	if (ubi->mtd->sync)
 		ubi->mtd->sync(ubi->mtd);
 
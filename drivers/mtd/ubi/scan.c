@@ -1011,6 +1011,26 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 	}
 
 	vol_id = be32_to_cpu(vidh->vol_id);
+	if (vol_id == UBI_FM_VOLUME_ID) {
+		/*
+		 * The fastmap was not used to attach the device, so it may be
+		 * stale. Make sure nobody uses it after the eraseblock
+		 * assignment is changed: the anchor is erased right away, the
+		 * other fastmap PEBs are useless without it.
+		 */
+		if (be32_to_cpu(vidh->lnum) == 0 && !ec_err) {
+			dbg_bld("erase fastmap anchor PEB %d", pnum);
+			err = ubi_scan_erase_peb(ubi, si, pnum, ec + 1);
+			if (err)
+				return err;
+			err = add_to_list(si, pnum, ec + 1, 0, &si->free);
+		} else
+			err = add_to_list(si, pnum, ec, 0, &si->erase);
+		if (err)
+			return err;
+		return 0;
+	}
+
 	if (vol_id > UBI_MAX_VOLUMES && vol_id != UBI_LAYOUT_VOLUME_ID) {
 		int lnum = be32_to_cpu(vidh->lnum);
 
@@ -1141,37 +1161,57 @@ static int check_what_we_have(struct ubi_device *ubi, struct ubi_scan_info *si)
 }
 
 /**
- * ubi_scan - scan an MTD device.
- * @ubi: UBI device description object
+ * ubi_scan_alloc_si - allocate scanning information.
  *
- * This function does full scanning of an MTD device and returns complete
- * information about it. In case of failure, an error code is returned.
+ * This function allocates and initializes an empty scanning information
+ * object. Returns %NULL if there is no memory.
  */
-struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
+struct ubi_scan_info *ubi_scan_alloc_si(void)
 {
-	int err, pnum;
-	struct rb_node *rb1, *rb2;
-	struct ubi_scan_volume *sv;
-	struct ubi_scan_leb *seb;
 	struct ubi_scan_info *si;
 
 	si = kzalloc(sizeof(struct ubi_scan_info), GFP_KERNEL);
 	if (!si)
-		return ERR_PTR(-ENOMEM);
+		return NULL;
 
 	INIT_LIST_HEAD(&si->corr);
 	INIT_LIST_HEAD(&si->free);
 	INIT_LIST_HEAD(&si->erase);
 	INIT_LIST_HEAD(&si->alien);
+	INIT_LIST_HEAD(&si->fastmap);
 	si->volumes = RB_ROOT;
 
-	err = -ENOMEM;
 	si->scan_leb_slab = kmem_cache_create("ubi_scan_leb_slab",
 					      sizeof(struct ubi_scan_leb),
 					      0, 0, NULL);
-	if (!si->scan_leb_slab)
-		goto out_si;
+	if (!si->scan_leb_slab) {
+		kfree(si);
+		return NULL;
+	}
 
+	return si;
+}
+
+/**
+ * ubi_scan - scan an MTD device.
+ * @ubi: UBI device description object
+ *
+ * This function does full scanning of an MTD device and returns complete
+ * information about it. In case of failure, an error code is returned.
+ */
+struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
+{
+	int err, pnum;
+	struct rb_node *rb1, *rb2;
+	struct ubi_scan_volume *sv;
+	struct ubi_scan_leb *seb;
+	struct ubi_scan_info *si;
+
+	si = ubi_scan_alloc_si();
+	if (!si)
+		return ERR_PTR(-ENOMEM);
+
+	err = -ENOMEM;
 	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
 	if (!ech)
 		goto out_si;
@@ -1300,6 +1340,10 @@ void ubi_scan_destroy_si(struct ubi_scan_info *si)
 		list_del(&seb->u.list);
 		kmem_cache_free(si->scan_leb_slab, seb);
 	}
+	list_for_each_entry_safe(seb, seb_tmp, &si->fastmap, u.list) {
+		list_del(&seb->u.list);
+		kmem_cache_free(si->scan_leb_slab, seb);
+	}
 
 	/* Destroy the volume RB-tree */
 	rb = si->volumes.rb_node;
@@ -312,6 +312,16 @@ struct ubi_vid_hdr {
 #define UBI_LAYOUT_VOLUME_NAME   "layout volume"
 #define UBI_LAYOUT_VOLUME_COMPAT UBI_COMPAT_REJECT
 
+/*
+ * The fastmap volume contains a snapshot of the eraseblock assignment. It is
+ * not a real volume: its PEBs are owned by the fastmap code and never appear
+ * in the volume table. Implementations which do not know about it just erase
+ * it.
+ */
+#define UBI_FM_VOLUME_ID        (UBI_LAYOUT_VOLUME_ID + 1)
+#define UBI_FM_VOLUME_TYPE      UBI_VID_DYNAMIC
+#define UBI_FM_VOLUME_COMPAT    UBI_COMPAT_DELETE
+
 /* The maximum number of volumes per one UBI device */
 #define UBI_MAX_VOLUMES 128
 
@@ -375,4 +385,110 @@ struct ubi_vtbl_record {
 	__be32  crc;
 } __packed;
 
+/* The fastmap anchor PEB has to be one of the first %UBI_FM_MAX_START PEBs */
+#define UBI_FM_MAX_START 64
+
+/* The maximum number of PEBs a fastmap may occupy */
+#define UBI_FM_MAX_BLOCKS 16
+
+/* The fastmap header magic number ("UBIF") */
+#define UBI_FM_HDR_MAGIC 0x55424946
+
+/* The fastmap format version */
+#define UBI_FM_FMT_VERSION 1
+
+/*
+ * Special values of the @vol_id field of &struct ubi_fm_peb for PEBs which are
+ * not mapped to any LEB.
+ */
+#define UBI_FM_PEB_FREE  0xFFFFFFFF
+#define UBI_FM_PEB_ERASE 0xFFFFFFFE
+#define UBI_FM_PEB_CORR  0xFFFFFFFD
+#define UBI_FM_PEB_BAD   0xFFFFFFFC
+
+/**
+ * struct ubi_fm_hdr - fastmap header.
+ * @magic: fastmap header magic number (%UBI_FM_HDR_MAGIC)
+ * @version: fastmap format version (%UBI_FM_FMT_VERSION)
+ * @peb_count: count of PEBs described by the fastmap
+ * @vol_count: count of &struct ubi_fm_vol records
+ * @fm_count: count of PEBs the fastmap occupies
+ * @bad_peb_count: count of bad PEBs
+ * @image_seq: image sequence number of the UBI image
+ * @leb_size: logical eraseblock size the fastmap was written with
+ * @data_size: size of the data following the header
+ * @sqnum: sequence number of the VID headers of the fastmap PEBs
+ * @data_crc: CRC32 checksum of the data following the header
+ * @fm_pebs: the PEBs of the fastmap, the anchor first
+ * @padding: reserved, zeroes
+ * @hdr_crc: CRC32 checksum of the header
+ *
+ * A fastmap is a snapshot of the eraseblock assignment of an UBI device,
+ * written when the device is detached or synchronized, which allows attaching
+ * it without scanning all the PEBs. It is stored in the LEBs of the fastmap
+ * volume (%UBI_FM_VOLUME_ID), LEB 0 (the anchor) being one of the first
+ * %UBI_FM_MAX_START PEBs so that it can be quickly found. All the fastmap VID
+ * headers carry the same sequence number, which is also stored in @sqnum.
+ *
+ * The header is followed by @vol_count &struct ubi_fm_vol records and by
+ * @peb_count &struct ubi_fm_peb records, one per PEB, and the whole is
+ * written across the LEBs of the fastmap. The last minimal I/O unit of the
+ * anchor is not used: it stays erased as long as the fastmap is valid and is
+ * programmed as soon as the eraseblock assignment changes.
+ */
+struct ubi_fm_hdr {
+	__be32  magic;
+	__be32  version;
+	__be32  peb_count;
+	__be32  vol_count;
+	__be32  fm_count;
+	__be32  bad_peb_count;
+	__be32  image_seq;
+	__be32  leb_size;
+	__be32  data_size;
+	__be64  sqnum;
+	__be32  data_crc;
+	__be32  fm_pebs[UBI_FM_MAX_BLOCKS];
+	__u8    padding[16];
+	__be32  hdr_crc;
+} __packed;
+
+/* Size of the fastmap header without the ending CRC */
+#define UBI_FM_HDR_SIZE_CRC (sizeof(struct ubi_fm_hdr) - sizeof(__be32))
+
+/**
+ * struct ubi_fm_vol - fastmap volume record.
+ * @vol_id: volume ID
+ * @vol_type: volume type (%UBI_DYNAMIC_VOLUME or %UBI_STATIC_VOLUME)
+ * @compat: compatibility flags of internal volumes
+ * @padding: reserved, zeroes
+ * @used_ebs: count of used LEBs (static volumes only)
+ * @data_pad: how many bytes are not used at the end of the LEBs
+ * @last_data_size: amount of data in the last used LEB (static volumes only)
+ */
+struct ubi_fm_vol {
+	__be32  vol_id;
+	__u8    vol_type;
+	__u8    compat;
+	__u8    padding[2];
+	__be32  used_ebs;
+	__be32  data_pad;
+	__be32  last_data_size;
+} __packed;
+
+/**
+ * struct ubi_fm_peb - fastmap PEB record.
+ * @ec: erase counter of the PEB
+ * @vol_id: ID of the volume the PEB is mapped to, or one of %UBI_FM_PEB_FREE,
+ *          %UBI_FM_PEB_ERASE, %UBI_FM_PEB_CORR and %UBI_FM_PEB_BAD
+ * @lnum: logical eraseblock number the PEB is mapped to
+ *
+ * PEB records are indexed by PEB number.
+ */
+struct ubi_fm_peb {
+	__be32  ec;
+	__be32  vol_id;
+	__be32  lnum;
+} __packed;
+
 #endif /* !__UBI_MEDIA_H__ */
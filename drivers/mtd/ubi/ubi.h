@@ -344,7 +344,8 @@ struct ubi_wl_entry;
  * @pq_head: protection queue head
  * @wl_lock: protects the @used, @free, @pq, @pq_head, @lookuptbl, @move_from,
  *	     @move_to, @move_to_put @erase_pending, @wl_scheduled, @works,
- *	     @erroneous, and @erroneous_peb_count fields
+ *	     @wl_works, @erroneous, @erroneous_peb_count and the statistics
+ *	     fields
  * @move_mutex: serializes eraseblock moves
  * @work_sem: synchronizes the WL worker with use tasks
  * @wl_scheduled: non-zero if the wear-leveling was scheduled
@@ -353,8 +354,18 @@ struct ubi_wl_entry;
  * @move_from: physical eraseblock from where the data is being moved
  * @move_to: physical eraseblock where the data is being moved to
  * @move_to_put: if the "to" PEB was put
- * @works: list of pending works
- * @works_count: count of pending works
+ * @works: list of pending erasure works
+ * @wl_works: list of pending wear-leveling and scrubbing works
+ * @works_count: count of pending works, on both lists
+ * @wl_works_count: count of pending works on @wl_works
+ * @fg_io: count of LEBs being read or written by users
+ * @fg_io_stamp: time (in jiffies) the last user LEB access ended
+ * @erase_count: count of PEBs erased by the background thread
+ * @erase_time_us: total time spent in those erasures (microseconds)
+ * @erase_max_us: longest of those erasures (microseconds)
+ * @wl_move_count: count of PEBs moved by wear-leveling or scrubbing
+ * @bgt_deferred: how many times background works were deferred because of
+ *                user I/O
  * @bgt_thread: background thread description object
  * @thread_enabled: if the background thread is enabled
  * @bgt_name: background thread name
@@ -392,6 +403,16 @@ struct ubi_wl_entry;
  * @peb_buf2: another buffer of PEB size used for different purposes
  * @buf_mutex: protects @peb_buf1 and @peb_buf2
  * @ckvol_mutex: serializes static volume checking when opening
+ *
+ * @fm_sem: held for reading by LEB writers and for writing while a fastmap
+ *          is being taken
+ * @fm_mutex: protects @fm_valid and serializes fastmap invalidation
+ * @fm_pebs: PEBs of the current fastmap, the anchor first
+ * @fm_count: count of PEBs in @fm_pebs
+ * @fm_valid: non-zero if the fastmap on flash describes the current
+ *            eraseblock assignment
+ * @fm_rsvd_pebs: count of PEBs reserved for the fastmap, %0 if the fastmap
+ *                is disabled
  */
 struct ubi_device {
 	struct cdev cdev;
@@ -441,7 +462,16 @@ struct ubi_device {
 	struct ubi_wl_entry *move_to;
 	int move_to_put;
 	struct list_head works;
+	struct list_head wl_works;
 	int works_count;
+	int wl_works_count;
+	atomic_t fg_io;
+	unsigned long fg_io_stamp;
+	unsigned long erase_count;
+	unsigned long long erase_time_us;
+	unsigned int erase_max_us;
+	unsigned long wl_move_count;
+	unsigned long bgt_deferred;
 	struct task_struct *bgt_thread;
 	int thread_enabled;
 	char bgt_name[sizeof(UBI_BGT_NAME_PATTERN)+2];
@@ -474,6 +504,15 @@ struct ubi_device {
 	void *peb_buf2;
 	struct mutex buf_mutex;
 	struct mutex ckvol_mutex;
+
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	struct rw_semaphore fm_sem;
+	struct mutex fm_mutex;
+	int fm_pebs[UBI_FM_MAX_BLOCKS];
+	int fm_count;
+	int fm_valid;
+	int fm_rsvd_pebs;
+#endif
 };
 
 extern struct kmem_cache *ubi_wl_entry_slab;
@@ -530,6 +569,7 @@ int ubi_eba_atomic_leb_change(struct ubi_device *ubi, struct ubi_volume *vol,
 			      int lnum, const void *buf, int len, int dtype);
 int ubi_eba_copy_leb(struct ubi_device *ubi, int from, int to,
 		     struct ubi_vid_hdr *vid_hdr);
+unsigned long long ubi_next_sqnum(struct ubi_device *ubi);
 int ubi_eba_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si);
 
 /* wl.c */
@@ -540,6 +580,50 @@ int ubi_wl_scrub_peb(struct ubi_device *ubi, int pnum);
 int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si);
 void ubi_wl_close(struct ubi_device *ubi);
 int ubi_thread(void *u);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+int ubi_wl_get_fm_peb(struct ubi_device *ubi, int max_pnum);
+int ubi_wl_put_fm_peb(struct ubi_device *ubi, int pnum, int torture);
+int ubi_wl_erase_fm_peb(struct ubi_device *ubi, int pnum);
+
+/* fastmap.c */
+struct ubi_scan_info *ubi_fastmap_scan(struct ubi_device *ubi);
+void ubi_fastmap_init(struct ubi_device *ubi);
+int ubi_fastmap_update(struct ubi_device *ubi);
+int ubi_fastmap_invalidate(struct ubi_device *ubi);
+
+static inline void ubi_fm_down_read(struct ubi_device *ubi)
+{
+	down_read(&ubi->fm_sem);
+}
+static inline int ubi_fm_down_read_trylock(struct ubi_device *ubi)
+{
+	return down_read_trylock(&ubi->fm_sem);
+}
+static inline void ubi_fm_up_read(struct ubi_device *ubi)
+{
+	up_read(&ubi->fm_sem);
+}
+#else
+static inline struct ubi_scan_info *ubi_fastmap_scan(struct ubi_device *ubi)
+{
+	return NULL;
+}
+static inline void ubi_fastmap_init(struct ubi_device *ubi) {}
+static inline int ubi_fastmap_update(struct ubi_device *ubi)
+{
+	return 0;
+}
+static inline int ubi_fastmap_invalidate(struct ubi_device *ubi)
+{
+	return 0;
+}
+static inline void ubi_fm_down_read(struct ubi_device *ubi) {}
+static inline int ubi_fm_down_read_trylock(struct ubi_device *ubi)
+{
+	return 1;
+}
+static inline void ubi_fm_up_read(struct ubi_device *ubi) {}
+#endif
 
 /* io.c */
 int ubi_io_read(const struct ubi_device *ubi, void *buf, int pnum, int offset,
@@ -325,6 +325,11 @@ static int create_vtbl(struct ubi_device *ubi, struct ubi_scan_info *si,
 	if (sv)
 		old_seb = ubi_scan_find_seb(sv, copy);
 
+	/* The device might have been attached using the fastmap */
+	err = ubi_fastmap_invalidate(ubi);
+	if (err)
+		goto out_free;
+
 retry:
 	new_seb = ubi_scan_get_free_peb(ubi, si);
 	if (IS_ERR(new_seb)) {
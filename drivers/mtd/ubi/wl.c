@@ -109,6 +109,7 @@
 #include <linux/crc32.h>
 #include <linux/freezer.h>
 #include <linux/kthread.h>
+#include <linux/ktime.h>
 #include "ubi.h"
 
 /* Number of physical eraseblocks reserved for wear-leveling purposes */
@@ -141,6 +142,18 @@
  */
 #define WL_MAX_FAILURES 32
 
+/*
+ * The background thread does not compete with foreground I/O: while LEBs are
+ * being read or written, and for %WL_IDLE_MS milliseconds after that, its
+ * works are deferred. Erasures are not deferred if there are less than
+ * %WL_FREE_LOW free physical eraseblocks, and wear-leveling is not deferred
+ * for more than %WL_MAX_DEFER_MS milliseconds, so that scrubbing cannot be
+ * starved by a busy file-system.
+ */
+#define WL_IDLE_MS 20
+#define WL_FREE_LOW 4
+#define WL_MAX_DEFER_MS 5000
+
 /**
  * struct ubi_work - UBI work description data structure.
  * @list: a link in the list of pending works
@@ -211,11 +224,14 @@ static void wl_tree_add(struct ubi_wl_entry *e, struct rb_root *root)
 /**
  * do_work - do one pending work.
  * @ubi: UBI device description object
+ * @wl: if wear-leveling works may be done
  *
- * This function returns zero in case of success and a negative error code in
- * case of failure.
+ * Erasure works are done first, as they produce free physical eraseblocks.
+ * Wear-leveling works are only done if there are no erasure works and @wl is
+ * not zero. This function returns zero in case of success and a negative error
+ * code in case of failure.
  */
-static int do_work(struct ubi_device *ubi)
+static int do_work(struct ubi_device *ubi, int wl)
 {
 	int err;
 	struct ubi_work *wrk;
@@ -230,13 +246,17 @@ static int do_work(struct ubi_device *ubi)
 	 */
 	down_read(&ubi->work_sem);
 	spin_lock(&ubi->wl_lock);
-	if (list_empty(&ubi->works)) {
+	if (!list_empty(&ubi->works))
+		wrk = list_entry(ubi->works.next, struct ubi_work, list);
+	else if (wl && !list_empty(&ubi->wl_works)) {
+		wrk = list_entry(ubi->wl_works.next, struct ubi_work, list);
+		ubi->wl_works_count -= 1;
+	} else {
 		spin_unlock(&ubi->wl_lock);
 		up_read(&ubi->work_sem);
 		return 0;
 	}
 
-	wrk = list_entry(ubi->works.next, struct ubi_work, list);
 	list_del(&wrk->list);
 	ubi->works_count -= 1;
 	ubi_assert(ubi->works_count >= 0);
@@ -273,7 +293,7 @@ static int produce_free_peb(struct ubi_device *ubi)
 		spin_unlock(&ubi->wl_lock);
 
 		dbg_wl("do one work synchronously");
-		err = do_work(ubi);
+		err = do_work(ubi, 1);
 		if (err)
 			return err;
 
@@ -597,6 +617,9 @@ repeat:
 	spin_unlock(&ubi->wl_lock);
 }
 
+static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
+			int cancel);
+
 /**
  * schedule_ubi_work - schedule a work.
  * @ubi: UBI device description object
@@ -608,7 +631,12 @@ repeat:
 static void schedule_ubi_work(struct ubi_device *ubi, struct ubi_work *wrk)
 {
 	spin_lock(&ubi->wl_lock);
-	list_add_tail(&wrk->list, &ubi->works);
+	if (wrk->func == &erase_worker)
+		list_add_tail(&wrk->list, &ubi->works);
+	else {
+		list_add_tail(&wrk->list, &ubi->wl_works);
+		ubi->wl_works_count += 1;
+	}
 	ubi_assert(ubi->works_count >= 0);
 	ubi->works_count += 1;
 	if (ubi->thread_enabled && !ubi_dbg_is_bgt_disabled())
@@ -616,9 +644,6 @@ static void schedule_ubi_work(struct ubi_device *ubi, struct ubi_work *wrk)
 	spin_unlock(&ubi->wl_lock);
 }
 
-static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
-			int cancel);
-
 /**
  * schedule_erase - schedule an erase work.
  * @ubi: UBI device description object
@@ -864,6 +889,10 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		}
 	}
 
+	spin_lock(&ubi->wl_lock);
+	ubi->wl_move_count += 1;
+	spin_unlock(&ubi->wl_lock);
+
 	dbg_wl("done");
 	mutex_unlock(&ubi->move_mutex);
 	return 0;
@@ -1015,6 +1044,8 @@ static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
 {
 	struct ubi_wl_entry *e = wl_wrk->e;
 	int pnum = e->pnum, err, need;
+	unsigned int us;
+	ktime_t start;
 
 	if (cancel) {
 		dbg_wl("cancel erasure of PEB %d EC %d", pnum, e->ec);
@@ -1025,13 +1056,19 @@ static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
 
 	dbg_wl("erase PEB %d EC %d", pnum, e->ec);
 
+	start = ktime_get();
 	err = sync_erase(ubi, e, wl_wrk->torture);
 	if (!err) {
 		/* Fine, we've erased it successfully */
 		kfree(wl_wrk);
+		us = ktime_us_delta(ktime_get(), start);
 
 		spin_lock(&ubi->wl_lock);
 		wl_tree_add(e, &ubi->free);
+		ubi->erase_count += 1;
+		ubi->erase_time_us += us;
+		if (us > ubi->erase_max_us)
+			ubi->erase_max_us = us;
 		spin_unlock(&ubi->wl_lock);
 
 		/*
@@ -1268,6 +1305,129 @@ retry:
 	return ensure_wear_leveling(ubi);
 }
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+
+/**
+ * ubi_wl_get_fm_peb - get a physical eraseblock for the fastmap.
+ * @ubi: UBI device description object
+ * @max_pnum: the physical eraseblock number has to be lower than this
+ *
+ * This function removes a free physical eraseblock from the free tree and
+ * hands it over to the fastmap code: the PEB is neither used nor protected
+ * until it is given back by 'ubi_wl_put_fm_peb()'. If there is no free PEB
+ * below @max_pnum, the first used PEB below @max_pnum is scheduled for
+ * scrubbing, so that it becomes free later, and %-ENOSPC is returned. Returns
+ * the physical eraseblock number in case of success and a negative error code
+ * in case of failure.
+ */
+int ubi_wl_get_fm_peb(struct ubi_device *ubi, int max_pnum)
+{
+	int err, pnum;
+	struct rb_node *rb;
+	struct ubi_wl_entry *e;
+
+retry:
+	spin_lock(&ubi->wl_lock);
+	if (!ubi->free.rb_node && ubi->works_count) {
+		spin_unlock(&ubi->wl_lock);
+
+		err = produce_free_peb(ubi);
+		if (err < 0)
+			return err;
+		goto retry;
+	}
+
+	/* The free tree is sorted by erase counter, take the least worn PEB */
+	ubi_rb_for_each_entry(rb, e, &ubi->free, u.rb)
+		if (e->pnum < max_pnum) {
+			rb_erase(&e->u.rb, &ubi->free);
+			spin_unlock(&ubi->wl_lock);
+			dbg_wl("PEB %d EC %d", e->pnum, e->ec);
+			return e->pnum;
+		}
+
+	for (pnum = 0; pnum < max_pnum; pnum++) {
+		e = ubi->lookuptbl[pnum];
+		if (e && in_wl_tree(e, &ubi->used))
+			break;
+	}
+	spin_unlock(&ubi->wl_lock);
+
+	if (pnum < max_pnum) {
+		dbg_wl("scrub PEB %d to make room for the fastmap", pnum);
+		err = ubi_wl_scrub_peb(ubi, pnum);
+		if (err)
+			return err;
+	}
+
+	return -ENOSPC;
+}
+
+/**
+ * ubi_wl_put_fm_peb - return a fastmap physical eraseblock.
+ * @ubi: UBI device description object
+ * @pnum: physical eraseblock to return
+ * @torture: if this physical eraseblock has to be tortured
+ *
+ * This function schedules physical eraseblock @pnum, which was previously
+ * obtained with 'ubi_wl_get_fm_peb()', for erasure. Returns zero in case of
+ * success and a negative error code in case of failure.
+ */
+int ubi_wl_put_fm_peb(struct ubi_device *ubi, int pnum, int torture)
+{
+	struct ubi_wl_entry *e;
+
+	dbg_wl("PEB %d", pnum);
+	spin_lock(&ubi->wl_lock);
+	e = ubi->lookuptbl[pnum];
+	spin_unlock(&ubi->wl_lock);
+	ubi_assert(e);
+
+	return schedule_erase(ubi, e, torture);
+}
+
+/**
+ * ubi_wl_erase_fm_peb - erase a fastmap physical eraseblock.
+ * @ubi: UBI device description object
+ * @pnum: physical eraseblock to erase
+ *
+ * This function synchronously erases physical eraseblock @pnum, which stays
+ * with the fastmap code. It is used to reuse the fastmap anchor in place when
+ * no other free PEB may hold it. Returns zero in case of success and a
+ * negative error code in case of failure.
+ */
+int ubi_wl_erase_fm_peb(struct ubi_device *ubi, int pnum)
+{
+	struct ubi_wl_entry *e;
+
+	spin_lock(&ubi->wl_lock);
+	e = ubi->lookuptbl[pnum];
+	spin_unlock(&ubi->wl_lock);
+	ubi_assert(e);
+
+	return sync_erase(ubi, e, 0);
+}
+
+/**
+ * fm_entries_destroy - free the WL entries of the fastmap PEBs.
+ * @ubi: UBI device description object
+ */
+static void fm_entries_destroy(struct ubi_device *ubi)
+{
+	int i;
+
+	for (i = 0; i < ubi->fm_count; i++)
+		if (ubi->lookuptbl[ubi->fm_pebs[i]])
+			kmem_cache_free(ubi_wl_entry_slab,
+					ubi->lookuptbl[ubi->fm_pebs[i]]);
+}
+
+#else
+
+#define fm_entries_destroy(ubi)
+
+#endif /* CONFIG_MTD_UBI_FASTMAP */
+
 /**
  * ubi_wl_flush - flush all pending works.
  * @ubi: UBI device description object
@@ -1285,7 +1445,7 @@ int ubi_wl_flush(struct ubi_device *ubi)
 	 */
 	dbg_wl("flush (%d pending works)", ubi->works_count);
 	while (ubi->works_count) {
-		err = do_work(ubi);
+		err = do_work(ubi, 1);
 		if (err)
 			return err;
 	}
@@ -1303,7 +1463,7 @@ int ubi_wl_flush(struct ubi_device *ubi)
 	 */
 	while (ubi->works_count) {
 		dbg_wl("flush more (%d pending works)", ubi->works_count);
-		err = do_work(ubi);
+		err = do_work(ubi, 1);
 		if (err)
 			return err;
 	}
@@ -1342,6 +1502,37 @@ static void tree_destroy(struct rb_root *root)
 	}
 }
 
+/**
+ * fg_io_busy - check for foreground I/O.
+ * @ubi: UBI device description object
+ *
+ * Returns non-zero if LEBs are being read or written, or were less than
+ * %WL_IDLE_MS milliseconds ago.
+ */
+static int fg_io_busy(const struct ubi_device *ubi)
+{
+	return atomic_read(&ubi->fg_io) ||
+	       time_before(jiffies, ubi->fg_io_stamp +
+				    msecs_to_jiffies(WL_IDLE_MS));
+}
+
+/**
+ * free_pool_low - check if there are few free physical eraseblocks.
+ * @ubi: UBI device description object
+ *
+ * Returns non-zero if there are less than %WL_FREE_LOW free PEBs. Has to be
+ * called with @ubi->wl_lock locked.
+ */
+static int free_pool_low(const struct ubi_device *ubi)
+{
+	int n = 0;
+	struct rb_node *rb = rb_first(&ubi->free);
+
+	while (rb && ++n < WL_FREE_LOW)
+		rb = rb_next(rb);
+	return n < WL_FREE_LOW;
+}
+
 /**
  * ubi_thread - UBI background thread.
  * @u: the UBI device description object pointer
@@ -1349,6 +1540,7 @@ static void tree_destroy(struct rb_root *root)
 int ubi_thread(void *u)
 {
 	int failures = 0;
+	unsigned long deferred_since = 0;
 	struct ubi_device *ubi = u;
 
 	ubi_msg("background thread \"%s\" started, PID %d",
@@ -1365,16 +1557,39 @@ int ubi_thread(void *u)
 			continue;
 
 		spin_lock(&ubi->wl_lock);
-		if (list_empty(&ubi->works) || ubi->ro_mode ||
+		if (!ubi->works_count || ubi->ro_mode ||
 		    !ubi->thread_enabled || ubi_dbg_is_bgt_disabled()) {
 			set_current_state(TASK_INTERRUPTIBLE);
 			spin_unlock(&ubi->wl_lock);
+			deferred_since = 0;
 			schedule();
 			continue;
 		}
-		spin_unlock(&ubi->wl_lock);
 
-		err = do_work(ubi);
+		if (!fg_io_busy(ubi)) {
+			/* Idle device, pre-erase and wear-level at will */
+			spin_unlock(&ubi->wl_lock);
+			deferred_since = 0;
+			err = do_work(ubi, 1);
+		} else if (deferred_since &&
+			   time_after(jiffies, deferred_since +
+				      msecs_to_jiffies(WL_MAX_DEFER_MS))) {
+			spin_unlock(&ubi->wl_lock);
+			err = do_work(ubi, 1);
+		} else if (ubi->works_count > ubi->wl_works_count &&
+			   free_pool_low(ubi)) {
+			spin_unlock(&ubi->wl_lock);
+			err = do_work(ubi, 0);
+		} else {
+			ubi->bgt_deferred += 1;
+			spin_unlock(&ubi->wl_lock);
+			if (!deferred_since)
+				deferred_since = jiffies;
+			schedule_timeout_interruptible(
+					msecs_to_jiffies(WL_IDLE_MS));
+			continue;
+		}
+
 		if (err) {
 			ubi_err("%s: work failed with error code %d",
 				ubi->bgt_name, err);
@@ -1405,10 +1620,11 @@ int ubi_thread(void *u)
  */
 static void cancel_pending(struct ubi_device *ubi)
 {
-	while (!list_empty(&ubi->works)) {
-		struct ubi_work *wrk;
+	struct ubi_work *wrk, *tmp;
 
-		wrk = list_entry(ubi->works.next, struct ubi_work, list);
+	list_splice_tail_init(&ubi->wl_works, &ubi->works);
+	ubi->wl_works_count = 0;
+	list_for_each_entry_safe(wrk, tmp, &ubi->works, list) {
 		list_del(&wrk->list);
 		wrk->func(ubi, wrk, 1);
 		ubi->works_count -= 1;
@@ -1438,6 +1654,9 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 	init_rwsem(&ubi->work_sem);
 	ubi->max_ec = si->max_ec;
 	INIT_LIST_HEAD(&ubi->works);
+	INIT_LIST_HEAD(&ubi->wl_works);
+	/* jiffies may be just below the wrap: start out idle, not at 0 */
+	ubi->fg_io_stamp = jiffies - msecs_to_jiffies(WL_IDLE_MS);
 
 	sprintf(ubi->bgt_name, UBI_BGT_NAME_PATTERN, ubi->ubi_num);
 
@@ -1503,6 +1722,17 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 		}
 	}
 
+	/* The fastmap PEBs are not in any tree, they belong to the fastmap */
+	list_for_each_entry(seb, &si->fastmap, u.list) {
+		e = kmem_cache_alloc(ubi_wl_entry_slab, GFP_KERNEL);
+		if (!e)
+			goto out_free;
+
+		e->pnum = seb->pnum;
+		e->ec = seb->ec;
+		ubi->lookuptbl[e->pnum] = e;
+	}
+
 	if (ubi->avail_pebs < WL_RESERVED_PEBS) {
 		ubi_err("no enough physical eraseblocks (%d, need %d)",
 			ubi->avail_pebs, WL_RESERVED_PEBS);
@@ -1526,6 +1756,7 @@ out_free:
 	tree_destroy(&ubi->used);
 	tree_destroy(&ubi->free);
 	tree_destroy(&ubi->scrub);
+	fm_entries_destroy(ubi);
 	kfree(ubi->lookuptbl);
 	return err;
 }
@@ -1560,6 +1791,7 @@ void ubi_wl_close(struct ubi_device *ubi)
 	tree_destroy(&ubi->erroneous);
 	tree_destroy(&ubi->free);
 	tree_destroy(&ubi->scrub);
+	fm_entries_destroy(ubi);
 	kfree(ubi->lookuptbl);
 }
 
@@ -24,6 +24,11 @@
 #include <linux/uaccess.h>
 #include <linux/interrupt.h>
 #include <linux/pm_runtime.h>
+#include <linux/s3c_fb.h>
+
+#ifdef CONFIG_ANDROID_PMEM
+#include <linux/android_pmem.h>
+#endif
 
 #include <mach/map.h>
 #include <plat/regs-fb-v4.h>
@@ -35,6 +40,12 @@
  * setting of the alpha-blending functions that each window has, so only
  * window 0 is actually useful.
  *
+ * Windows which are not given to a framebuffer by the platform data can
+ * be used as overlays instead, see S3CFB_SET_OVERLAY in <linux/s3c_fb.h>.
+ * They take their buffer from PMEM (or from another driver through the
+ * in-kernel interface) and are blended over the framebuffer windows with
+ * either a plane or a per-pixel alpha value.
+ *
  * Window 0 is treated specially, it is used for the basis of the LCD
  * output timings and as the control for the output power-down state.
 */
@@ -183,6 +194,39 @@ struct s3c_fb_vsync {
 	unsigned int		count;
 };
 
+/**
+ * struct s3c_fb_overlay_buf - buffer given to an overlay by another driver
+ * @done: Function to call once the buffer is no longer scanned out.
+ * @priv: Argument for @done.
+ */
+struct s3c_fb_overlay_buf {
+	s3c_fb_flip_done_t	 done;
+	void			*priv;
+};
+
+/**
+ * struct s3c_fb_overlay_win - window driven through the overlay interface
+ * @win: The window data used by the register helpers (has no fbinfo).
+ * @cfg: The configuration currently applied to the window.
+ * @addr: The bus address of the buffer last written to the registers.
+ * @file: The PMEM file backing the buffer, if it came from userspace.
+ * @enabled: Set if the window is currently shown.
+ * @flip_pending: Set until the VSYNC latching the last register update.
+ * @shown: The buffer being scanned out.
+ * @next: The buffer which replaces @shown at the next VSYNC.
+ */
+struct s3c_fb_overlay_win {
+	struct s3c_fb_win	 win;
+	struct s3c_fb_overlay	 cfg;
+	dma_addr_t		 addr;
+	struct file		*file;
+	bool			 enabled;
+
+	bool			 flip_pending;
+	struct s3c_fb_overlay_buf shown;
+	struct s3c_fb_overlay_buf next;
+};
+
 /**
  * struct s3c_fb - overall hardware state of the hardware
  * @slock: The spinlock protection for this data sturcture.
@@ -197,6 +241,7 @@ struct s3c_fb_vsync {
  * @irq_no: IRQ line number
  * @irq_flags: irq flags
  * @vsync_info: VSYNC-related information (count, queues...)
+ * @overlays: The hardware windows available as overlays.
  */
 struct s3c_fb {
 	spinlock_t		slock;
@@ -215,8 +260,13 @@ struct s3c_fb {
 	int			 irq_no;
 	unsigned long		 irq_flags;
 	struct s3c_fb_vsync	 vsync_info;
+
+	struct s3c_fb_overlay_win *overlays[S3C_FB_MAX_WIN];
 };
 
+/* the display controller the in-kernel overlay interface talks to */
+static struct s3c_fb *s3c_fb_overlay_dev;
+
 /**
  * s3c_fb_validate_win_bpp - validate the bits-per-pixel for this mode.
  * @win: The device window.
@@ -949,12 +999,58 @@ static void s3c_fb_disable_irq(struct s3c_fb *sfb)
 	}
 }
 
+/**
+ * s3c_fb_overlay_latch() - account for the VSYNC latching overlay updates
+ * @sfb: main hardware state
+ * @released: Array of S3C_FB_MAX_WIN entries to return the buffers which
+ *            are no longer scanned out.
+ *
+ * Called with the slock held. The callbacks of the @released buffers have
+ * to be run by the caller after dropping the lock, as the owners of the
+ * buffers may call s3c_fb_overlay_flip() with their own locks held.
+ */
+static void s3c_fb_overlay_latch(struct s3c_fb *sfb,
+				 struct s3c_fb_overlay_buf *released)
+{
+	struct s3c_fb_overlay_win *ovl;
+	int win_no;
+
+	for (win_no = 0; win_no < S3C_FB_MAX_WIN; win_no++) {
+		ovl = sfb->overlays[win_no];
+		released[win_no].done = NULL;
+
+		if (!ovl || !ovl->flip_pending)
+			continue;
+
+		released[win_no] = ovl->shown;
+		ovl->shown = ovl->next;
+		ovl->next.done = NULL;
+		ovl->flip_pending = false;
+	}
+}
+
+/**
+ * s3c_fb_overlay_release() - run the callbacks of released overlay buffers
+ * @released: The buffers returned by s3c_fb_overlay_latch().
+ */
+static void s3c_fb_overlay_release(struct s3c_fb_overlay_buf *released)
+{
+	int win_no;
+
+	for (win_no = 0; win_no < S3C_FB_MAX_WIN; win_no++)
+		if (released[win_no].done)
+			released[win_no].done(released[win_no].priv);
+}
+
 static irqreturn_t s3c_fb_irq(int irq, void *dev_id)
 {
 	struct s3c_fb *sfb = dev_id;
 	void __iomem  *regs = sfb->regs;
+	struct s3c_fb_overlay_buf released[S3C_FB_MAX_WIN];
 	u32 irq_sts_reg;
 
+	memset(released, 0, sizeof(released));
+
 	spin_lock(&sfb->slock);
 
 	irq_sts_reg = readl(regs + VIDINTCON1);
@@ -965,15 +1061,22 @@ static irqreturn_t s3c_fb_irq(int irq, void *dev_id)
 		writel(VIDINTCON1_INT_FRAME, regs + VIDINTCON1);
 
 		sfb->vsync_info.count++;
-		wake_up_interruptible(&sfb->vsync_info.wait);
+		s3c_fb_overlay_latch(sfb, released);
 	}
 
-	/* We only support waiting for VSYNC for now, so it's safe
-	 * to always disable irqs here.
+	/* We only use the VSYNC interrupt for waiting and for overlay
+	 * flips, which all complete at this one, so it's safe to always
+	 * disable irqs here.
 	 */
 	s3c_fb_disable_irq(sfb);
 
 	spin_unlock(&sfb->slock);
+
+	/* wake the waiters only once the buffers are back with their owners */
+	s3c_fb_overlay_release(released);
+
+	if (irq_sts_reg & VIDINTCON1_INT_FRAME)
+		wake_up_interruptible(&sfb->vsync_info.wait);
 	return IRQ_HANDLED;
 }
 
@@ -1001,11 +1104,414 @@ static int s3c_fb_wait_for_vsync(struct s3c_fb *sfb, u32 crtc)
 	return 0;
 }
 
+/**
+ * s3c_fb_overlay_bpp() - get the window bit depth for an overlay format
+ * @format: One of the S3CFB_FMT_* values.
+ *
+ * Returns the bits-per-pixel value as used by the window variant data,
+ * or 0 if the format is not known.
+ */
+static unsigned int s3c_fb_overlay_bpp(u32 format)
+{
+	switch (format) {
+	case S3CFB_FMT_RGB565:
+		return 16;
+	case S3CFB_FMT_XRGB8888:
+		return 24;
+	case S3CFB_FMT_ARGB8888:
+		return 28;
+	}
+
+	return 0;
+}
+
+/**
+ * s3c_fb_overlay_check() - validate an overlay configuration.
+ * @sfb: main hardware state
+ * @cfg: The requested configuration.
+ *
+ * Check the configuration against the window capabilities and against
+ * the size of the display, returning the overlay window to use for it.
+ */
+static struct s3c_fb_overlay_win *s3c_fb_overlay_check(struct s3c_fb *sfb,
+					const struct s3c_fb_overlay *cfg)
+{
+	struct fb_var_screeninfo *lcd;
+	struct s3c_fb_overlay_win *ovl;
+	unsigned int bpp, pagewidth;
+
+	if (cfg->win >= sfb->variant.nr_windows)
+		return ERR_PTR(-EINVAL);
+
+	ovl = sfb->overlays[cfg->win];
+	if (!ovl)
+		return ERR_PTR(-EBUSY);
+
+	if (!(cfg->flags & S3CFB_OVERLAY_ENABLE))
+		return ovl;
+
+	bpp = s3c_fb_overlay_bpp(cfg->format);
+	if (!bpp || !s3c_fb_validate_win_bpp(&ovl->win, bpp)) {
+		dev_dbg(sfb->dev, "win %d: unsupported overlay format %u\n",
+			cfg->win, cfg->format);
+		return ERR_PTR(-EINVAL);
+	}
+
+	/* the buffer lines must be a whole number of words */
+	pagewidth = cfg->width * (bpp > 16 ? 4 : 2);
+	if (!cfg->width || !cfg->height || pagewidth & 3
+	    || cfg->stride < pagewidth || cfg->alpha > S3CFB_ALPHA_MAX)
+		return ERR_PTR(-EINVAL);
+
+	lcd = &sfb->windows[sfb->pdata->default_win]->fbinfo->var;
+	if (cfg->x < 0 || cfg->y < 0
+	    || cfg->x + cfg->width > lcd->xres
+	    || cfg->y + cfg->height > lcd->yres)
+		return ERR_PTR(-EINVAL);
+
+	return ovl;
+}
+
+/**
+ * s3c_fb_overlay_set_addr() - write the buffer address of an overlay window
+ * @sfb: main hardware state
+ * @ovl: The overlay window, with @addr set.
+ *
+ * Must be called with the window shadow registers protected.
+ */
+static void s3c_fb_overlay_set_addr(struct s3c_fb *sfb,
+				    struct s3c_fb_overlay_win *ovl)
+{
+	void __iomem *buf = sfb->regs + ovl->win.index * 8;
+
+	writel(ovl->addr, buf + sfb->variant.buf_start);
+	writel(ovl->addr + ovl->cfg.stride * ovl->cfg.height,
+	       buf + sfb->variant.buf_end);
+}
+
+/**
+ * s3c_fb_overlay_program() - write the overlay window registers
+ * @sfb: main hardware state
+ * @ovl: The overlay window.
+ *
+ * Program the window from the configuration stored in @ovl. All the
+ * values are written with the shadow registers protected, so they take
+ * effect together at the next VSYNC. Called with the slock held.
+ */
+static void s3c_fb_overlay_program(struct s3c_fb *sfb,
+				   struct s3c_fb_overlay_win *ovl)
+{
+	struct s3c_fb_overlay *cfg = &ovl->cfg;
+	struct s3c_fb_win *win = &ovl->win;
+	void __iomem *regs = sfb->regs;
+	int win_no = win->index;
+	u32 pagewidth;
+	u32 alpha;
+	u32 data;
+
+	shadow_protect_win(win, 1);
+
+	if (!ovl->enabled) {
+		writel(0, regs + sfb->variant.wincon + (win_no * 4));
+		goto out;
+	}
+
+	s3c_fb_overlay_set_addr(sfb, ovl);
+
+	pagewidth = cfg->width * (cfg->format == S3CFB_FMT_RGB565 ? 2 : 4);
+	data = VIDW_BUF_SIZE_OFFSET(cfg->stride - pagewidth) |
+	       VIDW_BUF_SIZE_PAGEWIDTH(pagewidth);
+	writel(data, regs + sfb->variant.buf_size + (win_no * 4));
+
+	data = VIDOSDxA_TOPLEFT_X(cfg->x) | VIDOSDxA_TOPLEFT_Y(cfg->y);
+	writel(data, regs + VIDOSD_A(win_no, sfb->variant));
+
+	data = VIDOSDxB_BOTRIGHT_X(cfg->x + cfg->width - 1) |
+	       VIDOSDxB_BOTRIGHT_Y(cfg->y + cfg->height - 1);
+	writel(data, regs + VIDOSD_B(win_no, sfb->variant));
+
+	/* the hardware has 4 bits of alpha per colour channel */
+	alpha = cfg->alpha >> 4;
+	data = VIDISD14C_ALPHA0_R(alpha) | VIDISD14C_ALPHA0_G(alpha) |
+	       VIDISD14C_ALPHA0_B(alpha) | VIDISD14C_ALPHA1_R(alpha) |
+	       VIDISD14C_ALPHA1_G(alpha) | VIDISD14C_ALPHA1_B(alpha);
+
+	vidosd_set_alpha(win, data);
+	vidosd_set_size(win, cfg->width * cfg->height);
+
+	if (sfb->variant.has_shadowcon) {
+		data = readl(sfb->regs + SHADOWCON);
+		data |= SHADOWCON_CHx_ENABLE(win_no);
+		writel(data, sfb->regs + SHADOWCON);
+	}
+
+	data = WINCONx_ENWIN | WINCONx_BURSTLEN_16WORD;
+
+	switch (cfg->format) {
+	case S3CFB_FMT_RGB565:
+		data |= WINCON1_BPPMODE_16BPP_565 | WINCONx_HAWSWP;
+		break;
+	case S3CFB_FMT_XRGB8888:
+		data |= WINCON1_BPPMODE_24BPP_888 | WINCONx_WSWP;
+		break;
+	case S3CFB_FMT_ARGB8888:
+		data |= WINCON1_BPPMODE_28BPP_A4888 | WINCONx_WSWP
+			| WINCON1_BLD_PIX | WINCON1_ALPHA_SEL;
+		break;
+	}
+
+	writel(data, regs + sfb->variant.wincon + (win_no * 4));
+	writel(0x0, regs + sfb->variant.winmap + (win_no * 4));
+
+out:
+	shadow_protect_win(win, 0);
+}
+
+/**
+ * s3c_fb_overlay_apply() - change the configuration of an overlay window
+ * @sfb: main hardware state
+ * @cfg: The new configuration.
+ * @addr: The bus address of the buffer to show.
+ * @file: The PMEM file backing the buffer, or NULL.
+ * @done: Function to call once the buffer is no longer scanned out.
+ * @priv: Argument for @done.
+ * @old_file: Where to return the PMEM file of the previous buffer.
+ *
+ * The reference to @file is taken over by the window. The caller has to
+ * drop the one returned in @old_file once the update has been latched.
+ * A buffer flipped in by another driver and not shown yet is released
+ * right away, the one being shown is released at the next VSYNC.
+ */
+static int s3c_fb_overlay_apply(struct s3c_fb *sfb,
+				const struct s3c_fb_overlay *cfg,
+				dma_addr_t addr, struct file *file,
+				s3c_fb_flip_done_t done, void *priv,
+				struct file **old_file)
+{
+	bool enable = cfg->flags & S3CFB_OVERLAY_ENABLE;
+	struct s3c_fb_overlay_buf dropped;
+	struct s3c_fb_overlay_win *ovl;
+	unsigned long flags;
+	bool was_enabled;
+
+	ovl = s3c_fb_overlay_check(sfb, cfg);
+	if (IS_ERR(ovl))
+		return PTR_ERR(ovl);
+
+	pm_runtime_get_sync(sfb->dev);
+
+	spin_lock_irqsave(&sfb->slock, flags);
+
+	was_enabled = ovl->enabled;
+	ovl->enabled = enable;
+	ovl->cfg = *cfg;
+	ovl->addr = addr;
+	*old_file = ovl->file;
+	ovl->file = file;
+
+	dropped = ovl->next;
+	ovl->next.done = done;
+	ovl->next.priv = priv;
+	ovl->flip_pending = true;
+
+	s3c_fb_overlay_program(sfb, ovl);
+	s3c_fb_enable_irq(sfb);
+
+	spin_unlock_irqrestore(&sfb->slock, flags);
+
+	if (dropped.done)
+		dropped.done(dropped.priv);
+
+	/* a shown window keeps a reference to the controller */
+	if (was_enabled)
+		pm_runtime_put_sync(sfb->dev);
+	if (!enable)
+		pm_runtime_put_sync(sfb->dev);
+
+	return 0;
+}
+
+/**
+ * s3c_fb_overlay_ioctl() - handle S3CFB_SET_OVERLAY
+ * @sfb: main hardware state
+ * @cfg: The configuration passed by userspace.
+ */
+static int s3c_fb_overlay_ioctl(struct s3c_fb *sfb, struct s3c_fb_overlay *cfg)
+{
+	struct file *file = NULL;
+	struct file *old_file;
+	dma_addr_t addr = 0;
+	int ret;
+
+	if (cfg->flags & S3CFB_OVERLAY_ENABLE) {
+#ifdef CONFIG_ANDROID_PMEM
+		unsigned long start, vstart, len;
+
+		if (get_pmem_file(cfg->fd, &start, &vstart, &len, &file))
+			return -EINVAL;
+
+		if (cfg->offset >= len ||
+		    (u64)cfg->stride * cfg->height > len - cfg->offset) {
+			put_pmem_file(file);
+			return -EINVAL;
+		}
+
+		addr = start + cfg->offset;
+#else
+		return -ENODEV;
+#endif
+	}
+
+	ret = s3c_fb_overlay_apply(sfb, cfg, addr, file, NULL, NULL,
+				   &old_file);
+	if (ret) {
+#ifdef CONFIG_ANDROID_PMEM
+		if (file)
+			put_pmem_file(file);
+#endif
+		return ret;
+	}
+
+	/* the previous buffer can only be released once it is no longer
+	 * being scanned out */
+	if (old_file || (cfg->flags & S3CFB_OVERLAY_WAIT_VSYNC)) {
+		ret = s3c_fb_wait_for_vsync(sfb, 0);
+		if (!(cfg->flags & S3CFB_OVERLAY_WAIT_VSYNC))
+			ret = 0;
+	}
+
+#ifdef CONFIG_ANDROID_PMEM
+	if (old_file)
+		put_pmem_file(old_file);
+#endif
+
+	return ret;
+}
+
+/**
+ * s3c_fb_overlay_setup() - configure an overlay window from another driver
+ * @ovl: The window configuration, @fd and @offset are not used.
+ * @addr: The bus address of the first buffer to show.
+ * @done: Function to call once the buffer is no longer scanned out.
+ * @priv: Argument for @done.
+ *
+ * Returns immediately, the new configuration is shown from the next VSYNC.
+ */
+int s3c_fb_overlay_setup(const struct s3c_fb_overlay *ovl, dma_addr_t addr,
+			 s3c_fb_flip_done_t done, void *priv)
+{
+	struct s3c_fb *sfb = s3c_fb_overlay_dev;
+	struct file *old_file;
+	int ret;
+
+	if (!sfb)
+		return -ENODEV;
+
+	ret = s3c_fb_overlay_apply(sfb, ovl, addr, NULL, done, priv,
+				   &old_file);
+	WARN_ON(!ret && old_file);
+
+	return ret;
+}
+EXPORT_SYMBOL(s3c_fb_overlay_setup);
+
+/**
+ * s3c_fb_overlay_flip() - show a new buffer in an enabled overlay window
+ * @win: The window number.
+ * @addr: The bus address of the buffer, in the configured format.
+ * @done: Function to call once the buffer is no longer scanned out.
+ * @priv: Argument for @done.
+ *
+ * Can be called from interrupt context. The buffer is shown from the
+ * next VSYNC until it is replaced by a later flip or the window gets
+ * disabled, then @done is called from the VSYNC interrupt. Only one flip
+ * can be pending at a time, -EBUSY is returned until it is latched.
+ */
+int s3c_fb_overlay_flip(unsigned int win, dma_addr_t addr,
+			s3c_fb_flip_done_t done, void *priv)
+{
+	struct s3c_fb *sfb = s3c_fb_overlay_dev;
+	struct s3c_fb_overlay_win *ovl;
+	unsigned long flags;
+	int ret = 0;
+
+	if (!sfb || win >= S3C_FB_MAX_WIN)
+		return -ENODEV;
+
+	spin_lock_irqsave(&sfb->slock, flags);
+
+	ovl = sfb->overlays[win];
+	if (!ovl || !ovl->enabled) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (ovl->flip_pending) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	ovl->addr = addr;
+	ovl->next.done = done;
+	ovl->next.priv = priv;
+	ovl->flip_pending = true;
+
+	shadow_protect_win(&ovl->win, 1);
+	s3c_fb_overlay_set_addr(sfb, ovl);
+	shadow_protect_win(&ovl->win, 0);
+
+	s3c_fb_enable_irq(sfb);
+
+out:
+	spin_unlock_irqrestore(&sfb->slock, flags);
+	return ret;
+}
+EXPORT_SYMBOL(s3c_fb_overlay_flip);
+
+/**
+ * s3c_fb_overlay_disable() - hide an overlay window set up by a driver
+ * @win: The window number.
+ *
+ * Returns after the window has been removed from the display, with the
+ * callbacks of all the buffers given to it completed.
+ */
+int s3c_fb_overlay_disable(unsigned int win)
+{
+	struct s3c_fb *sfb = s3c_fb_overlay_dev;
+	struct s3c_fb_overlay cfg = { .win = win };
+	struct s3c_fb_overlay_buf released[S3C_FB_MAX_WIN];
+	struct file *old_file;
+	unsigned long flags;
+	int ret;
+
+	if (!sfb)
+		return -ENODEV;
+
+	ret = s3c_fb_overlay_apply(sfb, &cfg, 0, NULL, NULL, NULL, &old_file);
+	if (ret)
+		return ret;
+
+	WARN_ON(old_file);
+
+	/* if the display is off, nothing is going to latch the update */
+	if (s3c_fb_wait_for_vsync(sfb, 0)) {
+		spin_lock_irqsave(&sfb->slock, flags);
+		s3c_fb_overlay_latch(sfb, released);
+		spin_unlock_irqrestore(&sfb->slock, flags);
+
+		s3c_fb_overlay_release(released);
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL(s3c_fb_overlay_disable);
+
 static int s3c_fb_ioctl(struct fb_info *info, unsigned int cmd,
 			unsigned long arg)
 {
 	struct s3c_fb_win *win = info->par;
 	struct s3c_fb *sfb = win->parent;
+	struct s3c_fb_overlay ovl;
 	int ret;
 	u32 crtc;
 
@@ -1018,6 +1524,15 @@ static int s3c_fb_ioctl(struct fb_info *info, unsigned int cmd,
 
 		ret = s3c_fb_wait_for_vsync(sfb, crtc);
 		break;
+
+	case S3CFB_SET_OVERLAY:
+		if (copy_from_user(&ovl, (void __user *)arg, sizeof(ovl))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		ret = s3c_fb_overlay_ioctl(sfb, &ovl);
+		break;
 	default:
 		ret = -ENOTTY;
 	}
@@ -1313,6 +1828,84 @@ static void s3c_fb_clear_win(struct s3c_fb *sfb, int win)
 	writel(reg & ~SHADOWCON_WINx_PROTECT(win), regs + SHADOWCON);
 }
 
+/**
+ * s3c_fb_probe_overlay() - set up an hardware window for overlay use
+ * @sfb: The base resources for the hardware.
+ * @win_no: The window number.
+ * @variant: The variant information for this window.
+ */
+static int __devinit s3c_fb_probe_overlay(struct s3c_fb *sfb,
+					  unsigned int win_no,
+					  struct s3c_fb_win_variant *variant)
+{
+	struct s3c_fb_overlay_win *ovl;
+
+	ovl = kzalloc(sizeof(struct s3c_fb_overlay_win), GFP_KERNEL);
+	if (!ovl)
+		return -ENOMEM;
+
+	ovl->win.variant = *variant;
+	ovl->win.parent = sfb;
+	ovl->win.index = win_no;
+
+	sfb->overlays[win_no] = ovl;
+
+	dev_info(sfb->dev, "window %d: overlay\n", win_no);
+
+	return 0;
+}
+
+/**
+ * s3c_fb_release_overlays() - hide and free the overlay windows
+ * @sfb: The base resources for the hardware.
+ */
+static void s3c_fb_release_overlays(struct s3c_fb *sfb)
+{
+	struct s3c_fb_overlay_win *ovl;
+	int win_no;
+
+	for (win_no = 0; win_no < S3C_FB_MAX_WIN; win_no++) {
+		ovl = sfb->overlays[win_no];
+		if (!ovl)
+			continue;
+
+		if (ovl->enabled) {
+			writel(0, sfb->regs + sfb->variant.wincon
+			       + (win_no * 4));
+			pm_runtime_put_noidle(sfb->dev);
+		}
+#ifdef CONFIG_ANDROID_PMEM
+		if (ovl->file)
+			put_pmem_file(ovl->file);
+#endif
+		if (ovl->shown.done)
+			ovl->shown.done(ovl->shown.priv);
+		if (ovl->next.done)
+			ovl->next.done(ovl->next.priv);
+
+		sfb->overlays[win_no] = NULL;
+		kfree(ovl);
+	}
+}
+
+/**
+ * s3c_fb_restore_overlays() - reprogram the overlay windows on resume
+ * @sfb: The base resources for the hardware.
+ */
+static void s3c_fb_restore_overlays(struct s3c_fb *sfb)
+{
+	unsigned long flags;
+	int win_no;
+
+	spin_lock_irqsave(&sfb->slock, flags);
+
+	for (win_no = 0; win_no < S3C_FB_MAX_WIN; win_no++)
+		if (sfb->overlays[win_no] && sfb->overlays[win_no]->enabled)
+			s3c_fb_overlay_program(sfb, sfb->overlays[win_no]);
+
+	spin_unlock_irqrestore(&sfb->slock, flags);
+}
+
 static int __devinit s3c_fb_probe(struct platform_device *pdev)
 {
 	const struct platform_device_id *platid;
@@ -1464,6 +2057,26 @@ static int __devinit s3c_fb_probe(struct platform_device *pdev)
 		}
 	}
 
+	/* the windows left over are available as overlays */
+
+	for (win = 1; win < fbdrv->variant.nr_windows; win++) {
+		if (sfb->windows[win] || !fbdrv->win[win])
+			continue;
+
+		ret = s3c_fb_probe_overlay(sfb, win, fbdrv->win[win]);
+		if (ret < 0) {
+			dev_err(dev, "failed to create overlay %d\n", win);
+			s3c_fb_release_overlays(sfb);
+			for (win = S3C_FB_MAX_WIN - 1; win >= 0; win--)
+				if (sfb->windows[win])
+					s3c_fb_release_win(sfb,
+							   sfb->windows[win]);
+			goto err_irq;
+		}
+	}
+
+	s3c_fb_overlay_dev = sfb;
+
 	platform_set_drvdata(pdev, sfb);
 	pm_runtime_put_sync(sfb->dev);
 
@@ -1504,6 +2117,9 @@ static int __devexit s3c_fb_remove(struct platform_device *pdev)
 
 	pm_runtime_get_sync(sfb->dev);
 
+	s3c_fb_overlay_dev = NULL;
+	s3c_fb_release_overlays(sfb);
+
 	for (win = 0; win < S3C_FB_MAX_WIN; win++)
 		if (sfb->windows[win])
 			s3c_fb_release_win(sfb, sfb->windows[win]);
@@ -1588,6 +2204,8 @@ static int s3c_fb_resume(struct device *dev)
 		s3c_fb_set_par(win->fbinfo);
 	}
 
+	s3c_fb_restore_overlays(sfb);
+
 	return 0;
 }
 
@@ -1651,6 +2269,8 @@ static int s3c_fb_runtime_resume(struct device *dev)
 		s3c_fb_set_par(win->fbinfo);
 	}
 
+	s3c_fb_restore_overlays(sfb);
+
 	return 0;
 }
 
@@ -20,6 +20,8 @@
 #include <linux/compat.h>
 #include <asm/uaccess.h>
 #include <linux/kernel.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
 #include "fat.h"
 
 /*
@@ -334,105 +336,470 @@ parse_long:
 }
 
 /*
- * Return values: negative -> error, 0 -> not found, positive -> found,
- * value is the total amount of slots, including the shortname entry.
+ * Read the next directory record from *cpos: the long name slots, if any,
+ * and the short name entry.  Free entries and volume labels are skipped.
+ * On return *de is the short name entry and *cpos the position after it.
+ * The short name is converted to @shortname (*short_len is 0 if it is
+ * blank) and, if *nr_slots is not zero, the long name to *longname.
+ *
+ * Returns 0, -ENOENT at the end of the directory, or a negative error.
  */
-int fat_search_long(struct inode *inode, const unsigned char *name,
-		    int name_len, struct fat_slot_info *sinfo)
+static int fat_get_names(struct inode *dir, loff_t *cpos,
+			 struct buffer_head **bh, struct msdos_dir_entry **de,
+			 wchar_t **unicode, unsigned char *nr_slots,
+			 unsigned char *shortname, int *short_len,
+			 unsigned char **longname, int *long_len)
 {
-	struct super_block *sb = inode->i_sb;
+	struct super_block *sb = dir->i_sb;
 	struct msdos_sb_info *sbi = MSDOS_SB(sb);
-	struct buffer_head *bh = NULL;
-	struct msdos_dir_entry *de;
 	struct nls_table *nls_disk = sbi->nls_disk;
-	unsigned char nr_slots;
+	unsigned short opt_shortname = sbi->options.shortname;
 	wchar_t bufuname[14];
-	wchar_t *unicode = NULL;
 	unsigned char work[MSDOS_NAME];
-	unsigned char bufname[FAT_MAX_SHORT_SIZE];
-	unsigned short opt_shortname = sbi->options.shortname;
-	loff_t cpos = 0;
-	int chl, i, j, last_u, err, len;
+	int chl, i, j, last_u;
 
-	err = -ENOENT;
 	while (1) {
-		if (fat_get_entry(inode, &cpos, &bh, &de) == -1)
-			goto end_of_dir;
+		if (fat_get_entry(dir, cpos, bh, de) == -1)
+			return -ENOENT;
 parse_record:
-		nr_slots = 0;
-		if (de->name[0] == DELETED_FLAG)
+		*nr_slots = 0;
+		if ((*de)->name[0] == DELETED_FLAG)
 			continue;
-		if (de->attr != ATTR_EXT && (de->attr & ATTR_VOLUME))
+		if ((*de)->attr != ATTR_EXT && ((*de)->attr & ATTR_VOLUME))
 			continue;
-		if (de->attr != ATTR_EXT && IS_FREE(de->name))
+		if ((*de)->attr != ATTR_EXT && IS_FREE((*de)->name))
 			continue;
-		if (de->attr == ATTR_EXT) {
-			int status = fat_parse_long(inode, &cpos, &bh, &de,
-						    &unicode, &nr_slots);
-			if (status < 0) {
-				err = status;
-				goto end_of_dir;
-			} else if (status == PARSE_INVALID)
+		if ((*de)->attr == ATTR_EXT) {
+			int status = fat_parse_long(dir, cpos, bh, de,
+						    unicode, nr_slots);
+			if (status < 0)
+				return status;
+			else if (status == PARSE_INVALID)
 				continue;
 			else if (status == PARSE_NOT_LONGNAME)
 				goto parse_record;
 			else if (status == PARSE_EOF)
-				goto end_of_dir;
+				return -ENOENT;
 		}
+		break;
+	}
 
-		memcpy(work, de->name, sizeof(de->name));
-		/* see namei.c, msdos_format_name */
-		if (work[0] == 0x05)
-			work[0] = 0xE5;
-		for (i = 0, j = 0, last_u = 0; i < 8;) {
-			if (!work[i])
-				break;
-			chl = fat_shortname2uni(nls_disk, &work[i], 8 - i,
-						&bufuname[j++], opt_shortname,
-						de->lcase & CASE_LOWER_BASE);
-			if (chl <= 1) {
-				if (work[i] != ' ')
-					last_u = j;
-			} else {
+	memcpy(work, (*de)->name, sizeof((*de)->name));
+	/* see namei.c, msdos_format_name */
+	if (work[0] == 0x05)
+		work[0] = 0xE5;
+	for (i = 0, j = 0, last_u = 0; i < 8;) {
+		if (!work[i])
+			break;
+		chl = fat_shortname2uni(nls_disk, &work[i], 8 - i,
+					&bufuname[j++], opt_shortname,
+					(*de)->lcase & CASE_LOWER_BASE);
+		if (chl <= 1) {
+			if (work[i] != ' ')
 				last_u = j;
-			}
-			i += chl;
+		} else {
+			last_u = j;
 		}
-		j = last_u;
-		fat_short2uni(nls_disk, ".", 1, &bufuname[j++]);
-		for (i = 8; i < MSDOS_NAME;) {
-			if (!work[i])
-				break;
-			chl = fat_shortname2uni(nls_disk, &work[i],
-						MSDOS_NAME - i,
-						&bufuname[j++], opt_shortname,
-						de->lcase & CASE_LOWER_EXT);
-			if (chl <= 1) {
-				if (work[i] != ' ')
-					last_u = j;
-			} else {
+		i += chl;
+	}
+	j = last_u;
+	fat_short2uni(nls_disk, ".", 1, &bufuname[j++]);
+	for (i = 8; i < MSDOS_NAME;) {
+		if (!work[i])
+			break;
+		chl = fat_shortname2uni(nls_disk, &work[i],
+					MSDOS_NAME - i,
+					&bufuname[j++], opt_shortname,
+					(*de)->lcase & CASE_LOWER_EXT);
+		if (chl <= 1) {
+			if (work[i] != ' ')
 				last_u = j;
+		} else {
+			last_u = j;
+		}
+		i += chl;
+	}
+
+	*short_len = 0;
+	*long_len = 0;
+	if (!last_u)
+		return 0;
+
+	bufuname[last_u] = 0x0000;
+	*short_len = fat_uni_to_x8(sb, bufuname, shortname, FAT_MAX_SHORT_SIZE);
+
+	if (*nr_slots) {
+		int size = PATH_MAX - FAT_MAX_UNI_SIZE;
+
+		*longname = (unsigned char *)(*unicode + FAT_MAX_UNI_CHARS);
+		*long_len = fat_uni_to_x8(sb, *unicode, *longname, size);
+	}
+
+	return 0;
+}
+
+/*
+ * Directory lookup hash.
+ *
+ * fat_search_long() and fat_scan() read the directory from the start,
+ * which gets slow in directories of thousands of files (camera folders).
+ * Once a search had to go through FAT_DHASH_MIN_RECORDS records, the
+ * directory gets an in-memory hash of the names of its records:
+ * the short name and the long name as compared by fat_search_long()
+ * (case folded unless name_check=s), and the raw 8.3 name as compared by
+ * fat_scan().  An entry only holds a name hash and the position of the
+ * record; the record is read and compared to confirm a match, so hash
+ * collisions and entries of removed records are harmless.  A name that
+ * isn't in the hash isn't in the directory, so looking up a new name
+ * doesn't read the directory at all.
+ *
+ * The hash is kept up to date by fat_add_entries(), which also uses the
+ * hash's lower bound of the free slots.  It is protected by the
+ * superblock lock, like all the directory modifications, and freed when
+ * the inode is evicted, or dropped if it can't be kept up to date.
+ */
+#define FAT_DHASH_MIN_RECORDS	128
+#define FAT_DHASH_MIN_BITS	6
+#define FAT_DHASH_MAX_BITS	10
+
+struct fat_dhash_entry {
+	struct hlist_node node;
+	u32 hash;
+	u32 slot;		/* record position / sizeof(msdos_dir_entry) */
+};
+
+struct fat_dhash {
+	unsigned int bits;
+	unsigned int nr_entries;
+	unsigned int nr_stale;	/* entries of removed records */
+	loff_t free_pos;	/* no free slot before this position */
+	struct hlist_head table[0];
+};
+
+static struct kmem_cache *fat_dhash_cachep;
+
+int __init fat_dhash_init(void)
+{
+	fat_dhash_cachep = kmem_cache_create("fat_dhash_cache",
+				sizeof(struct fat_dhash_entry),
+				0, SLAB_RECLAIM_ACCOUNT|SLAB_MEM_SPREAD,
+				NULL);
+	if (fat_dhash_cachep == NULL)
+		return -ENOMEM;
+	return 0;
+}
+
+void fat_dhash_destroy(void)
+{
+	kmem_cache_destroy(fat_dhash_cachep);
+}
+
+void fat_dhash_free(struct inode *dir)
+{
+	struct fat_dhash *dh = MSDOS_I(dir)->i_dhash;
+	struct fat_dhash_entry *e;
+	struct hlist_node *p, *n;
+	int i;
+
+	if (!dh)
+		return;
+	MSDOS_I(dir)->i_dhash = NULL;
+
+	for (i = 0; i < (1 << dh->bits); i++) {
+		hlist_for_each_entry_safe(e, p, n, &dh->table[i], node)
+			kmem_cache_free(fat_dhash_cachep, e);
+	}
+	kfree(dh);
+}
+
+/* Hash of a name as fat_name_match() compares it */
+static u32 fat_dhash_name(struct msdos_sb_info *sbi,
+			  const unsigned char *name, int len)
+{
+	unsigned long hash;
+
+	if (sbi->options.name_check == 's')
+		return full_name_hash(name, len);
+
+	hash = init_name_hash();
+	while (len--)
+		hash = partial_name_hash(nls_tolower(sbi->nls_io, *name++),
+					 hash);
+	return end_name_hash(hash);
+}
+
+/* Hash of a raw 8.3 name as fat_scan() compares it */
+static u32 fat_dhash_rawname(const unsigned char *name)
+{
+	return full_name_hash(name, strnlen((const char *)name, MSDOS_NAME));
+}
+
+static int fat_dhash_add(struct fat_dhash *dh, u32 hash, loff_t pos)
+{
+	struct hlist_head *head = &dh->table[hash_32(hash, dh->bits)];
+	u32 slot = pos >> MSDOS_DIR_BITS;
+	struct fat_dhash_entry *e;
+	struct hlist_node *p;
+
+	hlist_for_each_entry(e, p, head, node) {
+		if (e->hash == hash && e->slot == slot)
+			return 0;
+	}
+
+	e = kmem_cache_alloc(fat_dhash_cachep, GFP_NOFS);
+	if (!e)
+		return -ENOMEM;
+	e->hash = hash;
+	e->slot = slot;
+	hlist_add_head(&e->node, head);
+	dh->nr_entries++;
+	return 0;
+}
+
+/* Add the names of the record starting at @pos */
+static int fat_dhash_add_names(struct inode *dir, struct fat_dhash *dh,
+			       loff_t pos, struct msdos_dir_entry *de,
+			       const unsigned char *shortname, int short_len,
+			       const unsigned char *longname, int long_len)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(dir->i_sb);
+	int err;
+
+	err = fat_dhash_add(dh, fat_dhash_rawname(de->name), pos);
+	if (!err && sbi->options.isvfat && short_len)
+		err = fat_dhash_add(dh, fat_dhash_name(sbi, shortname,
+						       short_len), pos);
+	if (!err && sbi->options.isvfat && short_len && long_len)
+		err = fat_dhash_add(dh, fat_dhash_name(sbi, longname,
+						       long_len), pos);
+	return err;
+}
+
+/* Read the whole directory and build its hash */
+static void fat_dhash_build(struct inode *dir, int nr_records)
+{
+	struct buffer_head *bh = NULL;
+	struct msdos_dir_entry *de;
+	struct fat_dhash *dh;
+	unsigned char nr_slots;
+	wchar_t *unicode = NULL;
+	unsigned char bufname[FAT_MAX_SHORT_SIZE], *longname = NULL;
+	loff_t cpos = 0, pos, next_pos = 0;
+	int bits, err, short_len, long_len;
+
+	bits = clamp_t(int, ilog2(nr_records) + 1, FAT_DHASH_MIN_BITS,
+		       FAT_DHASH_MAX_BITS);
+	dh = kzalloc(sizeof(*dh) + (sizeof(struct hlist_head) << bits),
+		     GFP_NOFS);
+	if (!dh)
+		return;
+	dh->bits = bits;
+	dh->free_pos = -1;
+	MSDOS_I(dir)->i_dhash = dh;
+
+	while (1) {
+		err = fat_get_names(dir, &cpos, &bh, &de, &unicode, &nr_slots,
+				    bufname, &short_len, &longname, &long_len);
+		if (err)
+			break;
+
+		pos = cpos - (nr_slots + 1) * sizeof(*de);
+		if (pos != next_pos && dh->free_pos == -1)
+			dh->free_pos = next_pos;
+		next_pos = cpos;
+
+		err = fat_dhash_add_names(dir, dh, pos, de, bufname, short_len,
+					  longname, long_len);
+		if (err)
+			break;
+	}
+	brelse(bh);
+	if (unicode)
+		__putname(unicode);
+
+	if (err != -ENOENT) {
+		fat_dhash_free(dir);
+		return;
+	}
+	if (dh->free_pos == -1)
+		dh->free_pos = next_pos;
+}
+
+/* Add the record written at @pos by fat_add_entries() */
+static void fat_dhash_insert(struct inode *dir, loff_t pos)
+{
+	struct fat_dhash *dh = MSDOS_I(dir)->i_dhash;
+	struct buffer_head *bh = NULL;
+	struct msdos_dir_entry *de;
+	unsigned char nr_long;
+	wchar_t *unicode = NULL;
+	unsigned char bufname[FAT_MAX_SHORT_SIZE], *longname = NULL;
+	loff_t cpos = pos;
+	int err, short_len, long_len;
+
+	if (!dh)
+		return;
+
+	err = fat_get_names(dir, &cpos, &bh, &de, &unicode, &nr_long,
+			    bufname, &short_len, &longname, &long_len);
+	if (!err) {
+		pos = cpos - (nr_long + 1) * sizeof(*de);
+		err = fat_dhash_add_names(dir, dh, pos, de, bufname,
+					  short_len, longname, long_len);
+	}
+	brelse(bh);
+	if (unicode)
+		__putname(unicode);
+
+	if (err) {
+		/* A name missing from the hash would hide the file */
+		fat_dhash_free(dir);
+		return;
+	}
+	if (pos == dh->free_pos)
+		dh->free_pos = cpos;
+}
+
+/* The record of @sinfo is being removed */
+static void fat_dhash_remove(struct inode *dir, struct fat_slot_info *sinfo)
+{
+	struct fat_dhash *dh = MSDOS_I(dir)->i_dhash;
+
+	if (!dh)
+		return;
+
+	if (sinfo->slot_off < dh->free_pos)
+		dh->free_pos = sinfo->slot_off;
+	/* Entries are dropped as lookups find them stale; bound their number */
+	dh->nr_stale += sinfo->nr_slots;
+	if (dh->nr_stale > dh->nr_entries)
+		fat_dhash_free(dir);
+}
+
+/*
+ * Look-up @name in the hash, as fat_search_long() (@raw == 0) or fat_scan()
+ * (@raw != 0) would find it.  Returns 0 with @sinfo filled in as by those
+ * functions, or -ENOENT.
+ */
+static int fat_dhash_search(struct inode *dir, const unsigned char *name,
+			    int name_len, int raw, struct fat_slot_info *sinfo)
+{
+	struct super_block *sb = dir->i_sb;
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	struct fat_dhash *dh = MSDOS_I(dir)->i_dhash;
+	struct buffer_head *bh = NULL;
+	struct msdos_dir_entry *de;
+	struct fat_dhash_entry *e;
+	struct hlist_node *p, *n;
+	struct hlist_head *head;
+	unsigned char nr_slots;
+	wchar_t *unicode = NULL;
+	unsigned char bufname[FAT_MAX_SHORT_SIZE], *longname = NULL;
+	loff_t cpos;
+	u32 hash;
+	int err = -ENOENT, short_len, long_len;
+
+	if (raw)
+		hash = fat_dhash_rawname(name);
+	else
+		hash = fat_dhash_name(sbi, name, name_len);
+	head = &dh->table[hash_32(hash, dh->bits)];
+
+	hlist_for_each_entry_safe(e, p, n, head, node) {
+		if (e->hash != hash)
+			continue;
+
+		/* fat_get_entry() would step from the previous entry */
+		brelse(bh);
+		bh = NULL;
+		cpos = (loff_t)e->slot << MSDOS_DIR_BITS;
+		err = fat_get_names(dir, &cpos, &bh, &de, &unicode, &nr_slots,
+				    bufname, &short_len, &longname, &long_len);
+		if (err == -ENOENT ||
+		    (!err && cpos - (nr_slots + 1) * sizeof(*de) !=
+		     (loff_t)e->slot << MSDOS_DIR_BITS)) {
+			/* The record was removed */
+			hlist_del(&e->node);
+			kmem_cache_free(fat_dhash_cachep, e);
+			dh->nr_entries--;
+			if (dh->nr_stale)
+				dh->nr_stale--;
+			err = -ENOENT;
+			continue;
+		}
+		if (err)
+			break;
+
+		if (raw) {
+			if (!strncmp(de->name, name, MSDOS_NAME)) {
+				nr_slots = 0;
+				goto found;
 			}
-			i += chl;
+		} else if (short_len) {
+			if (fat_name_match(sbi, name, name_len, bufname,
+					   short_len))
+				goto found;
+			if (nr_slots && fat_name_match(sbi, name, name_len,
+						       longname, long_len))
+				goto found;
 		}
-		if (!last_u)
+		err = -ENOENT;
+	}
+	brelse(bh);
+	goto out;
+
+found:
+	nr_slots++;	/* include the de */
+	sinfo->slot_off = cpos - nr_slots * sizeof(*de);
+	sinfo->nr_slots = nr_slots;
+	sinfo->de = de;
+	sinfo->bh = bh;
+	sinfo->i_pos = fat_make_i_pos(sb, sinfo->bh, sinfo->de);
+	err = 0;
+out:
+	if (unicode)
+		__putname(unicode);
+	return err;
+}
+
+/*
+ * Return values: negative -> error, 0 -> not found, positive -> found,
+ * value is the total amount of slots, including the shortname entry.
+ */
+int fat_search_long(struct inode *inode, const unsigned char *name,
+		    int name_len, struct fat_slot_info *sinfo)
+{
+	struct super_block *sb = inode->i_sb;
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	struct buffer_head *bh = NULL;
+	struct msdos_dir_entry *de;
+	unsigned char nr_slots;
+	wchar_t *unicode = NULL;
+	unsigned char bufname[FAT_MAX_SHORT_SIZE], *longname = NULL;
+	loff_t cpos = 0;
+	int err, short_len, long_len, nr_records = 0;
+
+	if (MSDOS_I(inode)->i_dhash)
+		return fat_dhash_search(inode, name, name_len, 0, sinfo);
+
+	while (1) {
+		err = fat_get_names(inode, &cpos, &bh, &de, &unicode,
+				    &nr_slots, bufname, &short_len,
+				    &longname, &long_len);
+		if (err)
+			goto end_of_dir;
+		nr_records++;
+		if (!short_len)
 			continue;
 
 		/* Compare shortname */
-		bufuname[last_u] = 0x0000;
-		len = fat_uni_to_x8(sb, bufuname, bufname, sizeof(bufname));
-		if (fat_name_match(sbi, name, name_len, bufname, len))
+		if (fat_name_match(sbi, name, name_len, bufname, short_len))
 			goto found;
 
-		if (nr_slots) {
-			void *longname = unicode + FAT_MAX_UNI_CHARS;
-			int size = PATH_MAX - FAT_MAX_UNI_SIZE;
-
-			/* Compare longname */
-			len = fat_uni_to_x8(sb, unicode, longname, size);
-			if (fat_name_match(sbi, name, name_len, longname, len))
-				goto found;
-		}
+		/* Compare longname */
+		if (nr_slots &&
+		    fat_name_match(sbi, name, name_len, longname, long_len))
+			goto found;
 	}
 
 found:
@@ -446,6 +813,8 @@ found:
 end_of_dir:
 	if (unicode)
 		__putname(unicode);
+	if (nr_records >= FAT_DHASH_MIN_RECORDS && (!err || err == -ENOENT))
+		fat_dhash_build(inode, nr_records);
 
 	return err;
 }
@@ -935,6 +1304,10 @@ int fat_scan(struct inode *dir, const unsigned char *name,
 	     struct fat_slot_info *sinfo)
 {
 	struct super_block *sb = dir->i_sb;
+	int nr_records = 0;
+
+	if (MSDOS_I(dir)->i_dhash)
+		return fat_dhash_search(dir, name, MSDOS_NAME, 1, sinfo);
 
 	sinfo->slot_off = 0;
 	sinfo->bh = NULL;
@@ -944,9 +1317,14 @@ int fat_scan(struct inode *dir, const unsigned char *name,
 			sinfo->slot_off -= sizeof(*sinfo->de);
 			sinfo->nr_slots = 1;
 			sinfo->i_pos = fat_make_i_pos(sb, sinfo->bh, sinfo->de);
+			if (nr_records >= FAT_DHASH_MIN_RECORDS)
+				fat_dhash_build(dir, nr_records);
 			return 0;
 		}
+		nr_records++;
 	}
+	if (nr_records >= FAT_DHASH_MIN_RECORDS)
+		fat_dhash_build(dir, nr_records);
 	return -ENOENT;
 }
 
@@ -994,6 +1372,8 @@ int fat_remove_entries(struct inode *dir, struct fat_slot_info *sinfo)
 	struct buffer_head *bh;
 	int err = 0, nr_slots;
 
+	fat_dhash_remove(dir, sinfo);
+
 	/*
 	 * First stage: Remove the shortname. By this, the directory
 	 * entry is removed.
@@ -1250,6 +1630,8 @@ int fat_add_entries(struct inode *dir, void *slots, int nr_slots,
 	free_slots = nr_bhs = 0;
 	bh = prev = NULL;
 	pos = 0;
+	if (MSDOS_I(dir)->i_dhash)
+		pos = MSDOS_I(dir)->i_dhash->free_pos;
 	err = -ENOSPC;
 	while (fat_get_entry(dir, &pos, &bh, &de) > -1) {
 		/* check the maximum size of directory */
@@ -1353,6 +1735,8 @@ found:
 	sinfo->bh = bh;
 	sinfo->i_pos = fat_make_i_pos(sb, sinfo->bh, sinfo->de);
 
+	fat_dhash_insert(dir, pos);
+
 	return 0;
 
 error:
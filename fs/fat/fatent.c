@@ -7,6 +7,7 @@
 #include <linux/fs.h>
 #include <linux/msdos_fs.h>
 #include <linux/blkdev.h>
+#include <linux/vmalloc.h>
 #include "fat.h"
 
 struct fatent_operations {
@@ -452,6 +453,63 @@ static void fat_collect_bhs(struct buffer_head **bhs, int *nr_bhs,
 	}
 }
 
+static int fat_scan_free_clusters(struct super_block *sb,
+				  unsigned long *bitmap);
+
+/*
+ * Build the in-memory bitmap of free clusters.  With it, finding a free
+ * cluster doesn't need to read the FAT blocks of the used region before
+ * it, which on a large and full card is most of the FAT.  Called with
+ * the FAT locked.  If the bitmap can't be built, allocation falls back to
+ * searching the FAT, and building it isn't tried again: a failed attempt
+ * reads the whole FAT, which is what the bitmap is there to avoid.
+ */
+static int fat_build_free_bitmap(struct super_block *sb)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	unsigned long *bitmap;
+	int err;
+
+	bitmap = vzalloc(BITS_TO_LONGS(sbi->max_cluster) * sizeof(long));
+	if (!bitmap) {
+		err = -ENOMEM;
+		goto failed;
+	}
+	err = fat_scan_free_clusters(sb, bitmap);
+	if (err) {
+		vfree(bitmap);
+		goto failed;
+	}
+	sbi->free_bitmap = bitmap;
+	return 0;
+
+failed:
+	sbi->free_bitmap_failed = 1;
+	return err;
+}
+
+/* Find the first free cluster at or after @entry, wrapping around */
+static int fat_find_free_cluster(struct msdos_sb_info *sbi, int entry)
+{
+	unsigned long found;
+
+	found = find_next_bit(sbi->free_bitmap, sbi->max_cluster, entry);
+	if (found >= sbi->max_cluster)
+		found = find_next_bit(sbi->free_bitmap, sbi->max_cluster,
+				      FAT_START_ENT);
+	if (found >= sbi->max_cluster)
+		return -1;
+	return found;
+}
+
+void fat_ent_release(struct super_block *sb)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+
+	vfree(sbi->free_bitmap);
+	sbi->free_bitmap = NULL;
+}
+
 int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 {
 	struct super_block *sb = inode->i_sb;
@@ -474,6 +532,52 @@ int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 	count = FAT_START_ENT;
 	fatent_init(&prev_ent);
 	fatent_init(&fatent);
+
+	if (!sbi->free_bitmap && !sbi->free_bitmap_failed) {
+		err = fat_build_free_bitmap(sb);
+		if (err) {
+			fat_msg(sb, KERN_WARNING, "can't build the free cluster"
+				" bitmap (%d), searching the FAT", err);
+			err = 0;
+		}
+	}
+	if (sbi->free_bitmap) {
+		int entry = sbi->prev_free;
+
+		while ((entry = fat_find_free_cluster(sbi, entry + 1)) >= 0) {
+			err = fat_ent_read(inode, &fatent, entry);
+			if (err < 0)
+				goto out;
+			__clear_bit(entry, sbi->free_bitmap);
+			if (err != FAT_ENT_FREE) {
+				/* Stale bit, the FAT is authoritative */
+				err = 0;
+				continue;
+			}
+			err = 0;
+
+			/* make the cluster chain */
+			ops->ent_put(&fatent, FAT_ENT_EOF);
+			if (prev_ent.nr_bhs)
+				ops->ent_put(&prev_ent, entry);
+
+			fat_collect_bhs(bhs, &nr_bhs, &fatent);
+
+			sbi->prev_free = entry;
+			if (sbi->free_clusters != -1)
+				sbi->free_clusters--;
+			sb->s_dirt = 1;
+
+			cluster[idx_clus] = entry;
+			idx_clus++;
+			if (idx_clus == nr_cluster)
+				goto out;
+
+			prev_ent = fatent;
+		}
+		goto out_nospc;
+	}
+
 	fatent_set_entry(&fatent, sbi->prev_free + 1);
 	while (count < sbi->max_cluster) {
 		if (fatent.entry >= sbi->max_cluster)
@@ -517,6 +621,7 @@ int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 		} while (fat_ent_next(sbi, &fatent));
 	}
 
+out_nospc:
 	/* Couldn't allocate the free entries */
 	sbi->free_clusters = 0;
 	sbi->free_clus_valid = 1;
@@ -585,6 +690,8 @@ int fat_free_clusters(struct inode *inode, int cluster)
 		}
 
 		ops->ent_put(&fatent, FAT_ENT_FREE);
+		if (sbi->free_bitmap)
+			__set_bit(fatent.entry, sbi->free_bitmap);
 		if (sbi->free_clusters != -1) {
 			sbi->free_clusters++;
 			sb->s_dirt = 1;
@@ -639,7 +746,12 @@ static void fat_ent_reada(struct super_block *sb, struct fat_entry *fatent,
 		sb_breadahead(sb, blocknr + i);
 }
 
-int fat_count_free_clusters(struct super_block *sb)
+/*
+ * Count the free clusters by reading the whole FAT, and mark them in
+ * @bitmap if it isn't NULL.  Called with the FAT locked.
+ */
+static int fat_scan_free_clusters(struct super_block *sb,
+				  unsigned long *bitmap)
 {
 	struct msdos_sb_info *sbi = MSDOS_SB(sb);
 	struct fatent_operations *ops = sbi->fatent_ops;
@@ -647,10 +759,6 @@ int fat_count_free_clusters(struct super_block *sb)
 	unsigned long reada_blocks, reada_mask, cur_block;
 	int err = 0, free;
 
-	lock_fat(sbi);
-	if (sbi->free_clusters != -1 && sbi->free_clus_valid)
-		goto out;
-
 	reada_blocks = FAT_READA_SIZE >> sb->s_blocksize_bits;
 	reada_mask = reada_blocks - 1;
 	cur_block = 0;
@@ -668,17 +776,39 @@ int fat_count_free_clusters(struct super_block *sb)
 
 		err = fat_ent_read_block(sb, &fatent);
 		if (err)
-			goto out;
+			return err;
 
 		do {
-			if (ops->ent_get(&fatent) == FAT_ENT_FREE)
+			if (ops->ent_get(&fatent) == FAT_ENT_FREE) {
 				free++;
+				if (bitmap)
+					__set_bit(fatent.entry, bitmap);
+			}
 		} while (fat_ent_next(sbi, &fatent));
 	}
 	sbi->free_clusters = free;
 	sbi->free_clus_valid = 1;
 	sb->s_dirt = 1;
 	fatent_brelse(&fatent);
+	return 0;
+}
+
+int fat_count_free_clusters(struct super_block *sb)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	int err = 0;
+
+	lock_fat(sbi);
+	if (sbi->free_clusters != -1 && sbi->free_clus_valid)
+		goto out;
+
+	/* The FAT is read anyway, build the bitmap at the same time */
+	if (!sbi->free_bitmap && !sbi->free_bitmap_failed) {
+		err = fat_build_free_bitmap(sb);
+		if (err != -ENOMEM)
+			goto out;
+	}
+	err = fat_scan_free_clusters(sb, NULL);
 out:
 	unlock_fat(sbi);
 	return err;
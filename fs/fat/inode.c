@@ -456,6 +456,7 @@ static void fat_evict_inode(struct inode *inode)
 	invalidate_inode_buffers(inode);
 	end_writeback(inode);
 	fat_cache_inval_inode(inode);
+	fat_dhash_free(inode);
 	fat_detach(inode);
 }
 
@@ -491,6 +492,7 @@ static void fat_put_super(struct super_block *sb)
 		fat_write_super(sb);
 
 	iput(sbi->fat_inode);
+	fat_ent_release(sb);
 
 	unload_nls(sbi->nls_disk);
 	unload_nls(sbi->nls_io);
@@ -510,6 +512,7 @@ static struct inode *fat_alloc_inode(struct super_block *sb)
 	ei = kmem_cache_alloc(fat_inode_cachep, GFP_NOFS);
 	if (!ei)
 		return NULL;
+	ei->i_dhash = NULL;
 	return &ei->vfs_inode;
 }
 
@@ -1596,12 +1599,18 @@ static int __init init_fat_fs(void)
 	if (err)
 		return err;
 
-	err = fat_init_inodecache();
+	err = fat_dhash_init();
 	if (err)
 		goto failed;
 
+	err = fat_init_inodecache();
+	if (err)
+		goto failed_dhash;
+
 	return 0;
 
+failed_dhash:
+	fat_dhash_destroy();
 failed:
 	fat_cache_destroy();
 	return err;
@@ -1610,6 +1619,7 @@ failed:
 static void __exit exit_fat_fs(void)
 {
 	fat_cache_destroy();
+	fat_dhash_destroy();
 	fat_destroy_inodecache();
 }
 
@@ -32,6 +32,14 @@
  * To avoid out of memory and fragmentation issues with vmalloc the cache
  * uses sequences of kmalloced PAGE_CACHE_SIZE buffers.
  *
+ * Entries are evicted least recently used first.  The block numbers of the
+ * last evicted entries are remembered in a small "ghost" list; a miss on a
+ * ghost block means a slightly bigger cache would have hit, and if the
+ * cache was set up with room to grow (see the fragment_cache and
+ * metadata_cache mount options) it adds an entry.  Hit, miss and ghost hit
+ * counters are exported through sysfs so the sizes can be chosen from real
+ * workloads.
+ *
  * It should be noted that the cache is not used for file datablocks, these
  * are decompressed and cached in the page-cache in the normal way.  The
  * cache is only used to temporarily cache fragment and metadata blocks
@@ -57,6 +65,102 @@
 #include "squashfs_fs_sb.h"
 #include "squashfs.h"
 
+/*
+ * Allocate the buffers of a cache entry.
+ */
+static int cache_entry_init(struct squashfs_cache *cache,
+	struct squashfs_cache_entry *entry)
+{
+	int j;
+
+	entry->data = kcalloc(cache->pages, sizeof(void *), GFP_KERNEL);
+	if (entry->data == NULL) {
+		ERROR("Failed to allocate %s cache entry\n", cache->name);
+		return -ENOMEM;
+	}
+
+	for (j = 0; j < cache->pages; j++) {
+		entry->data[j] = kmalloc(PAGE_CACHE_SIZE, GFP_KERNEL);
+		if (entry->data[j] == NULL) {
+			ERROR("Failed to allocate %s buffer\n", cache->name);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+
+static void cache_entry_free(struct squashfs_cache *cache,
+	struct squashfs_cache_entry *entry)
+{
+	int j;
+
+	if (entry->data) {
+		for (j = 0; j < cache->pages; j++)
+			kfree(entry->data[j]);
+		kfree(entry->data);
+		entry->data = NULL;
+	}
+}
+
+
+/*
+ * Add one entry to the cache.  Called without the cache lock held, by at
+ * most one process at a time (cache->growing), so the entry past the end of
+ * the cache can be set up unlocked and then published under the lock.
+ */
+static void cache_grow(struct squashfs_cache *cache)
+{
+	struct squashfs_cache_entry *entry = &cache->entry[cache->entries];
+
+	if (cache_entry_init(cache, entry)) {
+		cache_entry_free(cache, entry);
+		return;
+	}
+
+	spin_lock(&cache->lock);
+	cache->entries++;
+	cache->unused++;
+	if (cache->num_waiters) {
+		spin_unlock(&cache->lock);
+		wake_up(&cache->wait_queue);
+	} else
+		spin_unlock(&cache->lock);
+
+	TRACE("Grew %s cache to %d entries\n", cache->name, cache->entries);
+}
+
+
+/*
+ * Remember an evicted block in the ghost list.  Called with the cache lock
+ * held.
+ */
+static void cache_ghost_add(struct squashfs_cache *cache, u64 block)
+{
+	cache->ghost[cache->next_ghost] = block;
+	cache->next_ghost = (cache->next_ghost + 1) % cache->ghosts;
+}
+
+
+/*
+ * Look-up and forget a block in the ghost list.  Called with the cache lock
+ * held.
+ */
+static int cache_ghost_hit(struct squashfs_cache *cache, u64 block)
+{
+	int i;
+
+	for (i = 0; i < cache->ghosts; i++)
+		if (cache->ghost[i] == block) {
+			cache->ghost[i] = SQUASHFS_INVALID_BLK;
+			return 1;
+		}
+
+	return 0;
+}
+
+
 /*
  * Look-up block in cache, and increment usage count.  If not in cache, read
  * and decompress it from disk.
@@ -64,7 +168,7 @@
 struct squashfs_cache_entry *squashfs_cache_get(struct super_block *sb,
 	struct squashfs_cache *cache, u64 block, int length)
 {
-	int i, n;
+	int i, n, missed = 0;
 	struct squashfs_cache_entry *entry;
 
 	spin_lock(&cache->lock);
@@ -76,8 +180,30 @@ struct squashfs_cache_entry *squashfs_cache_get(struct super_block *sb,
 
 		if (i == cache->entries) {
 			/*
-			 * Block not in cache, if all cache entries are used
-			 * go to sleep waiting for one to become available.
+			 * Block not in cache.  If it was evicted recently and
+			 * the cache may still grow, add an entry rather than
+			 * evicting another block.
+			 */
+			if (!missed) {
+				missed = 1;
+				cache->misses++;
+				if (cache_ghost_hit(cache, block)) {
+					cache->ghost_hits++;
+					if (cache->entries < cache->max_entries &&
+							!cache->growing) {
+						cache->growing = 1;
+						spin_unlock(&cache->lock);
+						cache_grow(cache);
+						spin_lock(&cache->lock);
+						cache->growing = 0;
+						continue;
+					}
+				}
+			}
+
+			/*
+			 * If all cache entries are used go to sleep waiting
+			 * for one to become available.
 			 */
 			if (cache->unused == 0) {
 				cache->num_waiters++;
@@ -89,19 +215,21 @@ struct squashfs_cache_entry *squashfs_cache_get(struct super_block *sb,
 			}
 
 			/*
-			 * At least one unused cache entry.  A simple
-			 * round-robin strategy is used to choose the entry to
-			 * be evicted from the cache.
+			 * At least one unused cache entry.  Evict the least
+			 * recently used one, remembering its block in the
+			 * ghost list.
 			 */
-			i = cache->next_blk;
-			for (n = 0; n < cache->entries; n++) {
-				if (cache->entry[i].refcount == 0)
-					break;
-				i = (i + 1) % cache->entries;
+			for (i = -1, n = 0; n < cache->entries; n++) {
+				if (cache->entry[n].refcount)
+					continue;
+				if (i == -1 || cache->entry[n].last_used <
+						cache->entry[i].last_used)
+					i = n;
 			}
 
-			cache->next_blk = (i + 1) % cache->entries;
 			entry = &cache->entry[i];
+			if (entry->block != SQUASHFS_INVALID_BLK)
+				cache_ghost_add(cache, entry->block);
 
 			/*
 			 * Initialise chosen cache entry, and fill it in from
@@ -113,6 +241,7 @@ struct squashfs_cache_entry *squashfs_cache_get(struct super_block *sb,
 			entry->pending = 1;
 			entry->num_waiters = 0;
 			entry->error = 0;
+			entry->last_used = ++cache->tick;
 			spin_unlock(&cache->lock);
 
 			entry->length = squashfs_read_data(sb, entry->data,
@@ -123,6 +252,8 @@ struct squashfs_cache_entry *squashfs_cache_get(struct super_block *sb,
 
 			if (entry->length < 0)
 				entry->error = entry->length;
+			else
+				cache->bytes += entry->length;
 
 			entry->pending = 0;
 
@@ -150,6 +281,9 @@ struct squashfs_cache_entry *squashfs_cache_get(struct super_block *sb,
 		if (entry->refcount == 0)
 			cache->unused--;
 		entry->refcount++;
+		entry->last_used = ++cache->tick;
+		if (!missed)
+			cache->hits++;
 
 		/*
 		 * If the entry is currently being filled in by another process
@@ -205,19 +339,16 @@ void squashfs_cache_put(struct squashfs_cache_entry *entry)
  */
 void squashfs_cache_delete(struct squashfs_cache *cache)
 {
-	int i, j;
+	int i;
 
 	if (cache == NULL)
 		return;
 
-	for (i = 0; i < cache->entries; i++) {
-		if (cache->entry[i].data) {
-			for (j = 0; j < cache->pages; j++)
-				kfree(cache->entry[i].data[j]);
-			kfree(cache->entry[i].data);
-		}
-	}
+	if (cache->entry)
+		for (i = 0; i < cache->max_entries; i++)
+			cache_entry_free(cache, &cache->entry[i]);
 
+	kfree(cache->ghost);
 	kfree(cache->entry);
 	kfree(cache);
 }
@@ -227,11 +358,13 @@ void squashfs_cache_delete(struct squashfs_cache *cache)
  * Initialise cache allocating the specified number of entries, each of
  * size block_size.  To avoid vmalloc fragmentation issues each entry
  * is allocated as a sequence of kmalloced PAGE_CACHE_SIZE buffers.
+ * If max_entries is larger than entries the cache grows on demand up to
+ * max_entries.
  */
 struct squashfs_cache *squashfs_cache_init(char *name, int entries,
-	int block_size)
+	int max_entries, int block_size)
 {
-	int i, j;
+	int i;
 	struct squashfs_cache *cache = kzalloc(sizeof(*cache), GFP_KERNEL);
 
 	if (cache == NULL) {
@@ -239,13 +372,20 @@ struct squashfs_cache *squashfs_cache_init(char *name, int entries,
 		return NULL;
 	}
 
-	cache->entry = kcalloc(entries, sizeof(*(cache->entry)), GFP_KERNEL);
-	if (cache->entry == NULL) {
+	max_entries = max(entries, max_entries);
+	cache->max_entries = max_entries;
+	cache->entry = kcalloc(max_entries, sizeof(*(cache->entry)),
+		GFP_KERNEL);
+	cache->ghosts = max_entries;
+	cache->ghost = kmalloc(max_entries * sizeof(u64), GFP_KERNEL);
+	if (cache->entry == NULL || cache->ghost == NULL) {
 		ERROR("Failed to allocate %s cache\n", name);
 		goto cleanup;
 	}
 
-	cache->next_blk = 0;
+	for (i = 0; i < cache->ghosts; i++)
+		cache->ghost[i] = SQUASHFS_INVALID_BLK;
+
 	cache->unused = entries;
 	cache->entries = entries;
 	cache->block_size = block_size;
@@ -256,25 +396,14 @@ struct squashfs_cache *squashfs_cache_init(char *name, int entries,
 	spin_lock_init(&cache->lock);
 	init_waitqueue_head(&cache->wait_queue);
 
-	for (i = 0; i < entries; i++) {
+	for (i = 0; i < max_entries; i++) {
 		struct squashfs_cache_entry *entry = &cache->entry[i];
 
 		init_waitqueue_head(&cache->entry[i].wait_queue);
 		entry->cache = cache;
 		entry->block = SQUASHFS_INVALID_BLK;
-		entry->data = kcalloc(cache->pages, sizeof(void *), GFP_KERNEL);
-		if (entry->data == NULL) {
-			ERROR("Failed to allocate %s cache entry\n", name);
+		if (i < entries && cache_entry_init(cache, entry))
 			goto cleanup;
-		}
-
-		for (j = 0; j < cache->pages; j++) {
-			entry->data[j] = kmalloc(PAGE_CACHE_SIZE, GFP_KERNEL);
-			if (entry->data[j] == NULL) {
-				ERROR("Failed to allocate %s buffer\n", name);
-				goto cleanup;
-			}
-		}
 	}
 
 	return cache;
@@ -23,12 +23,16 @@
  * squashfs_fs_sb.h
  */
 
+#include <linux/kobject.h>
+#include <linux/completion.h>
+
 #include "squashfs_fs.h"
 
 struct squashfs_cache {
 	char			*name;
 	int			entries;
-	int			next_blk;
+	int			max_entries;
+	int			growing;
 	int			num_waiters;
 	int			unused;
 	int			block_size;
@@ -36,6 +40,14 @@ struct squashfs_cache {
 	spinlock_t		lock;
 	wait_queue_head_t	wait_queue;
 	struct squashfs_cache_entry *entry;
+	unsigned long		tick;
+	u64			*ghost;
+	int			ghosts;
+	int			next_ghost;
+	unsigned long		hits;
+	unsigned long		misses;
+	unsigned long		ghost_hits;
+	unsigned long long	bytes;
 };
 
 struct squashfs_cache_entry {
@@ -46,6 +58,7 @@ struct squashfs_cache_entry {
 	int			pending;
 	int			error;
 	int			num_waiters;
+	unsigned long		last_used;
 	wait_queue_head_t	wait_queue;
 	struct squashfs_cache	*cache;
 	void			**data;
@@ -62,7 +75,6 @@ struct squashfs_sb_info {
 	__le64					*id_table;
 	__le64					*fragment_index;
 	__le64					*xattr_id_table;
-	struct mutex				read_data_mutex;
 	struct mutex				meta_index_mutex;
 	struct meta_index			*meta_index;
 	void					*stream;
@@ -75,5 +87,8 @@ struct squashfs_sb_info {
 	long long				bytes_used;
 	unsigned int				inodes;
 	int					xattr_ids;
+	struct kobject				kobj;
+	struct completion			kobj_unregister;
+	int					kobj_registered;
 };
 #endif
@@ -36,6 +36,7 @@
 #include <linux/module.h>
 #include <linux/magic.h>
 #include <linux/xattr.h>
+#include <linux/parser.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -47,6 +48,70 @@
 static struct file_system_type squashfs_fs_type;
 static const struct super_operations squashfs_super_ops;
 
+/* Upper limit for the fragment_cache and metadata_cache mount options */
+#define SQUASHFS_MAX_CACHED		64
+
+enum {
+	Opt_fragment_cache, Opt_metadata_cache, Opt_err
+};
+
+static const match_table_t tokens = {
+	{Opt_fragment_cache, "fragment_cache=%u"},
+	{Opt_metadata_cache, "metadata_cache=%u"},
+	{Opt_err, NULL}
+};
+
+/*
+ * Parse the mount options.  The fragment_cache and metadata_cache options
+ * give the number of entries the caches may grow to; other options are
+ * ignored.  The caches start
+ * with the default number of entries (or fewer, if asked for) and grow
+ * while blocks recently evicted from them are read again.
+ */
+static int squashfs_parse_options(char *options, int *fragments,
+	int *metadata)
+{
+	substring_t args[MAX_OPT_ARGS];
+	char *p;
+	int token, n;
+
+	if (options == NULL)
+		return 0;
+
+	while ((p = strsep(&options, ",")) != NULL) {
+		if (!*p)
+			continue;
+
+		token = match_token(p, tokens, args);
+		switch (token) {
+		case Opt_fragment_cache:
+		case Opt_metadata_cache:
+			if (match_int(&args[0], &n) || n < 1 ||
+					n > SQUASHFS_MAX_CACHED) {
+				ERROR("Invalid cache size in \"%s\", must be "
+					"1 to %d\n", p, SQUASHFS_MAX_CACHED);
+				return -EINVAL;
+			}
+			if (token == Opt_fragment_cache)
+				*fragments = n;
+			else
+				*metadata = n;
+			break;
+		default:
+			/*
+			 * Squashfs used to ignore its mount data, so don't
+			 * fail mounts passing options meant for other
+			 * filesystems.
+			 */
+			WARNING("Ignoring unrecognized mount option \"%s\" "
+				"or missing value\n", p);
+			break;
+		}
+	}
+
+	return 0;
+}
+
 static const struct squashfs_decompressor *supported_squashfs_filesystem(short
 	major, short minor, short id)
 {
@@ -84,10 +149,16 @@ static int squashfs_fill_super(struct super_block *sb, void *data, int silent)
 	unsigned short flags;
 	unsigned int fragments;
 	u64 lookup_table_start, xattr_id_table_start, next_table;
+	int max_fragments = SQUASHFS_CACHED_FRAGMENTS;
+	int max_blks = SQUASHFS_CACHED_BLKS;
 	int err;
 
 	TRACE("Entered squashfs_fill_superblock\n");
 
+	err = squashfs_parse_options(data, &max_fragments, &max_blks);
+	if (err)
+		return err;
+
 	sb->s_fs_info = kzalloc(sizeof(*msblk), GFP_KERNEL);
 	if (sb->s_fs_info == NULL) {
 		ERROR("Failed to allocate squashfs_sb_info\n");
@@ -98,7 +169,6 @@ static int squashfs_fill_super(struct super_block *sb, void *data, int silent)
 	msblk->devblksize = sb_min_blocksize(sb, BLOCK_SIZE);
 	msblk->devblksize_log2 = ffz(~msblk->devblksize);
 
-	mutex_init(&msblk->read_data_mutex);
 	mutex_init(&msblk->meta_index_mutex);
 
 	/*
@@ -195,13 +265,18 @@ static int squashfs_fill_super(struct super_block *sb, void *data, int silent)
 
 	err = -ENOMEM;
 
+	/*
+	 * The metadata cache never has fewer than SQUASHFS_CACHED_BLKS
+	 * entries, the meta_index code in file.c relies on it.
+	 */
 	msblk->block_cache = squashfs_cache_init("metadata",
-			SQUASHFS_CACHED_BLKS, SQUASHFS_METADATA_SIZE);
+			SQUASHFS_CACHED_BLKS, max_blks, SQUASHFS_METADATA_SIZE);
 	if (msblk->block_cache == NULL)
 		goto failed_mount;
 
-	/* Allocate read_page block */
-	msblk->read_page = squashfs_cache_init("data", 1, msblk->block_size);
+	/* Allocate read_page blocks, one for each decompressor */
+	msblk->read_page = squashfs_cache_init("data",
+		squashfs_max_decompressors(), 0, msblk->block_size);
 	if (msblk->read_page == NULL) {
 		ERROR("Failed to allocate read_page block\n");
 		goto failed_mount;
@@ -271,7 +346,8 @@ handle_fragments:
 		goto check_directory_table;
 
 	msblk->fragment_cache = squashfs_cache_init("fragment",
-		SQUASHFS_CACHED_FRAGMENTS, msblk->block_size);
+		min(max_fragments, SQUASHFS_CACHED_FRAGMENTS), max_fragments,
+		msblk->block_size);
 	if (msblk->fragment_cache == NULL) {
 		err = -ENOMEM;
 		goto failed_mount;
@@ -324,6 +400,8 @@ check_directory_table:
 		goto failed_mount;
 	}
 
+	squashfs_sysfs_register(sb);
+
 	TRACE("Leaving squashfs_fill_super\n");
 	kfree(sblk);
 	return 0;
@@ -332,7 +410,7 @@ failed_mount:
 	squashfs_cache_delete(msblk->block_cache);
 	squashfs_cache_delete(msblk->fragment_cache);
 	squashfs_cache_delete(msblk->read_page);
-	squashfs_decompressor_free(msblk, msblk->stream);
+	squashfs_decompressor_destroy(msblk);
 	kfree(msblk->inode_lookup_table);
 	kfree(msblk->fragment_index);
 	kfree(msblk->id_table);
@@ -376,10 +454,11 @@ static void squashfs_put_super(struct super_block *sb)
 {
 	if (sb->s_fs_info) {
 		struct squashfs_sb_info *sbi = sb->s_fs_info;
+		squashfs_sysfs_unregister(sb);
 		squashfs_cache_delete(sbi->block_cache);
 		squashfs_cache_delete(sbi->fragment_cache);
 		squashfs_cache_delete(sbi->read_page);
-		squashfs_decompressor_free(sbi, sbi->stream);
+		squashfs_decompressor_destroy(sbi);
 		kfree(sbi->id_table);
 		kfree(sbi->fragment_index);
 		kfree(sbi->meta_index);
@@ -432,8 +511,15 @@ static int __init init_squashfs_fs(void)
 	if (err)
 		return err;
 
+	err = squashfs_sysfs_init();
+	if (err) {
+		destroy_inodecache();
+		return err;
+	}
+
 	err = register_filesystem(&squashfs_fs_type);
 	if (err) {
+		squashfs_sysfs_exit();
 		destroy_inodecache();
 		return err;
 	}
@@ -448,6 +534,7 @@ static int __init init_squashfs_fs(void)
 static void __exit exit_squashfs_fs(void)
 {
 	unregister_filesystem(&squashfs_fs_type);
+	squashfs_sysfs_exit();
 	destroy_inodecache();
 }
 
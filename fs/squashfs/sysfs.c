@@ -0,0 +1,158 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * sysfs.c
+ */
+
+/*
+ * This file exports the statistics of the metadata, fragment and data
+ * caches of each mounted filesystem in /sys/fs/squashfs/<device>/.  Each
+ * file holds one line of numbers:
+ *
+ *	entries max_entries hits misses ghost_hits bytes_decompressed
+ */
+
+#include <linux/fs.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/slab.h>
+#include <linux/stddef.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "squashfs.h"
+
+static struct kobject *squashfs_kobj;
+
+struct squashfs_attr {
+	struct attribute attr;
+	int offset;	/* of the cache pointer in struct squashfs_sb_info */
+};
+
+#define SQUASHFS_CACHE_ATTR(_name, _cache)				\
+static struct squashfs_attr squashfs_attr_##_name = {			\
+	.attr = { .name = __stringify(_name), .mode = S_IRUGO },	\
+	.offset = offsetof(struct squashfs_sb_info, _cache),		\
+}
+
+SQUASHFS_CACHE_ATTR(metadata_cache, block_cache);
+SQUASHFS_CACHE_ATTR(fragment_cache, fragment_cache);
+SQUASHFS_CACHE_ATTR(data_cache, read_page);
+
+static struct attribute *squashfs_attrs[] = {
+	&squashfs_attr_metadata_cache.attr,
+	&squashfs_attr_fragment_cache.attr,
+	&squashfs_attr_data_cache.attr,
+	NULL
+};
+
+static ssize_t squashfs_attr_show(struct kobject *kobj,
+	struct attribute *attr, char *buf)
+{
+	struct squashfs_sb_info *msblk = container_of(kobj,
+		struct squashfs_sb_info, kobj);
+	struct squashfs_attr *a = container_of(attr, struct squashfs_attr,
+		attr);
+	struct squashfs_cache *cache = *(struct squashfs_cache **)
+		((char *) msblk + a->offset);
+	int entries, max_entries;
+	unsigned long hits, misses, ghost_hits;
+	unsigned long long bytes;
+
+	/* No fragment cache if the filesystem has no fragments */
+	if (cache == NULL)
+		return snprintf(buf, PAGE_SIZE, "0 0 0 0 0 0\n");
+
+	spin_lock(&cache->lock);
+	entries = cache->entries;
+	max_entries = cache->max_entries;
+	hits = cache->hits;
+	misses = cache->misses;
+	ghost_hits = cache->ghost_hits;
+	bytes = cache->bytes;
+	spin_unlock(&cache->lock);
+
+	return snprintf(buf, PAGE_SIZE, "%d %d %lu %lu %lu %llu\n", entries,
+		max_entries, hits, misses, ghost_hits, bytes);
+}
+
+static void squashfs_sb_release(struct kobject *kobj)
+{
+	struct squashfs_sb_info *msblk = container_of(kobj,
+		struct squashfs_sb_info, kobj);
+
+	complete(&msblk->kobj_unregister);
+}
+
+static const struct sysfs_ops squashfs_attr_ops = {
+	.show	= squashfs_attr_show,
+};
+
+static struct kobj_type squashfs_ktype = {
+	.default_attrs	= squashfs_attrs,
+	.sysfs_ops	= &squashfs_attr_ops,
+	.release	= squashfs_sb_release,
+};
+
+
+/*
+ * Add the statistics directory of a mounted filesystem.  Failure is not
+ * fatal for the mount, the statistics are just not available.
+ */
+void squashfs_sysfs_register(struct super_block *sb)
+{
+	struct squashfs_sb_info *msblk = sb->s_fs_info;
+	int err;
+
+	init_completion(&msblk->kobj_unregister);
+	err = kobject_init_and_add(&msblk->kobj, &squashfs_ktype,
+		squashfs_kobj, "%s", sb->s_id);
+	if (err) {
+		WARNING("Failed to add %s to sysfs\n", sb->s_id);
+		kobject_put(&msblk->kobj);
+		wait_for_completion(&msblk->kobj_unregister);
+		return;
+	}
+
+	msblk->kobj_registered = 1;
+}
+
+
+void squashfs_sysfs_unregister(struct super_block *sb)
+{
+	struct squashfs_sb_info *msblk = sb->s_fs_info;
+
+	if (!msblk->kobj_registered)
+		return;
+
+	kobject_put(&msblk->kobj);
+	wait_for_completion(&msblk->kobj_unregister);
+	msblk->kobj_registered = 0;
+}
+
+
+int __init squashfs_sysfs_init(void)
+{
+	squashfs_kobj = kobject_create_and_add("squashfs", fs_kobj);
+	return squashfs_kobj ? 0 : -ENOMEM;
+}
+
+
+void squashfs_sysfs_exit(void)
+{
+	kobject_put(squashfs_kobj);
+}
@@ -2866,6 +2866,27 @@ static const struct file_operations dfs_fops = {
 	.llseek = no_llseek,
 };
 
+static ssize_t read_ra_stats(struct file *file, char __user *u, size_t count,
+			     loff_t *ppos)
+{
+	struct ubifs_info *c = file->private_data;
+	char buf[96];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "hits %ld\nmisses %ld\npages %ld\n",
+		       atomic_long_read(&c->ra_hits),
+		       atomic_long_read(&c->ra_misses),
+		       atomic_long_read(&c->ra_pages));
+	return simple_read_from_buffer(u, count, ppos, buf, len);
+}
+
+static const struct file_operations dfs_ra_fops = {
+	.open = open_debugfs_file,
+	.read = read_ra_stats,
+	.owner = THIS_MODULE,
+	.llseek = no_llseek,
+};
+
 /**
  * dbg_debugfs_init_fs - initialize debugfs for UBIFS instance.
  * @c: UBIFS file-system description object
@@ -2910,6 +2931,12 @@ int dbg_debugfs_init_fs(struct ubifs_info *c)
 		goto out_remove;
 	d->dfs_dump_tnc = dent;
 
+	fname = "ra_stats";
+	dent = debugfs_create_file(fname, S_IRUSR, d->dfs_dir, c, &dfs_ra_fops);
+	if (IS_ERR_OR_NULL(dent))
+		goto out_remove;
+	d->dfs_ra_stats = dent;
+
 	return 0;
 
 out_remove:
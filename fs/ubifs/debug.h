@@ -61,6 +61,7 @@ typedef int (*dbg_znode_callback)(struct ubifs_info *c,
  * @dfs_dump_lprops: "dump lprops" debugfs knob
  * @dfs_dump_budg: "dump budgeting information" debugfs knob
  * @dfs_dump_tnc: "dump TNC" debugfs knob
+ * @dfs_ra_stats: read-ahead statistics debugfs file
  */
 struct ubifs_debug_info {
 	struct ubifs_zbranch old_zroot;
@@ -89,6 +90,7 @@ struct ubifs_debug_info {
 	struct dentry *dfs_dump_lprops;
 	struct dentry *dfs_dump_budg;
 	struct dentry *dfs_dump_tnc;
+	struct dentry *dfs_ra_stats;
 };
 
 #define ubifs_assert(expr) do {                                                \
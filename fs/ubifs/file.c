@@ -892,6 +892,176 @@ static int ubifs_readpage(struct file *file, struct page *page)
 	return 0;
 }
 
+/**
+ * readahead_bulk - bulk-read a part of the read-ahead window.
+ * @c: UBIFS file-system description object
+ * @bu: bulk-read information
+ * @page1: first page to read, locked and in the page cache
+ * @pages: the rest of the read-ahead window, not in the page cache yet
+ *
+ * This function reads in one go the data nodes of @page1 and of the following
+ * pages of the window, as long as they are consecutive in the same LEB, and
+ * decompresses them directly into the page cache. Returns the number of pages
+ * read, in which case @page1 is unlocked, or %0 if the data nodes are too
+ * scattered for a bulk-read to be worth it, in which case the caller has to
+ * read @page1 itself.
+ */
+static int readahead_bulk(struct ubifs_info *c, struct bu_info *bu,
+			  struct page *page1, struct list_head *pages)
+{
+	struct address_space *mapping = page1->mapping;
+	int err, n = 0, cnt = 1, allocate = bu->buf ? 0 : 1;
+	unsigned int end_block;
+	pgoff_t end;
+
+	bu->buf_len = c->max_bu_buf_len;
+	data_key_init(c, &bu->key, mapping->host->i_ino,
+		      page1->index << UBIFS_BLOCKS_PER_PAGE_SHIFT);
+	err = ubifs_tnc_get_bu_keys(c, bu);
+	if (err)
+		goto out_warn;
+
+	/* @pages is sorted by decreasing index, do not read past the window */
+	end = page1->index + (bu->blk_cnt >> UBIFS_BLOCKS_PER_PAGE_SHIFT);
+	end = min_t(pgoff_t, end,
+		    list_entry(pages->next, struct page, lru)->index + 1);
+	if (end < page1->index + 2)
+		return 0;
+
+	end_block = end << UBIFS_BLOCKS_PER_PAGE_SHIFT;
+	while (bu->cnt &&
+	       key_block(c, &bu->zbranch[bu->cnt - 1].key) >= end_block)
+		bu->cnt -= 1;
+
+	if (bu->cnt) {
+		if (allocate) {
+			bu->buf_len = bu->zbranch[bu->cnt - 1].offs +
+				      bu->zbranch[bu->cnt - 1].len -
+				      bu->zbranch[0].offs;
+			ubifs_assert(bu->buf_len > 0);
+			ubifs_assert(bu->buf_len <= c->leb_size);
+			bu->buf = kmalloc(bu->buf_len, GFP_NOFS | __GFP_NOWARN);
+			if (!bu->buf)
+				return 0;
+		}
+
+		err = ubifs_tnc_bulk_read(c, bu);
+		if (err)
+			goto out_warn;
+	}
+
+	err = populate_page(c, page1, bu, &n);
+	if (err)
+		goto out_warn;
+	unlock_page(page1);
+
+	while (!list_empty(pages)) {
+		struct page *page = list_entry(pages->prev, struct page, lru);
+
+		if (page->index >= end)
+			break;
+		list_del(&page->lru);
+		if (!add_to_page_cache_lru(page, mapping, page->index,
+					   GFP_NOFS)) {
+			err = populate_page(c, page, bu, &n);
+			unlock_page(page);
+			if (!err)
+				cnt += 1;
+		}
+		page_cache_release(page);
+		if (err)
+			break;
+	}
+
+out_free:
+	if (allocate) {
+		kfree(bu->buf);
+		bu->buf = NULL;
+	}
+	return cnt;
+
+out_warn:
+	ubifs_warn("ignoring error %d and skipping bulk-read", err);
+	cnt = 0;
+	goto out_free;
+}
+
+/**
+ * ubifs_readpages - read-ahead.
+ * @file: file to read from
+ * @mapping: address space of the file
+ * @pages: pages to read, sorted by decreasing index
+ * @nr_pages: number of pages in @pages
+ *
+ * The VFS calls this function with its read-ahead window, which for UBIFS is
+ * limited to %UBIFS_RA_PAGES pages. Data nodes which are consecutive on the
+ * media are bulk-read and decompressed directly into the page cache, the
+ * others are read one by one. If the file turns out to be fragmented, this
+ * function stops trying to bulk-read for the rest of the window. Always
+ * returns zero, pages which could not be read are left not up-to-date and
+ * will be read by 'ubifs_readpage()'.
+ */
+static int ubifs_readpages(struct file *file, struct address_space *mapping,
+			   struct list_head *pages, unsigned nr_pages)
+{
+	struct ubifs_info *c = mapping->host->i_sb->s_fs_info;
+	struct bu_info *bu = NULL;
+	int allocated = 0, misses = 0;
+
+	/*
+	 * If possible, try to use pre-allocated bulk-read information, which
+	 * is protected by @c->bu_mutex.
+	 */
+	if (nr_pages > 1) {
+		if (mutex_trylock(&c->bu_mutex))
+			bu = &c->bu;
+		else {
+			bu = kmalloc(sizeof(struct bu_info),
+				     GFP_NOFS | __GFP_NOWARN);
+			if (bu) {
+				bu->buf = NULL;
+				allocated = 1;
+			}
+		}
+	}
+
+	while (!list_empty(pages)) {
+		struct page *page = list_entry(pages->prev, struct page, lru);
+		int cnt = 0;
+
+		list_del(&page->lru);
+		if (add_to_page_cache_lru(page, mapping, page->index,
+					  GFP_NOFS)) {
+			page_cache_release(page);
+			continue;
+		}
+
+		if (bu && misses < 2 && !list_empty(pages)) {
+			cnt = readahead_bulk(c, bu, page, pages);
+			if (cnt) {
+				atomic_long_inc(&c->ra_hits);
+				atomic_long_add(cnt, &c->ra_pages);
+			} else {
+				atomic_long_inc(&c->ra_misses);
+				misses += 1;
+			}
+		}
+		if (!cnt) {
+			do_readpage(page);
+			unlock_page(page);
+		}
+		page_cache_release(page);
+	}
+
+	if (bu) {
+		if (!allocated)
+			mutex_unlock(&c->bu_mutex);
+		else
+			kfree(bu);
+	}
+	return 0;
+}
+
 static int do_writepage(struct page *page, int len)
 {
 	int err = 0, i, blen;
@@ -1550,6 +1720,7 @@ static int ubifs_file_mmap(struct file *file, struct vm_area_struct *vma)
 
 const struct address_space_operations ubifs_file_address_operations = {
 	.readpage       = ubifs_readpage,
+	.readpages      = ubifs_readpages,
 	.writepage      = ubifs_writepage,
 	.write_begin    = ubifs_write_begin,
 	.write_end      = ubifs_write_end,
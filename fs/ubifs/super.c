@@ -434,6 +434,11 @@ static int ubifs_show_options(struct seq_file *s, struct vfsmount *mnt)
 	else if (c->mount_opts.bulk_read == 1)
 		seq_printf(s, ",no_bulk_read");
 
+	if (c->mount_opts.readahead == 2)
+		seq_printf(s, ",readahead");
+	else if (c->mount_opts.readahead == 1)
+		seq_printf(s, ",no_readahead");
+
 	if (c->mount_opts.chk_data_crc == 2)
 		seq_printf(s, ",chk_data_crc");
 	else if (c->mount_opts.chk_data_crc == 1)
@@ -935,6 +940,8 @@ static int check_volume_empty(struct ubifs_info *c)
  * Opt_norm_unmount: run a journal commit before un-mounting
  * Opt_bulk_read: enable bulk-reads
  * Opt_no_bulk_read: disable bulk-reads
+ * Opt_readahead: read ahead of sequential readers
+ * Opt_no_readahead: do not read ahead
  * Opt_chk_data_crc: check CRCs when reading data nodes
  * Opt_no_chk_data_crc: do not check CRCs when reading data nodes
  * Opt_override_compr: override default compressor
@@ -945,6 +952,8 @@ enum {
 	Opt_norm_unmount,
 	Opt_bulk_read,
 	Opt_no_bulk_read,
+	Opt_readahead,
+	Opt_no_readahead,
 	Opt_chk_data_crc,
 	Opt_no_chk_data_crc,
 	Opt_override_compr,
@@ -956,6 +965,8 @@ static const match_table_t tokens = {
 	{Opt_norm_unmount, "norm_unmount"},
 	{Opt_bulk_read, "bulk_read"},
 	{Opt_no_bulk_read, "no_bulk_read"},
+	{Opt_readahead, "readahead"},
+	{Opt_no_readahead, "no_readahead"},
 	{Opt_chk_data_crc, "chk_data_crc"},
 	{Opt_no_chk_data_crc, "no_chk_data_crc"},
 	{Opt_override_compr, "compr=%s"},
@@ -1028,6 +1039,12 @@ static int ubifs_parse_options(struct ubifs_info *c, char *options,
 			c->mount_opts.bulk_read = 1;
 			c->bulk_read = 0;
 			break;
+		case Opt_readahead:
+			c->mount_opts.readahead = 2;
+			break;
+		case Opt_no_readahead:
+			c->mount_opts.readahead = 1;
+			break;
 		case Opt_chk_data_crc:
 			c->mount_opts.chk_data_crc = 2;
 			c->no_chk_data_crc = 0;
@@ -1890,6 +1907,7 @@ static int ubifs_remount_fs(struct super_block *sb, int *flags, char *data)
 		kfree(c->bu.buf);
 		c->bu.buf = NULL;
 	}
+	c->bdi.ra_pages = c->mount_opts.readahead == 1 ? 0 : UBIFS_RA_PAGES;
 
 	ubifs_assert(c->lst.taken_empty_lebs > 0);
 	return 0;
@@ -2032,12 +2050,13 @@ static int ubifs_fill_super(struct super_block *sb, void *data, int silent)
 	}
 
 	/*
-	 * UBIFS provides 'backing_dev_info' in order to disable read-ahead. For
-	 * UBIFS, I/O is not deferred, it is done immediately in readpage,
-	 * which means the user would have to wait not just for their own I/O
-	 * but the read-ahead I/O as well i.e. completely pointless.
-	 *
-	 * Read-ahead will be disabled because @c->bdi.ra_pages is 0.
+	 * UBIFS provides 'backing_dev_info' in order to size read-ahead. For
+	 * UBIFS, I/O is not deferred, it is done immediately, which means the
+	 * user has to wait not just for their own I/O but for the read-ahead
+	 * I/O as well. This only pays off because 'ubifs_readpages()' reads
+	 * the data nodes of the read-ahead window in one go, so the window is
+	 * limited to what one bulk-read can cover. @c->bdi.ra_pages is set
+	 * once the mount options are known.
 	 */
 	c->bdi.name = "ubifs",
 	c->bdi.capabilities = BDI_CAP_MAP_COPY;
@@ -2052,6 +2071,8 @@ static int ubifs_fill_super(struct super_block *sb, void *data, int silent)
 	err = ubifs_parse_options(c, data, 0);
 	if (err)
 		goto out_bdi;
+	if (c->mount_opts.readahead != 1)
+		c->bdi.ra_pages = UBIFS_RA_PAGES;
 
 	sb->s_bdi = &c->bdi;
 	sb->s_fs_info = c;
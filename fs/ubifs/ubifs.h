@@ -163,6 +163,9 @@
 /* Maximum number of data nodes to bulk-read */
 #define UBIFS_MAX_BULK_READ 32
 
+/* Default read-ahead window, in pages: as much as one bulk-read can cover */
+#define UBIFS_RA_PAGES (UBIFS_MAX_BULK_READ >> UBIFS_BLOCKS_PER_PAGE_SHIFT)
+
 /*
  * Lockdep classes for UBIFS inode @ui_mutex.
  */
@@ -925,6 +928,7 @@ struct ubifs_orphan {
  * @bulk_read: enable/disable bulk-reads (%0 default, %1 disabe, %2 enable)
  * @chk_data_crc: enable/disable CRC data checking when reading data nodes
  *                (%0 default, %1 disabe, %2 enable)
+ * @readahead: enable/disable read-ahead (%0 default, %1 disable, %2 enable)
  * @override_compr: override default compressor (%0 - do not override and use
  *                  superblock compressor, %1 - override and use compressor
  *                  specified in @compr_type)
@@ -935,6 +939,7 @@ struct ubifs_mount_opts {
 	unsigned int unmount_mode:2;
 	unsigned int bulk_read:2;
 	unsigned int chk_data_crc:2;
+	unsigned int readahead:2;
 	unsigned int override_compr:1;
 	unsigned int compr_type:2;
 };
@@ -1047,6 +1052,10 @@ struct ubifs_debug_info;
  * @max_bu_buf_len: maximum bulk-read buffer length
  * @bu_mutex: protects the pre-allocated bulk-read buffer and @c->bu
  * @bu: pre-allocated bulk-read information
+ * @ra_hits: read-ahead requests served by bulk-reads
+ * @ra_misses: read-ahead requests which fell back to reading page by page
+ *             because the data nodes were not consecutive on the media
+ * @ra_pages: count of pages populated by read-ahead bulk-reads
  *
  * @write_reserve_mutex: protects @write_reserve_buf
  * @write_reserve_buf: on the write path we allocate memory, which might
@@ -1285,6 +1294,9 @@ struct ubifs_info {
 	int max_bu_buf_len;
 	struct mutex bu_mutex;
 	struct bu_info bu;
+	atomic_long_t ra_hits;
+	atomic_long_t ra_misses;
+	atomic_long_t ra_pages;
 
 	struct mutex write_reserve_mutex;
 	void *write_reserve_buf;
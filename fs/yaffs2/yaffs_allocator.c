@@ -64,10 +64,12 @@ void yaffs_free_raw_obj(struct yaffs_dev *dev, struct yaffs_obj *obj)
 
 #else
 
-struct yaffs_tnode_list {
-	struct yaffs_tnode_list *next;
-	struct yaffs_tnode *tnodes;
-};
+/*
+ * Tnodes come from a slab cache of their own, so that the memory of the
+ * tnode trees dropped under memory pressure goes back to the system. The
+ * caches are named yaffs_tnode_N in /proc/slabinfo.
+ */
+static atomic_t yaffs_tnode_cache_id = ATOMIC_INIT(0);
 
 struct yaffs_obj_list {
 	struct yaffs_obj_list *next;
@@ -75,10 +77,8 @@ struct yaffs_obj_list {
 };
 
 struct yaffs_allocator {
-	int n_tnodes_created;
-	struct yaffs_tnode *free_tnodes;
-	int n_free_tnodes;
-	struct yaffs_tnode_list *alloc_tnode_list;
+	struct kmem_cache *tnode_cache;
+	char tnode_cache_name[24];
 
 	int n_obj_created;
 	struct yaffs_obj *free_objs;
@@ -93,131 +93,53 @@ static void yaffs_deinit_raw_tnodes(struct yaffs_dev *dev)
 	struct yaffs_allocator *allocator =
 	    (struct yaffs_allocator *)dev->allocator;
 
-	struct yaffs_tnode_list *tmp;
-
 	if (!allocator) {
 		YBUG();
 		return;
 	}
 
-	while (allocator->alloc_tnode_list) {
-		tmp = allocator->alloc_tnode_list->next;
-
-		kfree(allocator->alloc_tnode_list->tnodes);
-		kfree(allocator->alloc_tnode_list);
-		allocator->alloc_tnode_list = tmp;
-
-	}
-
-	allocator->free_tnodes = NULL;
-	allocator->n_free_tnodes = 0;
-	allocator->n_tnodes_created = 0;
+	if (allocator->tnode_cache)
+		kmem_cache_destroy(allocator->tnode_cache);
+	allocator->tnode_cache = NULL;
 }
 
 static void yaffs_init_raw_tnodes(struct yaffs_dev *dev)
 {
 	struct yaffs_allocator *allocator = dev->allocator;
 
-	if (allocator) {
-		allocator->alloc_tnode_list = NULL;
-		allocator->free_tnodes = NULL;
-		allocator->n_free_tnodes = 0;
-		allocator->n_tnodes_created = 0;
-	} else {
-		YBUG();
-	}
-}
-
-static int yaffs_create_tnodes(struct yaffs_dev *dev, int n_tnodes)
-{
-	struct yaffs_allocator *allocator =
-	    (struct yaffs_allocator *)dev->allocator;
-	int i;
-	struct yaffs_tnode *new_tnodes;
-	u8 *mem;
-	struct yaffs_tnode *curr;
-	struct yaffs_tnode *next;
-	struct yaffs_tnode_list *tnl;
-
 	if (!allocator) {
 		YBUG();
-		return YAFFS_FAIL;
-	}
-
-	if (n_tnodes < 1)
-		return YAFFS_OK;
-
-	/* make these things */
-
-	new_tnodes = kmalloc(n_tnodes * dev->tnode_size, GFP_NOFS);
-	mem = (u8 *) new_tnodes;
-
-	if (!new_tnodes) {
-		yaffs_trace(YAFFS_TRACE_ERROR,
-			"yaffs: Could not allocate Tnodes");
-		return YAFFS_FAIL;
-	}
-
-	/* New hookup for wide tnodes */
-	for (i = 0; i < n_tnodes - 1; i++) {
-		curr = (struct yaffs_tnode *)&mem[i * dev->tnode_size];
-		next = (struct yaffs_tnode *)&mem[(i + 1) * dev->tnode_size];
-		curr->internal[0] = next;
+		return;
 	}
 
-	curr = (struct yaffs_tnode *)&mem[(n_tnodes - 1) * dev->tnode_size];
-	curr->internal[0] = allocator->free_tnodes;
-	allocator->free_tnodes = (struct yaffs_tnode *)mem;
-
-	allocator->n_free_tnodes += n_tnodes;
-	allocator->n_tnodes_created += n_tnodes;
-
-	/* Now add this bunch of tnodes to a list for freeing up.
-	 * NB If we can't add this to the management list it isn't fatal
-	 * but it just means we can't free this bunch of tnodes later.
-	 */
-
-	tnl = kmalloc(sizeof(struct yaffs_tnode_list), GFP_NOFS);
-	if (!tnl) {
+	snprintf(allocator->tnode_cache_name,
+		 sizeof(allocator->tnode_cache_name), "yaffs_tnode_%d",
+		 atomic_inc_return(&yaffs_tnode_cache_id));
+	allocator->tnode_cache = kmem_cache_create(allocator->tnode_cache_name,
+						   dev->tnode_size, 0, 0,
+						   NULL);
+	if (!allocator->tnode_cache)
 		yaffs_trace(YAFFS_TRACE_ERROR,
-			"Could not add tnodes to management list");
-		return YAFFS_FAIL;
-	} else {
-		tnl->tnodes = new_tnodes;
-		tnl->next = allocator->alloc_tnode_list;
-		allocator->alloc_tnode_list = tnl;
-	}
-
-	yaffs_trace(YAFFS_TRACE_ALLOCATE,"Tnodes added");
-
-	return YAFFS_OK;
+			"yaffs: Could not create tnode cache");
 }
 
 struct yaffs_tnode *yaffs_alloc_raw_tnode(struct yaffs_dev *dev)
 {
 	struct yaffs_allocator *allocator =
 	    (struct yaffs_allocator *)dev->allocator;
-	struct yaffs_tnode *tn = NULL;
 
 	if (!allocator) {
 		YBUG();
 		return NULL;
 	}
 
-	/* If there are none left make more */
-	if (!allocator->free_tnodes)
-		yaffs_create_tnodes(dev, YAFFS_ALLOCATION_NTNODES);
-
-	if (allocator->free_tnodes) {
-		tn = allocator->free_tnodes;
-		allocator->free_tnodes = allocator->free_tnodes->internal[0];
-		allocator->n_free_tnodes--;
-	}
+	if (!allocator->tnode_cache)
+		return NULL;
 
-	return tn;
+	return kmem_cache_alloc(allocator->tnode_cache, GFP_NOFS);
 }
 
-/* FreeTnode frees up a tnode and puts it back on the free list */
+/* FreeTnode gives a tnode back to the slab cache */
 void yaffs_free_raw_tnode(struct yaffs_dev *dev, struct yaffs_tnode *tn)
 {
 	struct yaffs_allocator *allocator = dev->allocator;
@@ -227,11 +149,8 @@ void yaffs_free_raw_tnode(struct yaffs_dev *dev, struct yaffs_tnode *tn)
 		return;
 	}
 
-	if (tn) {
-		tn->internal[0] = allocator->free_tnodes;
-		allocator->free_tnodes = tn;
-		allocator->n_free_tnodes++;
-	}
+	if (tn)
+		kmem_cache_free(allocator->tnode_cache, tn);
 	dev->checkpoint_blocks_required = 0;	/* force recalculation */
 }
 
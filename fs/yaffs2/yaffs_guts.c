@@ -34,6 +34,7 @@
 #include "yaffs_allocator.h"
 
 #include "yaffs_attribs.h"
+#include "yaffs_summary.h"
 
 /* Note YAFFS_GC_GOOD_ENOUGH must be <= YAFFS_GC_PASSIVE_THRESHOLD */
 #define YAFFS_GC_GOOD_ENOUGH 2
@@ -46,6 +47,10 @@
 static int yaffs_wr_data_obj(struct yaffs_obj *in, int inode_chunk,
 			     const u8 * buffer, int n_bytes, int use_reserve);
 
+static int yaffs_free_tnode_tree(struct yaffs_dev *dev,
+				 struct yaffs_tnode *tn, int level);
+static int yaffs_load_tnodes(struct yaffs_obj *obj);
+
 
 
 /* Function to calculate chunk and offset */
@@ -609,6 +614,8 @@ static int yaffs_write_new_chunk(struct yaffs_dev *dev,
 
 	if (!write_ok)
 		chunk = -1;
+	else
+		yaffs_summary_add(dev, tags, chunk);
 
 	if (attempts > 1) {
 		yaffs_trace(YAFFS_TRACE_ERROR,
@@ -735,8 +742,10 @@ struct yaffs_tnode *yaffs_get_tnode(struct yaffs_dev *dev)
 }
 
 /* FreeTnode frees up a tnode and puts it back on the free list */
-static void yaffs_free_tnode(struct yaffs_dev *dev, struct yaffs_tnode *tn)
+void yaffs_free_tnode(struct yaffs_dev *dev, struct yaffs_tnode *tn)
 {
+	if (!tn)
+		return;	/* A dropped tree has no top tnode */
 	yaffs_free_raw_tnode(dev, tn);
 	dev->n_tnodes--;
 	dev->checkpoint_blocks_required = 0;	/* force recalculation */
@@ -744,9 +753,31 @@ static void yaffs_free_tnode(struct yaffs_dev *dev, struct yaffs_tnode *tn)
 
 static void yaffs_deinit_tnodes_and_objs(struct yaffs_dev *dev)
 {
+	struct list_head *i;
+	struct yaffs_obj *obj;
+	int bucket;
+
+	/* The tnodes must all be given back before the allocator goes away */
+	for (bucket = 0; bucket < YAFFS_NOBJECT_BUCKETS; bucket++) {
+		list_for_each(i, &dev->obj_bucket[bucket].list) {
+			obj = list_entry(i, struct yaffs_obj, hash_link);
+			if (obj->variant_type != YAFFS_OBJECT_TYPE_FILE)
+				continue;
+			yaffs_free_tnode_tree(dev,
+					      obj->variant.file_variant.top,
+					      obj->variant.file_variant.
+					      top_level);
+			obj->variant.file_variant.top = NULL;
+			kfree(obj->variant.file_variant.drop_blocks);
+			obj->variant.file_variant.drop_blocks = NULL;
+		}
+	}
+
 	yaffs_deinit_raw_tnodes_and_objs(dev);
 	dev->n_obj = 0;
 	dev->n_tnodes = 0;
+	dev->n_dropped_trees = 0;
+	dev->n_dropped_tnodes = 0;
 }
 
 void yaffs_load_tnode_0(struct yaffs_dev *dev, struct yaffs_tnode *tn,
@@ -1018,6 +1049,9 @@ static int yaffs_find_chunk_in_file(struct yaffs_obj *in, int inode_chunk,
 		tags = &local_tags;
 	}
 
+	if (yaffs_load_tnodes(in) != YAFFS_OK)
+		return -1;
+
 	tn = yaffs_find_tnode_0(dev, &in->variant.file_variant, inode_chunk);
 
 	if (tn) {
@@ -1046,6 +1080,9 @@ static int yaffs_find_del_file_chunk(struct yaffs_obj *in, int inode_chunk,
 		tags = &local_tags;
 	}
 
+	if (yaffs_load_tnodes(in) != YAFFS_OK)
+		return -1;
+
 	tn = yaffs_find_tnode_0(dev, &in->variant.file_variant, inode_chunk);
 
 	if (tn) {
@@ -1096,6 +1133,9 @@ int yaffs_put_chunk_in_file(struct yaffs_obj *in, int inode_chunk,
 		return YAFFS_OK;
 	}
 
+	if (!in_scan && yaffs_load_tnodes(in) != YAFFS_OK)
+		return YAFFS_FAIL;
+
 	tn = yaffs_add_find_tnode_0(dev,
 				    &in->variant.file_variant,
 				    inode_chunk, NULL);
@@ -1675,6 +1715,11 @@ static void yaffs_free_obj(struct yaffs_obj *obj)
 
 	yaffs_unhash_obj(obj);
 
+	if (obj->tnodes_dropped) {
+		dev->n_dropped_trees--;
+		kfree(obj->variant.file_variant.drop_blocks);
+	}
+
 	yaffs_free_raw_obj(dev, obj);
 	dev->n_obj--;
 	dev->checkpoint_blocks_required = 0;	/* force recalculation */
@@ -1723,6 +1768,8 @@ static void yaffs_soft_del_file(struct yaffs_obj *obj)
 				obj->obj_id);
 			yaffs_generic_obj_del(obj);
 		} else {
+			if (yaffs_load_tnodes(obj) != YAFFS_OK)
+				return;
 			yaffs_soft_del_worker(obj,
 					      obj->variant.file_variant.top,
 					      obj->variant.
@@ -1836,6 +1883,450 @@ static int yaffs_prune_tree(struct yaffs_dev *dev,
 	return YAFFS_OK;
 }
 
+/*-------------------- Dropping and reloading tnode trees ---------------
+ *
+ * The tnode tree of a file which has no inode is not needed until the file
+ * is opened again, so it can be freed when memory is short. It is rebuilt
+ * from the chunks in use on the device when it is needed: their tags come
+ * from the block summaries where there are some, otherwise from the NAND.
+ *
+ * The blocks holding the chunks of the file are recorded when the tree is
+ * dropped, and only those are read back, so a reload costs at most
+ * YAFFS_DROP_MAX_BLOCKS block reads. The chunks of a file cannot move while
+ * its tree is dropped: everything that would move or replace one, garbage
+ * collection included, reloads the tree first. Only trees of more than one
+ * tnode, of files spread over no more than YAFFS_DROP_MAX_BLOCKS blocks, are
+ * dropped.
+ */
+
+#define YAFFS_DROP_MAX_BLOCKS	16
+
+static int yaffs_free_tnode_tree(struct yaffs_dev *dev,
+				 struct yaffs_tnode *tn, int level)
+{
+	int i;
+	int n = 0;
+
+	if (!tn)
+		return 0;
+
+	if (level > 0) {
+		for (i = 0; i < YAFFS_NTNODES_INTERNAL; i++)
+			n += yaffs_free_tnode_tree(dev, tn->internal[i],
+						   level - 1);
+	}
+
+	yaffs_free_tnode(dev, tn);
+
+	return n + 1;
+}
+
+/*
+ * yaffs_tree_blocks() adds the blocks holding the chunks of a tree to blocks,
+ * without duplicates. Returns YAFFS_FAIL if there are more than
+ * YAFFS_DROP_MAX_BLOCKS of them.
+ */
+static int yaffs_tree_blocks(struct yaffs_dev *dev, struct yaffs_tnode *tn,
+			     int level, int *blocks, int *n_blocks)
+{
+	int i;
+	int j;
+	int blk;
+	u32 base;
+
+	if (!tn)
+		return YAFFS_OK;
+
+	if (level > 0) {
+		for (i = 0; i < YAFFS_NTNODES_INTERNAL; i++)
+			if (yaffs_tree_blocks(dev, tn->internal[i], level - 1,
+					      blocks, n_blocks) != YAFFS_OK)
+				return YAFFS_FAIL;
+		return YAFFS_OK;
+	}
+
+	for (i = 0; i < YAFFS_NTNODES_LEVEL0; i++) {
+		base = yaffs_get_group_base(dev, tn, i);
+		if (!base)
+			continue;
+		blk = base / dev->param.chunks_per_block;
+		for (j = 0; j < *n_blocks && blocks[j] != blk; j++)
+			;
+		if (j < *n_blocks)
+			continue;
+		if (*n_blocks >= YAFFS_DROP_MAX_BLOCKS)
+			return YAFFS_FAIL;
+		blocks[(*n_blocks)++] = blk;
+	}
+
+	return YAFFS_OK;
+}
+
+static int yaffs_can_drop_tnodes(struct yaffs_obj *obj)
+{
+	return obj->variant_type == YAFFS_OBJECT_TYPE_FILE &&
+	    obj->valid && !obj->deleted && !obj->soft_del && !obj->unlinked &&
+	    !obj->being_created && !obj->my_inode && !obj->tnodes_dropped &&
+	    obj->variant.file_variant.top_level > 0 &&
+	    !yaffs_obj_cache_dirty(obj);
+}
+
+/*
+ * yaffs_drop_tnodes() frees the tnode trees of unused files until at least
+ * n_wanted tnodes are freed. Returns the number of tnodes freed.
+ */
+int yaffs_drop_tnodes(struct yaffs_dev *dev, int n_wanted)
+{
+	struct list_head *i;
+	struct yaffs_obj *obj;
+	struct yaffs_file_var *file_struct;
+	int blocks[YAFFS_DROP_MAX_BLOCKS];
+	int *drop_blocks;
+	int n_blocks;
+	int n_freed = 0;
+	int n_buckets;
+	int n;
+
+	if (!dev->is_mounted || !dev->param.is_yaffs2)
+		return 0;
+
+	for (n_buckets = 0;
+	     n_freed < n_wanted && n_buckets < YAFFS_NOBJECT_BUCKETS;
+	     n_buckets++) {
+		list_for_each(i, &dev->obj_bucket[dev->drop_bucket].list) {
+			obj = list_entry(i, struct yaffs_obj, hash_link);
+			if (!yaffs_can_drop_tnodes(obj))
+				continue;
+
+			file_struct = &obj->variant.file_variant;
+			n_blocks = 0;
+			if (yaffs_tree_blocks(dev, file_struct->top,
+					      file_struct->top_level, blocks,
+					      &n_blocks) != YAFFS_OK)
+				continue;
+			drop_blocks = NULL;
+			if (n_blocks) {
+				drop_blocks = kmemdup(blocks,
+						      n_blocks * sizeof(int),
+						      GFP_NOFS);
+				if (!drop_blocks)
+					goto out;
+			}
+
+			n = yaffs_free_tnode_tree(dev, file_struct->top,
+						  file_struct->top_level);
+			file_struct->top = NULL;
+			file_struct->top_level = 0;
+			file_struct->n_drop_blocks = n_blocks;
+			file_struct->drop_blocks = drop_blocks;
+			obj->tnodes_dropped = 1;
+
+			dev->n_dropped_trees++;
+			dev->n_dropped_tnodes += n;
+			dev->n_tnode_drops++;
+			n_freed += n;
+		}
+		dev->drop_bucket = (dev->drop_bucket + 1) % YAFFS_NOBJECT_BUCKETS;
+	}
+
+out:
+	if (n_freed)
+		yaffs_trace(YAFFS_TRACE_OS,
+			"yaffs: dropped %d tnodes, %d trees dropped",
+			n_freed, dev->n_dropped_trees);
+
+	return n_freed;
+}
+
+/*
+ * yaffs_count_droppable_tnodes() estimates how many tnodes yaffs_drop_tnodes()
+ * could free, from the sizes of the files whose trees may be dropped.
+ */
+int yaffs_count_droppable_tnodes(struct yaffs_dev *dev)
+{
+	struct list_head *i;
+	struct yaffs_obj *obj;
+	int n_tnodes = 0;
+	int bucket;
+	int n;
+
+	if (!dev->is_mounted || !dev->param.is_yaffs2)
+		return 0;
+
+	for (bucket = 0; bucket < YAFFS_NOBJECT_BUCKETS; bucket++) {
+		list_for_each(i, &dev->obj_bucket[bucket].list) {
+			obj = list_entry(i, struct yaffs_obj, hash_link);
+			if (!yaffs_can_drop_tnodes(obj))
+				continue;
+
+			/* Level 0 tnodes, then each level of internal ones */
+			n = (obj->variant.file_variant.file_size +
+			     dev->data_bytes_per_chunk - 1) /
+			    dev->data_bytes_per_chunk;
+			n = (n + YAFFS_NTNODES_LEVEL0 - 1) /
+			    YAFFS_NTNODES_LEVEL0;
+			n_tnodes += n;
+			while (n > 1) {
+				n = (n + YAFFS_NTNODES_INTERNAL - 1) /
+				    YAFFS_NTNODES_INTERNAL;
+				n_tnodes += n;
+			}
+		}
+	}
+
+	return n_tnodes;
+}
+
+static int yaffs_start_tnode_load(struct yaffs_obj *obj)
+{
+	struct yaffs_tnode *tn = yaffs_get_tnode(obj->my_dev);
+
+	if (!tn)
+		return YAFFS_FAIL;
+
+	obj->variant.file_variant.top = tn;
+	obj->variant.file_variant.top_level = 0;
+	obj->tnodes_dropped = 0;
+	obj->tnodes_loading = 1;
+
+	return YAFFS_OK;
+}
+
+static void yaffs_end_tnode_load(struct yaffs_obj *obj, int result)
+{
+	struct yaffs_dev *dev = obj->my_dev;
+	struct yaffs_file_var *file_struct = &obj->variant.file_variant;
+
+	obj->tnodes_loading = 0;
+
+	if (result == YAFFS_OK) {
+		kfree(file_struct->drop_blocks);
+		file_struct->drop_blocks = NULL;
+		file_struct->n_drop_blocks = 0;
+		dev->n_dropped_trees--;
+		dev->n_tnode_loads++;
+	} else {
+		/* Give back what was built, it is retried next time */
+		yaffs_free_tnode_tree(dev, file_struct->top,
+				      file_struct->top_level);
+		file_struct->top = NULL;
+		file_struct->top_level = 0;
+		obj->tnodes_dropped = 1;
+	}
+}
+
+/* The tnodes of the rebuilt trees no longer need to be allowed for */
+static void yaffs_account_tnode_load(struct yaffs_dev *dev, int n_before)
+{
+	dev->n_dropped_tnodes -= dev->n_tnodes - n_before;
+	if (dev->n_dropped_tnodes < 0 || !dev->n_dropped_trees)
+		dev->n_dropped_tnodes = 0;
+}
+
+static int yaffs_reload_chunk(struct yaffs_obj *obj, int inode_chunk,
+			      int nand_chunk)
+{
+	struct yaffs_dev *dev = obj->my_dev;
+	struct yaffs_tnode *tn;
+	int existing;
+	int blk;
+	int existing_blk;
+
+	tn = yaffs_add_find_tnode_0(dev, &obj->variant.file_variant,
+				    inode_chunk, NULL);
+	if (!tn)
+		return YAFFS_FAIL;
+
+	/* A chunk being replaced is still in use until the new one is in
+	 * the tree, so there may be two of them. The newer one is the one
+	 * written later: in a younger block, or further on in the same block.
+	 * The tree only records chunk groups: if both are in the same group
+	 * the entry is the same either way, and otherwise the groups are
+	 * ordered like the chunks in them.
+	 */
+	existing = yaffs_get_group_base(dev, tn, inode_chunk);
+	if (existing > 0) {
+		if ((nand_chunk >> dev->chunk_grp_bits) ==
+		    (existing >> dev->chunk_grp_bits))
+			return YAFFS_OK;
+		blk = nand_chunk / dev->param.chunks_per_block;
+		existing_blk = existing / dev->param.chunks_per_block;
+		if (blk == existing_blk ? nand_chunk < existing :
+		    yaffs_get_block_info(dev, blk)->seq_number <
+		    yaffs_get_block_info(dev, existing_blk)->seq_number)
+			return YAFFS_OK;
+	}
+
+	yaffs_load_tnode_0(dev, tn, inode_chunk, nand_chunk);
+
+	return YAFFS_OK;
+}
+
+/*
+ * yaffs_rebuild_block() puts the chunks in use in block blk back into the
+ * trees being loaded: those of obj only, or of all objects if obj is NULL.
+ */
+static int yaffs_rebuild_block(struct yaffs_dev *dev, struct yaffs_obj *only,
+			       int blk, struct yaffs_summary_tags *sum_buffer)
+{
+	struct yaffs_block_info *bi = yaffs_get_block_info(dev, blk);
+	struct yaffs_summary_tags *sum_tags;
+	struct yaffs_ext_tags tags;
+	struct yaffs_obj *obj;
+	int result = YAFFS_OK;
+	int c;
+	int chunk;
+
+	if (!bi->pages_in_use ||
+	    (bi->block_state != YAFFS_BLOCK_STATE_FULL &&
+	     bi->block_state != YAFFS_BLOCK_STATE_ALLOCATING &&
+	     bi->block_state != YAFFS_BLOCK_STATE_COLLECTING))
+		return YAFFS_OK;
+
+	/* The block being written has its summary in memory */
+	sum_tags = NULL;
+	if (dev->sum_tags && blk == dev->sum_block)
+		sum_tags = dev->sum_tags;
+	else if (sum_buffer &&
+		 yaffs_summary_read(dev, sum_buffer, blk) == YAFFS_OK)
+		sum_tags = sum_buffer;
+
+	for (c = 0; result == YAFFS_OK && c < dev->param.chunks_per_block; c++) {
+		if (bi->has_summary && c >= dev->chunks_per_summary)
+			break;	/* The summary chunks hold no file data */
+
+		if (!yaffs_check_chunk_bit(dev, blk, c))
+			continue;
+
+		chunk = blk * dev->param.chunks_per_block + c;
+
+		if (!sum_tags ||
+		    yaffs_summary_fetch(dev, sum_tags, &tags, c) != YAFFS_OK) {
+			yaffs_rd_chunk_tags_nand(dev, chunk, NULL, &tags);
+			if (!tags.chunk_used ||
+			    tags.ecc_result == YAFFS_ECC_RESULT_UNFIXED)
+				continue;
+		}
+
+		if (tags.chunk_id == 0)
+			continue;	/* An object header */
+
+		if (only)
+			obj = (tags.obj_id == only->obj_id) ? only : NULL;
+		else
+			obj = yaffs_find_by_number(dev, tags.obj_id);
+
+		if (obj && obj->tnodes_loading)
+			result = yaffs_reload_chunk(obj, tags.chunk_id, chunk);
+	}
+
+	return result;
+}
+
+/*
+ * yaffs_rebuild_tnodes() rebuilds the trees being loaded: that of obj, from
+ * the blocks recorded when it was dropped, or those of all objects, from the
+ * whole device, if obj is NULL.
+ */
+static int yaffs_rebuild_tnodes(struct yaffs_dev *dev, struct yaffs_obj *only)
+{
+	struct yaffs_summary_tags *sum_buffer = NULL;
+	int result = YAFFS_OK;
+	int blk;
+	int i;
+
+	if (dev->chunks_per_summary)
+		sum_buffer = kmalloc(dev->chunks_per_summary *
+				     sizeof(struct yaffs_summary_tags),
+				     GFP_NOFS);
+
+	if (only) {
+		for (i = 0; result == YAFFS_OK &&
+		     i < only->variant.file_variant.n_drop_blocks; i++)
+			result = yaffs_rebuild_block(dev, only,
+				only->variant.file_variant.drop_blocks[i],
+				sum_buffer);
+	} else {
+		for (blk = dev->internal_start_block;
+		     result == YAFFS_OK && blk <= dev->internal_end_block;
+		     blk++)
+			result = yaffs_rebuild_block(dev, NULL, blk,
+						     sum_buffer);
+	}
+
+	kfree(sum_buffer);
+
+	return result;
+}
+
+static int yaffs_load_tnodes(struct yaffs_obj *obj)
+{
+	struct yaffs_dev *dev = obj->my_dev;
+	int n_before = dev->n_tnodes;
+	int result;
+
+	if (!obj->tnodes_dropped)
+		return YAFFS_OK;
+
+	result = yaffs_start_tnode_load(obj);
+	if (result == YAFFS_OK) {
+		result = yaffs_rebuild_tnodes(dev, obj);
+		yaffs_end_tnode_load(obj, result);
+	}
+
+	if (result == YAFFS_OK)
+		yaffs_account_tnode_load(dev, n_before);
+	else
+		yaffs_trace(YAFFS_TRACE_ERROR,
+			"yaffs: could not reload tnodes of object %d",
+			obj->obj_id);
+
+	return result;
+}
+
+/*
+ * yaffs_load_all_tnodes() rebuilds all the dropped trees in one pass, as
+ * needed before writing a checkpoint.
+ */
+int yaffs_load_all_tnodes(struct yaffs_dev *dev)
+{
+	struct list_head *i;
+	struct yaffs_obj *obj;
+	int n_before = dev->n_tnodes;
+	int result = YAFFS_OK;
+	int bucket;
+
+	if (!dev->n_dropped_trees)
+		return YAFFS_OK;
+
+	for (bucket = 0; bucket < YAFFS_NOBJECT_BUCKETS; bucket++) {
+		list_for_each(i, &dev->obj_bucket[bucket].list) {
+			obj = list_entry(i, struct yaffs_obj, hash_link);
+			if (obj->tnodes_dropped && result == YAFFS_OK)
+				result = yaffs_start_tnode_load(obj);
+		}
+	}
+
+	if (result == YAFFS_OK)
+		result = yaffs_rebuild_tnodes(dev, NULL);
+
+	for (bucket = 0; bucket < YAFFS_NOBJECT_BUCKETS; bucket++) {
+		list_for_each(i, &dev->obj_bucket[bucket].list) {
+			obj = list_entry(i, struct yaffs_obj, hash_link);
+			if (obj->tnodes_loading)
+				yaffs_end_tnode_load(obj, result);
+		}
+	}
+
+	if (result == YAFFS_OK)
+		yaffs_account_tnode_load(dev, n_before);
+	else
+		yaffs_trace(YAFFS_TRACE_ERROR,
+			"yaffs: could not reload dropped tnodes");
+
+	return result;
+}
+
 /*-------------------- End of File Structure functions.-------------------*/
 
 /* AllocateEmptyObject gets us a clean Object. Tries to make allocate more if we run out */
@@ -2422,6 +2913,7 @@ void yaffs_block_became_dirty(struct yaffs_dev *dev, int block_no)
 		bi->pages_in_use = 0;
 		bi->soft_del_pages = 0;
 		bi->has_shrink_hdr = 0;
+		bi->has_summary = 0;
 		bi->skip_erased_check = 1;	/* Clean, so no need to check */
 		bi->gc_prioritise = 0;
 		yaffs_clear_chunk_bits(dev, block_no);
@@ -2475,6 +2967,8 @@ static int yaffs_gc_block(struct yaffs_dev *dev, int block, int whole_block)
 
 	dev->gc_disable = 1;
 
+	yaffs_summary_gc(dev, block);
+
 	if (is_checkpt_block || !yaffs_still_some_chunks(dev, block)) {
 		yaffs_trace(YAFFS_TRACE_TRACING,
 			"Collecting block %d that has no chunks in use",
@@ -4980,6 +5474,9 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 			init_failed = 1;
 	}
 
+	if (!init_failed && !yaffs_summary_init(dev))
+		init_failed = 1;
+
 	if (dev->param.is_yaffs2)
 		dev->param.use_header_file_size = 1;
 
@@ -5089,6 +5586,7 @@ void yaffs_deinitialise(struct yaffs_dev *dev)
 		}
 
 		kfree(dev->gc_cleanup_list);
+		yaffs_summary_deinit(dev);
 
 		for (i = 0; i < YAFFS_N_TEMP_BUFFERS; i++)
 			kfree(dev->temp_buffer[i].buffer);
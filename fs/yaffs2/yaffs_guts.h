@@ -83,6 +83,9 @@
 #define YAFFS_OBJECTID_CHECKPOINT_DATA	0x20
 #define YAFFS_SEQUENCE_CHECKPOINT_DATA  0x21
 
+/* Pseudo object id for block summaries, outside of the valid object id range */
+#define YAFFS_OBJECTID_SUMMARY		0x0ffffff0
+
 #define YAFFS_MAX_SHORT_OP_CACHES	20
 
 #define YAFFS_N_TEMP_BUFFERS		6
@@ -281,11 +284,19 @@ struct yaffs_block_info {
 
 #ifdef CONFIG_YAFFS_YAFFS2
 	u32 has_shrink_hdr:1;	/* This block has at least one shrink object header */
+	u32 has_summary:1;	/* This block has summary chunks in use */
 	u32 seq_number;		/* block sequence number for yaffs2 */
 #endif
 
 };
 
+/* Tags of one chunk, as saved in the block summary (see yaffs_summary.c) */
+struct yaffs_summary_tags {
+	unsigned obj_id;
+	unsigned chunk_id;
+	unsigned n_bytes;
+};
+
 /* -------------------------- Object structure -------------------------------*/
 /* This is the object structure as stored on NAND */
 
@@ -352,6 +363,8 @@ struct yaffs_file_var {
 	u32 shrink_size;
 	int top_level;
 	struct yaffs_tnode *top;
+	int n_drop_blocks;	/* Blocks holding the chunks of a dropped tree */
+	int *drop_blocks;
 };
 
 struct yaffs_dir_var {
@@ -399,6 +412,9 @@ struct yaffs_obj {
 	u8 xattr_known:1;	/* We know if this has object has xattribs or not. */
 	u8 has_xattr:1;		/* This object has xattribs. Valid if xattr_known. */
 
+	u8 tnodes_dropped:1;	/* The tnode tree was freed and must be reloaded. */
+	u8 tnodes_loading:1;	/* The tnode tree is being reloaded. */
+
 	u8 serial;		/* serial number of chunk in NAND. Cached here */
 	u16 sum;		/* sum of the name to speed searching */
 
@@ -565,6 +581,7 @@ struct yaffs_param {
 	/* Debug control flags. Don't use unless you know what you're doing */
 	int use_header_file_size;	/* Flag to determine if we should use file sizes from the header */
 	int disable_lazy_load;	/* Disable lazy loading on this device */
+	int disable_summary;	/* Do not write block summaries (yaffs2 only) */
 	int wide_tnodes_disabled;	/* Set to disable wide tnodes */
 	int disable_soft_del;	/* yaffs 1 only: Set to disable the use of softdeletion. */
 
@@ -651,6 +668,11 @@ struct yaffs_dev {
 	int n_obj;
 	int n_tnodes;
 
+	/* Tnode trees of unused files freed under memory pressure */
+	int n_dropped_trees;
+	int n_dropped_tnodes;	/* Allowed for when sizing the checkpoint */
+	u32 drop_bucket;	/* Where the next drop starts looking */
+
 	int n_hardlinks;
 
 	struct yaffs_obj_bucket obj_bucket[YAFFS_NOBJECT_BUCKETS];
@@ -707,6 +729,11 @@ struct yaffs_dev {
 	unsigned oldest_dirty_seq;
 	unsigned oldest_dirty_block;
 
+	/* Block summaries */
+	int chunks_per_summary;	/* Data chunks per block, 0 if disabled */
+	int sum_block;		/* Block the summary tags belong to */
+	struct yaffs_summary_tags *sum_tags;
+
 	/* Block refreshing */
 	int refresh_skip;	/* A skip down counter. Refresh happens when this gets to zero. */
 
@@ -734,6 +761,10 @@ struct yaffs_dev {
 	u32 n_unmarked_deletions;
 	u32 refresh_count;
 	u32 cache_hits;
+	u32 tags_used;		/* Chunk tags read while scanning */
+	u32 summary_used;	/* Chunk tags taken from summaries while scanning */
+	u32 n_tnode_drops;
+	u32 n_tnode_loads;
 
 };
 
@@ -815,6 +846,10 @@ int yaffs_flush_file(struct yaffs_obj *obj, int update_time, int data_sync);
 void yaffs_flush_whole_cache(struct yaffs_dev *dev);
 
 int yaffs_checkpoint_save(struct yaffs_dev *dev);
+
+int yaffs_drop_tnodes(struct yaffs_dev *dev, int n_wanted);
+int yaffs_count_droppable_tnodes(struct yaffs_dev *dev);
+int yaffs_load_all_tnodes(struct yaffs_dev *dev);
 int yaffs_checkpoint_restore(struct yaffs_dev *dev);
 
 /* Directory operations */
@@ -892,6 +927,7 @@ void yaffs_handle_shadowed_obj(struct yaffs_dev *dev, int obj_id,
 			       int backward_scanning);
 int yaffs_check_alloc_available(struct yaffs_dev *dev, int n_chunks);
 struct yaffs_tnode *yaffs_get_tnode(struct yaffs_dev *dev);
+void yaffs_free_tnode(struct yaffs_dev *dev, struct yaffs_tnode *tn);
 struct yaffs_tnode *yaffs_add_find_tnode_0(struct yaffs_dev *dev,
 					   struct yaffs_file_var *file_struct,
 					   u32 chunk_id,
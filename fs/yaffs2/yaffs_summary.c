@@ -0,0 +1,320 @@
+/*
+ * YAFFS: Yet Another Flash File System. A NAND-flash specific file system.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Block summaries.
+ *
+ * When the last data chunk of a block has been written, the tags of all the
+ * data chunks of the block are written to the last chunk(s) of the block.
+ * When scanning, one summary read replaces reading the tags of every chunk.
+ *
+ * The summary chunks are counted as in use, both when written and when found
+ * by the scan, since garbage collecting a block whose data is all live just
+ * writes another summary: they are only given back by yaffs_summary_gc()
+ * when their block is collected. Their object id is out of the valid range,
+ * so older code which does not know about summaries ignores them as chunks
+ * with bad tags, and images written by older code simply have no summaries.
+ */
+
+#include "yaffs_summary.h"
+#include "yaffs_nand.h"
+#include "yaffs_tagsvalidity.h"
+#include "yaffs_getblockinfo.h"
+#include "yaffs_bitmap.h"
+#include "yaffs_trace.h"
+
+#define YAFFS_SUMMARY_VERSION	1
+
+struct yaffs_summary_header {
+	u32 version;		/* Must be YAFFS_SUMMARY_VERSION */
+	u32 block;		/* Must be this block */
+	u32 seq;		/* Must be the block's sequence number */
+	u32 sum;		/* Sum of the bytes of the summary tags */
+	u32 xor;		/* Xor of the bytes of the summary tags */
+};
+
+#define YAFFS_SUMMARY_HDR_SIZE sizeof(struct yaffs_summary_header)
+
+static int yaffs_summary_bytes(struct yaffs_dev *dev)
+{
+	return dev->chunks_per_summary * sizeof(struct yaffs_summary_tags);
+}
+
+static void yaffs_summary_csum(struct yaffs_dev *dev,
+			       struct yaffs_summary_tags *sum_tags,
+			       u32 *sum, u32 *xor)
+{
+	u8 *p = (u8 *) sum_tags;
+	int n = yaffs_summary_bytes(dev);
+
+	*sum = 0;
+	*xor = 0;
+	while (n--) {
+		*sum += *p;
+		*xor ^= *p;
+		p++;
+	}
+}
+
+int yaffs_summary_init(struct yaffs_dev *dev)
+{
+	int per_chunk = dev->data_bytes_per_chunk - YAFFS_SUMMARY_HDR_SIZE;
+	int n_chunks;
+
+	dev->chunks_per_summary = 0;
+	dev->sum_tags = NULL;
+
+	if (dev->param.disable_summary || !dev->param.is_yaffs2)
+		return YAFFS_OK;
+
+	/* Size the summary for a whole block, which is slightly too big */
+	n_chunks = (dev->param.chunks_per_block *
+		    sizeof(struct yaffs_summary_tags) + per_chunk - 1) /
+		   per_chunk;
+	if (n_chunks >= dev->param.chunks_per_block / 2) {
+		yaffs_trace(YAFFS_TRACE_ALWAYS,
+			"summary would take %d chunks per block, disabled",
+			n_chunks);
+		return YAFFS_OK;
+	}
+
+	dev->chunks_per_summary = dev->param.chunks_per_block - n_chunks;
+	dev->sum_tags = kmalloc(yaffs_summary_bytes(dev), GFP_NOFS);
+	if (!dev->sum_tags) {
+		dev->chunks_per_summary = 0;
+		return YAFFS_FAIL;
+	}
+	yaffs_summary_clear(dev);
+
+	return YAFFS_OK;
+}
+
+void yaffs_summary_deinit(struct yaffs_dev *dev)
+{
+	kfree(dev->sum_tags);
+	dev->sum_tags = NULL;
+	dev->chunks_per_summary = 0;
+}
+
+void yaffs_summary_clear(struct yaffs_dev *dev)
+{
+	if (!dev->sum_tags)
+		return;
+	memset(dev->sum_tags, 0, yaffs_summary_bytes(dev));
+	dev->sum_block = -1;
+}
+
+static int yaffs_summary_write(struct yaffs_dev *dev, int blk)
+{
+	struct yaffs_block_info *bi = yaffs_get_block_info(dev, blk);
+	struct yaffs_summary_header hdr;
+	struct yaffs_ext_tags tags;
+	u8 *sum_buffer = (u8 *) dev->sum_tags;
+	int n_bytes = yaffs_summary_bytes(dev);
+	int per_chunk = dev->data_bytes_per_chunk - YAFFS_SUMMARY_HDR_SIZE;
+	int chunk_in_block = dev->chunks_per_summary;
+	int chunk = blk * dev->param.chunks_per_block + chunk_in_block;
+	int result = YAFFS_OK;
+	u8 *buffer;
+
+	hdr.version = YAFFS_SUMMARY_VERSION;
+	hdr.block = blk;
+	hdr.seq = bi->seq_number;
+	yaffs_summary_csum(dev, dev->sum_tags, &hdr.sum, &hdr.xor);
+
+	yaffs_init_tags(&tags);
+	tags.obj_id = YAFFS_OBJECTID_SUMMARY;
+	tags.chunk_id = 1;
+
+	buffer = yaffs_get_temp_buffer(dev, __LINE__);
+
+	while (result == YAFFS_OK && n_bytes > 0) {
+		int this_tx = min(n_bytes, per_chunk);
+
+		memset(buffer, 0xff, dev->data_bytes_per_chunk);
+		memcpy(buffer, &hdr, YAFFS_SUMMARY_HDR_SIZE);
+		memcpy(buffer + YAFFS_SUMMARY_HDR_SIZE, sum_buffer, this_tx);
+		tags.n_bytes = YAFFS_SUMMARY_HDR_SIZE + this_tx;
+
+		result = yaffs_wr_chunk_tags_nand(dev, chunk, buffer, &tags);
+		if (result == YAFFS_OK) {
+			yaffs_set_chunk_bit(dev, blk, chunk_in_block);
+			bi->pages_in_use++;
+			bi->has_summary = 1;
+			dev->n_free_chunks--;
+		}
+
+		n_bytes -= this_tx;
+		sum_buffer += this_tx;
+		chunk++;
+		chunk_in_block++;
+		tags.chunk_id++;
+	}
+
+	yaffs_release_temp_buffer(dev, buffer, __LINE__);
+
+	if (result != YAFFS_OK)
+		yaffs_trace(YAFFS_TRACE_ERROR,
+			"failed to write summary of block %d", blk);
+	return result;
+}
+
+/*
+ * yaffs_summary_add() records the tags of a chunk which has just been written.
+ * Once the last data chunk of the block is written, the summary is written
+ * and the rest of the block is skipped.
+ */
+int yaffs_summary_add(struct yaffs_dev *dev, struct yaffs_ext_tags *tags,
+		      int chunk_in_nand)
+{
+	struct yaffs_packed_tags2_tags_only tags_only;
+	struct yaffs_summary_tags *sum_tags;
+	int blk = chunk_in_nand / dev->param.chunks_per_block;
+	int chunk_in_block = chunk_in_nand % dev->param.chunks_per_block;
+
+	if (!dev->sum_tags || chunk_in_block >= dev->chunks_per_summary)
+		return YAFFS_OK;
+
+	/* Never mix up entries of two blocks */
+	if (blk != dev->sum_block) {
+		yaffs_summary_clear(dev);
+		dev->sum_block = blk;
+	}
+
+	yaffs_pack_tags2_tags_only(&tags_only, tags);
+	sum_tags = &dev->sum_tags[chunk_in_block];
+	sum_tags->obj_id = tags_only.obj_id;
+	sum_tags->chunk_id = tags_only.chunk_id;
+	sum_tags->n_bytes = tags_only.n_bytes;
+
+	if (chunk_in_block == dev->chunks_per_summary - 1) {
+		yaffs_summary_write(dev, blk);
+		yaffs_summary_clear(dev);
+		yaffs_skip_rest_of_block(dev);
+	}
+
+	return YAFFS_OK;
+}
+
+/*
+ * yaffs_summary_gc() gives back the summary chunks of a block which is being
+ * garbage collected, so that the block can become dirty once its data chunks
+ * have been copied.
+ */
+void yaffs_summary_gc(struct yaffs_dev *dev, int blk)
+{
+	struct yaffs_block_info *bi = yaffs_get_block_info(dev, blk);
+	int i;
+
+	if (!bi->has_summary)
+		return;
+
+	for (i = dev->chunks_per_summary; i < dev->param.chunks_per_block; i++) {
+		if (yaffs_check_chunk_bit(dev, blk, i)) {
+			yaffs_clear_chunk_bit(dev, blk, i);
+			bi->pages_in_use--;
+			dev->n_free_chunks++;
+		}
+	}
+	bi->has_summary = 0;
+}
+
+/*
+ * yaffs_summary_read() loads the summary of a block into sum_tags, which
+ * must hold dev->chunks_per_summary entries. Returns YAFFS_OK if the block
+ * has a valid summary.
+ */
+int yaffs_summary_read(struct yaffs_dev *dev,
+		       struct yaffs_summary_tags *sum_tags, int blk)
+{
+	struct yaffs_block_info *bi = yaffs_get_block_info(dev, blk);
+	struct yaffs_summary_header hdr;
+	struct yaffs_ext_tags tags;
+	u8 *sum_buffer = (u8 *) sum_tags;
+	int n_bytes = yaffs_summary_bytes(dev);
+	int per_chunk = dev->data_bytes_per_chunk - YAFFS_SUMMARY_HDR_SIZE;
+	int chunk = blk * dev->param.chunks_per_block + dev->chunks_per_summary;
+	int chunk_id = 1;
+	int result = YAFFS_OK;
+	u32 sum, xor;
+	u8 *buffer;
+
+	if (!sum_tags || !dev->chunks_per_summary)
+		return YAFFS_FAIL;
+
+	buffer = yaffs_get_temp_buffer(dev, __LINE__);
+
+	while (result == YAFFS_OK && n_bytes > 0) {
+		int this_tx = min(n_bytes, per_chunk);
+
+		result = yaffs_rd_chunk_tags_nand(dev, chunk, buffer, &tags);
+		if (result != YAFFS_OK)
+			break;
+
+		memcpy(&hdr, buffer, YAFFS_SUMMARY_HDR_SIZE);
+		if (!tags.chunk_used ||
+		    tags.ecc_result == YAFFS_ECC_RESULT_UNFIXED ||
+		    tags.obj_id != YAFFS_OBJECTID_SUMMARY ||
+		    tags.chunk_id != chunk_id ||
+		    tags.seq_number != bi->seq_number ||
+		    tags.n_bytes != YAFFS_SUMMARY_HDR_SIZE + this_tx ||
+		    hdr.version != YAFFS_SUMMARY_VERSION ||
+		    hdr.block != blk || hdr.seq != bi->seq_number) {
+			result = YAFFS_FAIL;
+			break;
+		}
+
+		memcpy(sum_buffer, buffer + YAFFS_SUMMARY_HDR_SIZE, this_tx);
+		n_bytes -= this_tx;
+		sum_buffer += this_tx;
+		chunk++;
+		chunk_id++;
+	}
+
+	yaffs_release_temp_buffer(dev, buffer, __LINE__);
+
+	if (result == YAFFS_OK) {
+		yaffs_summary_csum(dev, sum_tags, &sum, &xor);
+		if (sum != hdr.sum || xor != hdr.xor)
+			result = YAFFS_FAIL;
+	}
+
+	if (result != YAFFS_OK)
+		yaffs_trace(YAFFS_TRACE_SCAN_DEBUG,
+			"no valid summary for block %d", blk);
+	return result;
+}
+
+/*
+ * yaffs_summary_fetch() gets the tags of a chunk from a summary loaded by
+ * yaffs_summary_read(), or from dev->sum_tags for the block being written.
+ * Chunks which were skipped when the block was written have no entry and
+ * must be read from the NAND.
+ */
+int yaffs_summary_fetch(struct yaffs_dev *dev,
+			struct yaffs_summary_tags *sum_tags,
+			struct yaffs_ext_tags *tags, int chunk_in_block)
+{
+	struct yaffs_packed_tags2_tags_only tags_only;
+	struct yaffs_summary_tags *entry;
+
+	if (chunk_in_block < 0 || chunk_in_block >= dev->chunks_per_summary)
+		return YAFFS_FAIL;
+
+	entry = &sum_tags[chunk_in_block];
+	if (!entry->obj_id)
+		return YAFFS_FAIL;
+
+	tags_only.obj_id = entry->obj_id;
+	tags_only.chunk_id = entry->chunk_id;
+	tags_only.n_bytes = entry->n_bytes;
+	tags_only.seq_number = 0;
+	yaffs_unpack_tags2_tags_only(tags, &tags_only);
+
+	return YAFFS_OK;
+}
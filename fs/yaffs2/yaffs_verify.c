@@ -259,7 +259,7 @@ void yaffs_verify_file(struct yaffs_obj *obj)
 	 * checking the tags for every chunk match.
 	 */
 
-	if (yaffs_skip_nand_verification(dev))
+	if (yaffs_skip_nand_verification(dev) || obj->tnodes_dropped)
 		return;
 
 	for (i = 1; i <= last_chunk; i++) {
@@ -1751,6 +1751,48 @@ static int yaffs_sync_fs(struct super_block *sb, int wait)
 static LIST_HEAD(yaffs_context_list);
 struct mutex yaffs_context_lock;
 
+/*
+ * Under memory pressure, free the tnode trees of files which have no inode.
+ * They are rebuilt from the NAND when the file is used again. Devices which
+ * are busy are skipped rather than waited for.
+ */
+static int yaffs_shrink_tnodes(struct shrinker *shrink,
+			       struct shrink_control *sc)
+{
+	struct list_head *item;
+	int n_wanted = sc->nr_to_scan;
+	int n_tnodes = 0;
+
+	if (n_wanted && !(sc->gfp_mask & __GFP_FS))
+		return -1;
+
+	if (!mutex_trylock(&yaffs_context_lock))
+		return -1;
+
+	list_for_each(item, &yaffs_context_list) {
+		struct yaffs_linux_context *lc =
+		    list_entry(item, struct yaffs_linux_context,
+			       context_list);
+		struct yaffs_dev *dev = lc->dev;
+
+		if (!mutex_trylock(&lc->gross_lock))
+			continue;
+		if (n_wanted > 0)
+			n_wanted -= yaffs_drop_tnodes(dev, n_wanted);
+		n_tnodes += yaffs_count_droppable_tnodes(dev);
+		mutex_unlock(&lc->gross_lock);
+	}
+
+	mutex_unlock(&yaffs_context_lock);
+
+	return n_tnodes;
+}
+
+static struct shrinker yaffs_tnode_shrinker = {
+	.shrink = yaffs_shrink_tnodes,
+	.seeks = DEFAULT_SEEKS * 4,	/* A reload reads up to 16 blocks */
+};
+
 
 
 struct yaffs_options {
@@ -1762,6 +1804,7 @@ struct yaffs_options {
 	int tags_ecc_overridden;
 	int lazy_loading_enabled;
 	int lazy_loading_overridden;
+	int summary_off;
 	int empty_lost_and_found;
 	int empty_lost_and_found_overridden;
 };
@@ -1805,6 +1848,10 @@ static int yaffs_parse_options(struct yaffs_options *options,
 		} else if (!strcmp(cur_opt, "lazy-loading-on")) {
 			options->lazy_loading_enabled = 1;
 			options->lazy_loading_overridden = 1;
+		} else if (!strcmp(cur_opt, "summary-off")) {
+			options->summary_off = 1;
+		} else if (!strcmp(cur_opt, "summary-on")) {
+			options->summary_off = 0;
 		} else if (!strcmp(cur_opt, "empty-lost-and-found-off")) {
 			options->empty_lost_and_found = 0;
 			options->empty_lost_and_found_overridden = 1;
@@ -2226,6 +2273,7 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 #endif
 	if (options.lazy_loading_overridden)
 		param->disable_lazy_load = !options.lazy_loading_enabled;
+	param->disable_summary = options.summary_off;
 
 #ifdef CONFIG_YAFFS_DISABLE_TAGS_ECC
 	param->no_tags_ecc = 1;
@@ -2297,6 +2345,8 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 	param->skip_checkpt_rd = options.skip_checkpoint_read;
 	param->skip_checkpt_wr = options.skip_checkpoint_write;
 
+	mutex_init(&(yaffs_dev_to_lc(dev)->gross_lock));
+
 	mutex_lock(&yaffs_context_lock);
 	/* Get a mount id */
 	found = 0;
@@ -2320,8 +2370,6 @@ static struct super_block *yaffs_internal_read_super(int yaffs_version,
 	INIT_LIST_HEAD(&(yaffs_dev_to_lc(dev)->search_contexts));
 	param->remove_obj_fn = yaffs_remove_obj_callback;
 
-	mutex_init(&(yaffs_dev_to_lc(dev)->gross_lock));
-
 	yaffs_gross_lock(dev);
 
 	err = yaffs_guts_initialise(dev);
@@ -2435,6 +2483,8 @@ static char *yaffs_dump_dev_part0(char *buf, struct yaffs_dev *dev)
 			param->empty_lost_n_found);
 	buf += sprintf(buf, "disable_lazy_load..... %d\n",
 			param->disable_lazy_load);
+	buf += sprintf(buf, "disable_summary....... %d\n",
+			param->disable_summary);
 	buf += sprintf(buf, "refresh_period........ %d\n",
 			param->refresh_period);
 	buf += sprintf(buf, "n_caches.............. %d\n", param->n_caches);
@@ -2459,6 +2509,8 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 	    sprintf(buf, "blocks_in_checkpt..... %d\n", dev->blocks_in_checkpt);
 	buf += sprintf(buf, "\n");
 	buf += sprintf(buf, "n_tnodes.............. %d\n", dev->n_tnodes);
+	buf +=
+	    sprintf(buf, "n_dropped_trees....... %d\n", dev->n_dropped_trees);
 	buf += sprintf(buf, "n_obj................. %d\n", dev->n_obj);
 	buf += sprintf(buf, "n_free_chunks......... %d\n", dev->n_free_chunks);
 	buf += sprintf(buf, "\n");
@@ -2486,6 +2538,10 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 	    sprintf(buf, "n_tags_ecc_unfixed.... %u\n",
 		    dev->n_tags_ecc_unfixed);
 	buf += sprintf(buf, "cache_hits............ %u\n", dev->cache_hits);
+	buf += sprintf(buf, "tags_used............. %u\n", dev->tags_used);
+	buf += sprintf(buf, "summary_used.......... %u\n", dev->summary_used);
+	buf += sprintf(buf, "n_tnode_drops......... %u\n", dev->n_tnode_drops);
+	buf += sprintf(buf, "n_tnode_loads......... %u\n", dev->n_tnode_loads);
 	buf +=
 	    sprintf(buf, "n_deleted_files....... %u\n", dev->n_deleted_files);
 	buf +=
@@ -2758,6 +2814,8 @@ static int __init init_yaffs_fs(void)
 			}
 			fsinst++;
 		}
+	} else {
+		register_shrinker(&yaffs_tnode_shrinker);
 	}
 
 	return error;
@@ -2771,6 +2829,8 @@ static void __exit exit_yaffs_fs(void)
 	yaffs_trace(YAFFS_TRACE_ALWAYS,
 		"yaffs built " __DATE__ " " __TIME__ " removing.");
 
+	unregister_shrinker(&yaffs_tnode_shrinker);
+
 	remove_proc_entry("yaffs", YPROC_ROOT);
 
 	fsinst = fs_to_install;
@@ -20,6 +20,7 @@
 #include "yaffs_getblockinfo.h"
 #include "yaffs_verify.h"
 #include "yaffs_attribs.h"
+#include "yaffs_summary.h"
 
 /*
  * Checkpoints are really no benefit on very small partitions.
@@ -228,7 +229,8 @@ int yaffs_calc_checkpt_blocks_required(struct yaffs_dev *dev)
 		n_bytes +=
 		    (sizeof(struct yaffs_checkpt_obj) +
 		     sizeof(u32)) * (dev->n_obj);
-		n_bytes += (dev->tnode_size + sizeof(u32)) * (dev->n_tnodes);
+		n_bytes += (dev->tnode_size + sizeof(u32)) *
+		    (dev->n_tnodes + dev->n_dropped_tnodes);
 		n_bytes += sizeof(struct yaffs_checkpt_validity);
 		n_bytes += sizeof(u32);	/* checksum */
 
@@ -539,6 +541,8 @@ static int yaffs2_rd_checkpt_tnodes(struct yaffs_obj *obj)
 			ok = yaffs_add_find_tnode_0(dev,
 						    file_stuct_ptr,
 						    base_chunk, tn) ? 1 : 0;
+		else if (tn)
+			yaffs_free_tnode(dev, tn);
 
 		if (ok)
 			ok = (yaffs2_checkpt_rd
@@ -702,6 +706,10 @@ static int yaffs2_wr_checkpt_data(struct yaffs_dev *dev)
 		ok = 0;
 	}
 
+	/* Dropped tnode trees are written out like the others */
+	if (ok && yaffs_load_all_tnodes(dev) != YAFFS_OK)
+		ok = 0;
+
 	if (ok)
 		ok = yaffs2_checkpt_open(dev, 1);
 
@@ -983,6 +991,7 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 	int found_chunks;
 	int equiv_id;
 	int alloc_failed = 0;
+	int summary_available;
 
 	struct yaffs_block_index *block_index = NULL;
 	int alt_block_index = 0;
@@ -1010,6 +1019,8 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 	}
 
 	dev->blocks_in_checkpt = 0;
+	dev->tags_used = 0;
+	dev->summary_used = 0;
 
 	chunk_data = yaffs_get_temp_buffer(dev, __LINE__);
 
@@ -1102,6 +1113,12 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 		deleted = 0;
 
+		summary_available = 0;
+		if (state == YAFFS_BLOCK_STATE_NEEDS_SCANNING)
+			summary_available =
+			    (yaffs_summary_read(dev, dev->sum_tags, blk) ==
+			     YAFFS_OK);
+
 		/* For each chunk in each block that needs scanning.... */
 		found_chunks = 0;
 		for (c = dev->param.chunks_per_block - 1;
@@ -1114,8 +1131,26 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 			chunk = blk * dev->param.chunks_per_block + c;
 
-			result = yaffs_rd_chunk_tags_nand(dev, chunk, NULL,
-							  &tags);
+			if (summary_available &&
+			    c >= dev->chunks_per_summary) {
+				/* The summary itself, in use until collected */
+				found_chunks = 1;
+				yaffs_set_chunk_bit(dev, blk, c);
+				bi->pages_in_use++;
+				bi->has_summary = 1;
+				continue;
+			}
+
+			if (summary_available &&
+			    yaffs_summary_fetch(dev, dev->sum_tags, &tags, c) ==
+			    YAFFS_OK) {
+				tags.seq_number = bi->seq_number;
+				dev->summary_used++;
+			} else {
+				result = yaffs_rd_chunk_tags_nand(dev, chunk,
+								  NULL, &tags);
+				dev->tags_used++;
+			}
 
 			/* Let's have a good look at this chunk... */
 
@@ -1575,6 +1610,9 @@ int yaffs2_scan_backwards(struct yaffs_dev *dev)
 
 	yaffs_skip_rest_of_block(dev);
 
+	/* dev->sum_tags was borrowed for reading the summaries */
+	yaffs_summary_clear(dev);
+
 	if (alt_block_index)
 		vfree(block_index);
 	else
@@ -0,0 +1,27 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ *  LZ4 Public Kernel Interface
+ *
+ *  Only the decoder is provided; LZ4 data for the kernel image and the
+ *  initramfs is produced at build time by the host lz4 tool.  The block
+ *  format is described at https://github.com/lz4/lz4 (lz4_Block_format).
+ */
+
+/* worst case expansion of an incompressible block of size x */
+#define lz4_compressbound(x)	((x) + ((x) / 255) + 16)
+
+/* safe decompression with overrun testing */
+int lz4_decompress_safe(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len);
+
+/*
+ * Return values (< 0 = Error)
+ */
+#define LZ4_E_OK			0
+#define LZ4_E_ERROR			(-1)
+#define LZ4_E_INPUT_OVERRUN		(-4)
+#define LZ4_E_OUTPUT_OVERRUN		(-5)
+#define LZ4_E_LOOKBEHIND_OVERRUN	(-6)
+
+#endif
@@ -88,6 +88,11 @@ struct sdhci_host {
 /* The read-only detection via SDHCI_PRESENT_STATE register is unstable */
 #define SDHCI_QUIRK_UNSTABLE_RO_DETECT			(1<<31)
 
+	unsigned int quirks2;	/* More deviations from spec. */
+
+/* SDMA can walk a scatterlist by restarting at 4K buffer boundaries */
+#define SDHCI_QUIRK2_SDMA_SG				(1<<0)
+
 	int irq;		/* Device IRQ */
 	void __iomem *ioaddr;	/* Mapped address */
 
@@ -115,6 +120,7 @@ struct sdhci_host {
 #define SDHCI_NEEDS_RETUNING	(1<<5)	/* Host needs retuning */
 #define SDHCI_AUTO_CMD12	(1<<6)	/* Auto CMD12 support */
 #define SDHCI_AUTO_CMD23	(1<<7)	/* Auto CMD23 support */
+#define SDHCI_USE_SDMA_SG	(1<<8)	/* SDMA chained across sg entries */
 
 	unsigned int version;	/* SDHCI spec. version */
 
@@ -135,6 +141,11 @@ struct sdhci_host {
 
 	int sg_count;		/* Mapped sg entries */
 
+	struct scatterlist *sdma_sg;	/* SDMA: current sg entry */
+	int sdma_left;		/* SDMA: sg entries left, incl. current */
+	u32 sdma_addr;		/* SDMA: address the engine restarted at */
+	u32 sdma_boundary;	/* SDMA: buffer boundary of the request */
+
 	u8 *adma_desc;		/* ADMA descriptor table */
 	u8 *align_buffer;	/* Bounce buffer */
 
@@ -63,6 +63,9 @@ struct onenand_bufferram {
  * @unlock_all:		[REPLACEABLE] hardware specific function for unlock all
  * @read_bufferram:	[REPLACEABLE] hardware specific function for BufferRAM Area
  * @write_bufferram:	[REPLACEABLE] hardware specific function for BufferRAM Area
+ * @read_ahead:		[OPTIONAL] hardware specific function to load the
+ *			following pages of a sequential read while the
+ *			current one is transferred
  * @read_word:		[REPLACEABLE] hardware specific function for read
  *			register of OneNAND
  * @write_word:		[REPLACEABLE] hardware specific function for write
@@ -112,6 +115,7 @@ struct onenand_chip {
 			unsigned char *buffer, int offset, size_t count);
 	int (*write_bufferram)(struct mtd_info *mtd, int area,
 			const unsigned char *buffer, int offset, size_t count);
+	int (*read_ahead)(struct mtd_info *mtd, loff_t from, size_t len);
 	unsigned short (*read_word)(void __iomem *addr);
 	void (*write_word)(unsigned short value, void __iomem *addr);
 	void (*mmcontrol)(struct mtd_info *mtd, int sync_read);
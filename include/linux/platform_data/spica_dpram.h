@@ -16,6 +16,29 @@
 #ifndef _PLATFORM_DATA_SPICA_DPRAM_H
 #define _PLATFORM_DATA_SPICA_DPRAM_H
 
+#include <linux/interrupt.h>
+
+/**
+ * struct dpram_sim_link - connection to a simulated modem
+ * @base: OneDRAM contents, backed by ordinary memory
+ * @active: state of the PHONE_ACTIVE line
+ * @power: starts (@on != 0) or stops the modem
+ * @mailbox_write: called after each write to the AP->CP mailbox
+ * @mailbox_irq: CP->AP mailbox interrupt handler, set by the driver
+ * @irq_data: argument of @mailbox_irq, set by the driver
+ *
+ * Used by the modem simulator (drivers/misc/spica_dpram_sim.c) in place
+ * of the memory resource, GPIOs and interrupt lines of the real modem.
+ */
+struct dpram_sim_link {
+	void		*base;
+	int		active;
+	void		(*power)(struct dpram_sim_link *link, int on);
+	void		(*mailbox_write)(struct dpram_sim_link *link, u32 cmd);
+	irq_handler_t	mailbox_irq;
+	void		*irq_data;
+};
+
 struct dpram_platform_data {
 	unsigned int gpio_phone_on;
 	unsigned int gpio_phone_rst_n;
@@ -25,6 +48,8 @@ struct dpram_platform_data {
 	unsigned int gpio_pda_active;
 	unsigned int gpio_onedram_int_n;
 	unsigned int gpio_sim_detect_n;
+	/* simulated modem, NULL on real hardware */
+	struct dpram_sim_link *sim;
 };
 
 #endif /* _PLATFORM_DATA_SPICA_DPRAM_H */
@@ -0,0 +1,92 @@
+/* linux/s3c_fb.h
+ *
+ * Samsung SoC Framebuffer driver - overlay window interface
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef _S3C_FB_H_
+#define _S3C_FB_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * S3CFB_SET_OVERLAY
+ * Attach a buffer to one of the hardware windows which are not used by
+ * a framebuffer device, or update/disable it. All the window registers
+ * are latched together at the next VSYNC, so a new buffer, position and
+ * alpha value always appear on the same frame.
+ * Argument:	a pointer to struct s3c_fb_overlay
+ * Returns:	  0 on success,
+ *		< 0, on error
+ */
+#define S3CFB_SET_OVERLAY	_IOW('F', 0x80, struct s3c_fb_overlay)
+
+/* Flags for struct s3c_fb_overlay flags field */
+#define S3CFB_OVERLAY_ENABLE	(1 << 0)	/* show the window */
+#define S3CFB_OVERLAY_WAIT_VSYNC (1 << 1)	/* return after the update
+						   has been latched */
+
+/* Supported formats for struct s3c_fb_overlay format field */
+enum {
+	S3CFB_FMT_RGB565 = 0,
+	S3CFB_FMT_XRGB8888,
+	S3CFB_FMT_ARGB8888,	/* per-pixel alpha blending */
+};
+
+/* Maximum value of struct s3c_fb_overlay alpha field */
+#define S3CFB_ALPHA_MAX		255
+
+/**
+ * struct s3c_fb_overlay - overlay window configuration
+ * @win: hardware window number (1 .. number of windows - 1)
+ * @flags: S3CFB_OVERLAY_* flags
+ * @fd: file descriptor of the PMEM region holding the buffer
+ * @offset: offset of the first pixel in the PMEM region
+ * @format: pixel format, one of S3CFB_FMT_*
+ * @width: width of the displayed area in pixels
+ * @height: height of the displayed area in lines
+ * @stride: length of a buffer line in bytes
+ * @x: horizontal position of the window on the screen
+ * @y: vertical position of the window on the screen
+ * @alpha: plane alpha, 0 (transparent) to S3CFB_ALPHA_MAX (opaque)
+ */
+struct s3c_fb_overlay {
+	__u32	win;
+	__u32	flags;
+	__s32	fd;
+	__u32	offset;
+	__u32	format;
+	__u32	width;
+	__u32	height;
+	__u32	stride;
+	__s32	x;
+	__s32	y;
+	__u32	alpha;
+};
+
+#ifdef __KERNEL__
+
+/*
+ * In-kernel interface, for drivers producing frames directly in display
+ * format (e.g. the camera interface). The configuration is the same as
+ * for the ioctl, except that @fd and @offset are ignored and the buffer
+ * is given by its bus address. The callback passed with each flipped
+ * buffer runs in interrupt context once the buffer is no longer scanned
+ * out.
+ */
+typedef void (*s3c_fb_flip_done_t)(void *priv);
+
+extern int s3c_fb_overlay_setup(const struct s3c_fb_overlay *ovl,
+				dma_addr_t addr, s3c_fb_flip_done_t done,
+				void *priv);
+extern int s3c_fb_overlay_flip(unsigned int win, dma_addr_t addr,
+			       s3c_fb_flip_done_t done, void *priv);
+extern int s3c_fb_overlay_disable(unsigned int win);
+
+#endif /* __KERNEL__ */
+
+#endif /* _S3C_FB_H_ */
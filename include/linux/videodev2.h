@@ -1758,6 +1758,13 @@ enum v4l2_jpeg_chroma_subsampling {
 #define	V4L2_JPEG_ACTIVE_MARKER_DQT		(1 << 17)
 #define	V4L2_JPEG_ACTIVE_MARKER_DHT		(1 << 18)
 
+/*  JPEG-class control IDs specific to the Samsung S3C JPEG driver */
+#define V4L2_CID_JPEG_S3C_BASE			(V4L2_CTRL_CLASS_JPEG | 0x1000)
+#define V4L2_CID_JPEG_S3C_CAMERA_SOURCE		(V4L2_CID_JPEG_S3C_BASE + 0)
+#define V4L2_CID_JPEG_S3C_THUMBNAIL_WIDTH	(V4L2_CID_JPEG_S3C_BASE + 1)
+#define V4L2_CID_JPEG_S3C_THUMBNAIL_HEIGHT	(V4L2_CID_JPEG_S3C_BASE + 2)
+#define V4L2_CID_JPEG_S3C_DECODE_THUMBNAIL	(V4L2_CID_JPEG_S3C_BASE + 3)
+
 /*
  *	T U N I N G
  */
@@ -45,10 +45,13 @@ struct s3c_fimc_isp_info {
  *
  * @isp_info: properties of camera sensor required for host interface setup
  * @num_clients: the number of attached image sensors
+ * @overlay_win: s3c-fb window the capture output can be scanned out from
+ *		 directly, 0 if none
  */
 struct s3c_platform_fimc {
 	struct s3c_fimc_isp_info *isp_info;
 	int num_clients;
+	unsigned int overlay_win;
 };
 
 /*
@@ -0,0 +1,49 @@
+/*
+ * Samsung S3C JPEG codec driver - in-kernel encoder interface
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef S3C_JPEG_H_
+#define S3C_JPEG_H_
+
+#include <linux/list.h>
+#include <linux/time.h>
+#include <linux/types.h>
+
+/**
+ * struct s3c_jpeg_frame - raw frame handed to the encoder by another driver
+ * @list: entry in the encoder queue, private to the JPEG driver
+ * @addr: bus address of the frame
+ * @vaddr: kernel virtual address of the frame, used by the software encoder
+ * @fourcc: V4L2_PIX_FMT_YUYV or V4L2_PIX_FMT_RGB565
+ * @width: frame width in pixels, lines are not padded
+ * @height: frame height in lines
+ * @timestamp: timestamp copied to the JPEG buffer
+ * @sequence: sequence number copied to the JPEG buffer
+ * @done: called, in interrupt or process context, once the encoder has
+ *	  finished with the frame or dropped it
+ *
+ * The frame is encoded into the next buffer of the capture queue of the
+ * encoder context which has V4L2_CID_JPEG_S3C_CAMERA_SOURCE enabled, so
+ * the JPEG images are dequeued by userspace as with memory-to-memory
+ * encoding, while the raw frames never leave the kernel.
+ */
+struct s3c_jpeg_frame {
+	struct list_head	list;
+	dma_addr_t		addr;
+	void			*vaddr;
+	u32			fourcc;
+	u32			width;
+	u32			height;
+	struct timeval		timestamp;
+	u32			sequence;
+	void			(*done)(struct s3c_jpeg_frame *frame);
+};
+
+extern int s3c_jpeg_encode_frame(struct s3c_jpeg_frame *frame);
+extern void s3c_jpeg_flush_frames(void);
+
+#endif /* S3C_JPEG_H_ */
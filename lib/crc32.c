@@ -26,15 +26,16 @@
 #include <linux/compiler.h>
 #include <linux/types.h>
 #include <linux/init.h>
+#include <linux/cache.h>
 #include <asm/atomic.h>
 #include "crc32defs.h"
-#if CRC_LE_BITS == 8
+#if CRC_LE_BITS > 4
 # define tole(x) __constant_cpu_to_le32(x)
 #else
 # define tole(x) (x)
 #endif
 
-#if CRC_BE_BITS == 8
+#if CRC_BE_BITS > 4
 # define tobe(x) __constant_cpu_to_be32(x)
 #else
 # define tobe(x) (x)
@@ -45,26 +46,54 @@ MODULE_AUTHOR("Matt Domsch <Matt_Domsch@dell.com>");
 MODULE_DESCRIPTION("Ethernet CRC32 calculations");
 MODULE_LICENSE("GPL");
 
-#if CRC_LE_BITS == 8 || CRC_BE_BITS == 8
+#if CRC_LE_BITS > 4 || CRC_BE_BITS > 4
 
-static inline u32
-crc32_body(u32 crc, unsigned char const *buf, size_t len, const u32 (*tab)[256])
+/*
+ * Table-driven CRC over a buffer, @bits at a time (8, 32 or 64, a
+ * compile-time constant at every call site).  Row j of @tab is the crc
+ * of a byte followed by j zero bytes, so in slice-by-N every byte of an
+ * N-byte step is looked up in the row for its distance from the end of
+ * the step and the results are simply xored together.  The tables are
+ * stored in CPU byte order for the CRC's bit order (tole/tobe), which
+ * lets the same loop serve crc32_le and crc32_be.
+ */
+static __always_inline u32
+crc32_body(u32 crc, unsigned char const *buf, size_t len,
+	   const u32 (*tab)[256], const unsigned int bits)
 {
 # ifdef __LITTLE_ENDIAN
-#  define DO_CRC(x) crc = tab[0][(crc ^ (x)) & 255] ^ (crc >> 8)
-#  define DO_CRC4 crc = tab[3][(crc) & 255] ^ \
-		tab[2][(crc >> 8) & 255] ^ \
-		tab[1][(crc >> 16) & 255] ^ \
-		tab[0][(crc >> 24) & 255]
+#  define DO_CRC(x) crc = t0[(crc ^ (x)) & 255] ^ (crc >> 8)
+#  define DO_CRC4 (t3[(q) & 255] ^ t2[(q >> 8) & 255] ^ \
+		   t1[(q >> 16) & 255] ^ t0[(q >> 24) & 255])
+#  define DO_CRC8 (t7[(q) & 255] ^ t6[(q >> 8) & 255] ^ \
+		   t5[(q >> 16) & 255] ^ t4[(q >> 24) & 255])
 # else
-#  define DO_CRC(x) crc = tab[0][((crc >> 24) ^ (x)) & 255] ^ (crc << 8)
-#  define DO_CRC4 crc = tab[0][(crc) & 255] ^ \
-		tab[1][(crc >> 8) & 255] ^ \
-		tab[2][(crc >> 16) & 255] ^ \
-		tab[3][(crc >> 24) & 255]
+#  define DO_CRC(x) crc = t0[((crc >> 24) ^ (x)) & 255] ^ (crc << 8)
+#  define DO_CRC4 (t0[(q) & 255] ^ t1[(q >> 8) & 255] ^ \
+		   t2[(q >> 16) & 255] ^ t3[(q >> 24) & 255])
+#  define DO_CRC8 (t4[(q) & 255] ^ t5[(q >> 8) & 255] ^ \
+		   t6[(q >> 16) & 255] ^ t7[(q >> 24) & 255])
 # endif
 	const u32 *b;
 	size_t    rem_len;
+	const u32 *t0 = tab[0], *t1, *t2, *t3, *t4, *t5, *t6, *t7;
+	u32 q;
+
+	if (bits == 8) {
+		while (len--)
+			DO_CRC(*buf++);
+		return crc;
+	}
+
+	t1 = tab[1];
+	t2 = tab[2];
+	t3 = tab[3];
+	if (bits == 64) {
+		t4 = tab[4];
+		t5 = tab[5];
+		t6 = tab[6];
+		t7 = tab[7];
+	}
 
 	/* Align it */
 	if (unlikely((long)buf & 3 && len)) {
@@ -72,13 +101,25 @@ crc32_body(u32 crc, unsigned char const *buf, size_t len, const u32 (*tab)[256])
 			DO_CRC(*buf++);
 		} while ((--len) && ((long)buf)&3);
 	}
-	rem_len = len & 3;
+
 	/* load data 32 bits wide, xor data 32 bits wide. */
-	len = len >> 2;
+	if (bits == 64) {
+		rem_len = len & 7;
+		len = len >> 3;
+	} else {
+		rem_len = len & 3;
+		len = len >> 2;
+	}
 	b = (const u32 *)buf;
 	for (--b; len; --len) {
-		crc ^= *++b; /* use pre increment for speed */
-		DO_CRC4;
+		q = crc ^ *++b; /* use pre increment for speed */
+		if (bits == 64) {
+			crc = DO_CRC8;
+			q = *++b;
+			crc ^= DO_CRC4;
+		} else {
+			crc = DO_CRC4;
+		}
 	}
 	len = rem_len;
 	/* And the last few bytes */
@@ -91,6 +132,7 @@ crc32_body(u32 crc, unsigned char const *buf, size_t len, const u32 (*tab)[256])
 	return crc;
 #undef DO_CRC
 #undef DO_CRC4
+#undef DO_CRC8
 }
 #endif
 /**
@@ -122,26 +164,24 @@ u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
 
 u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
 {
-# if CRC_LE_BITS == 8
-	const u32      (*tab)[] = crc32table_le;
-
+# if CRC_LE_BITS > 4
 	crc = __cpu_to_le32(crc);
-	crc = crc32_body(crc, p, len, tab);
+	crc = crc32_body(crc, p, len, crc32table_le, CRC_LE_BITS);
 	return __le32_to_cpu(crc);
 # elif CRC_LE_BITS == 4
 	while (len--) {
 		crc ^= *p++;
-		crc = (crc >> 4) ^ crc32table_le[crc & 15];
-		crc = (crc >> 4) ^ crc32table_le[crc & 15];
+		crc = (crc >> 4) ^ crc32table_le[0][crc & 15];
+		crc = (crc >> 4) ^ crc32table_le[0][crc & 15];
 	}
 	return crc;
 # elif CRC_LE_BITS == 2
 	while (len--) {
 		crc ^= *p++;
-		crc = (crc >> 2) ^ crc32table_le[crc & 3];
-		crc = (crc >> 2) ^ crc32table_le[crc & 3];
-		crc = (crc >> 2) ^ crc32table_le[crc & 3];
-		crc = (crc >> 2) ^ crc32table_le[crc & 3];
+		crc = (crc >> 2) ^ crc32table_le[0][crc & 3];
+		crc = (crc >> 2) ^ crc32table_le[0][crc & 3];
+		crc = (crc >> 2) ^ crc32table_le[0][crc & 3];
+		crc = (crc >> 2) ^ crc32table_le[0][crc & 3];
 	}
 	return crc;
 # endif
@@ -179,26 +219,24 @@ u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len)
 #else				/* Table-based approach */
 u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len)
 {
-# if CRC_BE_BITS == 8
-	const u32      (*tab)[] = crc32table_be;
-
+# if CRC_BE_BITS > 4
 	crc = __cpu_to_be32(crc);
-	crc = crc32_body(crc, p, len, tab);
+	crc = crc32_body(crc, p, len, crc32table_be, CRC_BE_BITS);
 	return __be32_to_cpu(crc);
 # elif CRC_BE_BITS == 4
 	while (len--) {
 		crc ^= *p++ << 24;
-		crc = (crc << 4) ^ crc32table_be[crc >> 28];
-		crc = (crc << 4) ^ crc32table_be[crc >> 28];
+		crc = (crc << 4) ^ crc32table_be[0][crc >> 28];
+		crc = (crc << 4) ^ crc32table_be[0][crc >> 28];
 	}
 	return crc;
 # elif CRC_BE_BITS == 2
 	while (len--) {
 		crc ^= *p++ << 24;
-		crc = (crc << 2) ^ crc32table_be[crc >> 30];
-		crc = (crc << 2) ^ crc32table_be[crc >> 30];
-		crc = (crc << 2) ^ crc32table_be[crc >> 30];
-		crc = (crc << 2) ^ crc32table_be[crc >> 30];
+		crc = (crc << 2) ^ crc32table_be[0][crc >> 30];
+		crc = (crc << 2) ^ crc32table_be[0][crc >> 30];
+		crc = (crc << 2) ^ crc32table_be[0][crc >> 30];
+		crc = (crc << 2) ^ crc32table_be[0][crc >> 30];
 	}
 	return crc;
 # endif
@@ -208,6 +246,190 @@ u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len)
 EXPORT_SYMBOL(crc32_le);
 EXPORT_SYMBOL(crc32_be);
 
+#ifdef CONFIG_CRC32_SELFTEST
+
+#include <linux/slab.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <asm/unaligned.h>
+
+#define CRC32_TEST_LEN		4096
+#define CRC32_TEST_SLACK	8
+#define CRC32_BENCH_LOOPS	256
+
+/*
+ * Reference crcs: one table lookup per byte, with tables computed here
+ * bit by bit from the polynomial rather than taken from crc32table.h.
+ */
+static u32 crc32_ref_le[256] __initdata;
+static u32 crc32_ref_be[256] __initdata;
+
+static void __init crc32_ref_init(void)
+{
+	u32 le, be;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		le = i;
+		be = i << 24;
+		for (j = 0; j < 8; j++) {
+			le = (le >> 1) ^ ((le & 1) ? CRCPOLY_LE : 0);
+			be = (be << 1) ^ ((be & 0x80000000) ? CRCPOLY_BE : 0);
+		}
+		crc32_ref_le[i] = le;
+		crc32_ref_be[i] = be;
+	}
+}
+
+static u32 __init crc32_le_ref(u32 crc, unsigned char const *p, size_t len)
+{
+	while (len--)
+		crc = crc32_ref_le[(crc ^ *p++) & 255] ^ (crc >> 8);
+	return crc;
+}
+
+static u32 __init crc32_be_ref(u32 crc, unsigned char const *p, size_t len)
+{
+	while (len--)
+		crc = crc32_ref_be[((crc >> 24) ^ *p++) & 255] ^ (crc << 8);
+	return crc;
+}
+
+/*
+ * Seeds cycle through 0 and ~0, the two conventional initial values,
+ * and arbitrary values standing in for a crc carried over from an
+ * earlier buffer.
+ */
+static u32 __init crc32_test_seed(unsigned int i, u32 *rnd)
+{
+	switch (i % 4) {
+	case 0:
+		return 0;
+	case 1:
+		return ~0;
+	default:
+		*rnd = *rnd * 1664525 + 1013904223;
+		return *rnd;
+	}
+}
+
+static int __init crc32_check(u32 seed, const u8 *p, size_t len,
+			      u32 le_ref, u32 be_ref)
+{
+	u32 le = crc32_le(seed, p, len), be = crc32_be(seed, p, len);
+
+	if (le != le_ref || be != be_ref) {
+		pr_err("crc32: self test failed: len %zu, offset %lu, seed %08x: le %08x/%08x be %08x/%08x\n",
+		       len, (unsigned long)p & 7, seed, le, le_ref, be,
+		       be_ref);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int __init crc32_selftest(void)
+{
+	static const u8 check[] __initconst = "123456789";
+	const size_t buf_len = CRC32_TEST_LEN + CRC32_TEST_SLACK;
+	u8 *buf, *ref;
+	u32 rnd = 0x12345678, seed;
+	unsigned int off, i;
+	size_t len;
+	ktime_t start;
+	s64 ns;
+	u64 bytes;
+	int ret = -EINVAL;
+
+	/* the standard check values of CRC-32 and CRC-32/BZIP2 */
+	if ((crc32_le(~0, check, 9) ^ ~0) != 0xcbf43926 ||
+	    (crc32_be(~0, check, 9) ^ ~0) != 0xfc891918) {
+		pr_err("crc32: self test failed: wrong check value\n");
+		return -EINVAL;
+	}
+
+	crc32_ref_init();
+
+	buf = kmalloc(buf_len, GFP_KERNEL);
+	ref = kmalloc(buf_len, GFP_KERNEL);
+	if (!buf || !ref) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < buf_len; i++) {
+		rnd = rnd * 1664525 + 1013904223;
+		buf[i] = rnd >> 24;
+	}
+
+	/*
+	 * Every length from 0 to CRC32_TEST_LEN, each at all eight start
+	 * alignments.  The reference crcs are computed once per length.
+	 */
+	for (len = 0; len <= CRC32_TEST_LEN; len++) {
+		u32 le_ref, be_ref;
+
+		seed = crc32_test_seed(len, &rnd);
+		le_ref = crc32_le_ref(seed, buf, len);
+		be_ref = crc32_be_ref(seed, buf, len);
+		for (off = 0; off < 8; off++) {
+			memcpy(ref + off, buf, len);
+			ret = crc32_check(seed, ref + off, len, le_ref, be_ref);
+			if (ret)
+				goto out;
+		}
+	}
+
+	/* a crc over a buffer followed by that crc comes out as zero */
+	for (i = 0; i < 64; i++) {
+		u32 crc;
+
+		len = i * (CRC32_TEST_LEN / 64 - 1);
+		off = i & 3;
+		seed = crc32_test_seed(i, &rnd);
+		memcpy(ref + off, buf, len);
+		crc = crc32_le(seed, ref + off, len);
+		put_unaligned_le32(crc, ref + off + len);
+		if (crc32_le(seed, ref + off, len + 4)) {
+			pr_err("crc32: self test failed: le cancellation, len %zu\n",
+			       len);
+			ret = -EINVAL;
+			goto out;
+		}
+		crc = crc32_be(seed, ref + off, len);
+		put_unaligned_be32(crc, ref + off + len);
+		if (crc32_be(seed, ref + off, len + 4)) {
+			pr_err("crc32: self test failed: be cancellation, len %zu\n",
+			       len);
+			ret = -EINVAL;
+			goto out;
+		}
+	}
+
+	start = ktime_get();
+	for (i = 0; i < CRC32_BENCH_LOOPS; i++)
+		seed = crc32_le(seed, buf, CRC32_TEST_LEN);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	bytes = (u64)CRC32_BENCH_LOOPS * CRC32_TEST_LEN;
+
+	/* printing the chained result keeps the __pure calls alive */
+	pr_info("crc32: self tests passed, crc32_le (%d bits): %llu bytes in %lld ns, %llu MB/s (%08x)\n",
+		CRC_LE_BITS, bytes, ns,
+		ns > 0 ? div64_u64(bytes * 1000, ns) : 0, seed);
+	ret = 0;
+out:
+	kfree(ref);
+	kfree(buf);
+	return ret;
+}
+
+static int __init crc32_init(void)
+{
+	crc32_selftest();
+	return 0;
+}
+module_init(crc32_init);
+
+#endif /* CONFIG_CRC32_SELFTEST */
+
 /*
  * A brief CRC tutorial.
  *
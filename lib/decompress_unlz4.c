@@ -0,0 +1,157 @@
+/*
+ * LZ4 decompressor for the Linux kernel.
+ *
+ * Handles the "legacy" LZ4 frame written by "lz4 -l": a little-endian
+ * magic number followed by blocks, each preceded by its little-endian
+ * compressed size and each decompressing to 8 MiB except the last.
+ * The legacy frame has no end marker: input stops at a zero block size,
+ * or when too few bytes remain to hold a block (the zImage appends the
+ * 4-byte uncompressed size after the stream).
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifdef STATIC
+#include "lz4/lz4_decompress.c"
+#else
+#include <linux/decompress/unlz4.h>
+#endif
+
+#include <linux/types.h>
+#include <linux/lz4.h>
+#include <linux/decompress/mm.h>
+
+#include <linux/compiler.h>
+#include <asm/unaligned.h>
+
+#define LZ4_LEGACY_MAGIC	0x184c2102
+#define LZ4_LEGACY_BLOCK_SIZE	(8 << 20)
+
+STATIC inline int INIT unlz4(u8 *input, int in_len,
+				int (*fill) (void *, unsigned int),
+				int (*flush) (void *, unsigned int),
+				u8 *output, int *posp,
+				void (*error) (char *x))
+{
+	const size_t in_max = lz4_compressbound(LZ4_LEGACY_BLOCK_SIZE);
+	u8 *in_buf, *out_buf;
+	u32 src_len;
+	size_t dst_len;
+	int skip;
+	int ret = -1;
+
+	if (output) {
+		out_buf = output;
+	} else if (!flush) {
+		error("NULL output pointer and no flush function provided");
+		goto exit;
+	} else {
+		out_buf = large_malloc(LZ4_LEGACY_BLOCK_SIZE);
+		if (!out_buf) {
+			error("Could not allocate output buffer");
+			goto exit;
+		}
+	}
+
+	if (input && fill) {
+		error("Both input pointer and fill function provided, don't know what to do");
+		goto exit_1;
+	} else if (input) {
+		in_buf = input;
+	} else if (!fill) {
+		error("NULL input pointer and missing fill function");
+		goto exit_1;
+	} else {
+		in_buf = large_malloc(in_max);
+		if (!in_buf) {
+			error("Could not allocate input buffer");
+			goto exit_1;
+		}
+		in_len = fill(in_buf, 4);
+	}
+
+	if (posp)
+		*posp = 0;
+
+	if (in_len < 4 || get_unaligned_le32(in_buf) != LZ4_LEGACY_MAGIC) {
+		error("invalid header");
+		goto exit_2;
+	}
+	if (!fill)
+		in_buf += 4;
+	in_len -= 4;
+	if (posp)
+		*posp = 4;
+
+	for (;;) {
+		/* read compressed block size */
+		if (fill) {
+			in_len = fill(in_buf, 4);
+			if (in_len < 4)
+				break;
+		} else if (in_len <= 4) {
+			break;
+		}
+		src_len = get_unaligned_le32(in_buf);
+
+		/* concatenated streams each start with the magic again */
+		if (src_len == LZ4_LEGACY_MAGIC) {
+			if (!fill)
+				in_buf += 4;
+			in_len -= 4;
+			if (posp)
+				*posp += 4;
+			continue;
+		}
+		if (src_len == 0)
+			break;
+		if (src_len > in_max) {
+			error("block size exceeds the worst case expansion");
+			goto exit_2;
+		}
+		if (!fill)
+			in_buf += 4;
+		in_len -= 4;
+
+		if (fill) {
+			skip = fill(in_buf, src_len);
+			in_len = skip > 0 ? skip : 0;
+		}
+		if (in_len < src_len) {
+			error("file corrupted");
+			goto exit_2;
+		}
+
+		dst_len = LZ4_LEGACY_BLOCK_SIZE;
+		if (lz4_decompress_safe(in_buf, src_len, out_buf,
+					&dst_len) != LZ4_E_OK) {
+			error("Compressed data violation");
+			goto exit_2;
+		}
+
+		if (flush && flush(out_buf, dst_len) != dst_len)
+			goto exit_2;
+		if (output)
+			out_buf += dst_len;
+		if (posp)
+			*posp += src_len + 4;
+
+		if (!fill)
+			in_buf += src_len;
+		in_len -= src_len;
+	}
+
+	ret = 0;
+exit_2:
+	if (!input)
+		large_free(in_buf);
+exit_1:
+	if (!output)
+		large_free(out_buf);
+exit:
+	return ret;
+}
+
+#define decompress unlz4
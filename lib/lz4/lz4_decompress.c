@@ -0,0 +1,164 @@
+/*
+ *  LZ4 block decompressor
+ *
+ *  A bounds-checked decoder for the LZ4 block format, written for the
+ *  kernel and for the pre-boot decompressors.  Every sequence is a token
+ *  byte holding a 4-bit literal count and a 4-bit match length, optional
+ *  length extension bytes, the literals, and a little-endian 16-bit match
+ *  offset.  The last sequence of a block carries literals only.
+ *
+ *  Copies are done a word at a time only when source and destination
+ *  share the same alignment, so no unaligned word access is ever issued.
+ *  The ARMv6 zImage decompressor leaves the U bit as the boot loader set
+ *  it, so an unaligned LDR there may trap or silently rotate the data.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#ifndef STATIC
+#include <linux/module.h>
+#include <linux/kernel.h>
+#endif
+
+#include <linux/types.h>
+#include <linux/compiler.h>
+#include <asm/unaligned.h>
+#include <linux/lz4.h>
+
+#define LZ4_MIN_MATCH		4
+#define LZ4_ML_BITS		4
+#define LZ4_ML_MASK		((1U << LZ4_ML_BITS) - 1)
+#define LZ4_RUN_MASK		((1U << (8 - LZ4_ML_BITS)) - 1)
+
+/* shortest copy worth aligning the pointers for a word loop */
+#define LZ4_WORD_COPY_MIN	8
+
+/*
+ * Copy @len bytes in ascending order.  For match copies @dst may overlap
+ * @src; callers only get here when the distance is at least a word, so
+ * each word read has been fully written by an earlier iteration.
+ */
+static inline void lz4_copy(u8 *dst, const u8 *src, size_t len)
+{
+	if (len >= LZ4_WORD_COPY_MIN &&
+	    !(((unsigned long)dst ^ (unsigned long)src) & 3)) {
+		while ((unsigned long)dst & 3) {
+			*dst++ = *src++;
+			len--;
+		}
+		while (len >= 4) {
+			*(u32 *)dst = *(const u32 *)src;
+			dst += 4;
+			src += 4;
+			len -= 4;
+		}
+	}
+	while (len--)
+		*dst++ = *src++;
+}
+
+/*
+ * Read a length extension: bytes of 255 keep adding, the first smaller
+ * byte ends it.  Returns false if the input ran out first.
+ */
+static inline bool lz4_read_length(const u8 **ipp, const u8 *ip_end,
+				   size_t *length)
+{
+	const u8 *ip = *ipp;
+	unsigned int s;
+
+	do {
+		if (unlikely(ip >= ip_end))
+			return false;
+		s = *ip++;
+		*length += s;
+	} while (s == 255);
+
+	*ipp = ip;
+	return true;
+}
+
+int lz4_decompress_safe(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len)
+{
+	const u8 *ip = src;
+	const u8 * const ip_end = src + src_len;
+	u8 *op = dst;
+	u8 * const op_end = dst + *dst_len;
+	const u8 *match;
+	unsigned int token;
+	size_t length, offset;
+
+	for (;;) {
+		if (unlikely(ip >= ip_end))
+			goto input_overrun;
+		token = *ip++;
+
+		/* literals */
+		length = token >> LZ4_ML_BITS;
+		if (length == LZ4_RUN_MASK &&
+		    !lz4_read_length(&ip, ip_end, &length))
+			goto input_overrun;
+		if (unlikely(length > (size_t)(ip_end - ip)))
+			goto input_overrun;
+		if (unlikely(length > (size_t)(op_end - op)))
+			goto output_overrun;
+		lz4_copy(op, ip, length);
+		ip += length;
+		op += length;
+
+		/* the final sequence ends right after its literals */
+		if (ip == ip_end)
+			break;
+
+		/* match */
+		if (unlikely(ip_end - ip < 2))
+			goto input_overrun;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (unlikely(offset == 0 || offset > (size_t)(op - dst)))
+			goto lookbehind_overrun;
+		match = op - offset;
+
+		length = token & LZ4_ML_MASK;
+		if (length == LZ4_ML_MASK &&
+		    !lz4_read_length(&ip, ip_end, &length))
+			goto input_overrun;
+		length += LZ4_MIN_MATCH;
+		if (unlikely(length > (size_t)(op_end - op)))
+			goto output_overrun;
+
+		if (offset >= 4) {
+			lz4_copy(op, match, length);
+			op += length;
+		} else {
+			/* short distance: a repeating pattern, go bytewise */
+			while (length--)
+				*op++ = *match++;
+		}
+	}
+
+	*dst_len = op - dst;
+	return LZ4_E_OK;
+
+input_overrun:
+	*dst_len = op - dst;
+	return LZ4_E_INPUT_OVERRUN;
+
+output_overrun:
+	*dst_len = op - dst;
+	return LZ4_E_OUTPUT_OVERRUN;
+
+lookbehind_overrun:
+	*dst_len = op - dst;
+	return LZ4_E_LOOKBEHIND_OVERRUN;
+}
+#ifndef STATIC
+EXPORT_SYMBOL_GPL(lz4_decompress_safe);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
+
+#endif
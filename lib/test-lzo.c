@@ -0,0 +1,288 @@
+/*
+ * Round-trip and throughput test for the LZO1X compressor and decompressor
+ *
+ * Builds a small corpus of page-sized samples (zero-filled, random, text,
+ * and pointer-heavy data resembling anonymous memory), compresses every
+ * sample at each byte alignment, checks that it decompresses back to the
+ * original, and that truncated input or output buffers are reported as
+ * errors.  It then times compression and decompression over the whole
+ * corpus and reports MB/s for each kind of data.
+ *
+ * The module always fails to load once it has run, so it can simply be
+ * loaded again for another measurement.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/random.h>
+#include <linux/string.h>
+#include <linux/sched.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/lzo.h>
+#include <asm/unaligned.h>
+
+static unsigned int iterations = 32;
+module_param(iterations, uint, 0444);
+MODULE_PARM_DESC(iterations, "Passes over the corpus when measuring speed");
+
+static unsigned int pages = 64;
+module_param(pages, uint, 0444);
+MODULE_PARM_DESC(pages, "Pages of sample data per corpus");
+
+enum lzo_test_corpus {
+	LZO_TEST_ZERO,
+	LZO_TEST_RANDOM,
+	LZO_TEST_TEXT,
+	LZO_TEST_POINTERS,
+	LZO_TEST_NR_CORPUS,
+};
+
+static const char * const lzo_test_names[] = {
+	[LZO_TEST_ZERO]		= "zero",
+	[LZO_TEST_RANDOM]	= "random",
+	[LZO_TEST_TEXT]		= "text",
+	[LZO_TEST_POINTERS]	= "pointers",
+};
+
+static const char * const lzo_test_words[] = {
+	"the", "page", "of", "memory", "kernel", "and", "to", "swap",
+	"block", "device", "a", "is", "compressed", "in", "cache", "for",
+	"struct", "return", "if", "int", "unsigned", "long", "while", "data",
+};
+
+static void __init lzo_test_fill(u8 *buf, size_t len,
+				 enum lzo_test_corpus type)
+{
+	size_t i, n;
+
+	switch (type) {
+	case LZO_TEST_ZERO:
+		memset(buf, 0, len);
+		break;
+	case LZO_TEST_RANDOM:
+		for (i = 0; i + 4 <= len; i += 4)
+			put_unaligned(random32(), (u32 *)(buf + i));
+		for (; i < len; i++)
+			buf[i] = random32();
+		break;
+	case LZO_TEST_TEXT:
+		for (i = 0; i < len; i += n) {
+			const char *w = lzo_test_words[random32() %
+					ARRAY_SIZE(lzo_test_words)];
+
+			n = min(strlen(w) + 1, len - i);
+			memcpy(buf + i, w, n - 1);
+			buf[i + n - 1] = (random32() & 7) ? ' ' : '\n';
+		}
+		break;
+	case LZO_TEST_POINTERS:
+		/* kernel-looking pointers, small counters and some zeroes */
+		for (i = 0; i + 4 <= len; i += 4) {
+			u32 r = random32();
+			u32 v;
+
+			if (r & 1)
+				v = 0xc0000000 | (r & 0x00fffff0);
+			else if (r & 2)
+				v = (r >> 8) & 0xff;
+			else
+				v = 0;
+			put_unaligned(v, (u32 *)(buf + i));
+		}
+		for (; i < len; i++)
+			buf[i] = 0;
+		break;
+	default:
+		BUG();
+	}
+}
+
+static int __init lzo_test_roundtrip(const u8 *src, size_t len, u8 *cbuf,
+				     u8 *dbuf, void *wrkmem)
+{
+	size_t clen = lzo1x_worst_compress(len);
+	size_t dlen = len;
+	int ret;
+
+	ret = lzo1x_1_compress(src, len, cbuf, &clen, wrkmem);
+	if (ret != LZO_E_OK) {
+		pr_err("test-lzo: compress of %zu bytes failed: %d\n",
+		       len, ret);
+		return -EINVAL;
+	}
+	if (clen > lzo1x_worst_compress(len)) {
+		pr_err("test-lzo: %zu bytes compressed to %zu, over the bound\n",
+		       len, clen);
+		return -EINVAL;
+	}
+
+	ret = lzo1x_decompress_safe(cbuf, clen, dbuf, &dlen);
+	if (ret != LZO_E_OK || dlen != len || memcmp(src, dbuf, len)) {
+		pr_err("test-lzo: round trip of %zu bytes failed: %d, %zu bytes back\n",
+		       len, ret, dlen);
+		return -EINVAL;
+	}
+
+	if (len) {
+		dlen = len - 1;
+		ret = lzo1x_decompress_safe(cbuf, clen, dbuf, &dlen);
+		if (ret != LZO_E_OUTPUT_OVERRUN) {
+			pr_err("test-lzo: short output of %zu bytes not detected: %d\n",
+			       len, ret);
+			return -EINVAL;
+		}
+	}
+	if (clen > 1) {
+		dlen = len;
+		ret = lzo1x_decompress_safe(cbuf, clen - 1, dbuf, &dlen);
+		if (ret == LZO_E_OK) {
+			pr_err("test-lzo: truncated input of %zu bytes not detected\n",
+			       len);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static int __init lzo_test_verify(const u8 *corpus, size_t size, u8 *cbuf,
+				  u8 *dbuf, void *wrkmem)
+{
+	static const size_t lens[] __initconst = {
+		0, 1, 3, 4, 15, 16, 17, 20, 21, 64, 255, 256, 1000,
+		PAGE_SIZE - 1, PAGE_SIZE, PAGE_SIZE + 1,
+	};
+	unsigned int align, i;
+	int ret;
+
+	/* start at every byte alignment to cover the unaligned paths */
+	for (align = 0; align < 4; align++) {
+		for (i = 0; i < ARRAY_SIZE(lens); i++) {
+			ret = lzo_test_roundtrip(corpus + align, lens[i],
+						 cbuf + align, dbuf + align,
+						 wrkmem);
+			if (ret)
+				return ret;
+		}
+	}
+
+	/* a whole multi-page buffer, longer than one compressor block */
+	return lzo_test_roundtrip(corpus, size, cbuf, dbuf, wrkmem);
+}
+
+static unsigned long __init lzo_test_mbps(u64 bytes, s64 ns)
+{
+	if (ns <= 0)
+		return 0;
+	/* bytes per ns * 1000 is MB/s */
+	return div64_u64(bytes * 1000, ns);
+}
+
+static int __init lzo_test_speed(const char *name, const u8 *corpus,
+				 u8 *cbuf, u8 *dbuf, size_t *clens,
+				 void *wrkmem)
+{
+	const size_t stride = lzo1x_worst_compress(PAGE_SIZE);
+	u64 bytes = (u64)iterations * pages * PAGE_SIZE;
+	size_t ctotal = 0;
+	ktime_t start;
+	s64 cns, dns;
+	unsigned int it, p;
+	size_t len;
+
+	start = ktime_get();
+	for (it = 0; it < iterations; it++) {
+		for (p = 0; p < pages; p++) {
+			clens[p] = stride;
+			lzo1x_1_compress(corpus + p * PAGE_SIZE, PAGE_SIZE,
+					 cbuf + p * stride, &clens[p], wrkmem);
+		}
+		cond_resched();
+	}
+	cns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	start = ktime_get();
+	for (it = 0; it < iterations; it++) {
+		for (p = 0; p < pages; p++) {
+			len = PAGE_SIZE;
+			if (lzo1x_decompress_safe(cbuf + p * stride, clens[p],
+						  dbuf + p * PAGE_SIZE,
+						  &len) != LZO_E_OK ||
+			    len != PAGE_SIZE) {
+				pr_err("test-lzo: %s page %u failed to decompress\n",
+				       name, p);
+				return -EINVAL;
+			}
+		}
+		cond_resched();
+	}
+	dns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	for (p = 0; p < pages; p++)
+		ctotal += clens[p];
+
+	pr_info("test-lzo: %-8s %3lu%% of original, compress %lu MB/s, decompress %lu MB/s\n",
+		name, (unsigned long)(ctotal * 100 / (pages * PAGE_SIZE)),
+		lzo_test_mbps(bytes, cns), lzo_test_mbps(bytes, dns));
+	return 0;
+}
+
+static int __init test_lzo_init(void)
+{
+	size_t size, csize;
+	u8 *corpus, *cbuf, *dbuf;
+	size_t *clens;
+	void *wrkmem;
+	unsigned int i;
+	int ret = -ENOMEM;
+
+	if (!pages || !iterations)
+		return -EINVAL;
+
+	size = pages * PAGE_SIZE;
+	csize = max_t(size_t, lzo1x_worst_compress(size),
+		      pages * lzo1x_worst_compress(PAGE_SIZE));
+
+	/* four bytes of slack for the unaligned runs */
+	corpus = vmalloc(size + 4);
+	cbuf = vmalloc(csize + 4);
+	dbuf = vmalloc(size + 4);
+	clens = kcalloc(pages, sizeof(*clens), GFP_KERNEL);
+	wrkmem = kmalloc(LZO1X_1_MEM_COMPRESS, GFP_KERNEL);
+	if (!corpus || !cbuf || !dbuf || !clens || !wrkmem)
+		goto out;
+
+	for (i = 0; i < LZO_TEST_NR_CORPUS; i++) {
+		lzo_test_fill(corpus, size + 4, i);
+
+		ret = lzo_test_verify(corpus, size, cbuf, dbuf, wrkmem);
+		if (ret)
+			goto out;
+
+		ret = lzo_test_speed(lzo_test_names[i], corpus, cbuf, dbuf,
+				     clens, wrkmem);
+		if (ret)
+			goto out;
+	}
+
+	pr_info("test-lzo: all tests passed\n");
+	ret = -EAGAIN;
+out:
+	kfree(wrkmem);
+	kfree(clens);
+	vfree(dbuf);
+	vfree(cbuf);
+	vfree(corpus);
+	return ret;
+}
+module_init(test_lzo_init);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZO1X round-trip and throughput test");